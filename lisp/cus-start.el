@@ -407,6 +407,8 @@ Leaving \"Default\" unchecked is equivalent with specifying a default of
 	     (ns-use-srgb-colorspace ns boolean "24.4")
 	     ;; process.c
 	     (delete-exited-processes processes-basics boolean)
+	     ;; search.c
+	     (regexp-cache-size matching integer "25.1")
 	     ;; syntax.c
 	     (parse-sexp-ignore-comments editing-basics boolean)
 	     (words-include-escapes editing-basics boolean)
@@ -252,6 +252,16 @@ This option is enabled by default because it reduces Emacs memory usage."
   :type 'boolean)
 ;;;###autoload(put 'byte-compile-dynamic-docstrings 'safe-local-variable 'booleanp)
 
+(defcustom byte-compile-write-binary-files nil
+  "If non-nil, also write a binary compiled file next to each `.elc' file.
+The binary file has the extension `.elb' and holds the same forms as the
+`.elc' file, in a form that `load' can read without parsing text.  It is
+used only while the `.elc' file it was made from is unchanged; see
+`write-binary-compiled-file' and `load-binary-compiled-files'."
+  :group 'bytecomp
+  :type 'boolean
+  :version "25.1")
+
 (defconst byte-compile-log-buffer "*Compile-Log*"
   "Name of the byte-compiler's log buffer.")
 
@@ -1845,7 +1855,14 @@ The value is non-nil if there were no errors, nil if errors."
 		;; recompiled).  Previously this was accomplished by
 		;; deleting target-file before writing it.
 		(rename-file tempfile target-file t)
-		(message "Wrote %s" target-file))
+		(message "Wrote %s" target-file)
+		(when (and byte-compile-write-binary-files
+			   (fboundp 'write-binary-compiled-file))
+		  (condition-case err
+		      (write-binary-compiled-file target-file)
+		    (error
+		     (message "Could not write binary file for %s: %s"
+			      target-file (error-message-string err))))))
 	    ;; This is just to give a better error message than write-region
 	    (signal 'file-error
 		    (list "Opening output file"
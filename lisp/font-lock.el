@@ -369,6 +369,11 @@ call to make the search (called with one argument, the limit of the search;
 it should return non-nil, move point, and set `match-data' appropriately if
 it succeeds; like `re-search-forward' would).
 MATCHER regexps can be generated via the function `regexp-opt'.
+MATCHER can also be a list of literal strings, optionally preceded by
+`words' or `symbols'.  It then matches the occurrences of the strings,
+as the regexp that `regexp-opt' makes of them would, but faster when
+there are many strings; see `search-forward-strings'.  Such a MATCHER
+is not allowed in MATCH-ANCHORED.
 
 FORM is an expression, whose value should be a keyword element, evaluated when
 the keyword is (first) used in a buffer.  This feature can be used to provide a
@@ -1759,7 +1764,13 @@ If SYNTACTIC-KEYWORDS is non-nil, it means these keywords are used for
       keywords
     (setq keywords
 	  (cons t (cons keywords
-			(mapcar #'font-lock-compile-keyword keywords))))
+			(mapcar (lambda (keyword)
+				  (let ((compiled
+					 (font-lock-compile-keyword keyword)))
+				    (cons (font-lock-compile-matcher
+					   (car compiled))
+					  (cdr compiled))))
+				keywords))))
     (if (and (not syntactic-keywords)
 	     (let ((beg-function
 		    (or font-lock-beginning-of-syntax-function
@@ -1782,6 +1793,20 @@ If SYNTACTIC-KEYWORDS is non-nil, it means these keywords are used for
 		   prepend)))))
     keywords))
 
+(defun font-lock-compile-matcher (matcher)
+  "Return the function to search for MATCHER, if it is a list of strings.
+Otherwise, return MATCHER."
+  (if (and (consp matcher) (not (functionp matcher)))
+      (let ((delimited (car (memq (car matcher) '(words symbols)))))
+	(apply-partially #'font-lock-search-strings
+			 (if delimited (cdr matcher) matcher) delimited))
+    matcher))
+
+(defun font-lock-search-strings (strings delimited limit)
+  "Search forward up to LIMIT for any of STRINGS.
+DELIMITED is as in `search-forward-strings'."
+  (search-forward-strings strings limit t delimited))
+
 (defun font-lock-compile-keyword (keyword)
   (cond ((or (functionp keyword) (nlistp keyword)) ; MATCHER
 	 (list keyword '(0 font-lock-keyword-face)))
@@ -2346,6 +2346,13 @@ Return what remains of the list."
               (cons (list 'apply 'cdr nil) buffer-undo-list))))
   list)
 
+(defun undo-packed-changes (data objects)
+  "Undo the changes packed into DATA and OBJECTS.
+An element (apply undo-packed-changes DATA OBJECTS) of
+`buffer-undo-list' stands for the list of elements that
+`undo-unpack' returns; see `undo-pack-threshold'."
+  (primitive-undo 1 (undo-unpack data objects)))
+
 ;; Deep copy of a list
 (defun undo-copy-list (list)
   "Make a copy of undo list LIST."
@@ -2444,6 +2451,11 @@ list can be applied to the current buffer."
       (when undo-no-redo
         (while (gethash ulist undo-equiv-table)
           (setq ulist (gethash ulist undo-equiv-table))))
+      ;; Look at the elements of packed entries one by one.
+      (while (and (eq (car-safe (car ulist)) 'apply)
+                  (eq (car-safe (cdr (car ulist))) 'undo-packed-changes))
+        (setq ulist (append (apply #'undo-unpack (cddr (car ulist)))
+                            (cdr ulist))))
       (setq undo-elt (car ulist))
       (cond
        ((null undo-elt)
@@ -7968,6 +7980,41 @@ contains the list of implementations currently supported for this command."
 
 
 
+(defcustom buffer-compression-idle-time 3600
+  "Seconds a buffer must be idle before `buffer-compression-mode' compresses it.
+A buffer is idle while it is not current and no window displays it."
+  :type 'number
+  :group 'editing-basics
+  :version "25.1")
+
+(defvar buffer-compression-timer nil
+  "Timer that `buffer-compression-mode' uses to compress idle buffers.")
+
+(defun buffer-compression--compress ()
+  (compress-idle-buffers buffer-compression-idle-time))
+
+(define-minor-mode buffer-compression-mode
+  "Toggle compressing the text of idle buffers (Buffer Compression mode).
+With a prefix argument ARG, enable Buffer Compression mode if ARG
+is positive, and disable it otherwise.  If called from Lisp,
+enable the mode if ARG is omitted or nil.
+
+When Buffer Compression mode is enabled, Emacs compresses the text
+of buffers that have been idle for `buffer-compression-idle-time'
+seconds, and uncompresses it again as soon as it is used.  This
+saves memory in sessions with many buffers that are rarely looked
+at.  See `compress-idle-buffers' and `buffer-compression-counts'."
+  :global t
+  :group 'editing-basics
+  (when buffer-compression-timer
+    (cancel-timer buffer-compression-timer)
+    (setq buffer-compression-timer nil))
+  (when buffer-compression-mode
+    (setq buffer-compression-timer
+          (run-with-timer 60 60 #'buffer-compression--compress))))
+
+
+
 (provide 'simple)
 
 ;;; simple.el ends here
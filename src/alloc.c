@@ -110,6 +110,20 @@ static bool valgrind_p;
 
 #define MMAP_MAX_AREAS 100000000
 
+#ifdef HAVE_MALLOC_TRIM
+
+/* Trim the heap when a garbage collection leaves this many more free
+   bytes in it than there were after the last trim.  */
+
+#define HEAP_TRIM_THRESHOLD (16 * 1024 * 1024)
+
+/* Free bytes in the heap after the last trim, or after the last
+   garbage collection that left fewer.  */
+
+static size_t heap_free_after_trim;
+
+#endif /* HAVE_MALLOC_TRIM */
+
 #endif /* not DOUG_LEA_MALLOC */
 
 /* Mark, unmark, query mark bit of a Lisp string.  S must be a pointer
@@ -278,6 +292,8 @@ static Lisp_Object Qfloats;
 static Lisp_Object Qintervals;
 static Lisp_Object Qbuffers;
 static Lisp_Object Qstring_bytes, Qvector_slots, Qheap;
+static Lisp_Object Qbuffer_text, Qbuffer_gaps, Qcompressed_buffer_text;
+static Lisp_Object Qlisp_objects, Qlisp_free, Qglyph_matrices, Qmalloc_free;
 static Lisp_Object Qgc_cons_threshold;
 Lisp_Object Qautomatic_gc;
 Lisp_Object Qchar_table_extra_slots;
@@ -1533,6 +1549,64 @@ static EMACS_INT total_string_bytes;
 
 #define SDATA_OF_STRING(S) ((sdata *) ((S)->data - SDATA_DATA_OFFSET))
 
+/* Large strings can share their data with strings made from their
+   tails by `substring' and `copy-sequence'.  Since every such string
+   ends where the data ends, its data stays null-terminated.  The
+   sblock of shared data belongs to shared_sdata_owner instead of any
+   one string, and shared_strings maps each string that uses it to
+   the sblock.  A string that shares its data gets data of its own
+   before anything changes it in place.  */
+
+struct shared_string
+{
+  /* A string that shares its data, or null if this entry is unused.  */
+  struct Lisp_String *string;
+
+  /* The sblock holding STRING's data, or null if STRING no longer
+     shares it.  */
+  struct sblock *block;
+};
+
+/* The owner of the sblocks of shared data.  */
+
+static struct Lisp_String shared_sdata_owner;
+
+/* Hash table of the strings that share their data, of size
+   shared_strings_size, a power of 2.  Of its entries,
+   shared_strings_used are not null, and shared_strings_count
+   describe strings that currently share their data.  */
+
+static struct shared_string *shared_strings;
+static ptrdiff_t shared_strings_size, shared_strings_used;
+static ptrdiff_t shared_strings_count;
+
+/* Return the entry of shared_strings for S, or the null entry where
+   it would go.  */
+
+static struct shared_string *
+shared_string_entry (struct Lisp_String *s)
+{
+  size_t i = (uintptr_t) s / sizeof *s;
+
+  for (;; i++)
+    {
+      struct shared_string *e
+	= &shared_strings[i & (shared_strings_size - 1)];
+      if (e->string == s || !e->string)
+	return e;
+    }
+}
+
+/* Return the sblock whose data S shares, or null if S has data of its
+   own.  */
+
+static struct sblock *
+shared_string_block (struct Lisp_String *s)
+{
+  return (shared_strings_count ? shared_string_entry (s)->block : NULL);
+}
+
+
 
 #ifdef GC_CHECK_STRING_OVERRUN
 
@@ -1620,6 +1694,7 @@ string_bytes (struct Lisp_String *s)
 
   if (!PURE_POINTER_P (s)
       && s->data
+      && !shared_string_block (s)
       && nbytes != SDATA_NBYTES (SDATA_OF_STRING (s)))
     emacs_abort ();
   return nbytes;
@@ -1784,7 +1859,14 @@ allocate_string_data (struct Lisp_String *s,
   /* Determine the number of bytes needed to store NBYTES bytes
      of string data.  */
   needed = SDATA_SIZE (nbytes);
-  if (s->data)
+  if (s->data && shared_string_block (s))
+    {
+      /* Leave the shared data to the other strings using it.  */
+      shared_string_entry (s)->block = NULL;
+      shared_strings_count--;
+      old_data = NULL;
+    }
+  else if (s->data)
     {
       old_data = SDATA_OF_STRING (s);
       old_nbytes = STRING_BYTES (s);
@@ -1865,6 +1947,160 @@ allocate_string_data (struct Lisp_String *s,
   consing_since_gc += needed;
 }
 
+/* Record that S shares the data of sblock B.  */
+
+static void
+record_shared_string (struct Lisp_String *s, struct sblock *b)
+{
+  struct shared_string *e;
+
+  if (4 * (shared_strings_used + 1) > 3 * shared_strings_size)
+    {
+      struct shared_string *old = shared_strings;
+      ptrdiff_t i, old_size = shared_strings_size;
+
+      shared_strings_size = 64;
+      while (shared_strings_size < 4 * (shared_strings_count + 1))
+	shared_strings_size *= 2;
+      shared_strings = xzalloc (shared_strings_size * sizeof *shared_strings);
+      shared_strings_used = 0;
+      for (i = 0; i < old_size; i++)
+	if (old[i].block)
+	  {
+	    *shared_string_entry (old[i].string) = old[i];
+	    shared_strings_used++;
+	  }
+      xfree (old);
+    }
+
+  e = shared_string_entry (s);
+  if (!e->string)
+    shared_strings_used++;
+  e->string = s;
+  e->block = b;
+  shared_strings_count++;
+}
+
+/* Return a string of the characters of STRING from index FROM, which
+   is at byte FROM_BYTE, to its end, that shares the data of STRING.
+   Return nil if STRING is too small for that to be worth while, or if
+   the result would keep much more data alive than it uses.  */
+
+Lisp_Object
+make_shared_substring (Lisp_Object string, ptrdiff_t from,
+		       ptrdiff_t from_byte)
+{
+  struct Lisp_String *s = XSTRING (string), *n;
+  ptrdiff_t nbytes = STRING_BYTES (s) - from_byte;
+  struct sblock *b;
+  unsigned char *start;
+  Lisp_Object val;
+
+  if (nbytes <= LARGE_STRING_BYTES || PURE_POINTER_P (s->data))
+    return Qnil;
+
+  b = shared_string_block (s);
+  if (!b)
+    {
+      sdata *data = SDATA_OF_STRING (s);
+
+      eassert (data->string == s);
+      b = (struct sblock *) ((char *) data - offsetof (struct sblock, data));
+    }
+  start = (unsigned char *) b->data + SDATA_DATA_OFFSET;
+  if (4 * nbytes < s->data + STRING_BYTES (s) - start)
+    return Qnil;
+
+  if (b->data[0].string == s)
+    {
+      b->data[0].string = &shared_sdata_owner;
+      record_shared_string (s, b);
+    }
+
+  n = allocate_string ();
+  n->intervals = NULL;
+  n->data = s->data + from_byte;
+  n->size = s->size - from;
+  n->size_byte = s->size_byte < 0 ? -1 : nbytes;
+  record_shared_string (n, b);
+  XSETSTRING (val, n);
+  return val;
+}
+
+/* Give STRING data of its own, if it shares its data with other
+   strings, so that it can be changed in place.  */
+
+void
+unshare_string_data (Lisp_Object string)
+{
+  struct Lisp_String *s = XSTRING (string);
+
+  if (shared_string_block (s))
+    {
+      unsigned char *old = s->data;
+      ptrdiff_t nbytes = STRING_BYTES (s), size_byte = s->size_byte;
+
+      allocate_string_data (s, s->size, nbytes);
+      memcpy (s->data, old, nbytes);
+      s->size_byte = size_byte;
+    }
+}
+
+/* Forget the strings that share data and are about to be freed, and
+   free the sblocks of shared data that no live string uses.  Give the
+   data back to the string using it if there is just one, at its
+   start.  Called during GC before strings are swept.  */
+
+static void
+sweep_shared_strings (void)
+{
+  ptrdiff_t i;
+
+  if (!shared_strings_count)
+    return;
+
+  for (i = 0; i < shared_strings_size; i++)
+    if (shared_strings[i].block)
+      shared_strings[i].block->data[0].string = NULL;
+
+  for (i = 0; i < shared_strings_size; i++)
+    {
+      struct shared_string *e = &shared_strings[i];
+
+      if (!e->block)
+	continue;
+      if (!STRING_MARKED_P (e->string))
+	{
+	  /* Make sweep_strings treat the dead string as free, without
+	     looking for its sdata.  */
+	  e->string->data = NULL;
+	  e->block = NULL;
+	  shared_strings_count--;
+	}
+      else if (!e->block->data[0].string)
+	e->block->data[0].string = e->string;
+      else
+	e->block->data[0].string = &shared_sdata_owner;
+    }
+
+  for (i = 0; i < shared_strings_size; i++)
+    {
+      struct shared_string *e = &shared_strings[i];
+
+      if (e->block && e->block->data[0].string == e->string)
+	{
+	  if (e->string->data == ((unsigned char *) e->block->data
+				  + SDATA_DATA_OFFSET))
+	    {
+	      e->block = NULL;
+	      shared_strings_count--;
+	    }
+	  else
+	    e->block->data[0].string = &shared_sdata_owner;
+	}
+    }
+}
+
 
 /* Sweep and compact strings.  */
 
@@ -1879,6 +2115,8 @@ sweep_strings (void)
   total_strings = total_free_strings = 0;
   total_string_bytes = 0;
 
+  sweep_shared_strings ();
+
   /* Scan strings_blocks, free Lisp_Strings that aren't marked.  */
   for (b = string_blocks; b; b = next)
     {
@@ -3673,7 +3911,7 @@ build_overlay (Lisp_Object start, Lisp_Object end, Lisp_Object plist)
   OVERLAY_START (overlay) = start;
   OVERLAY_END (overlay) = end;
   set_overlay_plist (overlay, plist);
-  XOVERLAY (overlay)->next = NULL;
+  XOVERLAY (overlay)->node = NULL;
   return overlay;
 }
 
@@ -3687,9 +3925,9 @@ DEFUN ("make-marker", Fmake_marker, Smake_marker, 0, 0, 0,
   val = allocate_misc (Lisp_Misc_Marker);
   p = XMARKER (val);
   p->buffer = 0;
-  p->bytepos = 0;
-  p->charpos = 0;
-  p->next = NULL;
+  p->byte_offset = 0;
+  p->char_offset = 0;
+  p->parent = p->left = p->right = NULL;
   p->insertion_type = 0;
   p->need_adjustment = 0;
   return val;
@@ -3712,13 +3950,10 @@ build_marker (struct buffer *buf, ptrdiff_t charpos, ptrdiff_t bytepos)
 
   obj = allocate_misc (Lisp_Misc_Marker);
   m = XMARKER (obj);
-  m->buffer = buf;
-  m->charpos = charpos;
-  m->bytepos = bytepos;
+  m->buffer = NULL;
   m->insertion_type = 0;
   m->need_adjustment = 0;
-  m->next = BUF_MARKERS (buf);
-  BUF_MARKERS (buf) = m;
+  attach_marker (m, buf, charpos, bytepos);
   return obj;
 }
 
@@ -5410,6 +5645,30 @@ bounded_number (EMACS_INT number)
   return make_number (min (MOST_POSITIVE_FIXNUM, number));
 }
 
+#if defined DOUG_LEA_MALLOC && defined HAVE_MALLOC_TRIM
+
+/* Give the free memory of the heap back to the system if a lot more of
+   it is free than after the last trim, as after a garbage collection
+   that freed much.  Unlike the trimming that M_TRIM_THRESHOLD asks
+   free to do, this releases the free pages in the middle of the heap
+   too, not just those at its top.  */
+
+static void
+trim_heap (void)
+{
+  size_t heap_free = mallinfo ().fordblks;
+
+  if (heap_free >= heap_free_after_trim + HEAP_TRIM_THRESHOLD)
+    {
+      malloc_trim (0);
+      heap_free_after_trim = mallinfo ().fordblks;
+    }
+  else if (heap_free < heap_free_after_trim)
+    heap_free_after_trim = heap_free;
+}
+
+#endif
+
 /* Calculate total bytes of live objects.  */
 
 static size_t
@@ -5504,7 +5763,8 @@ compact_font_caches (void)
 #endif /* HAVE_WINDOW_SYSTEM */
 
 /* Remove (MARKER . DATA) entries with unmarked MARKER
-   from buffer undo LIST and return changed list.  */
+   from buffer undo LIST and return changed list.  Unmarked
+   markers in packed entries are replaced by nil.  */
 
 static Lisp_Object
 compact_undo_list (Lisp_Object list)
@@ -5513,12 +5773,27 @@ compact_undo_list (Lisp_Object list)
 
   for (tail = list; CONSP (tail); tail = XCDR (tail))
     {
+      Lisp_Object args;
+
       if (CONSP (XCAR (tail))
 	  && MARKERP (XCAR (XCAR (tail)))
 	  && !XMARKER (XCAR (XCAR (tail)))->gcmarkbit)
 	*prev = XCDR (tail);
       else
-	prev = xcdr_addr (tail);
+	{
+	  args = packed_undo_args (XCAR (tail));
+	  if (CONSP (args) && VECTORP (XCAR (XCDR (args))))
+	    {
+	      Lisp_Object objects = XCAR (XCDR (args));
+	      ptrdiff_t i;
+
+	      for (i = 0; i < ASIZE (objects); i++)
+		if (MARKERP (AREF (objects, i))
+		    && !XMARKER (AREF (objects, i))->gcmarkbit)
+		  ASET (objects, i, Qnil);
+	    }
+	  prev = xcdr_addr (tail);
+	}
     }
   return list;
 }
@@ -5640,6 +5915,7 @@ garbage_collect_1 (void *end)
   mark_specpdl ();
   mark_terminals ();
   mark_kboards ();
+  mark_regexp_cache ();
 
 #ifdef USE_GTK
   xg_mark_data ();
@@ -5706,6 +5982,10 @@ garbage_collect_1 (void *end)
 
   unblock_input ();
 
+#if defined DOUG_LEA_MALLOC && defined HAVE_MALLOC_TRIM
+  trim_heap ();
+#endif
+
   consing_since_gc = 0;
   if (gc_cons_threshold < GC_DEFAULT_THRESHOLD / 10)
     gc_cons_threshold = GC_DEFAULT_THRESHOLD / 10;
@@ -6013,17 +6293,28 @@ mark_compiled (struct Lisp_Vector *ptr)
   return size > COMPILED_CONSTANTS ? ptr->contents[COMPILED_CONSTANTS] : Qnil;
 }
 
-/* Mark the chain of overlays starting at PTR.  */
+/* Mark the overlay PTR.  */
 
 static void
 mark_overlay (struct Lisp_Overlay *ptr)
 {
-  for (; ptr && !ptr->gcmarkbit; ptr = ptr->next)
+  ptr->gcmarkbit = 1;
+  mark_object (ptr->start);
+  mark_object (ptr->end);
+  mark_object (ptr->plist);
+}
+
+/* Mark the overlays in the overlay tree rooted at NODE.  The tree is
+   balanced, so recursing on the left subtrees only is safe.  */
+
+static void
+mark_overlay_tree (struct overlay_node *node)
+{
+  for (; node; node = node->right)
     {
-      ptr->gcmarkbit = 1;
-      mark_object (ptr->start);
-      mark_object (ptr->end);
-      mark_object (ptr->plist);
+      mark_overlay_tree (node->left);
+      if (!node->overlay->gcmarkbit)
+	mark_overlay (node->overlay);
     }
 }
 
@@ -6043,8 +6334,7 @@ mark_buffer (struct buffer *buffer)
      a special way just before the sweep phase, and after stripping
      some of its elements that are not needed any more.  */
 
-  mark_overlay (buffer->overlays_before);
-  mark_overlay (buffer->overlays_after);
+  mark_overlay_tree (buffer->overlays);
 
   /* If this is an indirect buffer, mark its base buffer.  */
   if (buffer->base_buffer && !VECTOR_MARKED_P (buffer->base_buffer))
@@ -6870,6 +7160,7 @@ gc_sweep (void)
   /* Remove or mark entries in weak hash tables.
      This must be done before any object is unmarked.  */
   sweep_weak_hash_tables ();
+  sweep_string_indexes ();
 
   sweep_strings ();
   check_string_bytes (!noninteractive);
@@ -6977,6 +7268,71 @@ Frames, windows, buffers, and subprocesses count as vectors
 		bounded_number (strings_consed));
 }
 
+DEFUN ("memory-report", Fmemory_report, Smemory_report, 0, 0, 0,
+       doc: /* Return an alist that breaks down the memory Emacs is using.
+Each element has the form (KIND . BYTES), where KIND is one of
+  `buffer-text'             the text of live buffers
+  `buffer-gaps'             the gaps in the text of live buffers
+  `compressed-buffer-text'  buffer text that `compress-idle-buffers'
+                            has compressed
+  `lisp-objects'            live Lisp objects, other than intervals
+  `intervals'               the interval trees of text properties
+  `lisp-free'               free space in the blocks of Lisp objects
+  `glyph-matrices'          the glyph matrices of redisplay
+  `malloc-free'             free memory that malloc keeps, where known
+The figures for Lisp objects and intervals are those of the last
+garbage collection; call `garbage-collect' first to bring them up
+to date.  */)
+  (void)
+{
+  struct buffer *b;
+  size_t text = 0, gaps = 0, compressed = 0;
+  size_t intervals = total_intervals * sizeof (struct interval);
+  size_t lisp_free
+    = (total_free_conses * sizeof (struct Lisp_Cons)
+       + total_free_symbols * sizeof (struct Lisp_Symbol)
+       + total_free_markers * sizeof (union Lisp_Misc)
+       + total_free_strings * sizeof (struct Lisp_String)
+       + total_free_vector_slots * word_size
+       + total_free_floats * sizeof (struct Lisp_Float)
+       + total_free_intervals * sizeof (struct interval));
+  Lisp_Object report = Qnil;
+
+  FOR_EACH_BUFFER (b)
+    if (BUFFER_LIVE_P (b) && !b->base_buffer)
+      {
+	if (b->text->compressed)
+	  compressed += b->text->compressed_size;
+	else
+	  {
+	    text += BUF_Z_BYTE (b) - BUF_BEG_BYTE (b);
+	    gaps += BUF_GAP_SIZE (b);
+	  }
+      }
+
+#ifdef DOUG_LEA_MALLOC
+  report = Fcons (Fcons (Qmalloc_free,
+			 make_fixnum_or_float (mallinfo ().fordblks)),
+		  report);
+#endif
+  report = Fcons (Fcons (Qglyph_matrices,
+			 make_fixnum_or_float (glyph_memory_bytes ())),
+		  report);
+  report = Fcons (Fcons (Qlisp_free, make_fixnum_or_float (lisp_free)),
+		  report);
+  report = Fcons (Fcons (Qintervals, make_fixnum_or_float (intervals)),
+		  report);
+  report = Fcons (Fcons (Qlisp_objects,
+			 make_fixnum_or_float (total_bytes_of_live_objects ()
+					       - intervals)),
+		  report);
+  report = Fcons (Fcons (Qcompressed_buffer_text,
+			 make_fixnum_or_float (compressed)),
+		  report);
+  report = Fcons (Fcons (Qbuffer_gaps, make_fixnum_or_float (gaps)), report);
+  return Fcons (Fcons (Qbuffer_text, make_fixnum_or_float (text)), report);
+}
+
 /* Find at most FIND_MAX symbols which have OBJ as their value or
    function.  This is used in gdbinit's `xwhichsymbols' command.  */
 
@@ -7286,6 +7642,13 @@ do hash-consing of the objects allocated to pure space.  */);
   DEFSYM (Qstring_bytes, "string-bytes");
   DEFSYM (Qvector_slots, "vector-slots");
   DEFSYM (Qheap, "heap");
+  DEFSYM (Qbuffer_text, "buffer-text");
+  DEFSYM (Qbuffer_gaps, "buffer-gaps");
+  DEFSYM (Qcompressed_buffer_text, "compressed-buffer-text");
+  DEFSYM (Qlisp_objects, "lisp-objects");
+  DEFSYM (Qlisp_free, "lisp-free");
+  DEFSYM (Qglyph_matrices, "glyph-matrices");
+  DEFSYM (Qmalloc_free, "malloc-free");
   DEFSYM (Qautomatic_gc, "Automatic GC");
 
   DEFSYM (Qgc_cons_threshold, "gc-cons-threshold");
@@ -7313,6 +7676,7 @@ The time is in seconds as a floating point value.  */);
   defsubr (&Smemory_limit);
   defsubr (&Smemory_info);
   defsubr (&Smemory_use_counts);
+  defsubr (&Smemory_report);
   defsubr (&Ssuspicious_object);
 
 #if GC_MARK_STACK == GC_USE_GCPROS_CHECK_ZOMBIES
@@ -151,7 +151,10 @@ static Lisp_Object Qoverwrite_mode, Qfraction;
 
 static void alloc_buffer_text (struct buffer *, ptrdiff_t);
 static void free_buffer_text (struct buffer *b);
-static struct Lisp_Overlay * copy_overlays (struct buffer *, struct Lisp_Overlay *);
+static void free_compressed_text (struct buffer *);
+static void copy_overlays (struct buffer *, struct buffer *);
+static void overlay_tree_insert (struct buffer *, struct Lisp_Overlay *);
+static void free_overlay_tree (struct overlay_node *);
 static void modify_overlay (struct buffer *, ptrdiff_t, ptrdiff_t);
 static Lisp_Object buffer_lisp_local_variables (struct buffer *, bool);
 
@@ -585,12 +588,22 @@ even if it is dead.  The return value is never nil.  */)
   BUF_SAVE_MODIFF (b) = 1;
   BUF_COMPACT (b) = 1;
   set_buffer_intervals (b, NULL);
+  b->text->checkpoints = NULL;
+  b->text->checkpoints_size = 0;
+  b->text->checkpoints_gap = b->text->checkpoints_gap_end = 0;
+  b->text->newlines = -1;
+  b->text->line_checkpoints = NULL;
+  b->text->line_checkpoints_size = 0;
+  b->text->line_checkpoints_gap = b->text->line_checkpoints_gap_end = 0;
   BUF_UNCHANGED_MODIFIED (b) = 1;
   BUF_OVERLAY_UNCHANGED_MODIFIED (b) = 1;
   BUF_END_UNCHANGED (b) = 0;
   BUF_BEG_UNCHANGED (b) = 0;
   *(BUF_GPT_ADDR (b)) = *(BUF_Z_ADDR (b)) = 0; /* Put an anchor '\0'.  */
+  b->text->compressed = NULL;
+  b->text->compressed_size = 0;
   b->text->inhibit_shrinking = false;
+  b->text->used = true;
   b->text->redisplay = false;
 
   b->newline_cache = 0;
@@ -615,7 +628,7 @@ even if it is dead.  The return value is never nil.  */)
   reset_buffer_local_variables (b, 1);
 
   bset_mark (b, Fmake_marker ());
-  BUF_MARKERS (b) = NULL;
+  BUF_MARKERS (b, 0) = BUF_MARKERS (b, 1) = NULL;
 
   /* Put this in the alist of all live buffers.  */
   XSETBUFFER (buffer, b);
@@ -628,51 +641,33 @@ even if it is dead.  The return value is never nil.  */)
 }
 
 
-/* Return a list of overlays which is a copy of the overlay list
-   LIST, but for buffer B.  */
+/* Give buffer B a copy of each overlay of buffer FROM.  */
 
-static struct Lisp_Overlay *
-copy_overlays (struct buffer *b, struct Lisp_Overlay *list)
+static void
+copy_overlays (struct buffer *b, struct buffer *from)
 {
-  struct Lisp_Overlay *result = NULL, *tail = NULL;
+  struct overlay_node *node;
 
-  for (; list; list = list->next)
+  for (node = overlay_tree_first (from, PTRDIFF_MIN, PTRDIFF_MAX); node;
+       node = overlay_tree_next (node, PTRDIFF_MIN, PTRDIFF_MAX))
     {
+      struct Lisp_Overlay *ov = node->overlay;
       Lisp_Object overlay, start, end;
       struct Lisp_Marker *m;
 
-      eassert (MARKERP (list->start));
-      m = XMARKER (list->start);
-      start = build_marker (b, m->charpos, m->bytepos);
-      XMARKER (start)->insertion_type = m->insertion_type;
+      eassert (MARKERP (ov->start));
+      m = XMARKER (ov->start);
+      start = build_marker (b, marker_charpos (m), marker_bytepos (m));
+      set_marker_insertion_type (XMARKER (start), m->insertion_type);
 
-      eassert (MARKERP (list->end));
-      m = XMARKER (list->end);
-      end = build_marker (b, m->charpos, m->bytepos);
-      XMARKER (end)->insertion_type = m->insertion_type;
+      eassert (MARKERP (ov->end));
+      m = XMARKER (ov->end);
+      end = build_marker (b, marker_charpos (m), marker_bytepos (m));
+      set_marker_insertion_type (XMARKER (end), m->insertion_type);
 
-      overlay = build_overlay (start, end, Fcopy_sequence (list->plist));
-      if (tail)
-	tail = tail->next = XOVERLAY (overlay);
-      else
-	result = tail = XOVERLAY (overlay);
+      overlay = build_overlay (start, end, Fcopy_sequence (ov->plist));
+      overlay_tree_insert (b, XOVERLAY (overlay));
     }
-
-  return result;
-}
-
-/* Set an appropriate overlay of B.  */
-
-static void
-set_buffer_overlays_before (struct buffer *b, struct Lisp_Overlay *o)
-{
-  b->overlays_before = o;
-}
-
-static void
-set_buffer_overlays_after (struct buffer *b, struct Lisp_Overlay *o)
-{
-  b->overlays_after = o;
 }
 
 /* Clone per-buffer values of buffer FROM.
@@ -700,8 +695,8 @@ clone_per_buffer_values (struct buffer *from, struct buffer *to)
 	{
 	  struct Lisp_Marker *m = XMARKER (obj);
 
-	  obj = build_marker (to, m->charpos, m->bytepos);
-	  XMARKER (obj)->insertion_type = m->insertion_type;
+	  obj = build_marker (to, marker_charpos (m), marker_bytepos (m));
+	  set_marker_insertion_type (XMARKER (obj), m->insertion_type);
 	}
 
       set_per_buffer_value (to, offset, obj);
@@ -709,8 +704,7 @@ clone_per_buffer_values (struct buffer *from, struct buffer *to)
 
   memcpy (to->local_flags, from->local_flags, sizeof to->local_flags);
 
-  set_buffer_overlays_before (to, copy_overlays (to, from->overlays_before));
-  set_buffer_overlays_after (to, copy_overlays (to, from->overlays_after));
+  copy_overlays (to, from);
 
   /* Get (a copy of) the alist of Lisp-level local variables of FROM
      and install that in TO.  */
@@ -800,6 +794,7 @@ CLONE nil means the indirect buffer's state is reset to default values.  */)
   b->base_buffer = (XBUFFER (base_buffer)->base_buffer
 		    ? XBUFFER (base_buffer)->base_buffer
 		    : XBUFFER (base_buffer));
+  ensure_buffer_text (b->base_buffer);
 
   /* Use the base buffer's text object.  */
   b->text = b->base_buffer->text;
@@ -860,7 +855,8 @@ CLONE nil means the indirect buffer's state is reset to default values.  */)
 		      build_marker (b->base_buffer, b->base_buffer->zv,
 				    b->base_buffer->zv_byte));
 
-      XMARKER (BVAR (b->base_buffer, zv_marker))->insertion_type = 1;
+      set_marker_insertion_type (XMARKER (BVAR (b->base_buffer, zv_marker)),
+				 1);
     }
 
   if (NILP (clone))
@@ -869,7 +865,7 @@ CLONE nil means the indirect buffer's state is reset to default values.  */)
       bset_pt_marker (b, build_marker (b, b->pt, b->pt_byte));
       bset_begv_marker (b, build_marker (b, b->begv, b->begv_byte));
       bset_zv_marker (b, build_marker (b, b->zv, b->zv_byte));
-      XMARKER (BVAR (b, zv_marker))->insertion_type = 1;
+      set_marker_insertion_type (XMARKER (BVAR (b, zv_marker)), 1);
     }
   else
     {
@@ -908,31 +904,19 @@ drop_overlay (struct buffer *b, struct Lisp_Overlay *ov)
 
 }
 
-/* Delete all overlays of B and reset it's overlay lists.  */
+/* Delete all overlays of B and reset its overlay tree.  */
 
 void
 delete_all_overlays (struct buffer *b)
 {
-  struct Lisp_Overlay *ov, *next;
-
-  /* FIXME: Since each drop_overlay will scan BUF_MARKERS to unlink its
-     markers, we have an unneeded O(N^2) behavior here.  */
-  for (ov = b->overlays_before; ov; ov = next)
-    {
-      drop_overlay (b, ov);
-      next = ov->next;
-      ov->next = NULL;
-    }
+  struct overlay_node *node;
 
-  for (ov = b->overlays_after; ov; ov = next)
-    {
-      drop_overlay (b, ov);
-      next = ov->next;
-      ov->next = NULL;
-    }
+  for (node = overlay_tree_first (b, PTRDIFF_MIN, PTRDIFF_MAX); node;
+       node = overlay_tree_next (node, PTRDIFF_MIN, PTRDIFF_MAX))
+    drop_overlay (b, node->overlay);
 
-  set_buffer_overlays_before (b, NULL);
-  set_buffer_overlays_after (b, NULL);
+  free_overlay_tree (b->overlays);
+  b->overlays = NULL;
 }
 
 /* Reinitialize everything about a buffer except its name and contents
@@ -960,9 +944,7 @@ reset_buffer (register struct buffer *b)
   b->auto_save_failure_time = 0;
   bset_auto_save_file_name (b, Qnil);
   bset_read_only (b, Qnil);
-  set_buffer_overlays_before (b, NULL);
-  set_buffer_overlays_after (b, NULL);
-  b->overlay_center = BEG;
+  b->overlays = NULL;
   bset_mark_active (b, Qnil);
   bset_point_before_scroll (b, Qnil);
   bset_file_format (b, Qnil);
@@ -1615,10 +1597,11 @@ compact_buffer (struct buffer *buffer)
 {
   BUFFER_CHECK_INDIRECTION (buffer);
 
-  /* Skip dead buffers, indirect buffers and buffers
-     which aren't changed since last compaction.  */
+  /* Skip dead buffers, indirect buffers, compressed buffers
+     and buffers which aren't changed since last compaction.  */
   if (BUFFER_LIVE_P (buffer)
       && (buffer->base_buffer == NULL)
+      && !buffer->text->compressed
       && (BUF_COMPACT (buffer) != BUF_MODIFF (buffer)))
     {
       /* If a buffer's undo list is Qt, that means that undo is
@@ -1633,12 +1616,15 @@ compact_buffer (struct buffer *buffer)
 	{
 	  /* If a buffer's gap size is more than 10% of the buffer
 	     size, or larger than GAP_BYTES_DFL bytes, then shrink it
-	     accordingly.  Keep a minimum size of GAP_BYTES_MIN bytes.  */
+	     accordingly.  Keep a minimum size of GAP_BYTES_MIN bytes.
+	     A large buffer keeps some more, as shrinking and growing
+	     its gap again would move all the text after it.  */
 	  ptrdiff_t size = clip_to_bounds (GAP_BYTES_MIN,
 					   BUF_Z_BYTE (buffer) / 10,
 					   GAP_BYTES_DFL);
-	  if (BUF_GAP_SIZE (buffer) > size)
-	    make_gap_1 (buffer, -(BUF_GAP_SIZE (buffer) - size));
+	  ptrdiff_t slack = BUF_Z_BYTE (buffer) / GAP_FRACTION;
+	  if (BUF_GAP_SIZE (buffer) > size + 2 * slack)
+	    make_gap_1 (buffer, -(BUF_GAP_SIZE (buffer) - size - slack));
 	}
       BUF_COMPACT (buffer) = BUF_MODIFF (buffer);
     }
@@ -1833,16 +1819,12 @@ cleaning up all windows currently displaying the buffer to be killed. */)
       /* Unchain all markers that belong to this indirect buffer.
 	 Don't unchain the markers that belong to the base buffer
 	 or its other indirect buffers.  */
-      struct Lisp_Marker **mp = &BUF_MARKERS (b);
-      while ((m = *mp))
+      for (m = first_marker (b); m; )
 	{
+	  struct Lisp_Marker *next = next_marker (b, m);
 	  if (m->buffer == b)
-	    {
-	      m->buffer = NULL;
-	      *mp = m->next;
-	    }
-	  else
-	    mp = &m->next;
+	    unchain_marker (m);
+	  m = next;
 	}
       /* Intervals should be owned by the base buffer (Bug#16502).  */
       i = buffer_intervals (b);
@@ -1857,22 +1839,15 @@ cleaning up all windows currently displaying the buffer to be killed. */)
     {
       /* Unchain all markers of this buffer and its indirect buffers.
 	 and leave them pointing nowhere.  */
-      for (m = BUF_MARKERS (b); m; )
-	{
-	  struct Lisp_Marker *next = m->next;
-	  m->buffer = 0;
-	  m->next = NULL;
-	  m = next;
-	}
-      BUF_MARKERS (b) = NULL;
+      unchain_all_markers (b);
       set_buffer_intervals (b, NULL);
 
       /* Perhaps we should explicitly free the interval tree here...  */
     }
   /* Since we've unlinked the markers, the overlays can't be here any more
      either.  */
-  b->overlays_before = NULL;
-  b->overlays_after = NULL;
+  free_overlay_tree (b->overlays);
+  b->overlays = NULL;
 
   /* Reset the local variables, so that this buffer's local values
      won't be protected from GC.  They would be protected
@@ -1898,7 +1873,12 @@ cleaning up all windows currently displaying the buffer to be killed. */)
       /* Make sure that no one shows us.  */
       eassert (b->window_count == 0);
       /* No one shares our buffer text, can free it.  */
-      free_buffer_text (b);
+      if (b->text->compressed)
+	free_compressed_text (b);
+      else
+	free_buffer_text (b);
+      clear_position_index (b);
+      clear_line_index (b);
     }
 
   if (b->newline_cache)
@@ -2068,6 +2048,9 @@ set_buffer_internal_1 (register struct buffer *b)
   register struct buffer *old_buf;
   register Lisp_Object tail;
 
+  ensure_buffer_text (b);
+  b->text->used = true;
+
 #ifdef USE_MMAP_FOR_BUFFERS
   if (b->text->beg == NULL)
     enlarge_buffer_text (b, 0);
@@ -2134,6 +2117,9 @@ set_buffer_temp (struct buffer *b)
   if (current_buffer == b)
     return;
 
+  ensure_buffer_text (b);
+  b->text->used = true;
+
   old_buf = current_buffer;
   current_buffer = b;
 
@@ -2292,6 +2278,10 @@ DEFUN ("buffer-swap-text", Fbuffer_swap_text, Sbuffer_swap_text,
 	error ("One of the buffers to swap has indirect buffers");
   }
 
+  /* The text must be in place before its fields are swapped.  */
+  ensure_buffer_text (current_buffer);
+  ensure_buffer_text (other_buffer);
+
 #define swapfield(field, type) \
   do {							\
     type tmp##field = other_buffer->field;		\
@@ -2330,9 +2320,7 @@ DEFUN ("buffer-swap-text", Fbuffer_swap_text, Sbuffer_swap_text,
   swapfield (bidi_paragraph_cache, struct region_cache *);
   current_buffer->prevent_redisplay_optimizations_p = 1;
   other_buffer->prevent_redisplay_optimizations_p = 1;
-  swapfield (overlays_before, struct Lisp_Overlay *);
-  swapfield (overlays_after, struct Lisp_Overlay *);
-  swapfield (overlay_center, ptrdiff_t);
+  swapfield (overlays, struct overlay_node *);
   swapfield_ (undo_list, Lisp_Object);
   swapfield_ (mark, Lisp_Object);
   swapfield_ (enable_multibyte_characters, Lisp_Object);
@@ -2355,19 +2343,19 @@ DEFUN ("buffer-swap-text", Fbuffer_swap_text, Sbuffer_swap_text,
   other_buffer->text->end_unchanged = other_buffer->text->gpt;
   {
     struct Lisp_Marker *m;
-    for (m = BUF_MARKERS (current_buffer); m; m = m->next)
+    FOR_EACH_MARKER (current_buffer, m)
       if (m->buffer == other_buffer)
 	m->buffer = current_buffer;
       else
-	/* Since there's no indirect buffer in sight, markers on
-	   BUF_MARKERS(buf) should either be for `buf' or dead.  */
+	/* Since there's no indirect buffer in sight, the markers of
+	   buf's text should either be for `buf' or dead.  */
 	eassert (!m->buffer);
-    for (m = BUF_MARKERS (other_buffer); m; m = m->next)
+    FOR_EACH_MARKER (other_buffer, m)
       if (m->buffer == current_buffer)
 	m->buffer = other_buffer;
       else
-	/* Since there's no indirect buffer in sight, markers on
-	   BUF_MARKERS(buf) should either be for `buf' or dead.  */
+	/* Since there's no indirect buffer in sight, the markers of
+	   buf's text should either be for `buf' or dead.  */
 	eassert (!m->buffer);
   }
   { /* Some of the C code expects that both window markers of a
@@ -2430,7 +2418,8 @@ If the multibyte flag was really changed, undo information of the
 current buffer is cleared.  */)
   (Lisp_Object flag)
 {
-  struct Lisp_Marker *tail, *markers;
+  struct Lisp_Marker *tail, *markers[2];
+  int type;
   struct buffer *other;
   ptrdiff_t begv, zv;
   bool narrowed = (BEG != BEGV || Z != ZV);
@@ -2453,6 +2442,8 @@ current buffer is cleared.  */)
 
   /* If the cached position is for this buffer, clear it out.  */
   clear_charpos_cache (current_buffer);
+  clear_position_index (current_buffer);
+  clear_line_index (current_buffer);
 
   if (NILP (flag))
     begv = BEGV_BYTE, zv = ZV_BYTE;
@@ -2482,8 +2473,9 @@ current buffer is cleared.  */)
       TEMP_SET_PT_BOTH (PT_BYTE, PT_BYTE);
 
 
-      for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
-	tail->charpos = tail->bytepos;
+      /* Setting every offset makes every position equal too.  */
+      FOR_EACH_MARKER (current_buffer, tail)
+	tail->char_offset = tail->byte_offset;
 
       /* Convert multibyte form of 8-bit characters to unibyte.  */
       pos = BEG;
@@ -2641,25 +2633,42 @@ current buffer is cleared.  */)
 	TEMP_SET_PT_BOTH (position, byte);
       }
 
-      tail = markers = BUF_MARKERS (current_buffer);
-
       /* This prevents BYTE_TO_CHAR (that is, buf_bytepos_to_charpos) from
 	 getting confused by the markers that have not yet been updated.
 	 It is also a signal that it should never create a marker.  */
-      BUF_MARKERS (current_buffer) = NULL;
+      for (type = 0; type < 2; type++)
+	{
+	  markers[type] = BUF_MARKERS (current_buffer, type);
+	  BUF_MARKERS (current_buffer, type) = NULL;
+	}
 
-      for (; tail; tail = tail->next)
+      /* The conversion keeps the markers in order, so it can be done
+	 on their positions in place.  */
+      for (type = 0; type < 2; type++)
 	{
-	  tail->bytepos = advance_to_char_boundary (tail->bytepos);
-	  tail->charpos = BYTE_TO_CHAR (tail->bytepos);
+	  set_marker_tree_absolute (markers[type], 1);
+	  for (tail = markers[type]; tail && tail->left; tail = tail->left)
+	    continue;
+	  for (; tail; tail = marker_tree_next (tail))
+	    {
+	      tail->byte_offset = advance_to_char_boundary (tail->byte_offset);
+	      tail->char_offset = BYTE_TO_CHAR (tail->byte_offset);
+	    }
+	  set_marker_tree_absolute (markers[type], 0);
 	}
 
-      /* Make sure no markers were put on the chain
-	 while the chain value was incorrect.  */
-      if (BUF_MARKERS (current_buffer))
+      /* Make sure no markers were put in the trees
+	 while they were detached.  */
+      if (BUF_MARKERS (current_buffer, 0) || BUF_MARKERS (current_buffer, 1))
 	emacs_abort ();
 
-      BUF_MARKERS (current_buffer) = markers;
+      for (type = 0; type < 2; type++)
+	BUF_MARKERS (current_buffer, type) = markers[type];
+
+      /* Moving markers to character boundaries may have put overlay
+	 endpoints on the same position.  */
+      if (buffer_has_overlays ())
+	fix_start_end_in_overlays (BEG, Z);
 
       /* Do this last, so it can calculate the new correspondences
 	 between chars and bytes.  */
@@ -2773,6 +2782,329 @@ swap_out_buffer_local_variables (struct buffer *b)
     }
 }
 
+/* Overlay trees.  See struct overlay_node in buffer.h.  */
+
+/* Return the position where overlay OV starts.  */
+
+static ptrdiff_t
+overlay_start_pos (struct Lisp_Overlay *ov)
+{
+  return marker_charpos (XMARKER (ov->start));
+}
+
+/* Return the position where overlay OV ends.  */
+
+static ptrdiff_t
+overlay_end_pos (struct Lisp_Overlay *ov)
+{
+  return marker_charpos (XMARKER (ov->end));
+}
+
+/* Return true if overlay A comes before overlay B in tree order.  */
+
+static bool
+overlay_start_less (struct Lisp_Overlay *a, struct Lisp_Overlay *b)
+{
+  struct Lisp_Marker *ma = XMARKER (a->start), *mb = XMARKER (b->start);
+  ptrdiff_t pa = marker_charpos (ma), pb = marker_charpos (mb);
+
+  return (pa < pb
+	  || (pa == pb && ma->insertion_type < mb->insertion_type));
+}
+
+/* Return true if overlay A ends after overlay B, ordering equal end
+   positions the same way as overlay_start_less orders equal starts.  */
+
+static bool
+overlay_end_greater (struct Lisp_Overlay *a, struct Lisp_Overlay *b)
+{
+  struct Lisp_Marker *ma = XMARKER (a->end), *mb = XMARKER (b->end);
+  ptrdiff_t pa = marker_charpos (ma), pb = marker_charpos (mb);
+
+  return (pa > pb
+	  || (pa == pb && ma->insertion_type > mb->insertion_type));
+}
+
+static int
+overlay_node_height (struct overlay_node *node)
+{
+  return node ? node->height : 0;
+}
+
+/* Recompute the height and max_end of NODE from its children.  */
+
+static void
+overlay_node_update (struct overlay_node *node)
+{
+  node->height = max (overlay_node_height (node->left),
+		      overlay_node_height (node->right)) + 1;
+  node->max_end = node->overlay;
+  if (node->left && overlay_end_greater (node->left->max_end, node->max_end))
+    node->max_end = node->left->max_end;
+  if (node->right
+      && overlay_end_greater (node->right->max_end, node->max_end))
+    node->max_end = node->right->max_end;
+}
+
+/* Put NEW in the place of OLD in the overlay tree of B.  */
+
+static void
+overlay_node_replace (struct buffer *b, struct overlay_node *old,
+		      struct overlay_node *new)
+{
+  struct overlay_node *parent = old->parent;
+
+  if (!parent)
+    b->overlays = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+  if (new)
+    new->parent = parent;
+}
+
+/* Rotate the subtree rooted at NODE to the left or to the right, and
+   return the new root of that subtree.  */
+
+static struct overlay_node *
+overlay_rotate_left (struct buffer *b, struct overlay_node *node)
+{
+  struct overlay_node *right = node->right;
+
+  overlay_node_replace (b, node, right);
+  node->right = right->left;
+  if (node->right)
+    node->right->parent = node;
+  right->left = node;
+  node->parent = right;
+  overlay_node_update (node);
+  overlay_node_update (right);
+  return right;
+}
+
+static struct overlay_node *
+overlay_rotate_right (struct buffer *b, struct overlay_node *node)
+{
+  struct overlay_node *left = node->left;
+
+  overlay_node_replace (b, node, left);
+  node->left = left->right;
+  if (node->left)
+    node->left->parent = node;
+  left->right = node;
+  node->parent = left;
+  overlay_node_update (node);
+  overlay_node_update (left);
+  return left;
+}
+
+/* Update and rebalance the overlay tree of B from NODE up to the root,
+   after a node was added or removed below NODE.  */
+
+static void
+overlay_tree_rebalance (struct buffer *b, struct overlay_node *node)
+{
+  for (; node; node = node->parent)
+    {
+      int balance = (overlay_node_height (node->left)
+		     - overlay_node_height (node->right));
+
+      if (balance > 1)
+	{
+	  if (overlay_node_height (node->left->left)
+	      < overlay_node_height (node->left->right))
+	    overlay_rotate_left (b, node->left);
+	  node = overlay_rotate_right (b, node);
+	}
+      else if (balance < -1)
+	{
+	  if (overlay_node_height (node->right->right)
+	      < overlay_node_height (node->right->left))
+	    overlay_rotate_right (b, node->right);
+	  node = overlay_rotate_left (b, node);
+	}
+      else
+	overlay_node_update (node);
+    }
+}
+
+/* Add OV, which must not be in any tree, to the overlay tree of B.  */
+
+static void
+overlay_tree_insert (struct buffer *b, struct Lisp_Overlay *ov)
+{
+  struct overlay_node *node = xmalloc (sizeof *node);
+  struct overlay_node *parent = NULL, **link = &b->overlays;
+
+  eassert (!ov->node);
+  while (*link)
+    {
+      parent = *link;
+      link = (overlay_start_less (ov, parent->overlay)
+	      ? &parent->left : &parent->right);
+    }
+
+  node->parent = parent;
+  node->left = node->right = NULL;
+  node->overlay = node->max_end = ov;
+  node->height = 1;
+  *link = node;
+  ov->node = node;
+  overlay_tree_rebalance (b, parent);
+}
+
+/* Remove OV from the overlay tree of B.  This looks at the positions
+   of the overlays only to update max_end, so it works even when OV or
+   other overlays are out of order.  */
+
+static void
+overlay_tree_remove (struct buffer *b, struct Lisp_Overlay *ov)
+{
+  struct overlay_node *node = ov->node, *parent;
+
+  eassert (node);
+  if (node->left && node->right)
+    {
+      /* Let NODE hold the overlay of the node that follows it, and
+	 remove that node instead.  */
+      struct overlay_node *next = node->right;
+
+      while (next->left)
+	next = next->left;
+      node->overlay = next->overlay;
+      node->overlay->node = node;
+      node = next;
+    }
+
+  parent = node->parent;
+  overlay_node_replace (b, node, node->left ? node->left : node->right);
+  xfree (node);
+  ov->node = NULL;
+  overlay_tree_rebalance (b, parent);
+}
+
+/* Free the overlay tree rooted at NODE, leaving its overlays in no
+   tree.  */
+
+static void
+free_overlay_tree (struct overlay_node *node)
+{
+  while (node)
+    {
+      struct overlay_node *right = node->right;
+
+      free_overlay_tree (node->left);
+      node->overlay->node = NULL;
+      xfree (node);
+      node = right;
+    }
+}
+
+/* Return the first node, in tree order, in the subtree rooted at NODE
+   whose overlay starts at or before END and ends at or after BEG.
+   Return NULL if there is none.  */
+
+static struct overlay_node *
+overlay_subtree_first (struct overlay_node *node, ptrdiff_t beg, ptrdiff_t end)
+{
+  while (node && beg <= overlay_end_pos (node->max_end))
+    {
+      if (node->left && beg <= overlay_end_pos (node->left->max_end))
+	node = node->left;
+      else if (end < overlay_start_pos (node->overlay))
+	return NULL;
+      else if (beg <= overlay_end_pos (node->overlay))
+	return node;
+      else
+	node = node->right;
+    }
+  return NULL;
+}
+
+/* Return the first node of the overlay tree of B whose overlay starts
+   at or before END and ends at or after BEG, or NULL if there is none.
+   Use overlay_tree_next with the same BEG and END to get the others,
+   in order of increasing start position.  The tree must not be
+   changed while doing so.  */
+
+struct overlay_node *
+overlay_tree_first (struct buffer *b, ptrdiff_t beg, ptrdiff_t end)
+{
+  return overlay_subtree_first (b->overlays, beg, end);
+}
+
+struct overlay_node *
+overlay_tree_next (struct overlay_node *node, ptrdiff_t beg, ptrdiff_t end)
+{
+  while (true)
+    {
+      struct overlay_node *next = overlay_subtree_first (node->right, beg, end);
+
+      if (next)
+	return next;
+
+      /* Climb to the nearest ancestor that comes after NODE.  */
+      while (node->parent && node->parent->right == node)
+	node = node->parent;
+      node = node->parent;
+      if (!node || end < overlay_start_pos (node->overlay))
+	return NULL;
+      if (beg <= overlay_end_pos (node->overlay))
+	return node;
+    }
+}
+
+/* Return the smallest position after POS where an overlay of B starts,
+   or LIMIT if that is smaller.  */
+
+static ptrdiff_t
+overlay_tree_next_start (struct buffer *b, ptrdiff_t pos, ptrdiff_t limit)
+{
+  struct overlay_node *node = b->overlays;
+
+  while (node)
+    {
+      ptrdiff_t startpos = overlay_start_pos (node->overlay);
+
+      if (pos < startpos)
+	{
+	  limit = min (limit, startpos);
+	  node = node->left;
+	}
+      else
+	node = node->right;
+    }
+  return limit;
+}
+
+/* Return the greatest position before POS where an overlay in the
+   subtree rooted at NODE ends, or LIMIT if that is greater.  */
+
+static ptrdiff_t
+overlay_subtree_prev_end (struct overlay_node *node, ptrdiff_t pos,
+			  ptrdiff_t limit)
+{
+  for (; node; node = node->left)
+    {
+      ptrdiff_t endpos = overlay_end_pos (node->max_end);
+
+      if (endpos < pos)
+	return max (limit, endpos);
+
+      /* Overlays starting at or after POS end there or later, so
+	 only look to the right of overlays that start before POS.  */
+      if (overlay_start_pos (node->overlay) < pos)
+	{
+	  endpos = overlay_end_pos (node->overlay);
+	  if (endpos < pos)
+	    limit = max (limit, endpos);
+	  limit = overlay_subtree_prev_end (node->right, pos, limit);
+	}
+    }
+  return limit;
+}
+
 /* Find all the overlays in the current buffer that contain position POS.
    Return the number found, and store them in a vector in *VEC_PTR.
    Store in *LEN_PTR the size allocated for the vector.
@@ -2791,133 +3123,75 @@ swap_out_buffer_local_variables (struct buffer *b)
    and store only as many overlays as will fit.
    But still return the total number of overlays.
 
-   If CHANGE_REQ, any position written into *PREV_PTR or
-   *NEXT_PTR is guaranteed to be not equal to POS, unless it is the
-   default (BEGV or ZV).  */
+   Any position written into *PREV_PTR or *NEXT_PTR is not equal to
+   POS, unless it is the default (BEGV or ZV).  CHANGE_REQ, which used
+   to ask for that, is ignored.  */
 
 ptrdiff_t
 overlays_at (EMACS_INT pos, bool extend, Lisp_Object **vec_ptr,
 	     ptrdiff_t *len_ptr,
 	     ptrdiff_t *next_ptr, ptrdiff_t *prev_ptr, bool change_req)
 {
-  Lisp_Object overlay, start, end;
-  struct Lisp_Overlay *tail;
+  Lisp_Object overlay;
+  struct overlay_node *node;
   ptrdiff_t idx = 0;
   ptrdiff_t len = *len_ptr;
   Lisp_Object *vec = *vec_ptr;
-  ptrdiff_t next = ZV;
   ptrdiff_t prev = BEGV;
   bool inhibit_storing = 0;
 
-  for (tail = current_buffer->overlays_before; tail; tail = tail->next)
+  for (node = overlay_tree_first (current_buffer, pos, pos); node;
+       node = overlay_tree_next (node, pos, pos))
     {
-      ptrdiff_t startpos, endpos;
-
-      XSETMISC (overlay, tail);
+      ptrdiff_t startpos = overlay_start_pos (node->overlay);
 
-      start = OVERLAY_START (overlay);
-      end = OVERLAY_END (overlay);
-      endpos = OVERLAY_POSITION (end);
-      if (endpos < pos)
-	{
-	  if (prev < endpos)
-	    prev = endpos;
-	  break;
-	}
-      startpos = OVERLAY_POSITION (start);
       /* This one ends at or after POS
 	 so its start counts for PREV_PTR if it's before POS.  */
       if (prev < startpos && startpos < pos)
 	prev = startpos;
-      if (endpos == pos)
+      if (overlay_end_pos (node->overlay) == pos)
 	continue;
-      if (startpos <= pos)
+
+      if (idx == len)
 	{
-	  if (idx == len)
+	  /* The supplied vector is full.
+	     Either make it bigger, or don't store any more in it.  */
+	  if (extend)
 	    {
-	      /* The supplied vector is full.
-		 Either make it bigger, or don't store any more in it.  */
-	      if (extend)
-		{
-		  vec = xpalloc (vec, len_ptr, 1, OVERLAY_COUNT_MAX,
-				 sizeof *vec);
-		  *vec_ptr = vec;
-		  len = *len_ptr;
-		}
-	      else
-		inhibit_storing = 1;
+	      vec = xpalloc (vec, len_ptr, 1, OVERLAY_COUNT_MAX,
+			     sizeof *vec);
+	      *vec_ptr = vec;
+	      len = *len_ptr;
 	    }
-
-	  if (!inhibit_storing)
-	    vec[idx] = overlay;
-	  /* Keep counting overlays even if we can't return them all.  */
-	  idx++;
+	  else
+	    inhibit_storing = 1;
 	}
-      else if (startpos < next)
-	next = startpos;
-    }
 
-  for (tail = current_buffer->overlays_after; tail; tail = tail->next)
-    {
-      ptrdiff_t startpos, endpos;
-
-      XSETMISC (overlay, tail);
-
-      start = OVERLAY_START (overlay);
-      end = OVERLAY_END (overlay);
-      startpos = OVERLAY_POSITION (start);
-      if (pos < startpos)
+      if (!inhibit_storing)
 	{
-	  if (startpos < next)
-	    next = startpos;
-	  break;
+	  XSETMISC (overlay, node->overlay);
+	  vec[idx] = overlay;
 	}
-      endpos = OVERLAY_POSITION (end);
-      if (pos < endpos)
-	{
-	  if (idx == len)
-	    {
-	      if (extend)
-		{
-		  vec = xpalloc (vec, len_ptr, 1, OVERLAY_COUNT_MAX,
-				 sizeof *vec);
-		  *vec_ptr = vec;
-		  len = *len_ptr;
-		}
-	      else
-		inhibit_storing = 1;
-	    }
-
-	  if (!inhibit_storing)
-	    vec[idx] = overlay;
-	  idx++;
-
-	  if (startpos < pos && startpos > prev)
-	    prev = startpos;
-	}
-      else if (endpos < pos && endpos > prev)
-	prev = endpos;
-      else if (endpos == pos && startpos > prev
-	       && (!change_req || startpos < pos))
-	prev = startpos;
+      /* Keep counting overlays even if we can't return them all.  */
+      idx++;
     }
 
   if (next_ptr)
-    *next_ptr = next;
+    *next_ptr = overlay_tree_next_start (current_buffer, pos, ZV);
   if (prev_ptr)
-    *prev_ptr = prev;
+    *prev_ptr = overlay_subtree_prev_end (current_buffer->overlays, pos, prev);
   return idx;
 }
-
+
 /* Find all the overlays in the current buffer that overlap the range
    BEG-END, or are empty at BEG, or are empty at END provided END
    denotes the position at the end of the current buffer.
 
    Return the number found, and store them in a vector in *VEC_PTR.
    Store in *LEN_PTR the size allocated for the vector.
-   Store in *NEXT_PTR the next position after POS where an overlay starts,
+   Store in *NEXT_PTR the next position after END where an overlay starts,
      or ZV if there are no more overlays.
-   Store in *PREV_PTR the previous position before POS where an overlay ends,
+   Store in *PREV_PTR the previous position before BEG where an overlay ends,
      or BEGV if there are no previous overlays.
    NEXT_PTR and/or PREV_PTR may be 0, meaning don't store that info.
 
@@ -2934,32 +3208,20 @@ overlays_in (EMACS_INT beg, EMACS_INT end, bool extend,
 	     Lisp_Object **vec_ptr, ptrdiff_t *len_ptr,
 	     ptrdiff_t *next_ptr, ptrdiff_t *prev_ptr)
 {
-  Lisp_Object overlay, ostart, oend;
-  struct Lisp_Overlay *tail;
+  Lisp_Object overlay;
+  struct overlay_node *node;
   ptrdiff_t idx = 0;
   ptrdiff_t len = *len_ptr;
   Lisp_Object *vec = *vec_ptr;
-  ptrdiff_t next = ZV;
-  ptrdiff_t prev = BEGV;
   bool inhibit_storing = 0;
   bool end_is_Z = end == Z;
 
-  for (tail = current_buffer->overlays_before; tail; tail = tail->next)
+  for (node = overlay_tree_first (current_buffer, beg, end); node;
+       node = overlay_tree_next (node, beg, end))
     {
-      ptrdiff_t startpos, endpos;
-
-      XSETMISC (overlay, tail);
+      ptrdiff_t startpos = overlay_start_pos (node->overlay);
+      ptrdiff_t endpos = overlay_end_pos (node->overlay);
 
-      ostart = OVERLAY_START (overlay);
-      oend = OVERLAY_END (overlay);
-      endpos = OVERLAY_POSITION (oend);
-      if (endpos < beg)
-	{
-	  if (prev < endpos)
-	    prev = endpos;
-	  break;
-	}
-      startpos = OVERLAY_POSITION (ostart);
       /* Count an interval if it overlaps the range, is empty at the
 	 start of the range, or is empty at END provided END denotes the
 	 end of the buffer.  */
@@ -2983,62 +3245,19 @@ overlays_in (EMACS_INT beg, EMACS_INT end, bool extend,
 	    }
 
 	  if (!inhibit_storing)
-	    vec[idx] = overlay;
-	  /* Keep counting overlays even if we can't return them all.  */
-	  idx++;
-	}
-      else if (startpos < next)
-	next = startpos;
-    }
-
-  for (tail = current_buffer->overlays_after; tail; tail = tail->next)
-    {
-      ptrdiff_t startpos, endpos;
-
-      XSETMISC (overlay, tail);
-
-      ostart = OVERLAY_START (overlay);
-      oend = OVERLAY_END (overlay);
-      startpos = OVERLAY_POSITION (ostart);
-      if (end < startpos)
-	{
-	  if (startpos < next)
-	    next = startpos;
-	  break;
-	}
-      endpos = OVERLAY_POSITION (oend);
-      /* Count an interval if it overlaps the range, is empty at the
-	 start of the range, or is empty at END provided END denotes the
-	 end of the buffer.  */
-      if ((beg < endpos && startpos < end)
-	  || (startpos == endpos
-	      && (beg == endpos || (end_is_Z && endpos == end))))
-	{
-	  if (idx == len)
 	    {
-	      if (extend)
-		{
-		  vec = xpalloc (vec, len_ptr, 1, OVERLAY_COUNT_MAX,
-				 sizeof *vec);
-		  *vec_ptr = vec;
-		  len = *len_ptr;
-		}
-	      else
-		inhibit_storing = 1;
+	      XSETMISC (overlay, node->overlay);
+	      vec[idx] = overlay;
 	    }
-
-	  if (!inhibit_storing)
-	    vec[idx] = overlay;
+	  /* Keep counting overlays even if we can't return them all.  */
 	  idx++;
 	}
-      else if (endpos < beg && endpos > prev)
-	prev = endpos;
     }
 
   if (next_ptr)
-    *next_ptr = next;
+    *next_ptr = overlay_tree_next_start (current_buffer, end, ZV);
   if (prev_ptr)
-    *prev_ptr = prev;
+    *prev_ptr = overlay_subtree_prev_end (current_buffer->overlays, beg, BEGV);
   return idx;
 }
 
@@ -3081,39 +3300,16 @@ mouse_face_overlay_overlaps (Lisp_Object overlay)
 bool
 overlay_touches_p (ptrdiff_t pos)
 {
-  Lisp_Object overlay;
-  struct Lisp_Overlay *tail;
-
-  for (tail = current_buffer->overlays_before; tail; tail = tail->next)
-    {
-      ptrdiff_t endpos;
+  struct overlay_node *node;
 
-      XSETMISC (overlay ,tail);
-      eassert (OVERLAYP (overlay));
+  for (node = overlay_tree_first (current_buffer, pos, pos); node;
+       node = overlay_tree_next (node, pos, pos))
+    if (overlay_start_pos (node->overlay) == pos
+	|| overlay_end_pos (node->overlay) == pos)
+      return 1;
+  return 0;
+}
 
-      endpos = OVERLAY_POSITION (OVERLAY_END (overlay));
-      if (endpos < pos)
-	break;
-      if (endpos == pos || OVERLAY_POSITION (OVERLAY_START (overlay)) == pos)
-	return 1;
-    }
-
-  for (tail = current_buffer->overlays_after; tail; tail = tail->next)
-    {
-      ptrdiff_t startpos;
-
-      XSETMISC (overlay, tail);
-      eassert (OVERLAYP (overlay));
-
-      startpos = OVERLAY_POSITION (OVERLAY_START (overlay));
-      if (pos < startpos)
-	break;
-      if (startpos == pos || OVERLAY_POSITION (OVERLAY_END (overlay)) == pos)
-	return 1;
-    }
-  return 0;
-}
-
 struct sortvec
 {
   Lisp_Object overlay;
@@ -3322,21 +3518,20 @@ ptrdiff_t
 overlay_strings (ptrdiff_t pos, struct window *w, unsigned char **pstr)
 {
   Lisp_Object overlay, window, str;
-  struct Lisp_Overlay *ov;
+  struct overlay_node *node;
   ptrdiff_t startpos, endpos;
   bool multibyte = ! NILP (BVAR (current_buffer, enable_multibyte_characters));
 
   overlay_heads.used = overlay_heads.bytes = 0;
   overlay_tails.used = overlay_tails.bytes = 0;
-  for (ov = current_buffer->overlays_before; ov; ov = ov->next)
+  for (node = overlay_tree_first (current_buffer, pos, pos); node;
+       node = overlay_tree_next (node, pos, pos))
     {
-      XSETMISC (overlay, ov);
+      XSETMISC (overlay, node->overlay);
       eassert (OVERLAYP (overlay));
 
       startpos = OVERLAY_POSITION (OVERLAY_START (overlay));
       endpos = OVERLAY_POSITION (OVERLAY_END (overlay));
-      if (endpos < pos)
-	break;
       if (endpos != pos && startpos != pos)
 	continue;
       window = Foverlay_get (overlay, Qwindow);
@@ -3356,34 +3551,6 @@ overlay_strings (ptrdiff_t pos, struct window *w, unsigned char **pstr)
 			       Foverlay_get (overlay, Qpriority),
 			       endpos - startpos);
     }
-  for (ov = current_buffer->overlays_after; ov; ov = ov->next)
-    {
-      XSETMISC (overlay, ov);
-      eassert (OVERLAYP (overlay));
-
-      startpos = OVERLAY_POSITION (OVERLAY_START (overlay));
-      endpos = OVERLAY_POSITION (OVERLAY_END (overlay));
-      if (startpos > pos)
-	break;
-      if (endpos != pos && startpos != pos)
-	continue;
-      window = Foverlay_get (overlay, Qwindow);
-      if (WINDOWP (window) && XWINDOW (window) != w)
-	continue;
-      if (startpos == pos
-	  && (str = Foverlay_get (overlay, Qbefore_string), STRINGP (str)))
-	record_overlay_string (&overlay_heads, str,
-			       (startpos == endpos
-				? Foverlay_get (overlay, Qafter_string)
-				: Qnil),
-			       Foverlay_get (overlay, Qpriority),
-			       endpos - startpos);
-      else if (endpos == pos
-	       && (str = Foverlay_get (overlay, Qafter_string), STRINGP (str)))
-	record_overlay_string (&overlay_tails, str, Qnil,
-			       Foverlay_get (overlay, Qpriority),
-			       endpos - startpos);
-    }
   if (overlay_tails.used > 1)
     qsort (overlay_tails.buf, overlay_tails.used, sizeof (struct sortstr),
 	   cmp_for_strings);
@@ -3440,385 +3607,84 @@ overlay_strings (ptrdiff_t pos, struct window *w, unsigned char **pstr)
   return 0;
 }
 
-/* Shift overlays in BUF's overlay lists, to center the lists at POS.  */
+/* Reinsert the overlays of B that start or end between START and END
+   into the overlay tree of B.  Backward overlays are made empty.  */
 
-void
-recenter_overlay_lists (struct buffer *buf, ptrdiff_t pos)
+static void
+fix_overlays_in_buffer (struct buffer *b, ptrdiff_t start, ptrdiff_t end)
 {
-  Lisp_Object overlay, beg, end;
-  struct Lisp_Overlay *prev, *tail, *next;
-
-  /* See if anything in overlays_before should move to overlays_after.  */
-
-  /* We don't strictly need prev in this loop; it should always be nil.
-     But we use it for symmetry and in case that should cease to be true
-     with some future change.  */
-  prev = NULL;
-  for (tail = buf->overlays_before; tail; prev = tail, tail = next)
-    {
-      next = tail->next;
-      XSETMISC (overlay, tail);
-      eassert (OVERLAYP (overlay));
-
-      beg = OVERLAY_START (overlay);
-      end = OVERLAY_END (overlay);
-
-      if (OVERLAY_POSITION (end) > pos)
-	{
-	  /* OVERLAY needs to be moved.  */
-	  ptrdiff_t where = OVERLAY_POSITION (beg);
-	  struct Lisp_Overlay *other, *other_prev;
-
-	  /* Splice the cons cell TAIL out of overlays_before.  */
-	  if (prev)
-	    prev->next = next;
-	  else
-	    set_buffer_overlays_before (buf, next);
-
-	  /* Search thru overlays_after for where to put it.  */
-	  other_prev = NULL;
-	  for (other = buf->overlays_after; other;
-	       other_prev = other, other = other->next)
-	    {
-	      Lisp_Object otherbeg, otheroverlay;
+  struct Lisp_Overlay *vbuf[16];
+  struct Lisp_Overlay **vec = vbuf;
+  ptrdiff_t size = ARRAYELTS (vbuf);
+  ptrdiff_t i, n = 0;
+  struct overlay_node *node;
+  Lisp_Object buffer;
 
-	      XSETMISC (otheroverlay, other);
-	      eassert (OVERLAYP (otheroverlay));
+  /* Collect the overlays first, since reinserting them changes the
+     tree.  The search remains valid as long as the positions in the
+     range were only permuted or collapsed.  */
+  for (node = overlay_tree_first (b, start, end); node;
+       node = overlay_tree_next (node, start, end))
+    if (start <= overlay_start_pos (node->overlay)
+	|| overlay_end_pos (node->overlay) <= end)
+      {
+	if (n == size)
+	  {
+	    if (vec == vbuf)
+	      {
+		vec = xpalloc (NULL, &size, 1, -1, sizeof *vec);
+		memcpy (vec, vbuf, sizeof vbuf);
+	      }
+	    else
+	      vec = xpalloc (vec, &size, 1, -1, sizeof *vec);
+	  }
+	vec[n++] = node->overlay;
+      }
 
-	      otherbeg = OVERLAY_START (otheroverlay);
-	      if (OVERLAY_POSITION (otherbeg) >= where)
-		break;
-	    }
+  for (i = 0; i < n; i++)
+    overlay_tree_remove (b, vec[i]);
 
-	  /* Add TAIL to overlays_after before OTHER.  */
-	  tail->next = other;
-	  if (other_prev)
-	    other_prev->next = tail;
-	  else
-	    set_buffer_overlays_after (buf, tail);
-	  tail = prev;
-	}
-      else
-	/* We've reached the things that should stay in overlays_before.
-	   All the rest of overlays_before must end even earlier,
-	   so stop now.  */
-	break;
-    }
-
-  /* See if anything in overlays_after should be in overlays_before.  */
-  prev = NULL;
-  for (tail = buf->overlays_after; tail; prev = tail, tail = next)
+  XSETBUFFER (buffer, b);
+  for (i = 0; i < n; i++)
     {
-      next = tail->next;
-      XSETMISC (overlay, tail);
-      eassert (OVERLAYP (overlay));
-
-      beg = OVERLAY_START (overlay);
-      end = OVERLAY_END (overlay);
-
-      /* Stop looking, when we know that nothing further
-	 can possibly end before POS.  */
-      if (OVERLAY_POSITION (beg) > pos)
-	break;
-
-      if (OVERLAY_POSITION (end) <= pos)
-	{
-	  /* OVERLAY needs to be moved.  */
-	  ptrdiff_t where = OVERLAY_POSITION (end);
-	  struct Lisp_Overlay *other, *other_prev;
+      struct Lisp_Marker *m = XMARKER (vec[i]->end);
 
-	  /* Splice the cons cell TAIL out of overlays_after.  */
-	  if (prev)
-	    prev->next = next;
-	  else
-	    set_buffer_overlays_after (buf, next);
-
-	  /* Search thru overlays_before for where to put it.  */
-	  other_prev = NULL;
-	  for (other = buf->overlays_before; other;
-	       other_prev = other, other = other->next)
-	    {
-	      Lisp_Object otherend, otheroverlay;
-
-	      XSETMISC (otheroverlay, other);
-	      eassert (OVERLAYP (otheroverlay));
-
-	      otherend = OVERLAY_END (otheroverlay);
-	      if (OVERLAY_POSITION (otherend) <= where)
-		break;
-	    }
-
-	  /* Add TAIL to overlays_before before OTHER.  */
-	  tail->next = other;
-	  if (other_prev)
-	    other_prev->next = tail;
-	  else
-	    set_buffer_overlays_before (buf, tail);
-	  tail = prev;
-	}
+      /* If the overlay is backwards, make it empty.  */
+      if (marker_charpos (m) < overlay_start_pos (vec[i]))
+	set_marker_both (vec[i]->start, buffer, marker_charpos (m),
+			 marker_bytepos (m));
+      overlay_tree_insert (b, vec[i]);
     }
 
-  buf->overlay_center = pos;
-}
-
-void
-adjust_overlays_for_insert (ptrdiff_t pos, ptrdiff_t length)
-{
-  /* After an insertion, the lists are still sorted properly,
-     but we may need to update the value of the overlay center.  */
-  if (current_buffer->overlay_center >= pos)
-    current_buffer->overlay_center += length;
-}
-
-void
-adjust_overlays_for_delete (ptrdiff_t pos, ptrdiff_t length)
-{
-  if (current_buffer->overlay_center < pos)
-    /* The deletion was to our right.  No change needed; the before- and
-       after-lists are still consistent.  */
-    ;
-  else if (current_buffer->overlay_center - pos > length)
-    /* The deletion was to our left.  We need to adjust the center value
-       to account for the change in position, but the lists are consistent
-       given the new value.  */
-    current_buffer->overlay_center -= length;
-  else
-    /* We're right in the middle.  There might be things on the after-list
-       that now belong on the before-list.  Recentering will move them,
-       and also update the center point.  */
-    recenter_overlay_lists (current_buffer, pos);
+  if (vec != vbuf)
+    xfree (vec);
 }
 
 /* Fix up overlays that were garbled as a result of permuting markers
-   in the range START through END.  Any overlay with at least one
-   endpoint in this range will need to be unlinked from the overlay
-   list and reinserted in its proper place.
-   Such an overlay might even have negative size at this point.
-   If so, we'll make the overlay empty. */
+   in the range START through END, or of moving markers in that range
+   to the same position.  Any overlay with at least one endpoint in
+   this range will need to be reinserted in its proper place in the
+   overlay tree.  Such an overlay might even have negative size at
+   this point.  If so, we'll make the overlay empty.
+
+   The markers of an indirect buffer live in the text of its base
+   buffer, so the overlays of all buffers sharing the current buffer's
+   text are fixed.  */
 void
-fix_start_end_in_overlays (register ptrdiff_t start, register ptrdiff_t end)
+fix_start_end_in_overlays (ptrdiff_t start, ptrdiff_t end)
 {
-  Lisp_Object overlay;
-  struct Lisp_Overlay *before_list IF_LINT (= NULL);
-  struct Lisp_Overlay *after_list IF_LINT (= NULL);
-  /* These are either nil, indicating that before_list or after_list
-     should be assigned, or the cons cell the cdr of which should be
-     assigned.  */
-  struct Lisp_Overlay *beforep = NULL, *afterp = NULL;
-  /* 'Parent', likewise, indicates a cons cell or
-     current_buffer->overlays_before or overlays_after, depending
-     which loop we're in.  */
-  struct Lisp_Overlay *tail, *parent;
-  ptrdiff_t startpos, endpos;
-
-  /* This algorithm shifts links around instead of consing and GCing.
-     The loop invariant is that before_list (resp. after_list) is a
-     well-formed list except that its last element, the CDR of beforep
-     (resp. afterp) if beforep (afterp) isn't nil or before_list
-     (after_list) if it is, is still uninitialized.  So it's not a bug
-     that before_list isn't initialized, although it may look
-     strange.  */
-  for (parent = NULL, tail = current_buffer->overlays_before; tail;)
-    {
-      XSETMISC (overlay, tail);
-
-      endpos = OVERLAY_POSITION (OVERLAY_END (overlay));
-      startpos = OVERLAY_POSITION (OVERLAY_START (overlay));
-
-      /* If the overlay is backwards, make it empty.  */
-      if (endpos < startpos)
-	{
-	  startpos = endpos;
-	  Fset_marker (OVERLAY_START (overlay), make_number (startpos),
-		       Qnil);
-	}
-
-      if (endpos < start)
-	break;
-
-      if (endpos < end
-	  || (startpos >= start && startpos < end))
-	{
-	  /* Add it to the end of the wrong list.  Later on,
-	     recenter_overlay_lists will move it to the right place.  */
-	  if (endpos < current_buffer->overlay_center)
-	    {
-	      if (!afterp)
-		after_list = tail;
-	      else
-		afterp->next = tail;
-	      afterp = tail;
-	    }
-	  else
-	    {
-	      if (!beforep)
-		before_list = tail;
-	      else
-		beforep->next = tail;
-	      beforep = tail;
-	    }
-	  if (!parent)
-	    set_buffer_overlays_before (current_buffer, tail->next);
-	  else
-	    parent->next = tail->next;
-	  tail = tail->next;
-	}
-      else
-	parent = tail, tail = parent->next;
-    }
-  for (parent = NULL, tail = current_buffer->overlays_after; tail;)
-    {
-      XSETMISC (overlay, tail);
-
-      startpos = OVERLAY_POSITION (OVERLAY_START (overlay));
-      endpos = OVERLAY_POSITION (OVERLAY_END (overlay));
-
-      /* If the overlay is backwards, make it empty.  */
-      if (endpos < startpos)
-	{
-	  startpos = endpos;
-	  Fset_marker (OVERLAY_START (overlay), make_number (startpos),
-		       Qnil);
-	}
-
-      if (startpos >= end)
-	break;
-
-      if (startpos >= start
-	  || (endpos >= start && endpos < end))
-	{
-	  if (endpos < current_buffer->overlay_center)
-	    {
-	      if (!afterp)
-		after_list = tail;
-	      else
-		afterp->next = tail;
-	      afterp = tail;
-	    }
-	  else
-	    {
-	      if (!beforep)
-		before_list = tail;
-	      else
-		beforep->next = tail;
-	      beforep = tail;
-	    }
-	  if (!parent)
-	    set_buffer_overlays_after (current_buffer, tail->next);
-	  else
-	    parent->next = tail->next;
-	  tail = tail->next;
-	}
-      else
-	parent = tail, tail = parent->next;
-    }
-
-  /* Splice the constructed (wrong) lists into the buffer's lists,
-     and let the recenter function make it sane again.  */
-  if (beforep)
+  if (current_buffer->indirections == 0)
+    fix_overlays_in_buffer (current_buffer, start, end);
+  else
     {
-      beforep->next = current_buffer->overlays_before;
-      set_buffer_overlays_before (current_buffer, before_list);
-    }
+      Lisp_Object tail, buf;
 
-  if (afterp)
-    {
-      afterp->next = current_buffer->overlays_after;
-      set_buffer_overlays_after (current_buffer, after_list);
+      FOR_EACH_LIVE_BUFFER (tail, buf)
+	if (XBUFFER (buf)->text == current_buffer->text)
+	  fix_overlays_in_buffer (XBUFFER (buf), start, end);
     }
-  recenter_overlay_lists (current_buffer, current_buffer->overlay_center);
 }
 
-/* We have two types of overlay: the one whose ending marker is
-   after-insertion-marker (this is the usual case) and the one whose
-   ending marker is before-insertion-marker.  When `overlays_before'
-   contains overlays of the latter type and the former type in this
-   order and both overlays end at inserting position, inserting a text
-   increases only the ending marker of the latter type, which results
-   in incorrect ordering of `overlays_before'.
-
-   This function fixes ordering of overlays in the slot
-   `overlays_before' of the buffer *BP.  Before the insertion, `point'
-   was at PREV, and now is at POS.  */
-
-void
-fix_overlays_before (struct buffer *bp, ptrdiff_t prev, ptrdiff_t pos)
-{
-  /* If parent is nil, replace overlays_before; otherwise, parent->next.  */
-  struct Lisp_Overlay *tail = bp->overlays_before, *parent = NULL, *right_pair;
-  Lisp_Object tem;
-  ptrdiff_t end IF_LINT (= 0);
-
-  /* After the insertion, the several overlays may be in incorrect
-     order.  The possibility is that, in the list `overlays_before',
-     an overlay which ends at POS appears after an overlay which ends
-     at PREV.  Since POS is greater than PREV, we must fix the
-     ordering of these overlays, by moving overlays ends at POS before
-     the overlays ends at PREV.  */
-
-  /* At first, find a place where disordered overlays should be linked
-     in.  It is where an overlay which end before POS exists. (i.e. an
-     overlay whose ending marker is after-insertion-marker if disorder
-     exists).  */
-  while (tail
-	 && (XSETMISC (tem, tail),
-	     (end = OVERLAY_POSITION (OVERLAY_END (tem))) >= pos))
-    {
-      parent = tail;
-      tail = tail->next;
-    }
-
-  /* If we don't find such an overlay,
-     or the found one ends before PREV,
-     or the found one is the last one in the list,
-     we don't have to fix anything.  */
-  if (!tail || end < prev || !tail->next)
-    return;
-
-  right_pair = parent;
-  parent = tail;
-  tail = tail->next;
-
-  /* Now, end position of overlays in the list TAIL should be before
-     or equal to PREV.  In the loop, an overlay which ends at POS is
-     moved ahead to the place indicated by the CDR of RIGHT_PAIR.  If
-     we found an overlay which ends before PREV, the remaining
-     overlays are in correct order.  */
-  while (tail)
-    {
-      XSETMISC (tem, tail);
-      end = OVERLAY_POSITION (OVERLAY_END (tem));
-
-      if (end == pos)
-	{			/* This overlay is disordered. */
-	  struct Lisp_Overlay *found = tail;
-
-	  /* Unlink the found overlay.  */
-	  tail = found->next;
-	  parent->next = tail;
-	  /* Move an overlay at RIGHT_PLACE to the next of the found one,
-	     and link it into the right place.  */
-	  if (!right_pair)
-	    {
-	      found->next = bp->overlays_before;
-	      set_buffer_overlays_before (bp, found);
-	    }
-	  else
-	    {
-	      found->next = right_pair->next;
-	      right_pair->next = found;
-	    }
-	}
-      else if (end == prev)
-	{
-	  parent = tail;
-	  tail = tail->next;
-	}
-      else			/* No more disordered overlay. */
-	break;
-    }
-}
-
 DEFUN ("overlayp", Foverlayp, Soverlayp, 1, 1, 0,
        doc: /* Return t if OBJECT is an overlay.  */)
   (Lisp_Object object)
@@ -3867,28 +3733,12 @@ for the rear of the overlay advance when text is inserted there
   end = Fset_marker (Fmake_marker (), end, buffer);
 
   if (!NILP (front_advance))
-    XMARKER (beg)->insertion_type = 1;
+    set_marker_insertion_type (XMARKER (beg), 1);
   if (!NILP (rear_advance))
-    XMARKER (end)->insertion_type = 1;
+    set_marker_insertion_type (XMARKER (end), 1);
 
   overlay = build_overlay (beg, end, Qnil);
-
-  /* Put the new overlay on the wrong list.  */
-  end = OVERLAY_END (overlay);
-  if (OVERLAY_POSITION (end) < b->overlay_center)
-    {
-      eassert (b->overlays_after || (XOVERLAY (overlay)->next == NULL));
-      XOVERLAY (overlay)->next = b->overlays_after;
-      set_buffer_overlays_after (b, XOVERLAY (overlay));
-    }
-  else
-    {
-      eassert (b->overlays_before || (XOVERLAY (overlay)->next == NULL));
-      XOVERLAY (overlay)->next = b->overlays_before;
-      set_buffer_overlays_before (b, XOVERLAY (overlay));
-    }
-  /* This puts it in the right list, and in the right order.  */
-  recenter_overlay_lists (b, b->overlay_center);
+  overlay_tree_insert (b, XOVERLAY (overlay));
 
   /* We don't need to redisplay the region covered by the overlay, because
      the overlay has no properties at the moment.  */
@@ -3915,35 +3765,6 @@ modify_overlay (struct buffer *buf, ptrdiff_t start, ptrdiff_t end)
   ++BUF_OVERLAY_MODIFF (buf);
 }
 
-/* Remove OVERLAY from LIST.  */
-
-static struct Lisp_Overlay *
-unchain_overlay (struct Lisp_Overlay *list, struct Lisp_Overlay *overlay)
-{
-  register struct Lisp_Overlay *tail, **prev = &list;
-
-  for (tail = list; tail; prev = &tail->next, tail = *prev)
-    if (tail == overlay)
-      {
-	*prev = overlay->next;
-	overlay->next = NULL;
-	break;
-      }
-  return list;
-}
-
-/* Remove OVERLAY from both overlay lists of B.  */
-
-static void
-unchain_both (struct buffer *b, Lisp_Object overlay)
-{
-  struct Lisp_Overlay *ov = XOVERLAY (overlay);
-
-  set_buffer_overlays_before (b, unchain_overlay (b->overlays_before, ov));
-  set_buffer_overlays_after (b, unchain_overlay (b->overlays_after, ov));
-  eassert (XOVERLAY (overlay)->next == NULL);
-}
-
 DEFUN ("move-overlay", Fmove_overlay, Smove_overlay, 3, 4, 0,
        doc: /* Set the endpoints of OVERLAY to BEG and END in BUFFER.
 If BUFFER is omitted, leave OVERLAY in the same buffer it inhabits now.
@@ -3992,7 +3813,7 @@ buffer.  */)
       o_beg = OVERLAY_POSITION (OVERLAY_START (overlay));
       o_end = OVERLAY_POSITION (OVERLAY_END (overlay));
 
-      unchain_both (ob, overlay);
+      overlay_tree_remove (ob, XOVERLAY (overlay));
     }
 
   /* Set the overlay boundaries, which may clip them.  */
@@ -4002,6 +3823,9 @@ buffer.  */)
   n_beg = marker_position (OVERLAY_START (overlay));
   n_end = marker_position (OVERLAY_END (overlay));
 
+  /* Put the overlay into the new buffer's overlay tree.  */
+  overlay_tree_insert (b, XOVERLAY (overlay));
+
   /* If the overlay has changed buffers, do a thorough redisplay.  */
   if (!EQ (buffer, obuffer))
     {
@@ -4028,22 +3852,6 @@ buffer.  */)
   if (n_beg == n_end && !NILP (Foverlay_get (overlay, Qevaporate)))
     return unbind_to (count, Fdelete_overlay (overlay));
 
-  /* Put the overlay into the new buffer's overlay lists, first on the
-     wrong list.  */
-  if (n_end < b->overlay_center)
-    {
-      XOVERLAY (overlay)->next = b->overlays_after;
-      set_buffer_overlays_after (b, XOVERLAY (overlay));
-    }
-  else
-    {
-      XOVERLAY (overlay)->next = b->overlays_before;
-      set_buffer_overlays_before (b, XOVERLAY (overlay));
-    }
-
-  /* This puts it in the right list, and in the right order.  */
-  recenter_overlay_lists (b, b->overlay_center);
-
   return unbind_to (count, overlay);
 }
 
@@ -4064,7 +3872,7 @@ DEFUN ("delete-overlay", Fdelete_overlay, Sdelete_overlay, 1, 1, 0,
   b = XBUFFER (buffer);
   specbind (Qinhibit_quit, Qt);
 
-  unchain_both (b, overlay);
+  overlay_tree_remove (b, XOVERLAY (overlay));
   drop_overlay (b, XOVERLAY (overlay));
 
   /* When deleting an overlay with before or after strings, turn off
@@ -4279,44 +4087,37 @@ the value is (point-min).  */)
 
 DEFUN ("overlay-lists", Foverlay_lists, Soverlay_lists, 0, 0, 0,
        doc: /* Return a pair of lists giving all the overlays of the current buffer.
-The car has all the overlays before the overlay center;
-the cdr has all the overlays after the overlay center.
-Recentering overlays moves overlays between these lists.
+The car has all the overlays of the buffer, in order of their start
+positions; the cdr is always nil.  Overlays used to be kept in two lists,
+on either side of an overlay center; code that looks at both lists
+keeps working.
 The lists you get are copies, so that changing them has no effect.
 However, the overlays you get are the real objects that the buffer uses.  */)
   (void)
 {
-  struct Lisp_Overlay *ol;
-  Lisp_Object before = Qnil, after = Qnil, tmp;
+  struct overlay_node *node;
+  Lisp_Object overlays = Qnil, tmp;
 
-  for (ol = current_buffer->overlays_before; ol; ol = ol->next)
-    {
-      XSETMISC (tmp, ol);
-      before = Fcons (tmp, before);
-    }
-  for (ol = current_buffer->overlays_after; ol; ol = ol->next)
+  for (node = overlay_tree_first (current_buffer, PTRDIFF_MIN, PTRDIFF_MAX);
+       node; node = overlay_tree_next (node, PTRDIFF_MIN, PTRDIFF_MAX))
     {
-      XSETMISC (tmp, ol);
-      after = Fcons (tmp, after);
+      XSETMISC (tmp, node->overlay);
+      overlays = Fcons (tmp, overlays);
     }
 
-  return Fcons (Fnreverse (before), Fnreverse (after));
+  return Fcons (Fnreverse (overlays), Qnil);
 }
 
 DEFUN ("overlay-recenter", Foverlay_recenter, Soverlay_recenter, 1, 1, 0,
-       doc: /* Recenter the overlays of the current buffer around position POS.
-That makes overlay lookup faster for positions near POS (but perhaps slower
-for positions far away from POS).  */)
+       doc: /* Do nothing; formerly, recenter the overlays around position POS.
+Overlays are now kept in a balanced tree, so lookup is equally fast at
+every position.  */)
   (Lisp_Object pos)
 {
-  ptrdiff_t p;
   CHECK_NUMBER_COERCE_MARKER (pos);
-
-  p = clip_to_bounds (PTRDIFF_MIN, XINT (pos), PTRDIFF_MAX);
-  recenter_overlay_lists (current_buffer, p);
   return Qnil;
 }
-
+
 DEFUN ("overlay-get", Foverlay_get, Soverlay_get, 2, 2, 0,
        doc: /* Get the property of overlay OVERLAY with property name PROP.  */)
   (Lisp_Object overlay, Lisp_Object prop)
@@ -4418,13 +4219,12 @@ report_overlay_modification (Lisp_Object start, Lisp_Object end, bool after,
 			     Lisp_Object arg1, Lisp_Object arg2, Lisp_Object arg3)
 {
   Lisp_Object prop, overlay;
-  struct Lisp_Overlay *tail;
+  struct overlay_node *node;
   /* True if this change is an insertion.  */
   bool insertion = (after ? XFASTINT (arg3) == 0 : EQ (start, end));
   struct gcpro gcpro1, gcpro2, gcpro3, gcpro4;
 
   overlay = Qnil;
-  tail = NULL;
 
   /* We used to run the functions as soon as we found them and only register
      them in last_overlay_modification_hooks for the purpose of the `after'
@@ -4439,56 +4239,16 @@ report_overlay_modification (Lisp_Object start, Lisp_Object end, bool after,
       /* We are being called before a change.
 	 Scan the overlays to find the functions to call.  */
       last_overlay_modification_hooks_used = 0;
-      for (tail = current_buffer->overlays_before; tail; tail = tail->next)
-	{
-	  ptrdiff_t startpos, endpos;
-	  Lisp_Object ostart, oend;
-
-	  XSETMISC (overlay, tail);
-
-	  ostart = OVERLAY_START (overlay);
-	  oend = OVERLAY_END (overlay);
-	  endpos = OVERLAY_POSITION (oend);
-	  if (XFASTINT (start) > endpos)
-	    break;
-	  startpos = OVERLAY_POSITION (ostart);
-	  if (insertion && (XFASTINT (start) == startpos
-			    || XFASTINT (end) == startpos))
-	    {
-	      prop = Foverlay_get (overlay, Qinsert_in_front_hooks);
-	      if (!NILP (prop))
-		add_overlay_mod_hooklist (prop, overlay);
-	    }
-	  if (insertion && (XFASTINT (start) == endpos
-			    || XFASTINT (end) == endpos))
-	    {
-	      prop = Foverlay_get (overlay, Qinsert_behind_hooks);
-	      if (!NILP (prop))
-		add_overlay_mod_hooklist (prop, overlay);
-	    }
-	  /* Test for intersecting intervals.  This does the right thing
-	     for both insertion and deletion.  */
-	  if (XFASTINT (end) > startpos && XFASTINT (start) < endpos)
-	    {
-	      prop = Foverlay_get (overlay, Qmodification_hooks);
-	      if (!NILP (prop))
-		add_overlay_mod_hooklist (prop, overlay);
-	    }
-	}
-
-      for (tail = current_buffer->overlays_after; tail; tail = tail->next)
+      for (node = overlay_tree_first (current_buffer,
+				      XFASTINT (start), XFASTINT (end));
+	   node;
+	   node = overlay_tree_next (node, XFASTINT (start), XFASTINT (end)))
 	{
 	  ptrdiff_t startpos, endpos;
-	  Lisp_Object ostart, oend;
-
-	  XSETMISC (overlay, tail);
 
-	  ostart = OVERLAY_START (overlay);
-	  oend = OVERLAY_END (overlay);
-	  startpos = OVERLAY_POSITION (ostart);
-	  endpos = OVERLAY_POSITION (oend);
-	  if (XFASTINT (end) < startpos)
-	    break;
+	  XSETMISC (overlay, node->overlay);
+	  startpos = overlay_start_pos (node->overlay);
+	  endpos = overlay_end_pos (node->overlay);
 	  if (insertion && (XFASTINT (start) == startpos
 			    || XFASTINT (end) == startpos))
 	    {
@@ -4566,31 +4326,16 @@ void
 evaporate_overlays (ptrdiff_t pos)
 {
   Lisp_Object overlay, hit_list;
-  struct Lisp_Overlay *tail;
+  struct overlay_node *node;
 
   hit_list = Qnil;
-  if (pos <= current_buffer->overlay_center)
-    for (tail = current_buffer->overlays_before; tail; tail = tail->next)
+  for (node = overlay_tree_first (current_buffer, pos, pos); node;
+       node = overlay_tree_next (node, pos, pos))
+    if (overlay_start_pos (node->overlay) == pos
+	&& overlay_end_pos (node->overlay) == pos)
       {
-	ptrdiff_t endpos;
-	XSETMISC (overlay, tail);
-	endpos = OVERLAY_POSITION (OVERLAY_END (overlay));
-	if (endpos < pos)
-	  break;
-	if (endpos == pos && OVERLAY_POSITION (OVERLAY_START (overlay)) == pos
-	    && ! NILP (Foverlay_get (overlay, Qevaporate)))
-	  hit_list = Fcons (overlay, hit_list);
-      }
-  else
-    for (tail = current_buffer->overlays_after; tail; tail = tail->next)
-      {
-	ptrdiff_t startpos;
-	XSETMISC (overlay, tail);
-	startpos = OVERLAY_POSITION (OVERLAY_START (overlay));
-	if (startpos > pos)
-	  break;
-	if (startpos == pos && OVERLAY_POSITION (OVERLAY_END (overlay)) == pos
-	    && ! NILP (Foverlay_get (overlay, Qevaporate)))
+	XSETMISC (overlay, node->overlay);
+	if (! NILP (Foverlay_get (overlay, Qevaporate)))
 	  hit_list = Fcons (overlay, hit_list);
       }
   for (; CONSP (hit_list); hit_list = XCDR (hit_list))
@@ -4962,6 +4707,96 @@ mmap_realloc (void **var, size_t nbytes)
 			    Buffer-text Allocation
  ***********************************************************************/
 
+#ifdef MMAP_LARGE_BUFFER_TEXT
+
+#include <sys/mman.h>
+
+#if !defined MAP_ANON && defined MAP_ANONYMOUS
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+
+/* The text of large buffers gets an mmap region of its own, so that
+   killing the buffer or shrinking its gap gives the memory back to
+   the system.  Freed into malloc, it would stay in the heap.  Text
+   moves into a region once it needs MMAP_TEXT_THRESHOLD bytes, and
+   back into malloc only once it needs less than half as many, so
+   that a buffer near the threshold does not move back and forth.  */
+
+enum { MMAP_TEXT_THRESHOLD = 64 * 1024 };
+
+static ptrdiff_t text_page_size;
+
+/* Map a region of at least NBYTES bytes for buffer text.  Return
+   the region, or NULL if it cannot be mapped, and store its size in
+   *MAPPED.  */
+
+static unsigned char *
+map_text (ptrdiff_t nbytes, ptrdiff_t *mapped)
+{
+  void *p;
+
+  if (!text_page_size)
+    text_page_size = getpagesize ();
+  *mapped = (nbytes + text_page_size - 1) / text_page_size * text_page_size;
+  p = mmap (NULL, *mapped, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,
+	    -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+/* Resize the text buffer of B from OLD_NBYTES to NBYTES bytes, moving
+   it into or out of a region of its own as needed.  Return the new
+   text buffer, or NULL if there is no memory for it.  */
+
+static unsigned char *
+resize_text (struct buffer *b, ptrdiff_t old_nbytes, ptrdiff_t nbytes)
+{
+  ptrdiff_t mapped = b->text->mapped, new_mapped = 0;
+  unsigned char *p;
+
+  if (!mapped && (nbytes < MMAP_TEXT_THRESHOLD || !initialized))
+    return xrealloc (b->text->beg, nbytes);
+
+  if (mapped && nbytes >= MMAP_TEXT_THRESHOLD / 2)
+    {
+      ptrdiff_t size = ((nbytes + text_page_size - 1)
+			/ text_page_size * text_page_size);
+
+      if (size <= mapped)
+	{
+	  /* Give the pages that are no longer needed back.  */
+	  if (size < mapped)
+	    munmap (b->text->beg + size, mapped - size);
+	  b->text->mapped = size;
+	  return b->text->beg;
+	}
+#ifdef MREMAP_MAYMOVE
+      p = mremap (b->text->beg, mapped, size, MREMAP_MAYMOVE);
+      if (p == MAP_FAILED)
+	return NULL;
+      b->text->mapped = size;
+      return p;
+#endif
+    }
+
+  if (nbytes >= MMAP_TEXT_THRESHOLD / 2 && (mapped || initialized))
+    {
+      p = map_text (nbytes, &new_mapped);
+      if (!p)
+	return NULL;
+    }
+  else
+    p = xmalloc (nbytes);
+  memcpy (p, b->text->beg, min (old_nbytes, nbytes));
+  if (mapped)
+    munmap (b->text->beg, mapped);
+  else
+    xfree (b->text->beg);
+  b->text->mapped = new_mapped;
+  return p;
+}
+
+#endif /* MMAP_LARGE_BUFFER_TEXT */
+
 /* Allocate NBYTES bytes for buffer B's text buffer.  */
 
 static void
@@ -4975,7 +4810,14 @@ alloc_buffer_text (struct buffer *b, ptrdiff_t nbytes)
 #elif defined REL_ALLOC
   p = r_alloc ((void **) &b->text->beg, nbytes);
 #else
-  p = xmalloc (nbytes);
+  b->text->mapped = 0;
+# ifdef MMAP_LARGE_BUFFER_TEXT
+  /* Text allocated before dumping must be in the dumped heap.  */
+  if (nbytes >= MMAP_TEXT_THRESHOLD && initialized)
+    p = map_text (nbytes, &b->text->mapped);
+  else
+# endif
+    p = xmalloc (nbytes);
 #endif
 
   if (p == NULL)
@@ -5002,6 +4844,8 @@ enlarge_buffer_text (struct buffer *b, ptrdiff_t delta)
   p = mmap_realloc ((void **) &b->text->beg, nbytes);
 #elif defined REL_ALLOC
   p = r_re_alloc ((void **) &b->text->beg, nbytes);
+#elif defined MMAP_LARGE_BUFFER_TEXT
+  p = resize_text (b, nbytes - delta, nbytes);
 #else
   p = xrealloc (b->text->beg, nbytes);
 #endif
@@ -5029,13 +4873,210 @@ free_buffer_text (struct buffer *b)
 #elif defined REL_ALLOC
   r_alloc_free ((void **) &b->text->beg);
 #else
-  xfree (b->text->beg);
+  if (b->text->mapped)
+    {
+# ifdef MMAP_LARGE_BUFFER_TEXT
+      munmap (b->text->beg, b->text->mapped);
+# endif
+      b->text->mapped = 0;
+    }
+  else
+    xfree (b->text->beg);
 #endif
 
   BUF_BEG_ADDR (b) = NULL;
   unblock_input ();
 }
 
+/* Statistics about compressed buffer text; see
+   `buffer-compression-counts'.  */
+
+static EMACS_INT compressed_buffers;
+static EMACS_INT compressed_text_bytes, compressed_data_bytes;
+static EMACS_INT buffer_uncompressions;
+
+/* Don't compress the text of buffers smaller than this.  */
+
+enum { COMPRESS_MIN_BYTES = 4096 };
+
+/* Return the number of bytes in buffer B's text buffer.  */
+
+static ptrdiff_t
+buffer_text_bytes (struct buffer *b)
+{
+  return BUF_Z_BYTE (b) - BUF_BEG_BYTE (b) + BUF_GAP_SIZE (b) + 1;
+}
+
+/* Compress the text of buffer B and free its text buffer.  Return
+   false and leave B alone if zlib is not available or the text does
+   not compress well.  */
+
+static bool
+compress_buffer_text (struct buffer *b)
+{
+#ifdef HAVE_ZLIB
+  ptrdiff_t nbytes = buffer_text_bytes (b);
+  ptrdiff_t size;
+  unsigned char *data;
+
+#ifdef REL_ALLOC
+  r_alloc_inhibit_buffer_relocation (1);
+#endif
+  data = zlib_compress_text (BUF_BEG_ADDR (b),
+			     BUF_GPT_BYTE (b) - BUF_BEG_BYTE (b),
+			     BUF_GAP_END_ADDR (b),
+			     BUF_Z_BYTE (b) - BUF_GPT_BYTE (b),
+			     nbytes - nbytes / 4, &size);
+#ifdef REL_ALLOC
+  r_alloc_inhibit_buffer_relocation (0);
+#endif
+  if (!data)
+    return false;
+
+  free_buffer_text (b);
+  b->text->compressed = xrealloc (data, size);
+  b->text->compressed_size = size;
+  compressed_buffers++;
+  compressed_text_bytes += nbytes;
+  compressed_data_bytes += size;
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* Free the compressed text of buffer B.  */
+
+static void
+free_compressed_text (struct buffer *b)
+{
+  compressed_buffers--;
+  compressed_text_bytes -= buffer_text_bytes (b);
+  compressed_data_bytes -= b->text->compressed_size;
+  xfree (b->text->compressed);
+  b->text->compressed = NULL;
+  b->text->compressed_size = 0;
+}
+
+/* Give buffer B, whose text is compressed, a text buffer again and
+   uncompress the text into it.  */
+
+void
+uncompress_buffer_text (struct buffer *b)
+{
+#ifdef HAVE_ZLIB
+  bool ok;
+
+  alloc_buffer_text (b, buffer_text_bytes (b));
+#ifdef REL_ALLOC
+  r_alloc_inhibit_buffer_relocation (1);
+#endif
+  ok = zlib_uncompress_text (b->text->compressed, b->text->compressed_size,
+			     BUF_BEG_ADDR (b),
+			     BUF_GPT_BYTE (b) - BUF_BEG_BYTE (b),
+			     BUF_GAP_END_ADDR (b),
+			     BUF_Z_BYTE (b) - BUF_GPT_BYTE (b));
+#ifdef REL_ALLOC
+  r_alloc_inhibit_buffer_relocation (0);
+#endif
+  if (!ok)
+    {
+      free_buffer_text (b);
+      error ("Cannot uncompress the text of buffer %s",
+	     SDATA (BVAR (b, name)));
+    }
+
+  /* Put the anchors back.  */
+  if (BUF_GAP_SIZE (b) > 0)
+    *(BUF_GPT_ADDR (b)) = 0;
+  *(BUF_Z_ADDR (b)) = 0;
+
+  free_compressed_text (b);
+  b->text->used = true;
+  buffer_uncompressions++;
+#else
+  emacs_abort ();
+#endif
+}
+
+DEFUN ("compress-idle-buffers", Fcompress_idle_buffers,
+       Scompress_idle_buffers, 1, 1, 0,
+       doc: /* Compress the text of buffers idle for SECONDS seconds or more.
+A buffer is idle while it is not current and no window displays it.
+Its idle time counts from the first call to this function that finds
+it idle, so call this function periodically, as `buffer-compression-mode'
+does.  Buffers that share their text with indirect buffers, small
+buffers and buffers whose text does not compress well are left alone.
+
+Compressing a buffer frees the memory of its text, and using the
+buffer in any way that needs the text uncompresses it again.  This
+works only if Emacs was built with zlib.
+
+Return the number of buffers this call compressed.  */)
+  (Lisp_Object seconds)
+{
+  struct buffer *b;
+  time_t now = time (NULL);
+  double limit;
+  EMACS_INT n = 0;
+
+  CHECK_NUMBER_OR_FLOAT (seconds);
+  limit = XFLOATINT (seconds);
+
+  FOR_EACH_BUFFER (b)
+    {
+      struct buffer_text *text = b->text;
+
+      if (!BUFFER_LIVE_P (b))
+	continue;
+      if (text->used || b == current_buffer || b->window_count > 0)
+	{
+	  text->used = false;
+	  text->idle_since = now;
+	}
+      else if (!text->compressed && !b->base_buffer && b->indirections == 0
+	       && !text->inhibit_shrinking
+	       && BUF_Z_BYTE (b) - BUF_BEG_BYTE (b) >= COMPRESS_MIN_BYTES
+	       && difftime (now, text->idle_since) >= limit)
+	{
+	  if (compress_buffer_text (b))
+	    n++;
+	  else
+	    /* Don't try again until the text has been idle once more.  */
+	    text->idle_since = now;
+	}
+    }
+  return make_number (n);
+}
+
+DEFUN ("buffer-text-compressed-p", Fbuffer_text_compressed_p,
+       Sbuffer_text_compressed_p, 0, 1, 0,
+       doc: /* Return t if the text of BUFFER is compressed now.
+BUFFER defaults to the current buffer.  This does not uncompress the
+text.  See `compress-idle-buffers'.  */)
+  (Lisp_Object buffer)
+{
+  return decode_buffer (buffer)->text->compressed ? Qt : Qnil;
+}
+
+DEFUN ("buffer-compression-counts", Fbuffer_compression_counts,
+       Sbuffer_compression_counts, 0, 0, 0,
+       doc: /* Return a list of counters that describe compressed buffer text.
+The elements of the value are as follows:
+  (BUFFERS TEXT-BYTES COMPRESSED-BYTES UNCOMPRESSIONS)
+BUFFERS is the number of buffers whose text is compressed, TEXT-BYTES
+the memory their text would take uncompressed, including the gaps,
+and COMPRESSED-BYTES the memory it takes compressed.  UNCOMPRESSIONS
+counts the times the text of a buffer was uncompressed for use.
+See `compress-idle-buffers'.  */)
+  (void)
+{
+  return list4 (make_number (compressed_buffers),
+		make_fixnum_or_float (compressed_text_bytes),
+		make_fixnum_or_float (compressed_data_bytes),
+		make_fixnum_or_float (buffer_uncompressions));
+}
+
 
 
 /***********************************************************************
@@ -5092,9 +5133,7 @@ init_buffer_once (void)
   bset_mark_active (&buffer_defaults, Qnil);
   bset_file_format (&buffer_defaults, Qnil);
   bset_auto_save_file_format (&buffer_defaults, Qt);
-  set_buffer_overlays_before (&buffer_defaults, NULL);
-  set_buffer_overlays_after (&buffer_defaults, NULL);
-  buffer_defaults.overlay_center = BEG;
+  buffer_defaults.overlays = NULL;
 
   XSETFASTINT (BVAR (&buffer_defaults, tab_width), 8);
   bset_truncate_lines (&buffer_defaults, Qnil);
@@ -6115,6 +6154,9 @@ this change.
 An entry (MARKER . DISTANCE) indicates that the marker MARKER
 was adjusted in position by the offset DISTANCE (an integer).
 
+An entry (apply undo-packed-changes DATA OBJECTS) stands for the
+entries of a command that made many changes; see `undo-pack-threshold'.
+
 An entry of the form POSITION indicates that point was at the buffer
 location given by the integer.  Undoing an entry of this form places
 point at POSITION.
@@ -6318,6 +6360,9 @@ Functions running this hook are, `get-buffer-create',
   defsubr (&Sbarf_if_buffer_read_only);
   defsubr (&Serase_buffer);
   defsubr (&Sbuffer_swap_text);
+  defsubr (&Scompress_idle_buffers);
+  defsubr (&Sbuffer_text_compressed_p);
+  defsubr (&Sbuffer_compression_counts);
   defsubr (&Sset_buffer_multibyte);
   defsubr (&Skill_all_local_variables);
 
@@ -23,6 +23,13 @@ along with GNU Emacs.  If not, see <http://www.gnu.org/licenses/>.  */
 
 INLINE_HEADER_BEGIN
 
+/* Define this if the text of large buffers gets an mmap region of its
+   own, so that freeing it or shrinking its gap gives the memory back
+   to the system; see alloc_buffer_text in buffer.c.  */
+#if !defined USE_MMAP_FOR_BUFFERS && !defined REL_ALLOC && defined HAVE_MMAP
+# define MMAP_LARGE_BUFFER_TEXT
+#endif
+
 /* Accessing the parameters of the current buffer.  */
 
 /* These macros come in pairs, one for the char position
@@ -186,8 +193,13 @@ INLINE_HEADER_BEGIN
 /* Compaction count.  */
 #define BUF_COMPACT(buf) ((buf)->text->compact)
 
-/* Marker chain of buffer.  */
-#define BUF_MARKERS(buf) ((buf)->text->markers)
+/* Marker tree of buffer for markers of insertion type TYPE.  */
+#define BUF_MARKERS(buf, type) ((buf)->text->markers[type])
+
+/* Loop over all the markers of buffer B, binding M to each in turn.
+   The markers must not be moved, added or removed within the loop.  */
+#define FOR_EACH_MARKER(b, m) \
+  for ((m) = first_marker (b); (m); (m) = next_marker (b, m))
 
 #define BUF_UNCHANGED_MODIFIED(buf) \
   ((buf)->text->unchanged_modified)
@@ -321,6 +333,12 @@ extern void enlarge_buffer_text (struct buffer *, ptrdiff_t);
 
 #define GAP_BYTES_MIN 20
 
+/* Making the gap larger or smaller moves all the text after it, so a
+   buffer keeps, on top of the above, up to twice this fraction of its
+   size as a gap, and gets that much more when the gap fills up.  */
+
+#define GAP_FRACTION 64
+
 /* Return the address of byte position N in current buffer.  */
 
 #define BYTE_POS_ADDR(n) \
@@ -413,6 +431,24 @@ extern void enlarge_buffer_text (struct buffer *, ptrdiff_t);
 
 /* Define the actual buffer data structures.  */
 
+/* A known correspondence between a character position and a byte
+   position in a buffer's text.  */
+
+struct position_checkpoint
+  {
+    ptrdiff_t charpos;
+    ptrdiff_t bytepos;
+  };
+
+/* The number of newlines before a byte position in a buffer's
+   text.  */
+
+struct line_checkpoint
+  {
+    ptrdiff_t bytepos;
+    ptrdiff_t lines;
+  };
+
 /* This data structure describes the actual text contents of a buffer.
    It is shared between indirect buffers and their base buffer.  */
 
@@ -464,19 +500,63 @@ struct buffer_text
     INTERVAL intervals;
 
     /* The markers that refer to this buffer.
-       This is actually a single marker ---
-       successive elements in its marker `chain'
-       are the other markers referring to this buffer.
-       This is a singly linked unordered list, which means that it's
-       very cheap to add a marker to the list and it's also very cheap
-       to move a marker within a buffer.  */
-    struct Lisp_Marker *markers;
+       These are the roots of two balanced trees of markers ordered
+       by position, indexed by insertion type; see `marker.c'.
+       Finding, adding and removing a marker takes logarithmic time,
+       and so does relocating all the markers for an insertion or
+       deletion.  */
+    struct Lisp_Marker *markers[2];
+
+    /* Checkpoints of the correspondence between character and byte
+       positions, ordered by position; see `marker.c'.  Like the text,
+       the vector has a gap: the checkpoints before it are at or
+       before GPT and record positions, and those after it are at or
+       after GPT and record positions relative to Z, so that editing
+       at the gap leaves them all valid.  */
+    struct position_checkpoint *checkpoints;
+
+    /* Allocated size of CHECKPOINTS, and the bounds of its gap.  */
+    ptrdiff_t checkpoints_size;
+    ptrdiff_t checkpoints_gap;
+    ptrdiff_t checkpoints_gap_end;
+
+    /* Number of newlines in the text, or -1 if they have not been
+       counted.  Once they have, LINE_CHECKPOINTS records the number
+       of newlines before some byte positions; see `search.c'.  It is
+       ordered and has a gap like CHECKPOINTS, except that the
+       checkpoints after its gap record their number of newlines
+       relative to NEWLINES too.  */
+    ptrdiff_t newlines;
+    struct line_checkpoint *line_checkpoints;
+
+    /* Allocated size of LINE_CHECKPOINTS, and the bounds of its gap.  */
+    ptrdiff_t line_checkpoints_size;
+    ptrdiff_t line_checkpoints_gap;
+    ptrdiff_t line_checkpoints_gap_end;
+
+    /* If nonzero, BEG is an mmap region of this many bytes of its
+       own, which the text does not share with anything else.  */
+    ptrdiff_t mapped;
+
+    /* If non-NULL, `compress-idle-buffers' has compressed the text
+       into these COMPRESSED_SIZE bytes and freed BEG, which is NULL.
+       The gap keeps its position and size.  */
+    unsigned char *compressed;
+    ptrdiff_t compressed_size;
+
+    /* The time at which `compress-idle-buffers' last found that the
+       text had been used.  */
+    time_t idle_since;
 
     /* Usually false.  Temporarily true in decode_coding_gap to
        prevent Fgarbage_collect from shrinking the gap and losing
        not-yet-decoded bytes.  */
     bool_bf inhibit_shrinking : 1;
 
+    /* True if the buffer has been current since `compress-idle-buffers'
+       last looked at it.  */
+    bool_bf used : 1;
+
     /* True if it needs to be redisplayed.  */
     bool_bf redisplay : 1;
   };
@@ -856,16 +936,9 @@ struct buffer
   /* Non-zero whenever the narrowing is changed in this buffer.  */
   bool_bf clip_changed : 1;
 
-  /* List of overlays that end at or before the current center,
-     in order of end-position.  */
-  struct Lisp_Overlay *overlays_before;
-
-  /* List of overlays that end after  the current center,
-     in order of start-position.  */
-  struct Lisp_Overlay *overlays_after;
-
-  /* Position where the overlay lists are centered.  */
-  ptrdiff_t overlay_center;
+  /* Root of the balanced tree of this buffer's overlays, or NULL if
+     there are none.  See struct overlay_node.  */
+  struct overlay_node *overlays;
 
   /* Changes in the buffer are recorded here for undo, and t means
      don't record anything.  This information belongs to the base
@@ -1076,17 +1149,20 @@ extern void evaporate_overlays (ptrdiff_t);
 extern ptrdiff_t overlays_at (EMACS_INT, bool, Lisp_Object **,
 			      ptrdiff_t *, ptrdiff_t *, ptrdiff_t *, bool);
 extern ptrdiff_t sort_overlays (Lisp_Object *, ptrdiff_t, struct window *);
-extern void recenter_overlay_lists (struct buffer *, ptrdiff_t);
+extern struct overlay_node *overlay_tree_first (struct buffer *,
+					       ptrdiff_t, ptrdiff_t);
+extern struct overlay_node *overlay_tree_next (struct overlay_node *,
+					      ptrdiff_t, ptrdiff_t);
 extern ptrdiff_t overlay_strings (ptrdiff_t, struct window *, unsigned char **);
 extern void validate_region (Lisp_Object *, Lisp_Object *);
 extern void set_buffer_internal_1 (struct buffer *);
 extern void set_buffer_temp (struct buffer *);
 extern Lisp_Object buffer_local_value (Lisp_Object, Lisp_Object);
 extern void record_buffer (Lisp_Object);
-extern void fix_overlays_before (struct buffer *, ptrdiff_t, ptrdiff_t);
 extern void mmap_set_vars (bool);
 extern void restore_buffer (Lisp_Object);
 extern void set_buffer_if_live (Lisp_Object);
+extern void uncompress_buffer_text (struct buffer *);
 
 /* Return B as a struct buffer pointer, defaulting to the current buffer.  */
 
@@ -1112,6 +1188,18 @@ set_buffer_internal (struct buffer *b)
     set_buffer_internal_1 (b);
 }
 
+/* Make the text of buffer B accessible, uncompressing it if
+   `compress-idle-buffers' compressed it.  Code that accesses the
+   text of a buffer other than the current buffer must call this
+   first.  */
+
+INLINE void
+ensure_buffer_text (struct buffer *b)
+{
+  if (b->text->compressed)
+    uncompress_buffer_text (b);
+}
+
 /* Arrange to go back to the original buffer after the next
    call to unbind_to if the original buffer is still alive.  */
 
@@ -1177,7 +1265,7 @@ set_buffer_intervals (struct buffer *b, INTERVAL i)
 INLINE bool
 buffer_has_overlays (void)
 {
-  return current_buffer->overlays_before || current_buffer->overlays_after;
+  return current_buffer->overlays != NULL;
 }
 
 /* Return character code of multi-byte form at byte position POS.  If POS
@@ -1246,6 +1334,35 @@ buffer_window_count (struct buffer *b)
 #define OVERLAY_POSITION(P) \
  (MARKERP (P) ? marker_position (P) : (emacs_abort (), 0))
 
+/* A node of the tree that holds the overlays of a buffer.
+
+   The tree is an AVL tree ordered by the start position of each
+   overlay; overlays starting at the same position are ordered so that
+   those whose start marker does not advance on insertion come first.
+   Each node also records the overlay that ends last in its subtree,
+   with the same tie-breaking rule for the end markers, so searches
+   can skip subtrees that end before the region of interest.
+
+   Positions are read from the overlay's markers, so the tree follows
+   insertions and deletions without any adjustment: neither can change
+   the relative order of two markers.  Only when markers collapse onto
+   the same position, or are permuted, must the affected overlays be
+   reinserted; see fix_start_end_in_overlays.  */
+
+struct overlay_node
+{
+  struct overlay_node *parent, *left, *right;
+
+  /* The overlay held by this node.  */
+  struct Lisp_Overlay *overlay;
+
+  /* The overlay that ends last in the subtree rooted at this node.  */
+  struct Lisp_Overlay *max_end;
+
+  /* Height of the subtree rooted at this node; a leaf has height 1.  */
+  int height;
+};
+
 
 /***********************************************************************
 			Buffer-local Variables
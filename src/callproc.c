@@ -979,6 +979,7 @@ create_temp_file (ptrdiff_t nargs, Lisp_Object *args,
 #endif
 
     filename_string = Fcopy_sequence (ENCODE_FILE (pattern));
+    unshare_string_data (filename_string);
     GCPRO1 (filename_string);
     tempfile = SSDATA (filename_string);
 
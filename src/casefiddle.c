@@ -88,6 +88,7 @@ casify_object (enum case_action flag, Lisp_Object obj)
       ptrdiff_t size = SCHARS (obj);
 
       obj = Fcopy_sequence (obj);
+      unshare_string_data (obj);
       for (i = 0; i < size; i++)
 	{
 	  c = SREF (obj, i);
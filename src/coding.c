@@ -286,6 +286,11 @@ encode_coding_XXX (struct coding_system *coding)
 #include <config.h>
 #include <stdio.h>
 
+#include <count-trailing-zeros.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #ifdef HAVE_WCHAR_H
 #include <wchar.h>
 #endif /* HAVE_WCHAR_H */
@@ -987,6 +992,7 @@ coding_set_source (struct coding_system *coding)
     {
       struct buffer *buf = XBUFFER (coding->src_object);
 
+      ensure_buffer_text (buf);
       if (coding->src_pos < 0)
 	coding->source = BUF_GAP_END_ADDR (buf) + coding->src_pos_byte;
       else
@@ -1176,6 +1182,52 @@ alloc_destination (struct coding_system *coding, ptrdiff_t nbytes,
 #define EOL_SEEN_CR	2
 #define EOL_SEEN_CRLF	4
 
+/* Return the number of bytes at the start of the LEN bytes at P that
+   are ASCII characters other than control characters.  Detecting a
+   coding system, or checking that text is ASCII or UTF-8, need do
+   nothing with those but count them, so long runs of them are
+   skipped 16 bytes at a time with SSE2, or a word at a time.  */
+
+static ptrdiff_t
+skip_plain_ascii (const unsigned char *p, ptrdiff_t len)
+{
+  const unsigned char *start = p;
+
+#ifdef __SSE2__
+  __m128i limit = _mm_set1_epi8 (0x1F);
+
+  for (; len >= 16; p += 16, len -= 16)
+    {
+      /* As signed chars, just the bytes from 0x20 to 0x7F are greater
+	 than 0x1F.  */
+      int mask = _mm_movemask_epi8
+	(_mm_cmpgt_epi8 (_mm_loadu_si128 ((__m128i const *) p), limit));
+
+      if (mask != 0xFFFF)
+	return p - start + count_trailing_zeros (~mask);
+    }
+#else
+  unsigned long ones = ULONG_MAX / UCHAR_MAX;
+  unsigned long highs = ones << (CHAR_BIT - 1);
+
+  for (; len >= (ptrdiff_t) sizeof ones; p += sizeof ones, len -= sizeof ones)
+    {
+      unsigned long w;
+
+      memcpy (&w, p, sizeof w);
+      /* A byte of W at 0x80 or above sets its own high bit, and the
+	 first one below 0x20 borrows in the subtraction and sets its
+	 high bit there.  */
+      if ((w | (w - ones * 0x20)) & highs)
+	break;
+    }
+#endif
+
+  for (; len > 0 && 0x20 <= *p && *p < 0x80; p++, len--)
+    continue;
+  return p - start;
+}
+
 
 /*** 2. Emacs' internal format (emacs-utf-8) ***/
 
@@ -1232,6 +1284,13 @@ detect_coding_utf_8 (struct coding_system *coding,
     {
       int c, c1, c2, c3, c4;
 
+      if (! multibytep)
+	{
+	  ptrdiff_t plain = skip_plain_ascii (src, src_end - src);
+
+	  src += plain;
+	  nchars += plain;
+	}
       src_base = src;
       ONE_MORE_BYTE (c);
       if (c < 0 || UTF_8_1_OCTET_P (c))
@@ -6227,7 +6286,8 @@ check_ascii (struct coding_system *coding)
       || SYMBOLP (eol_type))
     {
       /* We don't have to check EOL format.  */
-      while (src < end && !( *src & 0x80))
+      while (src += skip_plain_ascii (src, end - src),
+	     src < end && !( *src & 0x80))
 	{
 	  if (*src++ == '\n')
 	    eol_seen |= EOL_SEEN_LF;
@@ -6236,7 +6296,7 @@ check_ascii (struct coding_system *coding)
   else
     {
       end--;		    /* We look ahead one byte for "CR LF".  */
-      while (src < end)
+      while (src += skip_plain_ascii (src, end - src), src < end)
 	{
 	  int c = *src;
 
@@ -6301,8 +6361,14 @@ check_utf_8 (struct coding_system *coding)
   eol_seen = coding->eol_seen;
   while (src < end)
     {
-      int c = *src;
+      int c;
+      ptrdiff_t plain = skip_plain_ascii (src, end - src);
 
+      src += plain;
+      nchars += plain;
+      if (src == end)
+	break;
+      c = *src;
       if (UTF_8_1_OCTET_P (*src))
 	{
 	  src++;
@@ -6546,6 +6612,16 @@ detect_coding (struct coding_system *coding)
       detect_info.checked = detect_info.found = detect_info.rejected = 0;
       for (src = coding->source; src < src_end; src++)
 	{
+	  ptrdiff_t plain = skip_plain_ascii (src, src_end - src);
+
+	  if (plain > 0)
+	    {
+	      src += plain;
+	      if (! eight_bit_found)
+		coding->head_ascii += plain;
+	      if (src == src_end)
+		break;
+	    }
 	  c = *src;
 	  if (c & 0x80)
 	    {
@@ -8012,6 +8088,84 @@ decode_coding_gap (struct coding_system *coding,
 }
 
 
+/* Flag the markers of the current buffer that have to be put back
+   after the text from FROM to TO is replaced by its conversion: those
+   at FROM that would advance over the new text, and the others at TO
+   that would be left before it.  Return true if any were flagged.  */
+
+static bool
+flag_markers_for_conversion (ptrdiff_t from, ptrdiff_t to)
+{
+  struct Lisp_Marker *tail;
+  bool flagged = 0;
+  int type;
+
+  for (type = 0; type < 2; type++)
+    for (tail = marker_tree_first (current_buffer, type, from);
+	 tail && marker_charpos (tail) <= to;
+	 tail = marker_tree_next (tail))
+      {
+	tail->need_adjustment = marker_charpos (tail) == (type ? from : to);
+	flagged |= tail->need_adjustment;
+      }
+  return flagged;
+}
+
+/* Put back the markers flagged by flag_markers_for_conversion, after
+   the text from FROM / FROM_BYTE was replaced by converted text ending
+   at TO / TO_BYTE.  */
+
+static void
+restore_flagged_markers (ptrdiff_t from, ptrdiff_t from_byte,
+			 ptrdiff_t to, ptrdiff_t to_byte)
+{
+  struct Lisp_Marker *vbuf[16];
+  struct Lisp_Marker **vec = vbuf;
+  ptrdiff_t size = ARRAYELTS (vbuf);
+  ptrdiff_t i, n = 0;
+  int type;
+
+  /* Collect the markers first, since moving them changes the marker
+     trees.  The flagged markers have since moved along with the others
+     that were between FROM and TO.  */
+  for (type = 0; type < 2; type++)
+    {
+      ptrdiff_t pos = type ? to : from;
+      struct Lisp_Marker *tail;
+
+      for (tail = marker_tree_first (current_buffer, type, pos);
+	   tail && marker_charpos (tail) == pos;
+	   tail = marker_tree_next (tail))
+	if (tail->need_adjustment)
+	  {
+	    if (n == size)
+	      {
+		if (vec == vbuf)
+		  {
+		    vec = xpalloc (NULL, &size, 1, -1, sizeof *vec);
+		    memcpy (vec, vbuf, sizeof vbuf);
+		  }
+		else
+		  vec = xpalloc (vec, &size, 1, -1, sizeof *vec);
+	      }
+	    vec[n++] = tail;
+	  }
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      vec[i]->need_adjustment = 0;
+      if (vec[i]->insertion_type)
+	attach_marker (vec[i], vec[i]->buffer, from, from_byte);
+      else
+	attach_marker (vec[i], vec[i]->buffer, to, to_byte);
+    }
+
+  if (vec != vbuf)
+    xfree (vec);
+  fix_start_end_in_overlays (from, to);
+}
+
 /* Decode the text in the range FROM/FROM_BYTE and TO/TO_BYTE in
    SRC_OBJECT into DST_OBJECT by coding context CODING.
 
@@ -8083,14 +8237,7 @@ decode_coding_object (struct coding_system *coding,
 	move_gap_both (from, from_byte);
       if (EQ (src_object, dst_object))
 	{
-	  struct Lisp_Marker *tail;
-
-	  for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
-	    {
-	      tail->need_adjustment
-		= tail->charpos == (tail->insertion_type ? from : to);
-	      need_marker_adjustment |= tail->need_adjustment;
-	    }
+	  need_marker_adjustment = flag_markers_for_conversion (from, to);
 	  saved_pt = PT, saved_pt_byte = PT_BYTE;
 	  TEMP_SET_PT_BOTH (from, from_byte);
 	  current_buffer->text->inhibit_shrinking = 1;
@@ -8197,27 +8344,11 @@ decode_coding_object (struct coding_system *coding,
 			  saved_pt_byte + (coding->produced - bytes));
 
       if (need_marker_adjustment)
-	{
-	  struct Lisp_Marker *tail;
-
-	  for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
-	    if (tail->need_adjustment)
-	      {
-		tail->need_adjustment = 0;
-		if (tail->insertion_type)
-		  {
-		    tail->bytepos = from_byte;
-		    tail->charpos = from;
-		  }
-		else
-		  {
-		    tail->bytepos = from_byte + coding->produced;
-		    tail->charpos
-		      = (NILP (BVAR (current_buffer, enable_multibyte_characters))
-			 ? tail->bytepos : from + coding->produced_char);
-		  }
-	      }
-	}
+	restore_flagged_markers
+	  (from, from_byte,
+	   (NILP (BVAR (current_buffer, enable_multibyte_characters))
+	    ? from_byte + coding->produced : from + coding->produced_char),
+	   from_byte + coding->produced);
     }
 
   Vdeactivate_mark = old_deactivate_mark;
@@ -8252,14 +8383,7 @@ encode_coding_object (struct coding_system *coding,
 
   if (EQ (src_object, dst_object))
     {
-      struct Lisp_Marker *tail;
-
-      for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
-	{
-	  tail->need_adjustment
-	    = tail->charpos == (tail->insertion_type ? from : to);
-	  need_marker_adjustment |= tail->need_adjustment;
-	}
+      need_marker_adjustment = flag_markers_for_conversion (from, to);
     }
 
   if (! NILP (CODING_ATTR_PRE_WRITE (attrs)))
@@ -8403,27 +8527,11 @@ encode_coding_object (struct coding_system *coding,
 			  saved_pt_byte + (coding->produced - bytes));
 
       if (need_marker_adjustment)
-	{
-	  struct Lisp_Marker *tail;
-
-	  for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
-	    if (tail->need_adjustment)
-	      {
-		tail->need_adjustment = 0;
-		if (tail->insertion_type)
-		  {
-		    tail->bytepos = from_byte;
-		    tail->charpos = from;
-		  }
-		else
-		  {
-		    tail->bytepos = from_byte + coding->produced;
-		    tail->charpos
-		      = (NILP (BVAR (current_buffer, enable_multibyte_characters))
-			 ? tail->bytepos : from + coding->produced_char);
-		  }
-	      }
-	}
+	restore_flagged_markers
+	  (from, from_byte,
+	   (NILP (BVAR (current_buffer, enable_multibyte_characters))
+	    ? from_byte + coding->produced : from + coding->produced_char),
+	   from_byte + coding->produced);
     }
 
   if (kill_src_buffer)
@@ -2274,6 +2274,7 @@ bool-vector.  IDX starts at 0.  */)
 	args_out_of_range (array, idx);
       CHECK_CHARACTER (newelt);
       c = XFASTINT (newelt);
+      unshare_string_data (array);
 
       if (STRING_MULTIBYTE (array))
 	{
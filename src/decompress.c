@@ -52,6 +52,18 @@ DEF_ZLIB_FN (int, inflate,
 DEF_ZLIB_FN (int, inflateEnd,
 	     (z_streamp strm));
 
+DEF_ZLIB_FN (int, inflateInit_,
+	     (z_streamp strm, const char *version, int stream_size));
+
+DEF_ZLIB_FN (int, deflateInit_,
+	     (z_streamp strm, int level, const char *version, int stream_size));
+
+DEF_ZLIB_FN (int, deflate,
+	     (z_streamp strm, int flush));
+
+DEF_ZLIB_FN (int, deflateEnd,
+	     (z_streamp strm));
+
 static bool zlib_initialized;
 
 static bool
@@ -68,17 +80,29 @@ init_zlib_functions (void)
   LOAD_ZLIB_FN (library, inflateInit2_);
   LOAD_ZLIB_FN (library, inflate);
   LOAD_ZLIB_FN (library, inflateEnd);
+  LOAD_ZLIB_FN (library, inflateInit_);
+  LOAD_ZLIB_FN (library, deflateInit_);
+  LOAD_ZLIB_FN (library, deflate);
+  LOAD_ZLIB_FN (library, deflateEnd);
   return true;
 }
 
 #define fn_inflateInit2(strm, windowBits) \
         fn_inflateInit2_((strm), (windowBits), ZLIB_VERSION, sizeof(z_stream))
+#define fn_inflateInit(strm) \
+        fn_inflateInit_((strm), ZLIB_VERSION, sizeof(z_stream))
+#define fn_deflateInit(strm, level) \
+        fn_deflateInit_((strm), (level), ZLIB_VERSION, sizeof(z_stream))
 
 #else /* !WINDOWSNT */
 
 #define fn_inflateInit2		inflateInit2
 #define fn_inflate		inflate
 #define fn_inflateEnd		inflateEnd
+#define fn_inflateInit		inflateInit
+#define fn_deflateInit		deflateInit
+#define fn_deflate		deflate
+#define fn_deflateEnd		deflateEnd
 
 #endif	/* WINDOWSNT */
 
@@ -217,6 +241,116 @@ This function can be called only in unibyte buffers.  */)
   return unbind_to (count, Qt);
 }
 
+/* Compress the N1 bytes at P1 followed by the N2 bytes at P2, which
+   may be the two parts of a buffer's text on either side of its gap.
+   Return the compressed data, allocated with xmalloc, and store its
+   size in *SIZE.  Return NULL if zlib is not available, or if the
+   data do not compress to fewer than LIMIT bytes.  */
+
+unsigned char *
+zlib_compress_text (unsigned char const *p1, ptrdiff_t n1,
+		    unsigned char const *p2, ptrdiff_t n2,
+		    ptrdiff_t limit, ptrdiff_t *size)
+{
+  z_stream stream;
+  unsigned char *data;
+  ptrdiff_t nout = 0;
+  int status;
+
+#ifdef WINDOWSNT
+  if (!zlib_initialized)
+    zlib_initialized = init_zlib_functions ();
+  if (!zlib_initialized)
+    return NULL;
+#endif
+
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  if (fn_deflateInit (&stream, Z_BEST_SPEED) != Z_OK)
+    return NULL;
+
+  data = xmalloc (limit);
+  do
+    {
+      /* zlib requires that avail_in and avail_out not exceed UINT_MAX.  */
+      ptrdiff_t avail_in, avail_out = min (limit - nout, UINT_MAX);
+
+      if (n1 == 0)
+	p1 = p2, n1 = n2, n2 = 0;
+      avail_in = min (n1, UINT_MAX);
+      stream.next_in = (Bytef *) p1;
+      stream.avail_in = avail_in;
+      stream.next_out = data + nout;
+      stream.avail_out = avail_out;
+      status = fn_deflate (&stream, (avail_in == n1 && n2 == 0
+				     ? Z_FINISH : Z_NO_FLUSH));
+      p1 += avail_in - stream.avail_in;
+      n1 -= avail_in - stream.avail_in;
+      nout += avail_out - stream.avail_out;
+    }
+  while (status == Z_OK && nout < limit);
+
+  fn_deflateEnd (&stream);
+  if (status != Z_STREAM_END)
+    {
+      xfree (data);
+      return NULL;
+    }
+  *size = nout;
+  return data;
+}
+
+/* Uncompress the SIZE bytes at DATA, which zlib_compress_text
+   returned, into the N1 bytes at P1 followed by the N2 bytes at P2.
+   Return true if successful.  */
+
+bool
+zlib_uncompress_text (unsigned char const *data, ptrdiff_t size,
+		      unsigned char *p1, ptrdiff_t n1,
+		      unsigned char *p2, ptrdiff_t n2)
+{
+  z_stream stream;
+  int status;
+
+#ifdef WINDOWSNT
+  if (!zlib_initialized)
+    zlib_initialized = init_zlib_functions ();
+  if (!zlib_initialized)
+    return false;
+#endif
+
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  stream.avail_in = 0;
+  stream.next_in = Z_NULL;
+  if (fn_inflateInit (&stream) != Z_OK)
+    return false;
+
+  do
+    {
+      ptrdiff_t avail_in = min (size, UINT_MAX), avail_out;
+
+      if (n1 == 0)
+	p1 = p2, n1 = n2, n2 = 0;
+      avail_out = min (n1, UINT_MAX);
+      stream.next_in = (Bytef *) data;
+      stream.avail_in = avail_in;
+      stream.next_out = p1;
+      stream.avail_out = avail_out;
+      status = fn_inflate (&stream, Z_NO_FLUSH);
+      data += avail_in - stream.avail_in;
+      size -= avail_in - stream.avail_in;
+      p1 += avail_out - stream.avail_out;
+      n1 -= avail_out - stream.avail_out;
+    }
+  while (status == Z_OK);
+
+  fn_inflateEnd (&stream);
+  return status == Z_STREAM_END && n1 == 0 && n2 == 0;
+}
+
 
 /***********************************************************************
 			    Initialization
@@ -3449,6 +3449,7 @@ extern void bitch_at_user (void);
 extern void adjust_frame_glyphs (struct frame *);
 void free_glyphs (struct frame *);
 void free_window_matrices (struct window *);
+ptrdiff_t glyph_memory_bytes (void);
 void check_glyph_memory (void);
 void mirrored_line_dance (struct glyph_matrix *, int, int, int *, char *);
 void clear_glyph_matrix (struct glyph_matrix *);
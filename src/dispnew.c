@@ -2240,6 +2240,87 @@ free_window_matrices (struct window *w)
 }
 
 
+/* Return the number of bytes that glyph matrix MATRIX takes, not
+   counting the glyph pool it may use.  MATRIX may be null.  */
+
+static ptrdiff_t
+glyph_matrix_bytes (struct glyph_matrix *matrix)
+{
+  ptrdiff_t nbytes = 0;
+
+  if (matrix)
+    {
+      nbytes = sizeof *matrix + matrix->rows_allocated * sizeof *matrix->rows;
+      if (!matrix->pool)
+	nbytes += (matrix->rows_allocated * matrix->matrix_w
+		   * sizeof (struct glyph));
+    }
+  return nbytes;
+}
+
+/* Return the number of bytes that glyph pool POOL takes.  POOL may be
+   null.  */
+
+static ptrdiff_t
+glyph_pool_bytes (struct glyph_pool *pool)
+{
+  return pool ? sizeof *pool + pool->nglyphs * sizeof (struct glyph) : 0;
+}
+
+/* Return the number of bytes that the glyph matrices in the window
+   tree rooted at W take.  */
+
+static ptrdiff_t
+window_matrices_bytes (struct window *w)
+{
+  ptrdiff_t nbytes = 0;
+
+  while (w)
+    {
+      if (WINDOWP (w->contents))
+	nbytes += window_matrices_bytes (XWINDOW (w->contents));
+      else
+	nbytes += (glyph_matrix_bytes (w->current_matrix)
+		   + glyph_matrix_bytes (w->desired_matrix));
+      w = NILP (w->next) ? 0 : XWINDOW (w->next);
+    }
+  return nbytes;
+}
+
+/* Return the number of bytes that the glyph matrices and glyph pools
+   of all frames take.  */
+
+ptrdiff_t
+glyph_memory_bytes (void)
+{
+  Lisp_Object tail, frame;
+  ptrdiff_t nbytes = 0;
+
+  FOR_EACH_FRAME (tail, frame)
+    {
+      struct frame *f = XFRAME (frame);
+
+      if (!f->glyphs_initialized_p)
+	continue;
+      if (!NILP (f->root_window))
+	nbytes += window_matrices_bytes (XWINDOW (f->root_window));
+#if defined (HAVE_X_WINDOWS) && ! defined (USE_X_TOOLKIT) && ! defined (USE_GTK)
+      if (!NILP (f->menu_bar_window))
+	nbytes += window_matrices_bytes (XWINDOW (f->menu_bar_window));
+#endif
+#if defined (HAVE_WINDOW_SYSTEM) && ! defined (USE_GTK) && ! defined (HAVE_NS)
+      if (!NILP (f->tool_bar_window))
+	nbytes += window_matrices_bytes (XWINDOW (f->tool_bar_window));
+#endif
+      nbytes += (glyph_matrix_bytes (f->desired_matrix)
+		 + glyph_matrix_bytes (f->current_matrix)
+		 + glyph_pool_bytes (f->desired_pool)
+		 + glyph_pool_bytes (f->current_pool));
+    }
+  return nbytes;
+}
+
+
 /* Check glyph memory leaks.  This function is called from
    shut_down_emacs.  Note that frames are not destroyed when Emacs
    exits.  We therefore free all glyph memory for all active frames
@@ -70,6 +70,7 @@ static int tm_diff (struct tm *, struct tm *);
 static void update_buffer_properties (ptrdiff_t, ptrdiff_t);
 
 static Lisp_Object Qbuffer_access_fontify_functions;
+static Lisp_Object Qreplace_regions;
 
 /* Symbol for the text property used to mark fields.  */
 
@@ -298,46 +299,18 @@ If you set the marker not to point anywhere, the buffer will have no mark.  */)
 static ptrdiff_t
 overlays_around (EMACS_INT pos, Lisp_Object *vec, ptrdiff_t len)
 {
-  Lisp_Object overlay, start, end;
-  struct Lisp_Overlay *tail;
-  ptrdiff_t startpos, endpos;
+  Lisp_Object overlay;
+  struct overlay_node *node;
   ptrdiff_t idx = 0;
 
-  for (tail = current_buffer->overlays_before; tail; tail = tail->next)
+  for (node = overlay_tree_first (current_buffer, pos, pos); node;
+       node = overlay_tree_next (node, pos, pos))
     {
-      XSETMISC (overlay, tail);
-
-      end = OVERLAY_END (overlay);
-      endpos = OVERLAY_POSITION (end);
-      if (endpos < pos)
-	  break;
-      start = OVERLAY_START (overlay);
-      startpos = OVERLAY_POSITION (start);
-      if (startpos <= pos)
-	{
-	  if (idx < len)
-	    vec[idx] = overlay;
-	  /* Keep counting overlays even if we can't return them all.  */
-	  idx++;
-	}
-    }
-
-  for (tail = current_buffer->overlays_after; tail; tail = tail->next)
-    {
-      XSETMISC (overlay, tail);
-
-      start = OVERLAY_START (overlay);
-      startpos = OVERLAY_POSITION (start);
-      if (pos < startpos)
-	break;
-      end = OVERLAY_END (overlay);
-      endpos = OVERLAY_POSITION (end);
-      if (pos <= endpos)
-	{
-	  if (idx < len)
-	    vec[idx] = overlay;
-	  idx++;
-	}
+      XSETMISC (overlay, node->overlay);
+      if (idx < len)
+	vec[idx] = overlay;
+      /* Keep counting overlays even if we can't return them all.  */
+      idx++;
     }
 
   return idx;
@@ -2979,6 +2952,8 @@ Both characters must have the same length of multi-byte form.  */)
 	    {
 	      if (NILP (noundo))
 		record_change (pos, 1);
+	      if (fromc == '\n' || toc == '\n')
+		clear_line_index (current_buffer);
 	      for (i = 0; i < len; i++) *p++ = tostr[i];
 	    }
 	  last_changed =  pos + 1;
@@ -3181,6 +3156,8 @@ It returns the number of characters changed.  */)
 	      else
 		{
 		  record_change (pos, 1);
+		  if (oc == '\n' || nc == '\n')
+		    clear_line_index (current_buffer);
 		  while (str_len-- > 0)
 		    *p++ = *str++;
 		  signal_after_change (pos, 1, 1);
@@ -3253,6 +3230,621 @@ DEFUN ("delete-and-extract-region", Fdelete_and_extract_region,
   return del_range_1 (XINT (start), XINT (end), 1, 1);
 }
 
+/* Replace the N regions of the current buffer whose bounds are the
+   pairs of positions in POS with the strings in the vector TEXTS.
+   The regions must be valid, in order and not overlapping.  INHERIT
+   says whether the new text inherits text properties, and RECORD
+   whether to record the change for undo.  See `replace-regions'.  */
+
+static void
+replace_regions (ptrdiff_t n, ptrdiff_t *pos, Lisp_Object texts, bool inherit,
+		 bool record)
+{
+  ptrdiff_t i, j, start, end, shift, delta;
+  Lisp_Object undo = Qnil;
+  struct gcpro gcpro1, gcpro2;
+
+  GCPRO2 (texts, undo);
+
+  /* Join each insertion at the end of a region to that region, so
+     that markers moved to the start of the region, when that is also
+     its end, do not then advance over the inserted text.  */
+  delta = 0;
+  for (i = j = 0; i < n; j++)
+    {
+      ptrdiff_t k = i + 1;
+
+      while (k < n && pos[2 * k] == pos[2 * k - 1]
+	     && pos[2 * k] == pos[2 * k + 1])
+	k++;
+      pos[2 * j] = pos[2 * i];
+      pos[2 * j + 1] = pos[2 * k - 1];
+      ASET (texts, j, (k - i == 1 ? AREF (texts, i)
+		       : Fconcat (k - i, XVECTOR (texts)->contents + i)));
+      delta += SCHARS (AREF (texts, j)) - (pos[2 * j + 1] - pos[2 * j]);
+      i = k;
+    }
+  n = j;
+
+  start = pos[0];
+  end = pos[2 * n - 1];
+  if (start == end && delta == 0)
+    {
+      UNGCPRO;
+      return;
+    }
+
+  /* The change hooks might move the text.  */
+  shift = start;
+  prepare_to_modify_buffer (start, end, &start);
+  shift = start - shift;
+  end += shift;
+  if (start < BEGV || end > ZV)
+    args_out_of_range (make_number (start), make_number (end));
+
+  /* Undoing the change replaces the new text of each region with its
+     old text.  */
+  if (record && ! EQ (BVAR (current_buffer, undo_list), Qt))
+    {
+      ptrdiff_t d = 0;
+
+      for (i = 0; i < n; i++)
+	{
+	  ptrdiff_t from = pos[2 * i] + shift, to = pos[2 * i + 1] + shift;
+	  ptrdiff_t len = SCHARS (AREF (texts, i));
+
+	  undo = Fcons (list3 (make_number (from + d),
+			       make_number (from + d + len),
+			       make_buffer_string (from, to, 1)),
+			undo);
+	  d += len - (to - from);
+	}
+      record_undo_function (start, Qreplace_regions, list1 (Fnreverse (undo)));
+    }
+
+  /* Replace the regions from first to last, so that the gap only
+     moves forward.  */
+  for (i = 0; i < n; i++)
+    {
+      ptrdiff_t from = pos[2 * i] + shift, to = pos[2 * i + 1] + shift;
+      Lisp_Object text = AREF (texts, i);
+
+      replace_range_1 (from, CHAR_TO_BYTE (from), to, CHAR_TO_BYTE (to),
+		       text, inherit, 1, 0);
+      shift += SCHARS (text) - (to - from);
+    }
+
+  signal_after_change (start, end - start, end + delta - start);
+  update_compositions (start, end + delta, CHECK_BORDER);
+
+  UNGCPRO;
+}
+
+DEFUN ("replace-regions", Freplace_regions, Sreplace_regions, 1, 2, 0,
+       doc: /* Replace several regions of the current buffer with new text.
+EDITS is a list of elements (START END NEWTEXT), each saying to replace
+the text from START to END with the string NEWTEXT.  The regions must
+be in order and must not overlap.  A region can be empty, to insert
+NEWTEXT, and NEWTEXT can be empty, to delete the region.  All the
+positions refer to the text as it was before any replacement.
+
+This has the same effect as replacing each region in turn, but it is
+much faster when there are many regions: the gap moves through the
+text just once, `before-change-functions' and `after-change-functions'
+run just once, for the text from the start of the first region to the
+end of the last, and a single undo entry records the whole change.
+The text between the regions counts as changed for those functions,
+and for checking that the text is not read-only.
+
+Markers and point are relocated as `replace-match' relocates them, so
+those inside a replaced region move to its start.  If optional second
+arg INHERIT is non-nil, the new text inherits text properties from the
+text around it, as with `insert-and-inherit'.  */)
+  (Lisp_Object edits, Lisp_Object inherit)
+{
+  ptrdiff_t n, i;
+  ptrdiff_t *pos;
+  Lisp_Object tail, texts;
+  struct gcpro gcpro1, gcpro2;
+  USE_SAFE_ALLOCA;
+
+  n = XFASTINT (Flength (edits));
+  if (n == 0)
+    return Qnil;
+  SAFE_NALLOCA (pos, 2, n);
+  texts = Fmake_vector (make_number (n), Qnil);
+  GCPRO2 (edits, texts);
+
+  /* Check all the regions before changing anything, and keep their
+     positions, which markers among EDITS would not.  */
+  for (i = 0, tail = edits; i < n; i++, tail = XCDR (tail))
+    {
+      Lisp_Object elt = XCAR (tail);
+      Lisp_Object beg = Fcar (elt), fin = Fcar (Fcdr (elt));
+      Lisp_Object text = Fcar (Fcdr (Fcdr (elt)));
+
+      validate_region (&beg, &fin);
+      CHECK_STRING (text);
+      if (i > 0 && XFASTINT (beg) < pos[2 * i - 1])
+	error ("Regions to replace are out of order or overlap");
+      pos[2 * i] = XFASTINT (beg);
+      pos[2 * i + 1] = XFASTINT (fin);
+      ASET (texts, i, text);
+    }
+
+  replace_regions (n, pos, texts, !NILP (inherit), 1);
+
+  UNGCPRO;
+  SAFE_FREE ();
+  return Qnil;
+}
+
+/* Comparing two texts, for `replace-buffer-contents'.  This is the
+   linear space variant of the algorithm in Eugene W. Myers, "An O(ND)
+   Difference Algorithm and Its Variations", Algorithmica 1 (1986),
+   251-266, as diffutils implements it.  It compares bytes.  */
+
+struct diff_context
+{
+  /* The two texts.  */
+  unsigned char const *a, *b;
+
+  /* For each diagonal, the furthest point the forward and the backward
+     searches have reached on it.  Each is indexed by the diagonal's
+     distance from the one the search starts on, plus RADIUS + 1.  */
+  ptrdiff_t *fdiag, *bdiag;
+
+  /* The number of rounds a search for a middle snake may take.  */
+  ptrdiff_t radius;
+
+  /* The work done so far, and the work after which to give up.  */
+  ptrdiff_t costs, max_costs;
+
+  /* The parts that differ, as groups of four offsets: the start and
+     end of the part of A, and of the part of B that replaces it.  */
+  ptrdiff_t *hunks;
+  ptrdiff_t nhunks, hunks_size;
+};
+
+/* The most rounds a search for a middle snake takes, whatever the
+   costs.  This bounds the memory the search uses.  */
+enum { DIFF_MAX_RADIUS = 1 << 18 };
+
+static void
+diff_free (void *ptr)
+{
+  struct diff_context *ctx = ptr;
+  xfree (ctx->fdiag);
+  xfree (ctx->hunks);
+}
+
+/* Record that bytes XOFF to XLIM of A differ from bytes YOFF to YLIM
+   of B, joining this to the previous part if they touch.  */
+
+static void
+diff_add_hunk (struct diff_context *ctx, ptrdiff_t xoff, ptrdiff_t xlim,
+	       ptrdiff_t yoff, ptrdiff_t ylim)
+{
+  ptrdiff_t *h;
+
+  if (ctx->nhunks > 0)
+    {
+      h = ctx->hunks + 4 * ctx->nhunks;
+      if (h[-3] == xoff && h[-1] == yoff)
+	{
+	  h[-3] = xlim;
+	  h[-1] = ylim;
+	  return;
+	}
+    }
+  if (ctx->hunks_size - 4 * ctx->nhunks < 4)
+    ctx->hunks = xpalloc (ctx->hunks, &ctx->hunks_size, 4, -1,
+			  sizeof *ctx->hunks);
+  h = ctx->hunks + 4 * ctx->nhunks++;
+  h[0] = xoff;
+  h[1] = xlim;
+  h[2] = yoff;
+  h[3] = ylim;
+}
+
+/* Find the midpoint of a shortest edit script that turns bytes XOFF
+   to XLIM of A into bytes YOFF to YLIM of B, and store it in *XMID
+   and *YMID.  The two parts must differ at both ends.  Return false
+   if this takes too much work.  */
+
+static bool
+diff_middle_snake (struct diff_context *ctx, ptrdiff_t xoff, ptrdiff_t xlim,
+		   ptrdiff_t yoff, ptrdiff_t ylim,
+		   ptrdiff_t *xmid, ptrdiff_t *ymid)
+{
+  unsigned char const *a = ctx->a, *b = ctx->b;
+  ptrdiff_t *fd = ctx->fdiag, *bd = ctx->bdiag;
+  ptrdiff_t dmin = xoff - ylim, dmax = xlim - yoff;
+  ptrdiff_t fmid = xoff - yoff, bmid = xlim - ylim;
+  ptrdiff_t fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+  ptrdiff_t foff = ctx->radius + 1 - fmid, boff = ctx->radius + 1 - bmid;
+  bool odd = (fmid - bmid) & 1;
+  ptrdiff_t round, d, x, y;
+
+  fd[fmid + foff] = xoff;
+  bd[bmid + boff] = xlim;
+
+  for (round = 0; round < ctx->radius; round++)
+    {
+      /* Extend the forward search by one edit.  */
+      if (fmin > dmin)
+	fd[--fmin - 1 + foff] = -1;
+      else
+	++fmin;
+      if (fmax < dmax)
+	fd[++fmax + 1 + foff] = -1;
+      else
+	--fmax;
+      for (d = fmax; d >= fmin; d -= 2)
+	{
+	  ptrdiff_t tlo = fd[d - 1 + foff], thi = fd[d + 1 + foff];
+	  ptrdiff_t x0 = tlo < thi ? thi : tlo + 1;
+
+	  for (x = x0, y = x0 - d; x < xlim && y < ylim && a[x] == b[y];
+	       x++, y++)
+	    continue;
+	  ctx->costs += x - x0 + 1;
+	  fd[d + foff] = x;
+	  if (odd && bmin <= d && d <= bmax && bd[d + boff] <= x)
+	    {
+	      *xmid = x;
+	      *ymid = y;
+	      return true;
+	    }
+	}
+
+      /* Likewise the backward search.  */
+      if (bmin > dmin)
+	bd[--bmin - 1 + boff] = PTRDIFF_MAX;
+      else
+	++bmin;
+      if (bmax < dmax)
+	bd[++bmax + 1 + boff] = PTRDIFF_MAX;
+      else
+	--bmax;
+      for (d = bmax; d >= bmin; d -= 2)
+	{
+	  ptrdiff_t tlo = bd[d - 1 + boff], thi = bd[d + 1 + boff];
+	  ptrdiff_t x0 = tlo < thi ? tlo : thi - 1;
+
+	  for (x = x0, y = x0 - d;
+	       xoff < x && yoff < y && a[x - 1] == b[y - 1];
+	       x--, y--)
+	    continue;
+	  ctx->costs += x0 - x + 1;
+	  bd[d + boff] = x;
+	  if (!odd && fmin <= d && d <= fmax && x <= fd[d + foff])
+	    {
+	      *xmid = x;
+	      *ymid = y;
+	      return true;
+	    }
+	}
+
+      if (ctx->costs > ctx->max_costs)
+	return false;
+      /* Comparing big texts can take a while; let the user quit.  The
+	 text cannot move meanwhile, and the caller frees CTX when
+	 unwinding.  */
+      QUIT;
+    }
+  return false;
+}
+
+/* Record the parts of bytes XOFF to XLIM of A that differ from bytes
+   YOFF to YLIM of B.  Return false if this takes too much work.  */
+
+static bool
+diff_compare (struct diff_context *ctx, ptrdiff_t xoff, ptrdiff_t xlim,
+	      ptrdiff_t yoff, ptrdiff_t ylim)
+{
+  unsigned char const *a = ctx->a, *b = ctx->b;
+  ptrdiff_t xmid, ymid;
+
+  while (xoff < xlim && yoff < ylim && a[xoff] == b[yoff])
+    xoff++, yoff++;
+  while (xoff < xlim && yoff < ylim && a[xlim - 1] == b[ylim - 1])
+    xlim--, ylim--;
+
+  if (xoff == xlim || yoff == ylim)
+    {
+      if (xoff < xlim || yoff < ylim)
+	diff_add_hunk (ctx, xoff, xlim, yoff, ylim);
+      return true;
+    }
+
+  return (diff_middle_snake (ctx, xoff, xlim, yoff, ylim, &xmid, &ymid)
+	  && diff_compare (ctx, xoff, xmid, yoff, ymid)
+	  && diff_compare (ctx, xmid, xlim, ymid, ylim));
+}
+
+/* Widen the parts that differ in CTX, between multibyte texts of NA
+   and NB bytes, to start and end at character boundaries in both
+   texts, and join those that then touch.  */
+
+static void
+diff_align_hunks (struct diff_context *ctx, ptrdiff_t na, ptrdiff_t nb)
+{
+  unsigned char const *a = ctx->a, *b = ctx->b;
+  ptrdiff_t *h = ctx->hunks;
+  ptrdiff_t i, j;
+
+  for (i = j = 0; i < ctx->nhunks; i++)
+    {
+      ptrdiff_t xoff = h[4 * i], xlim = h[4 * i + 1];
+      ptrdiff_t yoff = h[4 * i + 2], ylim = h[4 * i + 3];
+      ptrdiff_t prev = j > 0 ? h[4 * j - 3] : 0;
+
+      /* The text between two parts is the same in both texts, so
+	 moving over it keeps the parts in step.  */
+      while (xoff > prev
+	     && ((xoff < na && ! CHAR_HEAD_P (a[xoff]))
+		 || (yoff < nb && ! CHAR_HEAD_P (b[yoff]))))
+	xoff--, yoff--;
+      while ((xlim < na && ! CHAR_HEAD_P (a[xlim]))
+	     || (ylim < nb && ! CHAR_HEAD_P (b[ylim])))
+	xlim++, ylim++;
+
+      if (j > 0 && xoff <= prev)
+	{
+	  h[4 * j - 3] = max (prev, xlim);
+	  h[4 * j - 1] = max (h[4 * j - 1], ylim);
+	}
+      else
+	{
+	  h[4 * j] = xoff;
+	  h[4 * j + 1] = xlim;
+	  h[4 * j + 2] = yoff;
+	  h[4 * j + 3] = ylim;
+	  j++;
+	}
+    }
+  ctx->nhunks = j;
+}
+
+/* Replace the text from FROM to TO in the current buffer with the
+   text from SFROM to STO of SOURCE, a buffer or a string, replacing
+   only the parts that differ.  Give up comparing the texts once that
+   costs more than MAX_COSTS, and then replace everything between
+   their common beginning and end.  Return true if the replacement was
+   minimal.  RECORD says whether to record the change for undo.  */
+
+bool
+replace_range_minimally (ptrdiff_t from, ptrdiff_t to, Lisp_Object source,
+			 ptrdiff_t sfrom, ptrdiff_t sto, ptrdiff_t max_costs,
+			 bool record)
+{
+  struct buffer *sb = BUFFERP (source) ? XBUFFER (source) : NULL;
+  bool multibyte = ! NILP (BVAR (current_buffer, enable_multibyte_characters));
+  bool source_multibyte, minimal = true;
+  ptrdiff_t from_byte = CHAR_TO_BYTE (from), to_byte = CHAR_TO_BYTE (to);
+  ptrdiff_t sfrom_byte, sto_byte, na, nb, pre, post, i, n, *h;
+  unsigned char const *a, *b;
+  struct diff_context ctx;
+  Lisp_Object texts;
+  struct gcpro gcpro1, gcpro2;
+  ptrdiff_t count = SPECPDL_INDEX (), count1;
+
+  memset (&ctx, 0, sizeof ctx);
+  ctx.max_costs = max_costs;
+  record_unwind_protect_ptr (diff_free, &ctx);
+
+  if (sb)
+    {
+      sfrom_byte = buf_charpos_to_bytepos (sb, sfrom);
+      sto_byte = buf_charpos_to_bytepos (sb, sto);
+      source_multibyte = ! NILP (BVAR (sb, enable_multibyte_characters));
+    }
+  else
+    {
+      sfrom_byte = string_char_to_byte (source, sfrom);
+      sto_byte = string_char_to_byte (source, sto);
+      source_multibyte = STRING_MULTIBYTE (source);
+    }
+  na = to_byte - from_byte;
+  nb = sto_byte - sfrom_byte;
+
+  /* Make both texts contiguous.  */
+  if (sb && sb->text == current_buffer->text)
+    move_gap_both (Z, Z_BYTE);
+  else
+    {
+      if (from_byte < GPT_BYTE && GPT_BYTE < to_byte)
+	move_gap_both (from, from_byte);
+      if (sb && sfrom_byte < BUF_GPT_BYTE (sb) && BUF_GPT_BYTE (sb) < sto_byte)
+	{
+	  count1 = SPECPDL_INDEX ();
+	  record_unwind_current_buffer ();
+	  set_buffer_internal (sb);
+	  move_gap_both (sfrom, sfrom_byte);
+	  unbind_to (count1, Qnil);
+	}
+    }
+
+  count1 = SPECPDL_INDEX ();
+#ifdef REL_ALLOC
+  r_alloc_inhibit_buffer_relocation (1);
+  record_unwind_protect_int (r_alloc_inhibit_buffer_relocation, 0);
+#endif
+  ctx.a = a = BYTE_POS_ADDR (from_byte);
+  ctx.b = b = (sb ? BUF_BYTE_ADDRESS (sb, sfrom_byte)
+	       : SDATA (source) + sfrom_byte);
+
+  /* Texts in different forms compare byte by byte only if the new
+     text is ASCII.  Otherwise, replace all of the text.  */
+  if (multibyte != source_multibyte)
+    {
+      for (pre = 0; pre < nb && ASCII_CHAR_P (b[pre]); pre++)
+	continue;
+      if (pre < nb)
+	{
+	  unbind_to (count1, Qnil);
+	  if (from < to || sfrom < sto)
+	    diff_add_hunk (&ctx, from, to, sfrom, sto);
+	  minimal = false;
+	  goto replace;
+	}
+    }
+
+  /* Skip the common beginning and end first, so that the search needs
+     memory only for the text between.  */
+  for (pre = 0; pre < na && pre < nb && a[pre] == b[pre]; pre++)
+    continue;
+  for (post = 0;
+       post < na - pre && post < nb - pre && a[na - post - 1] == b[nb - post - 1];
+       post++)
+    continue;
+  if (multibyte)
+    {
+      while (pre > 0 && ((pre < na && ! CHAR_HEAD_P (a[pre]))
+			 || (pre < nb && ! CHAR_HEAD_P (b[pre]))))
+	pre--;
+      while (post > 0 && (! CHAR_HEAD_P (a[na - post])
+			  || ! CHAR_HEAD_P (b[nb - post])))
+	post--;
+    }
+
+  if (pre + post < na && pre + post < nb)
+    {
+      ctx.radius = min (na + nb - 2 * (pre + post), DIFF_MAX_RADIUS);
+      ctx.fdiag = xnmalloc (2 * ctx.radius + 3, 2 * sizeof *ctx.fdiag);
+      ctx.bdiag = ctx.fdiag + 2 * ctx.radius + 3;
+      minimal = diff_compare (&ctx, pre, na - post, pre, nb - post);
+      if (minimal && multibyte)
+	diff_align_hunks (&ctx, na, nb);
+    }
+  if (! minimal || ctx.radius == 0)
+    {
+      ctx.nhunks = 0;
+      if (pre + post < na || pre + post < nb)
+	diff_add_hunk (&ctx, pre, na - post, pre, nb - post);
+    }
+
+  /* Turn the byte offsets into character positions while the text
+     cannot move.  The new text is ASCII unless both texts are in the
+     same form, so counting its characters as multibyte is right.  */
+  h = ctx.hunks;
+  if (multibyte || source_multibyte)
+    {
+      ptrdiff_t abyte = 0, achar = from, bbyte = 0, bchar = sfrom;
+
+      for (i = 0; i < 4 * ctx.nhunks; i++)
+	if (i & 2)
+	  {
+	    bchar += multibyte_chars_in_text (b + bbyte, h[i] - bbyte);
+	    bbyte = h[i];
+	    h[i] = bchar;
+	  }
+	else
+	  {
+	    achar += (multibyte ? multibyte_chars_in_text (a + abyte,
+							  h[i] - abyte)
+		      : h[i] - abyte);
+	    abyte = h[i];
+	    h[i] = achar;
+	  }
+    }
+  else
+    for (i = 0; i < 4 * ctx.nhunks; i++)
+      h[i] += i & 2 ? sfrom : from;
+  unbind_to (count1, Qnil);
+
+ replace:
+  n = ctx.nhunks;
+  if (n == 0)
+    {
+      unbind_to (count, Qnil);
+      return minimal;
+    }
+
+  texts = Fmake_vector (make_number (n), Qnil);
+  GCPRO2 (source, texts);
+  h = ctx.hunks;
+  if (sb)
+    {
+      ptrdiff_t count1 = SPECPDL_INDEX ();
+
+      record_unwind_current_buffer ();
+      set_buffer_internal (sb);
+      for (i = 0; i < n; i++)
+	ASET (texts, i, make_buffer_string (h[4 * i + 2], h[4 * i + 3], 1));
+      unbind_to (count1, Qnil);
+    }
+  else
+    for (i = 0; i < n; i++)
+      ASET (texts, i, Fsubstring (source, make_number (h[4 * i + 2]),
+				  make_number (h[4 * i + 3])));
+
+  /* Keep just the bounds of the regions to replace.  */
+  for (i = 0; i < n; i++)
+    {
+      h[2 * i] = h[4 * i];
+      h[2 * i + 1] = h[4 * i + 1];
+    }
+  replace_regions (n, h, texts, 0, record);
+
+  UNGCPRO;
+  unbind_to (count, Qnil);
+  return minimal;
+}
+
+DEFUN ("replace-buffer-contents", Freplace_buffer_contents,
+       Sreplace_buffer_contents, 1, 2, 0,
+       doc: /* Replace the accessible portion of the buffer with SOURCE.
+SOURCE is a buffer, whose accessible portion is the new text, or a
+string.  This compares the old and new text, and replaces just the
+parts that differ, so that the markers, text properties and overlays of
+the rest stay as they were.  The new text comes with the text
+properties it has in SOURCE.
+
+Comparing texts that differ in many places can take long, so this gives
+up once the work it has done exceeds MAX-COSTS, which defaults to
+`replace-buffer-contents-max-costs', and then replaces all the text
+between the common beginning and end of the two texts.  It also does
+that when one text is multibyte and the other is not, unless the new
+text is ASCII.
+
+The replacement is a single change for `before-change-functions',
+`after-change-functions' and undo, as with `replace-regions'.
+
+Return t if just the parts that differ were replaced, nil otherwise.  */)
+  (Lisp_Object source, Lisp_Object max_costs)
+{
+  ptrdiff_t sfrom, sto;
+
+  if (STRINGP (source))
+    {
+      sfrom = 0;
+      sto = SCHARS (source);
+    }
+  else
+    {
+      struct buffer *b;
+
+      CHECK_BUFFER (source);
+      b = XBUFFER (source);
+      if (!BUFFER_LIVE_P (b))
+	error ("Selecting deleted buffer");
+      if (b == current_buffer)
+	return Qt;
+      sfrom = BUF_BEGV (b);
+      sto = BUF_ZV (b);
+    }
+  if (NILP (max_costs))
+    XSETINT (max_costs, replace_buffer_contents_max_costs);
+  else
+    CHECK_NATNUM (max_costs);
+
+  return (replace_range_minimally (BEGV, ZV, source, sfrom, sto,
+				   XINT (max_costs), 1)
+	  ? Qt : Qnil);
+}
+
 DEFUN ("widen", Fwiden, Swiden, 0, 0, "",
        doc: /* Remove restrictions (narrowing) from current buffer.
 This allows the buffer's full text to be seen and edited.  */)
@@ -3323,7 +3915,7 @@ save_restriction_save (void)
       end = build_marker (current_buffer, ZV, ZV_BYTE);
 
       /* END must move forward if text is inserted at its exact location.  */
-      XMARKER (end)->insertion_type = 1;
+      set_marker_insertion_type (XMARKER (end), 1);
 
       return Fcons (beg, end);
     }
@@ -3354,21 +3946,26 @@ save_restriction_restore (Lisp_Object data)
       eassert (buf == end->buffer);
 
       if (buf /* Verify marker still points to a buffer.  */
-	  && (beg->charpos != BUF_BEGV (buf) || end->charpos != BUF_ZV (buf)))
+	  && (marker_charpos (beg) != BUF_BEGV (buf)
+	      || marker_charpos (end) != BUF_ZV (buf)))
 	/* The restriction has changed from the saved one, so restore
 	   the saved restriction.  */
 	{
 	  ptrdiff_t pt = BUF_PT (buf);
+	  ptrdiff_t beg_charpos = marker_charpos (beg);
+	  ptrdiff_t beg_bytepos = marker_bytepos (beg);
+	  ptrdiff_t end_charpos = marker_charpos (end);
+	  ptrdiff_t end_bytepos = marker_bytepos (end);
 
-	  SET_BUF_BEGV_BOTH (buf, beg->charpos, beg->bytepos);
-	  SET_BUF_ZV_BOTH (buf, end->charpos, end->bytepos);
+	  SET_BUF_BEGV_BOTH (buf, beg_charpos, beg_bytepos);
+	  SET_BUF_ZV_BOTH (buf, end_charpos, end_bytepos);
 
-	  if (pt < beg->charpos || pt > end->charpos)
+	  if (pt < beg_charpos || pt > end_charpos)
 	    /* The point is outside the new visible range, move it inside. */
 	    SET_BUF_PT_BOTH (buf,
-			     clip_to_bounds (beg->charpos, pt, end->charpos),
-			     clip_to_bounds (beg->bytepos, BUF_PT_BYTE (buf),
-					     end->bytepos));
+			     clip_to_bounds (beg_charpos, pt, end_charpos),
+			     clip_to_bounds (beg_bytepos, BUF_PT_BYTE (buf),
+					     end_bytepos));
 
 	  buf->clip_changed = 1; /* Remember that the narrowing changed. */
 	}
@@ -3555,6 +4152,244 @@ usage: (propertize STRING &rest PROPERTIES)  */)
   RETURN_UNGCPRO (string);
 }
 
+/* Format strings made only of text and plain "%s", "%d" and "%%"
+   directives are common in logging and mode line code, which calls
+   `format' with the same format many times.  Such formats are parsed
+   once into a list of pieces and kept in a small cache, keyed by
+   their contents since a string can be modified; `format' then
+   fills in the result string directly from the pieces.  */
+
+struct format_piece
+{
+  /* The byte offset and length of the text copied from the format,
+     and the number of characters in it.  */
+  ptrdiff_t text_start, text_bytes, text_chars;
+
+  /* 's' or 'd' for the directive that follows the text, or 0.  */
+  char conversion;
+};
+
+struct format_cache_entry
+{
+  /* A copy of the format's contents, or null if the entry is unused.  */
+  char *text;
+  ptrdiff_t nbytes;
+  bool multibyte;
+
+  /* True if the format has only directives handled by format_simple.  */
+  bool simple;
+
+  ptrdiff_t npieces;
+  struct format_piece *pieces;
+};
+
+enum { FORMAT_CACHE_SIZE = 64 };
+
+static struct format_cache_entry format_cache[FORMAT_CACHE_SIZE];
+
+/* Parse the format FORMAT into ENTRY.  */
+
+static void
+format_parse (struct format_cache_entry *entry, Lisp_Object format)
+{
+  unsigned char const *text = SDATA (format);
+  ptrdiff_t nbytes = SBYTES (format), i = 0, npieces = 0, size = 0;
+  bool multibyte = STRING_MULTIBYTE (format);
+  struct format_piece *pieces = NULL;
+
+  entry->simple = true;
+  while (entry->simple)
+    {
+      struct format_piece piece;
+      int skip = 0;
+      piece.text_start = i;
+      piece.text_chars = 0;
+      piece.conversion = 0;
+
+      /* A run starting in the middle of a character might combine
+	 with what precedes it; leave that to the general code.  */
+      if (multibyte && i < nbytes && !CHAR_HEAD_P (text[i]))
+	entry->simple = false;
+
+      for (; i < nbytes; i++)
+	{
+	  if (text[i] == '%')
+	    {
+	      if (i + 1 < nbytes && text[i + 1] == '%')
+		{
+		  /* Keep the first '%' as text, and skip the second.  */
+		  piece.text_chars++;
+		  i++;
+		  skip = 1;
+		}
+	      else if (i + 1 < nbytes
+		       && (text[i + 1] == 's' || text[i + 1] == 'd'))
+		{
+		  piece.conversion = text[i + 1];
+		  skip = 2;
+		}
+	      else
+		entry->simple = false;
+	      break;
+	    }
+	  if (!multibyte || CHAR_HEAD_P (text[i]))
+	    piece.text_chars++;
+	}
+      piece.text_bytes = i - piece.text_start;
+      i += skip;
+
+      if (npieces == size)
+	pieces = xpalloc (pieces, &size, 1, -1, sizeof *pieces);
+      pieces[npieces++] = piece;
+      if (i == nbytes && !skip)
+	break;
+    }
+
+  xfree (entry->text);
+  xfree (entry->pieces);
+  entry->text = xmalloc (nbytes + 1);
+  memcpy (entry->text, text, nbytes);
+  entry->nbytes = nbytes;
+  entry->multibyte = multibyte;
+  entry->npieces = npieces;
+  entry->pieces = pieces;
+}
+
+/* Return the cache entry for the format FORMAT, parsing it if
+   necessary.  */
+
+static struct format_cache_entry *
+format_cache_lookup (Lisp_Object format)
+{
+  ptrdiff_t nbytes = SBYTES (format);
+  struct format_cache_entry *entry
+    = &format_cache[hash_string (SSDATA (format), nbytes)
+		    % FORMAT_CACHE_SIZE];
+  if (! (entry->text
+	 && entry->nbytes == nbytes
+	 && entry->multibyte == STRING_MULTIBYTE (format)
+	 && memcmp (entry->text, SDATA (format), nbytes) == 0))
+    format_parse (entry, format);
+  return entry;
+}
+
+/* Store the decimal representation of N in BUF, which must be big
+   enough, and return its length.  */
+
+static int
+format_integer (char *buf, EMACS_INT n)
+{
+  char digits[INT_STRLEN_BOUND (EMACS_INT)];
+  char *d = digits + sizeof digits;
+  EMACS_UINT u = n < 0 ? - (EMACS_UINT) n : n;
+  int len;
+  do
+    *--d = '0' + u % 10;
+  while ((u /= 10) != 0);
+  if (n < 0)
+    *--d = '-';
+  len = digits + sizeof digits - d;
+  memcpy (buf, d, len);
+  return len;
+}
+
+/* Format ARGS with the simple format described by ENTRY, whose
+   contents are those of ARGS[0].  Return nil if some argument needs
+   more than copying, so that the general code must handle it.  */
+
+static Lisp_Object
+format_simple (struct format_cache_entry *entry,
+	       ptrdiff_t nargs, Lisp_Object *args)
+{
+  bool multibyte = entry->multibyte;
+  ptrdiff_t nchars = 0, nbytes = 0, i, n;
+  unsigned char const *text = SDATA (args[0]);
+  unsigned char *p;
+  Lisp_Object val, arg;
+
+  /* Check the arguments, and see whether the result is multibyte.  */
+  for (i = n = 0; i < entry->npieces; i++)
+    {
+      struct format_piece *piece = &entry->pieces[i];
+      if (!piece->conversion)
+	continue;
+      if (! (++n < nargs))
+	return Qnil;
+      arg = args[n];
+      if (piece->conversion == 'd')
+	{
+	  if (!INTEGERP (arg))
+	    return Qnil;
+	  continue;
+	}
+      if (SYMBOLP (arg))
+	arg = SYMBOL_NAME (arg);
+      if (! STRINGP (arg) || string_intervals (arg))
+	return Qnil;
+      if (STRING_MULTIBYTE (arg))
+	{
+	  if (SBYTES (arg) && !CHAR_HEAD_P (SREF (arg, 0)))
+	    return Qnil;
+	  multibyte = true;
+	}
+    }
+
+  /* Compute the size of the result.  */
+  for (i = n = 0; i < entry->npieces; i++)
+    {
+      struct format_piece *piece = &entry->pieces[i];
+      nchars += piece->text_chars;
+      nbytes += (multibyte && !entry->multibyte
+		 ? count_size_as_multibyte (text + piece->text_start,
+					    piece->text_bytes)
+		 : piece->text_bytes);
+      if (piece->conversion == 'd')
+	{
+	  char digits[INT_STRLEN_BOUND (EMACS_INT)];
+	  int len = format_integer (digits, XINT (args[++n]));
+	  nchars += len;
+	  nbytes += len;
+	}
+      else if (piece->conversion == 's')
+	{
+	  arg = args[++n];
+	  if (SYMBOLP (arg))
+	    arg = SYMBOL_NAME (arg);
+	  nchars += SCHARS (arg);
+	  nbytes += (multibyte && !STRING_MULTIBYTE (arg)
+		     ? count_size_as_multibyte (SDATA (arg), SBYTES (arg))
+		     : SBYTES (arg));
+	}
+      if (STRING_BYTES_BOUND < nbytes)
+	string_overflow ();
+    }
+
+  /* Fill in the result.  */
+  val = (multibyte
+	 ? make_uninit_multibyte_string (nchars, nbytes)
+	 : make_uninit_string (nbytes));
+  text = SDATA (args[0]);
+  p = SDATA (val);
+  for (i = n = 0; i < entry->npieces; i++)
+    {
+      struct format_piece *piece = &entry->pieces[i];
+      p += copy_text (text + piece->text_start, p, piece->text_bytes,
+		      entry->multibyte, multibyte);
+      if (piece->conversion == 'd')
+	p += format_integer ((char *) p, XINT (args[++n]));
+      else if (piece->conversion == 's')
+	{
+	  arg = args[++n];
+	  if (SYMBOLP (arg))
+	    arg = SYMBOL_NAME (arg);
+	  p += copy_text (SDATA (arg), p, SBYTES (arg),
+			  STRING_MULTIBYTE (arg), multibyte);
+	}
+    }
+  eassert (p == SDATA (val) + nbytes);
+  return val;
+}
+
 DEFUN ("format", Fformat, Sformat, 1, MANY, 0,
        doc: /* Format a string out of a format-string and arguments.
 The first argument is a format control string.
@@ -3653,6 +4488,18 @@ usage: (format STRING &rest OBJECTS)  */)
      the caller in the interpreter should take care of that.  */
 
   CHECK_STRING (args[0]);
+
+  if (! string_intervals (args[0]))
+    {
+      struct format_cache_entry *entry = format_cache_lookup (args[0]);
+      if (entry->simple)
+	{
+	  val = format_simple (entry, nargs, args);
+	  if (! NILP (val))
+	    return val;
+	}
+    }
+
   format_start = SSDATA (args[0]);
   formatlen = SBYTES (args[0]);
 
@@ -4411,9 +5258,8 @@ Case is ignored if `case-fold-search' is non-nil in the current buffer.  */)
    START2, END2 are the character positions of the second region.
    START2_BYTE, END2_BYTE are the byte positions.
 
-   Traverses the entire marker list of the buffer to do so, adding an
-   appropriate amount to some, subtracting from some, and leaving the
-   rest untouched.  Most of this is copied from adjust_markers in insdel.c.
+   Visits the markers of the buffer from START1 to END2 to do so, adding
+   an appropriate amount to some and subtracting from others.
 
    It's the caller's job to ensure that START1 <= END1 <= START2 <= END2.  */
 
@@ -4425,6 +5271,11 @@ transpose_markers (ptrdiff_t start1, ptrdiff_t end1,
 {
   register ptrdiff_t amt1, amt1_byte, amt2, amt2_byte, diff, diff_byte, mpos;
   register struct Lisp_Marker *marker;
+  struct Lisp_Marker *vbuf[16];
+  struct Lisp_Marker **vec = vbuf;
+  ptrdiff_t size = ARRAYELTS (vbuf);
+  ptrdiff_t i, n = 0;
+  int type;
 
   /* Update point as if it were a marker.  */
   if (PT < start1)
@@ -4459,31 +5310,42 @@ transpose_markers (ptrdiff_t start1, ptrdiff_t end1,
   amt1_byte = (end2_byte - start2_byte) + (start2_byte - end1_byte);
   amt2_byte = (end1_byte - start1_byte) + (start2_byte - end1_byte);
 
-  for (marker = BUF_MARKERS (current_buffer); marker; marker = marker->next)
+  /* Collect the markers first, since moving them changes the marker
+     trees.  */
+  for (type = 0; type < 2; type++)
+    for (marker = marker_tree_first (current_buffer, type, start1);
+	 marker && marker_charpos (marker) < end2;
+	 marker = marker_tree_next (marker))
+      {
+	if (n == size)
+	  {
+	    if (vec == vbuf)
+	      {
+		vec = xpalloc (NULL, &size, 1, -1, sizeof *vec);
+		memcpy (vec, vbuf, sizeof vbuf);
+	      }
+	    else
+	      vec = xpalloc (vec, &size, 1, -1, sizeof *vec);
+	  }
+	vec[n++] = marker;
+      }
+
+  for (i = 0; i < n; i++)
     {
-      mpos = marker->bytepos;
-      if (mpos >= start1_byte && mpos < end2_byte)
-	{
-	  if (mpos < end1_byte)
-	    mpos += amt1_byte;
-	  else if (mpos < start2_byte)
-	    mpos += diff_byte;
-	  else
-	    mpos -= amt2_byte;
-	  marker->bytepos = mpos;
-	}
-      mpos = marker->charpos;
-      if (mpos >= start1 && mpos < end2)
-	{
-	  if (mpos < end1)
-	    mpos += amt1;
-	  else if (mpos < start2)
-	    mpos += diff;
-	  else
-	    mpos -= amt2;
-	}
-      marker->charpos = mpos;
+      ptrdiff_t mpos_byte = marker_bytepos (vec[i]);
+
+      mpos = marker_charpos (vec[i]);
+      if (mpos < end1)
+	mpos += amt1, mpos_byte += amt1_byte;
+      else if (mpos < start2)
+	mpos += diff, mpos_byte += diff_byte;
+      else
+	mpos -= amt2, mpos_byte -= amt2_byte;
+      attach_marker (vec[i], vec[i]->buffer, mpos, mpos_byte);
     }
+
+  if (vec != vbuf)
+    xfree (vec);
 }
 
 DEFUN ("transpose-regions", Ftranspose_regions, Stranspose_regions, 4, 5, 0,
@@ -4766,6 +5628,12 @@ Transposing beyond buffer boundaries is an error.  */)
       update_compositions (end2 - len1, end2, CHECK_BORDER);
     }
 
+  /* The regions have swapped, so checkpoints of the position and line
+     indexes between them no longer hold.  This must come after the
+     swap, as the scans done above can record new checkpoints.  */
+  forget_position_checkpoints (current_buffer, start1, end2);
+  forget_line_checkpoints (current_buffer, start1_byte, end2_byte);
+
   /* When doing multiple transpositions, it might be nice
      to optimize this.  Perhaps the markers in any one buffer
      should be organized in some sorted data tree.  */
@@ -4831,6 +5699,16 @@ functions if all the text being accessed has this property.  */);
   DEFVAR_LISP ("operating-system-release", Voperating_system_release,
 	       doc: /* The release of the operating system Emacs is running on.  */);
 
+  DEFVAR_INT ("replace-buffer-contents-max-costs",
+	      replace_buffer_contents_max_costs,
+	      doc: /* Work after which `replace-buffer-contents' stops comparing texts.
+Comparing two texts takes work roughly proportional to their size times
+the number of places where they differ.  Once the work exceeds this
+value, `replace-buffer-contents', and `insert-file-contents' when it
+replaces text, give up comparing and replace all the text between the
+common beginning and end of the two texts instead.  */);
+  replace_buffer_contents_max_costs = 10000000;
+
   defsubr (&Spropertize);
   defsubr (&Schar_equal);
   defsubr (&Sgoto_char);
@@ -4850,6 +5728,7 @@ functions if all the text being accessed has this property.  */);
 
   DEFSYM (Qfield, "field");
   DEFSYM (Qboundary, "boundary");
+  DEFSYM (Qreplace_regions, "replace-regions");
   defsubr (&Sfield_beginning);
   defsubr (&Sfield_end);
   defsubr (&Sfield_string);
@@ -4918,6 +5797,8 @@ functions if all the text being accessed has this property.  */);
   defsubr (&Stranslate_region_internal);
   defsubr (&Sdelete_region);
   defsubr (&Sdelete_and_extract_region);
+  defsubr (&Sreplace_regions);
+  defsubr (&Sreplace_buffer_contents);
   defsubr (&Swiden);
   defsubr (&Snarrow_to_region);
   defsubr (&Ssave_restriction);
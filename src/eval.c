@@ -2971,7 +2971,7 @@ DEFUN ("fetch-bytecode", Ffetch_bytecode, Sfetch_bytecode,
 
   if (COMPILEDP (object) && CONSP (AREF (object, COMPILED_BYTECODE)))
     {
-      tem = read_doc_string (AREF (object, COMPILED_BYTECODE));
+      tem = read_lazy_bytecode (AREF (object, COMPILED_BYTECODE));
       if (!CONSP (tem))
 	{
 	  tem = AREF (object, COMPILED_BYTECODE);
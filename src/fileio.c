@@ -3334,7 +3334,6 @@ decide_coding_unwind (Lisp_Object unwind_data)
 
   set_buffer_internal (XBUFFER (buffer));
   adjust_markers_for_delete (BEG, BEG_BYTE, Z, Z_BYTE);
-  adjust_overlays_for_delete (BEG, Z - BEG);
   set_buffer_intervals (current_buffer, NULL);
   TEMP_SET_PT_BOTH (BEG, BEG_BYTE);
 
@@ -3396,6 +3395,18 @@ file_offset (Lisp_Object val)
   wrong_type_argument (intern ("file-offset"), val);
 }
 
+/* Return true if `insert-file-contents', replacing text with a file
+   of TOTAL bytes whose middle differs from the buffer, should compare
+   OLD bytes of the buffer with NEW bytes of the file there and replace
+   only the parts that differ.  That reads the whole file, and does not
+   pay when it is large or when the parts are most of it.  */
+static bool
+replace_by_diff_p (off_t total, off_t old, off_t new)
+{
+  return (total <= replace_buffer_contents_max_costs
+	  && max (old, new) <= total / 4);
+}
+
 /* Return a special time value indicating the error number ERRNUM.  */
 static struct timespec
 time_error_value (int errnum)
@@ -3422,8 +3433,13 @@ characters in the buffer.  If VISIT is non-nil, BEG and END must be nil.
 If optional fifth argument REPLACE is non-nil, replace the current
 buffer contents (in the accessible portion) with the file contents.
 This is better than simply deleting and inserting the whole thing
-because (1) it preserves some marker positions and (2) it puts less data
-in the undo list.  When REPLACE is non-nil, the second return value is
+because (1) it replaces only the parts that differ, as far as it can
+tell, which preserves the markers and text properties elsewhere, and
+(2) it puts less data in the undo list.  Comparing the file with the
+buffer gives up as `replace-buffer-contents' does, according to
+`replace-buffer-contents-max-costs'; for a file larger than that, or
+when the text that differs is a large part of the file, it just replaces
+all of that text.  When REPLACE is non-nil, the second return value is
 the number of characters that replace previous buffer contents.
 
 This function does code conversion according to the value of
@@ -3658,8 +3674,7 @@ by calling `format-decode', which see.  */)
 		  bset_read_only (buf, Qnil);
 		  bset_filename (buf, Qnil);
 		  bset_undo_list (buf, Qt);
-		  eassert (buf->overlays_before == NULL);
-		  eassert (buf->overlays_after == NULL);
+		  eassert (buf->overlays == NULL);
 
 		  set_buffer_internal (buf);
 		  Ferase_buffer ();
@@ -3857,6 +3872,21 @@ by calling `format-decode', which see.  */)
 	}
       immediate_quit = 0;
 
+      /* If the file has text in place of some text in the middle of
+	 the buffer, rather than just more or less text there, let the
+	 other method find the parts that differ and replace just
+	 those.  */
+      if (! giveup_match_end && same_at_start < same_at_end)
+	{
+	  off_t matched = (same_at_start - BEGV_BYTE) + (ZV_BYTE - same_at_end);
+
+	  if (end_offset - beg_offset > matched
+	      && replace_by_diff_p (end_offset - beg_offset,
+				    same_at_end - same_at_start,
+				    end_offset - beg_offset - matched))
+	    giveup_match_end = 1;
+	}
+
       if (! giveup_match_end)
 	{
 	  ptrdiff_t temp;
@@ -3911,17 +3941,20 @@ by calling `format-decode', which see.  */)
      that preserves markers pointing to the unchanged parts.
 
      Here we implement this feature for the case where code conversion
-     is needed, in a simple way that needs a lot of memory.
+     is needed, in a simple way that needs a lot of memory.  It also
+     compares the nonmatching middle parts, and replaces only the
+     parts of those that differ.
      The preceding if-statement handles the case of no conversion
      in a more optimized way.  */
   if (!NILP (replace) && ! replace_handled && BEGV < ZV)
     {
       ptrdiff_t same_at_start = BEGV_BYTE;
       ptrdiff_t same_at_end = ZV_BYTE;
-      ptrdiff_t same_at_start_charpos;
+      ptrdiff_t same_at_start_charpos, same_at_end_charpos;
       ptrdiff_t inserted_chars;
       ptrdiff_t overlap;
       ptrdiff_t bufpos;
+      ptrdiff_t total_bytes;
       unsigned char *decoded;
       ptrdiff_t temp;
       ptrdiff_t this = 0;
@@ -4050,24 +4083,11 @@ by calling `format-decode', which see.  */)
       /* Replace the chars that we need to replace,
 	 and update INSERTED to equal the number of bytes
 	 we are taking from the decoded string.  */
+      total_bytes = inserted;
       inserted -= (ZV_BYTE - same_at_end) + (same_at_start - BEGV_BYTE);
 
-      if (same_at_end != same_at_start)
-	{
-	  invalidate_buffer_caches (current_buffer,
-				    BYTE_TO_CHAR (same_at_start),
-				    BYTE_TO_CHAR (same_at_end));
-	  del_range_byte (same_at_start, same_at_end, 0);
-	  temp = GPT;
-	  eassert (same_at_start == GPT_BYTE);
-	  same_at_start = GPT_BYTE;
-	}
-      else
-	{
-	  temp = BYTE_TO_CHAR (same_at_start);
-	}
-      /* Insert from the file at the proper position.  */
-      SET_PT_BOTH (temp, same_at_start);
+      temp = BYTE_TO_CHAR (same_at_start);
+      same_at_end_charpos = BYTE_TO_CHAR (same_at_end);
       same_at_start_charpos
 	= buf_bytepos_to_charpos (XBUFFER (conversion_buffer),
 				  same_at_start - BEGV_BYTE
@@ -4078,14 +4098,44 @@ by calling `format-decode', which see.  */)
 				   same_at_start + inserted - BEGV_BYTE
 				  + BUF_BEG_BYTE (XBUFFER (conversion_buffer)))
 	   - same_at_start_charpos);
+
+      invalidate_buffer_caches (current_buffer, temp, same_at_end_charpos);
       /* This binding is to avoid ask-user-about-supersession-threat
-	 being called in insert_from_buffer (via in
-	 prepare_to_modify_buffer).  */
+	 being called in replace_range_minimally or insert_from_buffer
+	 (via in prepare_to_modify_buffer).  */
       specbind (intern ("buffer-file-name"), Qnil);
-      insert_from_buffer (XBUFFER (conversion_buffer),
-			  same_at_start_charpos, inserted_chars, 0);
+      if (replace_by_diff_p (total_bytes, same_at_end - same_at_start,
+			     inserted))
+	{
+	  /* Undo the change as a deletion and insertion of the whole
+	     text in between, as the code below expects, even though
+	     only the parts of it that differ from the file are
+	     replaced.  */
+	  if (! EQ (BVAR (current_buffer, undo_list), Qt))
+	    {
+	      if (same_at_end_charpos > temp)
+		record_delete (temp,
+			       make_buffer_string (temp, same_at_end_charpos, 1),
+			       false);
+	      if (inserted_chars > 0)
+		record_insert (temp, inserted_chars);
+	    }
+	  replace_range_minimally (temp, same_at_end_charpos,
+				   conversion_buffer, same_at_start_charpos,
+				   same_at_start_charpos + inserted_chars,
+				   replace_buffer_contents_max_costs, 0);
+	}
+      else
+	{
+	  if (same_at_end != same_at_start)
+	    del_range_byte (same_at_start, same_at_end, 0);
+	  /* Insert from the file at the proper position.  */
+	  SET_PT_BOTH (temp, same_at_start);
+	  insert_from_buffer (XBUFFER (conversion_buffer),
+			      same_at_start_charpos, inserted_chars, 0);
+	}
       /* Set `inserted' to the number of inserted characters.  */
-      inserted = PT - temp;
+      inserted = inserted_chars;
       /* Set point before the inserted characters.  */
       SET_PT_BOTH (temp, same_at_start);
 
@@ -4227,6 +4277,8 @@ by calling `format-decode', which see.  */)
   ZV_BYTE  += inserted;
   Z        += inserted;
   Z_BYTE   += inserted;
+  adjust_line_index_for_insert (current_buffer,
+				GPT_BYTE - inserted, GPT_BYTE);
 
   if (GAP_SIZE > 0)
     /* Put an anchor to ensure multi-byte form ends at gap.  */
@@ -4314,11 +4366,15 @@ by calling `format-decode', which see.  */)
       && (inserted > 0 || CODING_REQUIRE_FLUSHING (&coding)))
     {
       move_gap_both (PT, PT_BYTE);
+      adjust_line_index_for_delete (current_buffer,
+				    PT_BYTE, PT_BYTE + inserted);
       GAP_SIZE += inserted;
       ZV_BYTE -= inserted;
       Z_BYTE -= inserted;
       ZV -= inserted;
       Z -= inserted;
+      trim_position_index (current_buffer);
+      trim_line_index (current_buffer);
       decode_coding_gap (&coding, inserted, inserted);
       inserted = coding.produced_char;
       coding_system = CODING_ID_NAME (coding.id);
@@ -523,6 +523,18 @@ with the original.  */)
   if (!CONSP (arg) && !VECTORP (arg) && !STRINGP (arg))
     wrong_type_argument (Qsequencep, arg);
 
+  if (STRINGP (arg))
+    {
+      Lisp_Object val = make_shared_substring (arg, 0, 0);
+
+      if (!NILP (val))
+	{
+	  copy_text_properties (make_number (0), make_number (SCHARS (arg)),
+				arg, make_number (0), val, Qnil);
+	  return val;
+	}
+    }
+
   return concat (1, &arg, XTYPE (arg), 0);
 }
 
@@ -815,10 +827,135 @@ static Lisp_Object string_char_byte_cache_string;
 static ptrdiff_t string_char_byte_cache_charpos;
 static ptrdiff_t string_char_byte_cache_bytepos;
 
+/* Large multibyte strings that are indexed repeatedly get an index of
+   the byte position of every STRING_INDEX_SPACING'th character, so
+   that converting a position scans at most that many characters.
+   Each entry of string_indexes counts the characters scanned in its
+   string, and builds the index once they add up to the length of the
+   string.  */
+
+enum
+  {
+    STRING_INDEX_SPACING = 64,
+    STRING_INDEX_MIN_BYTES = 4096,
+    STRING_INDEXES = 8
+  };
+
+struct string_index
+{
+  /* The string, or null if this entry is unused.  */
+  struct Lisp_String *string;
+
+  /* The data and size of STRING that the entry describes.  */
+  unsigned char *data;
+  ptrdiff_t nchars, nbytes;
+
+  /* Number of characters scanned in STRING without an index.  */
+  ptrdiff_t scanned;
+
+  /* If not null, BYTEPOS[K] is the byte position of character
+     K * STRING_INDEX_SPACING.  */
+  ptrdiff_t *bytepos;
+};
+
+static struct string_index string_indexes[STRING_INDEXES];
+
+/* The entry of string_indexes to reuse next.  */
+static int string_index_victim;
+
+/* Make E describe the current contents of S, with no index yet.  */
+
+static void
+reset_string_index (struct string_index *e, struct Lisp_String *s)
+{
+  xfree (e->bytepos);
+  e->bytepos = NULL;
+  e->string = s;
+  if (s)
+    {
+      e->data = s->data;
+      e->nchars = s->size;
+      e->nbytes = s->size_byte;
+    }
+  e->scanned = 0;
+}
+
+/* Return the entry of string_indexes for STRING, making one if
+   needed.  */
+
+static struct string_index *
+string_index_entry (Lisp_Object string)
+{
+  struct Lisp_String *s = XSTRING (string);
+  struct string_index *e;
+
+  for (e = string_indexes; e < string_indexes + STRING_INDEXES; e++)
+    if (e->string == s)
+      {
+	if (e->data != s->data || e->nchars != s->size
+	    || e->nbytes != s->size_byte)
+	  reset_string_index (e, s);
+	return e;
+      }
+
+  e = &string_indexes[string_index_victim];
+  string_index_victim = (string_index_victim + 1) % STRING_INDEXES;
+  reset_string_index (e, s);
+  return e;
+}
+
+/* Note that SCANNED characters of the string of E were scanned, and
+   index it if that is enough to pay for the index.  */
+
+static void
+note_string_scan (struct string_index *e, ptrdiff_t scanned)
+{
+  ptrdiff_t i, n = e->nchars / STRING_INDEX_SPACING + 1;
+  unsigned char *p = e->data;
+
+  e->scanned += scanned;
+  if (e->scanned < e->nchars)
+    return;
+
+  e->bytepos = xnmalloc (n, sizeof *e->bytepos);
+  for (i = 0; i < n; i++)
+    {
+      int j;
+
+      e->bytepos[i] = p - e->data;
+      if (i < n - 1)
+	for (j = 0; j < STRING_INDEX_SPACING; j++)
+	  p += BYTES_BY_CHAR_HEAD (*p);
+    }
+}
+
+/* Forget the indexes of strings that are about to be freed.  Called
+   by the garbage collector.  */
+
+void
+sweep_string_indexes (void)
+{
+  struct string_index *e;
+
+  for (e = string_indexes; e < string_indexes + STRING_INDEXES; e++)
+    if (e->string)
+      {
+	Lisp_Object string;
+
+	XSETSTRING (string, e->string);
+	if (!survives_gc_p (string))
+	  reset_string_index (e, NULL);
+      }
+}
+
 void
 clear_string_char_byte_cache (void)
 {
+  struct string_index *e;
+
   string_char_byte_cache_string = Qnil;
+  for (e = string_indexes; e < string_indexes + STRING_INDEXES; e++)
+    reset_string_index (e, NULL);
 }
 
 /* Return the byte index corresponding to CHAR_INDEX in STRING.  */
@@ -829,6 +966,7 @@ string_char_to_byte (Lisp_Object string, ptrdiff_t char_index)
   ptrdiff_t i_byte;
   ptrdiff_t best_below, best_below_byte;
   ptrdiff_t best_above, best_above_byte;
+  struct string_index *e = NULL;
 
   best_below = best_below_byte = 0;
   best_above = SCHARS (string);
@@ -836,20 +974,44 @@ string_char_to_byte (Lisp_Object string, ptrdiff_t char_index)
   if (best_above == best_above_byte)
     return char_index;
 
+  if (best_above_byte >= STRING_INDEX_MIN_BYTES)
+    {
+      e = string_index_entry (string);
+      if (e->bytepos)
+	{
+	  ptrdiff_t k = char_index / STRING_INDEX_SPACING;
+
+	  best_below = k * STRING_INDEX_SPACING;
+	  best_below_byte = e->bytepos[k];
+	  if (best_below + STRING_INDEX_SPACING <= best_above)
+	    {
+	      best_above = best_below + STRING_INDEX_SPACING;
+	      best_above_byte = e->bytepos[k + 1];
+	    }
+	}
+    }
+
   if (EQ (string, string_char_byte_cache_string))
     {
       if (string_char_byte_cache_charpos < char_index)
 	{
-	  best_below = string_char_byte_cache_charpos;
-	  best_below_byte = string_char_byte_cache_bytepos;
+	  if (best_below < string_char_byte_cache_charpos)
+	    {
+	      best_below = string_char_byte_cache_charpos;
+	      best_below_byte = string_char_byte_cache_bytepos;
+	    }
 	}
-      else
+      else if (string_char_byte_cache_charpos < best_above)
 	{
 	  best_above = string_char_byte_cache_charpos;
 	  best_above_byte = string_char_byte_cache_bytepos;
 	}
     }
 
+  if (e && !e->bytepos)
+    note_string_scan (e, min (char_index - best_below,
+			      best_above - char_index));
+
   if (char_index - best_below < best_above - char_index)
     {
       unsigned char *p = SDATA (string) + best_below_byte;
@@ -889,6 +1051,7 @@ string_byte_to_char (Lisp_Object string, ptrdiff_t byte_index)
   ptrdiff_t i, i_byte;
   ptrdiff_t best_below, best_below_byte;
   ptrdiff_t best_above, best_above_byte;
+  struct string_index *e = NULL;
 
   best_below = best_below_byte = 0;
   best_above = SCHARS (string);
@@ -896,20 +1059,53 @@ string_byte_to_char (Lisp_Object string, ptrdiff_t byte_index)
   if (best_above == best_above_byte)
     return byte_index;
 
+  if (best_above_byte >= STRING_INDEX_MIN_BYTES)
+    {
+      e = string_index_entry (string);
+      if (e->bytepos)
+	{
+	  /* Find the last indexed character at or before BYTE_INDEX.  */
+	  ptrdiff_t lo = 0, hi = best_above / STRING_INDEX_SPACING;
+
+	  while (lo < hi)
+	    {
+	      ptrdiff_t mid = hi - (hi - lo) / 2;
+	      if (e->bytepos[mid] <= byte_index)
+		lo = mid;
+	      else
+		hi = mid - 1;
+	    }
+	  best_below = lo * STRING_INDEX_SPACING;
+	  best_below_byte = e->bytepos[lo];
+	  if (best_below + STRING_INDEX_SPACING <= best_above)
+	    {
+	      best_above = best_below + STRING_INDEX_SPACING;
+	      best_above_byte = e->bytepos[lo + 1];
+	    }
+	}
+    }
+
   if (EQ (string, string_char_byte_cache_string))
     {
       if (string_char_byte_cache_bytepos < byte_index)
 	{
-	  best_below = string_char_byte_cache_charpos;
-	  best_below_byte = string_char_byte_cache_bytepos;
+	  if (best_below_byte < string_char_byte_cache_bytepos)
+	    {
+	      best_below = string_char_byte_cache_charpos;
+	      best_below_byte = string_char_byte_cache_bytepos;
+	    }
 	}
-      else
+      else if (string_char_byte_cache_bytepos < best_above_byte)
 	{
 	  best_above = string_char_byte_cache_charpos;
 	  best_above_byte = string_char_byte_cache_bytepos;
 	}
     }
 
+  if (e && !e->bytepos)
+    note_string_scan (e, min (byte_index - best_below_byte,
+			      best_above_byte - byte_index));
+
   if (byte_index - best_below_byte < best_above_byte - byte_index)
     {
       unsigned char *p = SDATA (string) + best_below_byte;
@@ -1265,9 +1461,14 @@ With one argument, just copy STRING (with properties, if any).  */)
 	= !ifrom ? 0 : string_char_to_byte (string, ifrom);
       ptrdiff_t to_byte
 	= ito == size ? SBYTES (string) : string_char_to_byte (string, ito);
-      res = make_specified_string (SSDATA (string) + from_byte,
-				   ito - ifrom, to_byte - from_byte,
-				   STRING_MULTIBYTE (string));
+
+      /* A large tail of STRING can share its data.  */
+      res = (ito == size
+	     ? make_shared_substring (string, ifrom, from_byte) : Qnil);
+      if (NILP (res))
+	res = make_specified_string (SSDATA (string) + from_byte,
+				     ito - ifrom, to_byte - from_byte,
+				     STRING_MULTIBYTE (string));
       copy_text_properties (make_number (ifrom), make_number (ito),
 			    string, make_number (0), res, Qnil);
     }
@@ -1296,6 +1497,12 @@ With one argument, just copy STRING without its properties.  */)
   validate_subarray (string, from, to, size, &from_char, &to_char);
 
   from_byte = !from_char ? 0 : string_char_to_byte (string, from_char);
+  if (to_char == size)
+    {
+      Lisp_Object res = make_shared_substring (string, from_char, from_byte);
+      if (!NILP (res))
+	return res;
+    }
   to_byte =
     to_char == size ? SBYTES (string) : string_char_to_byte (string, to_char);
   return make_specified_string (SSDATA (string) + from_byte,
@@ -2338,7 +2545,8 @@ internal_equal (Lisp_Object o1, Lisp_Object o2, int depth, bool props,
 	{
 	  return (XMARKER (o1)->buffer == XMARKER (o2)->buffer
 		  && (XMARKER (o1)->buffer == 0
-		      || XMARKER (o1)->bytepos == XMARKER (o2)->bytepos));
+		      || (marker_bytepos (XMARKER (o1))
+			  == marker_bytepos (XMARKER (o2)))));
 	}
       break;
 
@@ -2426,9 +2634,11 @@ ARRAY is a vector, string, char-table, or bool-vector.  */)
     }
   else if (STRINGP (array))
     {
-      register unsigned char *p = SDATA (array);
+      register unsigned char *p;
       int charval;
       CHECK_CHARACTER (item);
+      unshare_string_data (array);
+      p = SDATA (array);
       charval = XFASTINT (item);
       size = SCHARS (array);
       if (STRING_MULTIBYTE (array))
@@ -2440,6 +2650,7 @@ ARRAY is a vector, string, char-table, or bool-vector.  */)
 	  if (INT_MULTIPLY_OVERFLOW (SCHARS (array), len)
 	      || SCHARS (array) * len != size_byte)
 	    error ("Attempt to change byte length of a string");
+	  clear_string_char_byte_cache ();
 	  for (idx = 0; idx < size_byte; idx++)
 	    *p++ = str[idx % len];
 	}
@@ -2462,6 +2673,7 @@ This makes STRING unibyte and may change its length.  */)
 {
   ptrdiff_t len;
   CHECK_STRING (string);
+  unshare_string_data (string);
   len = SBYTES (string);
   memset (SDATA (string), 0, len);
   STRING_SET_CHARS (string, len);
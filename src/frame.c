@@ -3972,6 +3972,7 @@ validate_x_resource_name (void)
      with underscores.  */
 
   Vx_resource_name = new = Fcopy_sequence (Vx_resource_name);
+  unshare_string_data (new);
 
   for (i = 0; i < len; i++)
     {
@@ -34,7 +34,7 @@ static void insert_from_string_1 (Lisp_Object, ptrdiff_t, ptrdiff_t, ptrdiff_t,
 				  ptrdiff_t, bool, bool);
 static void insert_from_buffer_1 (struct buffer *, ptrdiff_t, ptrdiff_t, bool);
 static void gap_left (ptrdiff_t, ptrdiff_t, bool);
-static void gap_right (ptrdiff_t, ptrdiff_t);
+static void gap_right (ptrdiff_t, ptrdiff_t, bool);
 
 /* List of elements of the form (BEG-UNCHANGED END-UNCHANGED CHANGE-AMOUNT)
    describing changes which happened while combine_after_change_calls
@@ -64,17 +64,22 @@ check_markers (void)
 {
   struct Lisp_Marker *tail;
   bool multibyte = ! NILP (BVAR (current_buffer, enable_multibyte_characters));
+  ptrdiff_t last[2] = { BEG, BEG };
 
-  for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
+  FOR_EACH_MARKER (current_buffer, tail)
     {
+      ptrdiff_t charpos = marker_charpos (tail);
+      ptrdiff_t bytepos = marker_bytepos (tail);
+
       if (tail->buffer->text != current_buffer->text)
 	emacs_abort ();
-      if (tail->charpos > Z)
+      if (charpos > Z || charpos < last[tail->insertion_type])
 	emacs_abort ();
-      if (tail->bytepos > Z_BYTE)
+      if (bytepos > Z_BYTE)
 	emacs_abort ();
-      if (multibyte && ! CHAR_HEAD_P (FETCH_BYTE (tail->bytepos)))
+      if (multibyte && ! CHAR_HEAD_P (FETCH_BYTE (bytepos)))
 	emacs_abort ();
+      last[tail->insertion_type] = charpos;
     }
 }
 
@@ -95,13 +100,14 @@ move_gap_both (ptrdiff_t charpos, ptrdiff_t bytepos)
   if (bytepos < GPT_BYTE)
     gap_left (charpos, bytepos, 0);
   else if (bytepos > GPT_BYTE)
-    gap_right (charpos, bytepos);
+    gap_right (charpos, bytepos, 0);
 }
 
 /* Move the gap to a position less than the current GPT.
    BYTEPOS describes the new position as a byte position,
    and CHARPOS is the corresponding char position.
-   If NEWGAP, then don't update beg_unchanged and end_unchanged.  */
+   If NEWGAP, then don't update beg_unchanged and end_unchanged,
+   nor the position index.  */
 
 static void
 gap_left (ptrdiff_t charpos, ptrdiff_t bytepos, bool newgap)
@@ -149,16 +155,23 @@ gap_left (ptrdiff_t charpos, ptrdiff_t bytepos, bool newgap)
   GPT_BYTE = bytepos;
   GPT = charpos;
   eassert (charpos <= bytepos);
+  if (!newgap)
+    {
+      move_position_index_gap (current_buffer);
+      move_line_index_gap (current_buffer);
+    }
   if (GAP_SIZE > 0) *(GPT_ADDR) = 0; /* Put an anchor.  */
   QUIT;
 }
 
 /* Move the gap to a position greater than the current GPT.
    BYTEPOS describes the new position as a byte position,
-   and CHARPOS is the corresponding char position.  */
+   and CHARPOS is the corresponding char position.
+   If NEWGAP, the gap is only being resized, so don't update the
+   position index.  */
 
 static void
-gap_right (ptrdiff_t charpos, ptrdiff_t bytepos)
+gap_right (ptrdiff_t charpos, ptrdiff_t bytepos, bool newgap)
 {
   register unsigned char *to, *from;
   register ptrdiff_t i;
@@ -199,6 +212,11 @@ gap_right (ptrdiff_t charpos, ptrdiff_t bytepos)
   GPT = charpos;
   GPT_BYTE = bytepos;
   eassert (charpos <= bytepos);
+  if (!newgap)
+    {
+      move_position_index_gap (current_buffer);
+      move_line_index_gap (current_buffer);
+    }
   if (GAP_SIZE > 0) *(GPT_ADDR) = 0; /* Put an anchor.  */
   QUIT;
 }
@@ -215,8 +233,8 @@ adjust_suspend_auto_hscroll (ptrdiff_t from, ptrdiff_t to)
 
       if (BUFFERP (w->contents)
 	  && XBUFFER (w->contents) == current_buffer
-	  && XMARKER (w->old_pointm)->charpos >= from
-	  && XMARKER (w->old_pointm)->charpos <= to)
+	  && marker_charpos (XMARKER (w->old_pointm)) >= from
+	  && marker_charpos (XMARKER (w->old_pointm)) <= to)
 	w->suspend_auto_hscroll = 0;
     }
 }
@@ -233,32 +251,14 @@ void
 adjust_markers_for_delete (ptrdiff_t from, ptrdiff_t from_byte,
 			   ptrdiff_t to, ptrdiff_t to_byte)
 {
-  struct Lisp_Marker *m;
-  ptrdiff_t charpos;
-
   adjust_suspend_auto_hscroll (from, to);
-  for (m = BUF_MARKERS (current_buffer); m; m = m->next)
-    {
-      charpos = m->charpos;
-      eassert (charpos <= Z);
 
-      /* If the marker is after the deletion,
-	 relocate by number of chars / bytes deleted.  */
-      if (charpos > to)
-	{
-	  m->charpos -= to - from;
-	  m->bytepos -= to_byte - from_byte;
-	}
-      /* Here's the case where a marker is inside text being deleted.  */
-      else if (charpos > from)
-	{
-	  m->charpos = from;
-	  m->bytepos = from_byte;
-	}
-    }
+  /* Markers moved to FROM may leave overlays out of order.  */
+  if (shift_markers_for_replace (from, from_byte, to, to_byte, 0, 0))
+    fix_start_end_in_overlays (from, from);
 }
 
-
+
 /* Adjust markers for an insertion that stretches from FROM / FROM_BYTE
    to TO / TO_BYTE.  We have to relocate the charpos of every marker
    that points after the insertion (but not their bytepos).
@@ -271,42 +271,12 @@ static void
 adjust_markers_for_insert (ptrdiff_t from, ptrdiff_t from_byte,
 			   ptrdiff_t to, ptrdiff_t to_byte, bool before_markers)
 {
-  struct Lisp_Marker *m;
-  bool adjusted = 0;
-  ptrdiff_t nchars = to - from;
-  ptrdiff_t nbytes = to_byte - from_byte;
-
   adjust_suspend_auto_hscroll (from, to);
-  for (m = BUF_MARKERS (current_buffer); m; m = m->next)
-    {
-      eassert (m->bytepos >= m->charpos
-	       && m->bytepos - m->charpos <= Z_BYTE - Z);
-
-      if (m->bytepos == from_byte)
-	{
-	  if (m->insertion_type || before_markers)
-	    {
-	      m->bytepos = to_byte;
-	      m->charpos = to;
-	      if (m->insertion_type)
-		adjusted = 1;
-	    }
-	}
-      else if (m->bytepos > from_byte)
-	{
-	  m->bytepos += nbytes;
-	  m->charpos += nchars;
-	}
-    }
 
   /* Adjusting only markers whose insertion-type is t may result in
-     - disordered start and end in overlays, and
-     - disordered overlays in the slot `overlays_before' of current_buffer.  */
-  if (adjusted)
-    {
-      fix_start_end_in_overlays (from, to);
-      fix_overlays_before (current_buffer, from, to);
-    }
+     disordered start and end in overlays.  */
+  if (shift_markers_for_insert (from, from_byte, to, to_byte, before_markers))
+    fix_start_end_in_overlays (from, to);
 }
 
 /* Adjust point for an insertion of NBYTES bytes, which are NCHARS characters.
@@ -337,30 +307,17 @@ adjust_markers_for_replace (ptrdiff_t from, ptrdiff_t from_byte,
 			    ptrdiff_t old_chars, ptrdiff_t old_bytes,
 			    ptrdiff_t new_chars, ptrdiff_t new_bytes)
 {
-  register struct Lisp_Marker *m;
-  ptrdiff_t prev_to_byte = from_byte + old_bytes;
-  ptrdiff_t diff_chars = new_chars - old_chars;
-  ptrdiff_t diff_bytes = new_bytes - old_bytes;
-
   adjust_suspend_auto_hscroll (from, from + old_chars);
-  for (m = BUF_MARKERS (current_buffer); m; m = m->next)
-    {
-      if (m->bytepos >= prev_to_byte)
-	{
-	  m->charpos += diff_chars;
-	  m->bytepos += diff_bytes;
-	}
-      else if (m->bytepos > from_byte)
-	{
-	  m->charpos = from;
-	  m->bytepos = from_byte;
-	}
-    }
+
+  /* Markers moved to FROM may leave overlays out of order.  */
+  if (shift_markers_for_replace (from, from_byte, from + old_chars,
+				 from_byte + old_bytes, new_chars, new_bytes))
+    fix_start_end_in_overlays (from, from);
 
   check_markers ();
 }
 
-
+
 void
 buffer_overflow (void)
 {
@@ -381,9 +338,12 @@ make_gap_larger (ptrdiff_t nbytes_added)
   if (BUF_BYTES_MAX - current_size < nbytes_added)
     buffer_overflow ();
 
-  /* If we have to get more space, get enough to last a while;
+  /* If we have to get more space, get enough to last a while, in
+     proportion to the size of the text so that scattered insertions
+     in a large buffer do not move all of it again and again;
      but do not exceed the maximum buffer size.  */
-  nbytes_added = min (nbytes_added + GAP_BYTES_DFL,
+  nbytes_added = min (nbytes_added + GAP_BYTES_DFL
+		      + current_size / GAP_FRACTION,
 		      BUF_BYTES_MAX - current_size);
 
   enlarge_buffer_text (current_buffer, nbytes_added);
@@ -415,7 +375,8 @@ make_gap_larger (ptrdiff_t nbytes_added)
   Vinhibit_quit = tem;
 }
 
-#if defined USE_MMAP_FOR_BUFFERS || defined REL_ALLOC || defined DOUG_LEA_MALLOC
+#if (defined USE_MMAP_FOR_BUFFERS || defined REL_ALLOC \
+     || defined DOUG_LEA_MALLOC || defined MMAP_LARGE_BUFFER_TEXT)
 
 /* Make the gap NBYTES_REMOVED bytes shorter.  */
 
@@ -456,7 +417,7 @@ make_gap_smaller (ptrdiff_t nbytes_removed)
   GAP_SIZE = nbytes_removed;
 
   /* Move the unwanted pretend gap to the end of the buffer.  */
-  gap_right (Z, Z_BYTE);
+  gap_right (Z, Z_BYTE, 1);
 
   enlarge_buffer_text (current_buffer, -nbytes_removed);
 
@@ -481,7 +442,8 @@ make_gap (ptrdiff_t nbytes_added)
 {
   if (nbytes_added >= 0)
     make_gap_larger (nbytes_added);
-#if defined USE_MMAP_FOR_BUFFERS || defined REL_ALLOC || defined DOUG_LEA_MALLOC
+#if (defined USE_MMAP_FOR_BUFFERS || defined REL_ALLOC \
+     || defined DOUG_LEA_MALLOC || defined MMAP_LARGE_BUFFER_TEXT)
   else
     make_gap_smaller (-nbytes_added);
 #endif
@@ -819,6 +781,7 @@ insert_1_both (const char *string,
   GPT_BYTE += nbytes;
   ZV_BYTE += nbytes;
   Z_BYTE += nbytes;
+  adjust_line_index_for_insert (current_buffer, GPT_BYTE - nbytes, GPT_BYTE);
   if (GAP_SIZE > 0) *(GPT_ADDR) = 0; /* Put an anchor.  */
 
   eassert (GPT <= GPT_BYTE);
@@ -827,7 +790,6 @@ insert_1_both (const char *string,
   if (Z - GPT < END_UNCHANGED)
     END_UNCHANGED = Z - GPT;
 
-  adjust_overlays_for_insert (PT, nchars);
   adjust_markers_for_insert (PT, PT_BYTE,
 			     PT + nchars, PT_BYTE + nbytes,
 			     before_markers);
@@ -948,6 +910,8 @@ insert_from_string_1 (Lisp_Object string, ptrdiff_t pos, ptrdiff_t pos_byte,
   GPT_BYTE += outgoing_nbytes;
   ZV_BYTE += outgoing_nbytes;
   Z_BYTE += outgoing_nbytes;
+  adjust_line_index_for_insert (current_buffer,
+				GPT_BYTE - outgoing_nbytes, GPT_BYTE);
   if (GAP_SIZE > 0) *(GPT_ADDR) = 0; /* Put an anchor.  */
 
   eassert (GPT <= GPT_BYTE);
@@ -956,7 +920,6 @@ insert_from_string_1 (Lisp_Object string, ptrdiff_t pos, ptrdiff_t pos_byte,
   if (Z - GPT < END_UNCHANGED)
     END_UNCHANGED = Z - GPT;
 
-  adjust_overlays_for_insert (PT, nchars);
   adjust_markers_for_insert (PT, PT_BYTE, PT + nchars,
 			     PT_BYTE + outgoing_nbytes,
 			     before_markers);
@@ -1007,11 +970,12 @@ insert_from_gap (ptrdiff_t nchars, ptrdiff_t nbytes, bool text_at_gap_tail)
   Z += nchars;
   ZV_BYTE += nbytes;
   Z_BYTE += nbytes;
+  adjust_line_index_for_insert (current_buffer,
+				ins_bytepos, ins_bytepos + nbytes);
   if (GAP_SIZE > 0) *(GPT_ADDR) = 0; /* Put an anchor.  */
 
   eassert (GPT <= GPT_BYTE);
 
-  adjust_overlays_for_insert (ins_charpos, nchars);
   adjust_markers_for_insert (ins_charpos, ins_bytepos,
 			     ins_charpos + nchars, ins_bytepos + nbytes, 0);
 
@@ -1145,6 +1109,8 @@ insert_from_buffer_1 (struct buffer *buf,
   GPT_BYTE += outgoing_nbytes;
   ZV_BYTE += outgoing_nbytes;
   Z_BYTE += outgoing_nbytes;
+  adjust_line_index_for_insert (current_buffer,
+				GPT_BYTE - outgoing_nbytes, GPT_BYTE);
   if (GAP_SIZE > 0) *(GPT_ADDR) = 0; /* Put an anchor.  */
 
   eassert (GPT <= GPT_BYTE);
@@ -1153,7 +1119,6 @@ insert_from_buffer_1 (struct buffer *buf,
   if (Z - GPT < END_UNCHANGED)
     END_UNCHANGED = Z - GPT;
 
-  adjust_overlays_for_insert (PT, nchars);
   adjust_markers_for_insert (PT, PT_BYTE, PT + nchars,
 			     PT_BYTE + outgoing_nbytes,
 			     0);
@@ -1205,6 +1170,7 @@ adjust_after_replace (ptrdiff_t from, ptrdiff_t from_byte,
   ZV += len; Z+= len;
   ZV_BYTE += len_byte; Z_BYTE += len_byte;
   GPT += len; GPT_BYTE += len_byte;
+  adjust_line_index_for_insert (current_buffer, from_byte, GPT_BYTE);
   if (GAP_SIZE > 0) *(GPT_ADDR) = 0; /* Put an anchor. */
 
   if (nchars_del > 0)
@@ -1218,11 +1184,6 @@ adjust_after_replace (ptrdiff_t from, ptrdiff_t from_byte,
     record_delete (from, prev_text, false);
   record_insert (from, len);
 
-  if (len > nchars_del)
-    adjust_overlays_for_insert (from, len - nchars_del);
-  else if (len < nchars_del)
-    adjust_overlays_for_delete (from, nchars_del - len);
-
   offset_intervals (current_buffer, from, len - nchars_del);
 
   if (from < PT)
@@ -1253,10 +1214,13 @@ adjust_after_insert (ptrdiff_t from, ptrdiff_t from_byte,
 
   if (GPT != to)
     move_gap_both (to, to_byte);
+  adjust_line_index_for_delete (current_buffer, from_byte, to_byte);
   GAP_SIZE += len_byte;
   GPT -= len; GPT_BYTE -= len_byte;
   ZV -= len; ZV_BYTE -= len_byte;
   Z -= len; Z_BYTE -= len_byte;
+  trim_position_index (current_buffer);
+  trim_line_index (current_buffer);
   adjust_after_replace (from, from_byte, Qnil, newlen, len_byte);
 }
 
@@ -1276,19 +1240,12 @@ void
 replace_range (ptrdiff_t from, ptrdiff_t to, Lisp_Object new,
 	       bool prepare, bool inherit, bool markers)
 {
-  ptrdiff_t inschars = SCHARS (new);
-  ptrdiff_t insbytes = SBYTES (new);
   ptrdiff_t from_byte, to_byte;
-  ptrdiff_t nbytes_del, nchars_del;
   struct gcpro gcpro1;
-  INTERVAL intervals;
-  ptrdiff_t outgoing_insbytes = insbytes;
-  Lisp_Object deletion;
 
   check_markers ();
 
   GCPRO1 (new);
-  deletion = Qnil;
 
   if (prepare)
     {
@@ -1308,6 +1265,36 @@ replace_range (ptrdiff_t from, ptrdiff_t to, Lisp_Object new,
   from_byte = CHAR_TO_BYTE (from);
   to_byte = CHAR_TO_BYTE (to);
 
+  if (to_byte - from_byte <= 0 && SBYTES (new) == 0)
+    return;
+
+  replace_range_1 (from, from_byte, to, to_byte, new, inherit, markers, 1);
+
+  signal_after_change (from, to - from, GPT - from);
+  update_compositions (from, GPT, CHECK_BORDER);
+}
+
+/* Do the work of replace_range, for the text from FROM / FROM_BYTE to
+   TO / TO_BYTE, which must be valid.  RECORD says whether to record
+   the change for undo.  Leave the gap just after the new text.
+
+   Unlike replace_range, never call prepare_to_modify_buffer, never
+   call signal_after_change and never update compositions, so that
+   callers can make several replacements look like one change.  */
+
+void
+replace_range_1 (ptrdiff_t from, ptrdiff_t from_byte,
+		 ptrdiff_t to, ptrdiff_t to_byte, Lisp_Object new,
+		 bool inherit, bool markers, bool record)
+{
+  ptrdiff_t inschars = SCHARS (new);
+  ptrdiff_t insbytes = SBYTES (new);
+  ptrdiff_t nbytes_del, nchars_del;
+  struct gcpro gcpro1;
+  INTERVAL intervals;
+  ptrdiff_t outgoing_insbytes = insbytes;
+  Lisp_Object deletion;
+
   nchars_del = to - from;
   nbytes_del = to_byte - from_byte;
 
@@ -1323,20 +1310,21 @@ replace_range (ptrdiff_t from, ptrdiff_t to, Lisp_Object new,
     outgoing_insbytes
       = count_size_as_multibyte (SDATA (new), insbytes);
 
+  deletion = Qnil;
   GCPRO1 (new);
 
   /* Make sure the gap is somewhere in or next to what we are deleting.  */
   if (from > GPT)
-    gap_right (from, from_byte);
+    gap_right (from, from_byte, 0);
   if (to < GPT)
     gap_left (to, to_byte, 0);
 
-  /* Even if we don't record for undo, we must keep the original text
-     because we may have to recover it because of inappropriate byte
-     combining.  */
-  if (! EQ (BVAR (current_buffer, undo_list), Qt))
+  /* Keep the original text for undo, unless the caller records the
+     change some other way.  */
+  if (record && ! EQ (BVAR (current_buffer, undo_list), Qt))
     deletion = make_buffer_string_both (from, from_byte, to, to_byte, 1);
 
+  adjust_line_index_for_delete (current_buffer, from_byte, to_byte);
   GAP_SIZE += nbytes_del;
   ZV -= nchars_del;
   Z -= nchars_del;
@@ -1344,6 +1332,8 @@ replace_range (ptrdiff_t from, ptrdiff_t to, Lisp_Object new,
   Z_BYTE -= nbytes_del;
   GPT = from;
   GPT_BYTE = from_byte;
+  trim_position_index (current_buffer);
+  trim_line_index (current_buffer);
   if (GAP_SIZE > 0) *(GPT_ADDR) = 0; /* Put an anchor.  */
 
   eassert (GPT <= GPT_BYTE);
@@ -1390,6 +1380,7 @@ replace_range (ptrdiff_t from, ptrdiff_t to, Lisp_Object new,
   GPT_BYTE += outgoing_insbytes;
   ZV_BYTE += outgoing_insbytes;
   Z_BYTE += outgoing_insbytes;
+  adjust_line_index_for_insert (current_buffer, from_byte, GPT_BYTE);
   if (GAP_SIZE > 0) *(GPT_ADDR) = 0; /* Put an anchor.  */
 
   eassert (GPT <= GPT_BYTE);
@@ -1399,11 +1390,6 @@ replace_range (ptrdiff_t from, ptrdiff_t to, Lisp_Object new,
     adjust_markers_for_replace (from, from_byte, nchars_del, nbytes_del,
 				inschars, outgoing_insbytes);
 
-  /* Adjust the overlay center as needed.  This must be done after
-     adjusting the markers that bound the overlays.  */
-  adjust_overlays_for_delete (from, nchars_del);
-  adjust_overlays_for_insert (from, inschars);
-
   offset_intervals (current_buffer, from, inschars - nchars_del);
 
   /* Get the intervals for the part of the string we are inserting--
@@ -1427,11 +1413,8 @@ replace_range (ptrdiff_t from, ptrdiff_t to, Lisp_Object new,
   MODIFF++;
   CHARS_MODIFF = MODIFF;
   UNGCPRO;
-
-  signal_after_change (from, nchars_del, GPT - from);
-  update_compositions (from, GPT, CHECK_BORDER);
 }
-
+
 /* Replace the text from character positions FROM to TO with
    the text in INS of length INSCHARS.
    Keep the text properties that applied to the old characters
@@ -1462,10 +1445,11 @@ replace_range_2 (ptrdiff_t from, ptrdiff_t from_byte,
 
   /* Make sure the gap is somewhere in or next to what we are deleting.  */
   if (from > GPT)
-    gap_right (from, from_byte);
+    gap_right (from, from_byte, 0);
   if (to < GPT)
     gap_left (to, to_byte, 0);
 
+  adjust_line_index_for_delete (current_buffer, from_byte, to_byte);
   GAP_SIZE += nbytes_del;
   ZV -= nchars_del;
   Z -= nchars_del;
@@ -1473,6 +1457,8 @@ replace_range_2 (ptrdiff_t from, ptrdiff_t from_byte,
   Z_BYTE -= nbytes_del;
   GPT = from;
   GPT_BYTE = from_byte;
+  trim_position_index (current_buffer);
+  trim_line_index (current_buffer);
   if (GAP_SIZE > 0) *(GPT_ADDR) = 0; /* Put an anchor.  */
 
   eassert (GPT <= GPT_BYTE);
@@ -1506,6 +1492,7 @@ replace_range_2 (ptrdiff_t from, ptrdiff_t from_byte,
   GPT_BYTE += insbytes;
   ZV_BYTE += insbytes;
   Z_BYTE += insbytes;
+  adjust_line_index_for_insert (current_buffer, from_byte, GPT_BYTE);
   if (GAP_SIZE > 0) *(GPT_ADDR) = 0; /* Put an anchor.  */
 
   eassert (GPT <= GPT_BYTE);
@@ -1516,14 +1503,6 @@ replace_range_2 (ptrdiff_t from, ptrdiff_t from_byte,
     adjust_markers_for_replace (from, from_byte, nchars_del, nbytes_del,
 				inschars, insbytes);
 
-  /* Adjust the overlay center as needed.  This must be done after
-     adjusting the markers that bound the overlays.  */
-  if (nchars_del != inschars)
-    {
-      adjust_overlays_for_insert (from, inschars);
-      adjust_overlays_for_delete (from + inschars, nchars_del);
-    }
-
   offset_intervals (current_buffer, from, inschars - nchars_del);
 
   /* Relocate point as if it were a marker.  */
@@ -1697,7 +1676,7 @@ del_range_2 (ptrdiff_t from, ptrdiff_t from_byte,
 
   /* Make sure the gap is somewhere in or next to what we are deleting.  */
   if (from > GPT)
-    gap_right (from, from_byte);
+    gap_right (from, from_byte, 0);
   if (to < GPT)
     gap_left (to, to_byte, 0);
 
@@ -1730,10 +1709,7 @@ del_range_2 (ptrdiff_t from, ptrdiff_t from_byte,
 
   offset_intervals (current_buffer, from, - nchars_del);
 
-  /* Adjust the overlay center as needed.  This must be done after
-     adjusting the markers that bound the overlays.  */
-  adjust_overlays_for_delete (from, nchars_del);
-
+  adjust_line_index_for_delete (current_buffer, from_byte, to_byte);
   GAP_SIZE += nbytes_del;
   ZV_BYTE -= nbytes_del;
   Z_BYTE -= nbytes_del;
@@ -1741,6 +1717,8 @@ del_range_2 (ptrdiff_t from, ptrdiff_t from_byte,
   Z -= nchars_del;
   GPT = from;
   GPT_BYTE = from_byte;
+  trim_position_index (current_buffer);
+  trim_line_index (current_buffer);
   if (GAP_SIZE > 0 && !current_buffer->text->inhibit_shrinking)
     /* Put an anchor, unless called from decode_coding_object which
        needs to access the previous gap contents.  */
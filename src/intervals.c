@@ -60,18 +60,24 @@ static INTERVAL reproduce_tree (INTERVAL, INTERVAL);
 
 /* Utility functions for intervals.  */
 
-/* Use these functions to set pointer slots of struct interval.  */
+/* Use these functions to set pointer slots of struct interval.
+   The property bits of the new child are added to those of I, so
+   that a node whose subtree grows can only gain bits.  */
 
 static void
 set_interval_left (INTERVAL i, INTERVAL left)
 {
   i->left = left;
+  if (left)
+    i->property_bits |= left->property_bits;
 }
 
 static void
 set_interval_right (INTERVAL i, INTERVAL right)
 {
   i->right = right;
+  if (right)
+    i->property_bits |= right->property_bits;
 }
 
 /* Make the parent of D be whatever the parent of S is, regardless
@@ -778,6 +784,162 @@ previous_interval (register INTERVAL interval)
   return NULL;
 }
 
+/* Add the bits for the property names of I's plist to the property
+   bits of I and its ancestors.  */
+
+void
+note_interval_plist (INTERVAL i)
+{
+  unsigned int bits = 0;
+  Lisp_Object tail;
+
+  for (tail = i->plist; CONSP (tail); tail = CDR (XCDR (tail)))
+    {
+      bits |= interval_property_bit (XCAR (tail));
+      if (!CONSP (XCDR (tail)))
+	break;
+    }
+
+  /* Ancestors always have all the bits of their children, so stop
+     at the first one that has these.  */
+  while ((i->property_bits & bits) != bits)
+    {
+      i->property_bits |= bits;
+      if (NULL_PARENT (i))
+	break;
+      i = INTERVAL_PARENT (i);
+    }
+}
+
+/* Return the property bits that could affect the value of the text
+   property PROP.  On text whose intervals have none of them, PROP has
+   the same value as where there are no properties at all.  */
+
+unsigned int
+property_search_bits (Lisp_Object prop)
+{
+  unsigned int bits = (interval_property_bit (prop)
+		       | interval_property_bit (Qcategory));
+  Lisp_Object tail = Fassq (prop, Vchar_property_alias_alist);
+
+  if (CONSP (tail))
+    for (tail = XCDR (tail); CONSP (tail); tail = XCDR (tail))
+      bits |= interval_property_bit (XCAR (tail));
+  return bits;
+}
+
+/* Return true if the properties of I itself may include one of BITS.  */
+
+static bool
+interval_may_have_bits (INTERVAL i, unsigned int bits)
+{
+  Lisp_Object tail;
+
+  for (tail = i->plist; CONSP (tail); tail = CDR (XCDR (tail)))
+    {
+      if (interval_property_bit (XCAR (tail)) & bits)
+	return true;
+      if (!CONSP (XCDR (tail)))
+	break;
+    }
+  return false;
+}
+
+/* Like next_interval, but skip the intervals whose properties have
+   none of BITS (see property_search_bits), passing over whole subtrees
+   of them at once.  If BITS is zero, skip nothing.  */
+
+INTERVAL
+next_interval_with_bits (INTERVAL interval, unsigned int bits)
+{
+  INTERVAL i = interval;
+  ptrdiff_t position;
+
+  if (!i || !bits)
+    return next_interval (i);
+  position = i->position + LENGTH (i);
+
+  /* Each iteration starts after the text of I and its left subtree.  */
+  while (true)
+    {
+      INTERVAL next = i->right;
+
+      if (next && (next->property_bits & bits))
+	{
+	  /* Go down to the first interval of the right subtree that
+	     may have them.  */
+	  while (next->left && (next->left->property_bits & bits))
+	    next = next->left;
+	  position += LEFT_TOTAL_LENGTH (next);
+	}
+      else
+	{
+	  /* Skip the right subtree and go up to the first ancestor
+	     that follows it.  */
+	  position += RIGHT_TOTAL_LENGTH (i);
+	  while (AM_RIGHT_CHILD (i))
+	    i = INTERVAL_PARENT (i);
+	  if (NULL_PARENT (i))
+	    return NULL;
+	  next = INTERVAL_PARENT (i);
+	}
+
+      i = next;
+      if (interval_may_have_bits (i, bits))
+	{
+	  i->position = position;
+	  return i;
+	}
+      position += LENGTH (i);
+    }
+}
+
+/* Like previous_interval, but skip the intervals whose properties
+   have none of BITS, passing over whole subtrees of them at once.
+   If BITS is zero, skip nothing.  */
+
+INTERVAL
+previous_interval_with_bits (INTERVAL interval, unsigned int bits)
+{
+  INTERVAL i = interval;
+  ptrdiff_t position;
+
+  if (!i || !bits)
+    return previous_interval (i);
+  position = i->position;
+
+  /* Each iteration starts before the text of I and its right subtree.
+     POSITION is the end of the next interval to look at.  */
+  while (true)
+    {
+      INTERVAL prev = i->left;
+
+      if (prev && (prev->property_bits & bits))
+	{
+	  while (prev->right && (prev->right->property_bits & bits))
+	    prev = prev->right;
+	  position -= RIGHT_TOTAL_LENGTH (prev);
+	}
+      else
+	{
+	  position -= LEFT_TOTAL_LENGTH (i);
+	  while (AM_LEFT_CHILD (i))
+	    i = INTERVAL_PARENT (i);
+	  if (NULL_PARENT (i))
+	    return NULL;
+	  prev = INTERVAL_PARENT (i);
+	}
+
+      i = prev;
+      position -= LENGTH (i);
+      if (interval_may_have_bits (i, bits))
+	{
+	  i->position = position;
+	  return i;
+	}
+    }
+}
+
 /* Find the interval containing POS given some non-NULL INTERVAL
    in the same tree.  Note that we need to update interval->position
    if we go down the tree.
@@ -1211,10 +1373,12 @@ delete_node (register INTERVAL i)
   migrate_amt = i->left->total_length;
   this = i->right;
   this->total_length += migrate_amt;
+  this->property_bits |= migrate->property_bits;
   while (this->left)
     {
       this = this->left;
       this->total_length += migrate_amt;
+      this->property_bits |= migrate->property_bits;
     }
   set_interval_left (this, migrate);
   set_interval_parent (migrate, this);
@@ -55,6 +55,12 @@ struct interval
   bool_bf front_sticky : 1;	    /* True means text inserted just
 				       before this interval goes into it.  */
   bool_bf rear_sticky : 1;	    /* Likewise for just after it.  */
+
+  /* The bits of interval_property_bit for the names of the properties
+     of this interval and its children.  This can have bits set that
+     it no longer needs, but never lacks one.  */
+  unsigned int property_bits;
+
   Lisp_Object plist;		    /* Other properties.  */
 };
 
@@ -148,10 +154,23 @@ set_interval_parent (INTERVAL i, INTERVAL parent)
   i->up.interval = parent;
 }
 
+/* Return the bit that stands for the property named PROP in the
+   property_bits of intervals.  */
+
+INLINE unsigned int
+interval_property_bit (Lisp_Object prop)
+{
+  return 1u << ((XHASH (prop) >> GCTYPEBITS) % 31);
+}
+
+extern void note_interval_plist (INTERVAL);
+
 INLINE void
 set_interval_plist (INTERVAL i, Lisp_Object plist)
 {
   i->plist = plist;
+  if (CONSP (plist))
+    note_interval_plist (i);
 }
 
 /* Get the parent interval, if any, otherwise a null pointer.  Useful
@@ -169,6 +188,7 @@ set_interval_plist (INTERVAL i, Lisp_Object plist)
   (i)->write_protect = false;		      \
   (i)->visible = false;			      \
   (i)->front_sticky = (i)->rear_sticky = false;	\
+  (i)->property_bits = 0;		      \
   set_interval_plist (i, Qnil);		      \
  } while (false)
 
@@ -244,6 +264,9 @@ extern INTERVAL split_interval_left (INTERVAL, ptrdiff_t);
 extern INTERVAL find_interval (INTERVAL, ptrdiff_t);
 extern INTERVAL next_interval (INTERVAL);
 extern INTERVAL previous_interval (INTERVAL);
+extern unsigned int property_search_bits (Lisp_Object);
+extern INTERVAL next_interval_with_bits (INTERVAL, unsigned int);
+extern INTERVAL previous_interval_with_bits (INTERVAL, unsigned int);
 extern INTERVAL merge_interval_left (INTERVAL);
 extern void offset_intervals (struct buffer *, ptrdiff_t, ptrdiff_t);
 extern void graft_intervals_into_buffer (INTERVAL, ptrdiff_t, ptrdiff_t,
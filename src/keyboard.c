@@ -1564,6 +1564,9 @@ command_loop_1 (void)
 		last_undo_boundary
 		  = (EQ (undo, BVAR (current_buffer, undo_list))
 		     ? Qnil : BVAR (current_buffer, undo_list));
+		/* The previous command is over; pack its changes if
+		   there are many of them.  */
+		pack_undo_group (current_buffer);
 	      }
             call1 (Qcommand_execute, Vthis_command);
 
@@ -1871,7 +1871,7 @@ struct Lisp_Marker
 {
   ENUM_BF (Lisp_Misc_Type) type : 16;		/* = Lisp_Misc_Marker */
   bool_bf gcmarkbit : 1;
-  unsigned spacer : 13;
+  unsigned spacer : 5;
   /* This flag is temporarily used in the functions
      decode/encode_coding_object to record that the marker position
      must be adjusted after the conversion.  */
@@ -1879,14 +1879,16 @@ struct Lisp_Marker
   /* True means normal insertion at the marker's position
      leaves the marker after the inserted text.  */
   bool_bf insertion_type : 1;
+  /* Height of the subtree rooted at this marker in its marker tree.  */
+  unsigned height : 8;
   /* This is the buffer that the marker points into, or 0 if it points nowhere.
-     Note: a chain of markers can contain markers pointing into different
-     buffers (the chain is per buffer_text rather than per buffer, so it's
+     Note: a marker tree can contain markers pointing into different
+     buffers (the tree is per buffer_text rather than per buffer, so it's
      shared between indirect buffers).  */
   /* This is used for (other than NULL-checking):
      - Fmarker_buffer
      - Fset_marker: check eq(oldbuf, newbuf) to avoid unchain+rechain.
-     - unchain_marker: to find the list from which to unchain.
+     - unchain_marker: to find the tree from which to unchain.
      - Fkill_buffer: to only unchain the markers of current indirect buffer.
      */
   struct buffer *buffer;
@@ -1894,20 +1896,45 @@ struct Lisp_Marker
   /* The remaining fields are meaningless in a marker that
      does not point anywhere.  */
 
-  /* For markers that point somewhere,
-     this is used to chain of all the markers in a given buffer.  */
-  /* We could remove it and use an array in buffer_text instead.
-     That would also allow to preserve it ordered.  */
-  struct Lisp_Marker *next;
-  /* This is the char position where the marker points.  */
-  ptrdiff_t charpos;
-  /* This is the byte position.
-     It's mostly used as a charpos<->bytepos cache (i.e. it's not directly
-     used to implement the functionality of markers, but rather to (ab)use
-     markers as a cache for char<->byte mappings).  */
-  ptrdiff_t bytepos;
+  /* For markers that point somewhere, these link the marker into a
+     balanced tree of all the markers in a given buffer, ordered by
+     position.  */
+  struct Lisp_Marker *parent, *left, *right;
+  /* The char and byte positions where the marker points, minus those
+     of its parent in the tree; for the root, the positions themselves.
+     Keeping them relative lets an insertion or deletion relocate all
+     the markers after it by adjusting only the markers along one path.
+     Use marker_charpos and marker_bytepos to get the positions.
+     The byte position is mostly used as a charpos<->bytepos cache
+     (i.e. it's not directly used to implement the functionality of
+     markers, but rather to (ab)use markers as a cache for char<->byte
+     mappings).  */
+  ptrdiff_t char_offset;
+  ptrdiff_t byte_offset;
 };
 
+/* Return the char position of M, which must point somewhere.  */
+
+INLINE ptrdiff_t
+marker_charpos (struct Lisp_Marker *m)
+{
+  ptrdiff_t pos = 0;
+  for (; m; m = m->parent)
+    pos += m->char_offset;
+  return pos;
+}
+
+/* Return the byte position of M, which must point somewhere.  */
+
+INLINE ptrdiff_t
+marker_bytepos (struct Lisp_Marker *m)
+{
+  ptrdiff_t pos = 0;
+  for (; m; m = m->parent)
+    pos += m->byte_offset;
+  return pos;
+}
+
 /* START and END are markers in the overlay's buffer, and
    PLIST is the overlay's property list.  */
 struct Lisp_Overlay
@@ -1918,15 +1945,15 @@ struct Lisp_Overlay
    - insertion type of both ends (per-marker fields)
    - start & start byte (of start marker)
    - end & end byte (of end marker)
-   - next (singly linked list of overlays)
-   - next fields of start and end markers (singly linked list of markers).
-   I.e. 9words plus 2 bits, 3words of which are for external linked lists.
+   - node (the overlay's node in its buffer's overlay tree)
+   - tree fields of start and end markers (balanced tree of markers).
+   I.e. 13words plus 2 bits, 7words of which are for external structures.
 */
   {
     ENUM_BF (Lisp_Misc_Type) type : 16;	/* = Lisp_Misc_Overlay */
     bool_bf gcmarkbit : 1;
     unsigned spacer : 15;
-    struct Lisp_Overlay *next;
+    struct overlay_node *node;
     Lisp_Object start;
     Lisp_Object end;
     Lisp_Object plist;
@@ -3503,6 +3530,7 @@ extern Lisp_Object nconc2 (Lisp_Object, Lisp_Object);
 extern Lisp_Object assq_no_quit (Lisp_Object, Lisp_Object);
 extern Lisp_Object assoc_no_quit (Lisp_Object, Lisp_Object);
 extern void clear_string_char_byte_cache (void);
+extern void sweep_string_indexes (void);
 extern ptrdiff_t string_char_to_byte (Lisp_Object, ptrdiff_t);
 extern ptrdiff_t string_byte_to_char (Lisp_Object, ptrdiff_t);
 extern Lisp_Object string_to_multibyte (Lisp_Object);
@@ -3572,6 +3600,8 @@ extern void adjust_after_insert (ptrdiff_t, ptrdiff_t, ptrdiff_t,
 extern void adjust_markers_for_delete (ptrdiff_t, ptrdiff_t,
 				       ptrdiff_t, ptrdiff_t);
 extern void replace_range (ptrdiff_t, ptrdiff_t, Lisp_Object, bool, bool, bool);
+extern void replace_range_1 (ptrdiff_t, ptrdiff_t, ptrdiff_t, ptrdiff_t,
+			     Lisp_Object, bool, bool, bool);
 extern void replace_range_2 (ptrdiff_t, ptrdiff_t, ptrdiff_t, ptrdiff_t,
 			     const char *, ptrdiff_t, ptrdiff_t, bool);
 extern void syms_of_insdel (void);
@@ -3641,6 +3671,8 @@ extern void parse_str_as_multibyte (const unsigned char *, ptrdiff_t,
 extern void check_pure_size (void);
 extern void free_misc (Lisp_Object);
 extern void allocate_string_data (struct Lisp_String *, EMACS_INT, EMACS_INT);
+extern Lisp_Object make_shared_substring (Lisp_Object, ptrdiff_t, ptrdiff_t);
+extern void unshare_string_data (Lisp_Object);
 extern void malloc_warning (const char *);
 extern _Noreturn void memory_full (size_t);
 extern _Noreturn void buffer_memory_full (ptrdiff_t);
@@ -3847,6 +3879,77 @@ extern Lisp_Object internal_with_output_to_temp_buffer
         (const char *, Lisp_Object (*) (Lisp_Object), Lisp_Object);
 #define FLOAT_TO_STRING_BUFSIZE 350
 extern int float_to_string (char *, double);
+
+/* Tags of the binary encoding of Lisp objects.  print.c writes it and
+   lread.c reads it back.  Each object starts with one of these bytes;
+   integers and lengths that follow are unsigned LEB128 varints.  */
+enum binary_tag
+  {
+    BIN_NIL,			/* nil */
+    BIN_T,			/* t */
+    BIN_INT,			/* zigzag-encoded fixnum */
+    BIN_FLOAT,			/* 8 bytes, IEEE double, little endian */
+    BIN_SYMBOL,			/* index into the symbol table */
+    BIN_UNINTERNED,		/* name: NCHARS NBYTES BYTES */
+    BIN_STRING,			/* unibyte string: NBYTES BYTES */
+    BIN_MSTRING,		/* multibyte string: NCHARS NBYTES BYTES */
+    BIN_PROPS,			/* string, then N (BEG END PLIST) triples */
+    BIN_LIST,			/* N conses: N cars, then the final cdr */
+    BIN_VECTOR,			/* N elements */
+    BIN_BYTECODE,		/* N elements of a byte-code object */
+    BIN_BOOL_VECTOR,		/* NBITS, then the bytes */
+    BIN_CHAR_TABLE,		/* N slots */
+    BIN_SUB_CHAR_TABLE,		/* DEPTH MIN-CHAR, then the slots */
+    BIN_DEF,			/* the next object gets the next label */
+    BIN_REF,			/* LABEL of an object already read */
+    BIN_LOAD_FILE_NAME,		/* `#$' when reading a .elc file */
+    BIN_LAZY,			/* NBYTES of lazily read bytecode, constants */
+    BIN_HASH_TABLE		/* TEST WEAK SIZE REHASH-SIZE REHASH-THRESHOLD
+				   COUNT, then COUNT keys and values */
+  };
+
+/* The magic bytes and format version that start the data written by
+   `serialize-object'.  */
+#define SERIALIZED_MAGIC "\0ELD\1"
+
+/* State of an encoding in progress.  */
+struct binary_output
+{
+  /* The encoded bytes.  */
+  unsigned char *buf;
+  ptrdiff_t size, len;
+
+  /* Hash table mapping objects that may be shared to nil if seen
+     once, t if seen more than once, or their label once written.
+     NSHARED counts the objects seen more than once; when it is zero,
+     writing need not look anything up in the table.  */
+  Lisp_Object seen;
+  ptrdiff_t nshared, nlabels;
+
+  /* Hash table mapping interned symbols to their index in the symbol
+     table, and the symbols in reverse order.  */
+  Lisp_Object symbols, symbol_list;
+  ptrdiff_t nsymbols;
+
+  /* Object to write as BIN_LOAD_FILE_NAME, or nil.  */
+  Lisp_Object load_file_name;
+
+  /* Write byte-code objects whose bytecode string has at least this
+     many bytes as BIN_LAZY, or never if zero.  */
+  ptrdiff_t lazy_threshold;
+  bool in_lazy;
+};
+
+extern void binary_output_init (struct binary_output *, Lisp_Object,
+				ptrdiff_t);
+extern void binary_output_free (void *);
+extern void binary_output_byte (struct binary_output *, int);
+extern void binary_output_uint (struct binary_output *, EMACS_UINT);
+extern void binary_output_object (struct binary_output *, Lisp_Object);
+extern void binary_output_symbols (struct binary_output *,
+				   struct binary_output *);
+extern void binary_output_write_file (Lisp_Object, struct binary_output *,
+				      struct binary_output *);
 extern void init_print_once (void);
 extern void syms_of_print (void);
 
@@ -3880,6 +3983,7 @@ LOADHIST_ATTACH (Lisp_Object x)
 extern int openp (Lisp_Object, Lisp_Object, Lisp_Object,
                   Lisp_Object *, Lisp_Object, bool);
 extern Lisp_Object string_to_number (char const *, int, bool);
+extern Lisp_Object read_lazy_bytecode (Lisp_Object);
 extern void map_obarray (Lisp_Object, void (*) (Lisp_Object, Lisp_Object),
                          Lisp_Object);
 extern void dir_warning (const char *, Lisp_Object);
@@ -3988,6 +4092,8 @@ extern _Noreturn void time_overflow (void);
 extern Lisp_Object make_buffer_string (ptrdiff_t, ptrdiff_t, bool);
 extern Lisp_Object make_buffer_string_both (ptrdiff_t, ptrdiff_t, ptrdiff_t,
 					    ptrdiff_t, bool);
+extern bool replace_range_minimally (ptrdiff_t, ptrdiff_t, Lisp_Object,
+				     ptrdiff_t, ptrdiff_t, ptrdiff_t, bool);
 extern void init_editfns (void);
 extern void syms_of_editfns (void);
 extern void set_time_zone_rule (const char *);
@@ -3995,8 +4101,6 @@ extern void set_time_zone_rule (const char *);
 /* Defined in buffer.c.  */
 extern bool mouse_face_overlay_overlaps (Lisp_Object);
 extern _Noreturn void nsberror (Lisp_Object);
-extern void adjust_overlays_for_insert (ptrdiff_t, ptrdiff_t);
-extern void adjust_overlays_for_delete (ptrdiff_t, ptrdiff_t);
 extern void fix_start_end_in_overlays (ptrdiff_t, ptrdiff_t);
 extern void report_overlay_modification (Lisp_Object, Lisp_Object, bool,
                                          Lisp_Object, Lisp_Object, Lisp_Object);
@@ -4013,9 +4117,27 @@ extern void keys_of_buffer (void);
 extern ptrdiff_t marker_position (Lisp_Object);
 extern ptrdiff_t marker_byte_position (Lisp_Object);
 extern void clear_charpos_cache (struct buffer *);
+extern void clear_position_index (struct buffer *);
+extern void move_position_index_gap (struct buffer *);
+extern void trim_position_index (struct buffer *);
+extern void forget_position_checkpoints (struct buffer *, ptrdiff_t, ptrdiff_t);
 extern ptrdiff_t buf_charpos_to_bytepos (struct buffer *, ptrdiff_t);
 extern ptrdiff_t buf_bytepos_to_charpos (struct buffer *, ptrdiff_t);
 extern void unchain_marker (struct Lisp_Marker *marker);
+extern void unchain_all_markers (struct buffer *);
+extern void attach_marker (struct Lisp_Marker *, struct buffer *,
+			   ptrdiff_t, ptrdiff_t);
+extern void set_marker_insertion_type (struct Lisp_Marker *, bool);
+extern struct Lisp_Marker *marker_tree_first (struct buffer *, bool,
+					      ptrdiff_t);
+extern struct Lisp_Marker *marker_tree_next (struct Lisp_Marker *);
+extern struct Lisp_Marker *first_marker (struct buffer *);
+extern struct Lisp_Marker *next_marker (struct buffer *, struct Lisp_Marker *);
+extern bool shift_markers_for_insert (ptrdiff_t, ptrdiff_t, ptrdiff_t,
+				      ptrdiff_t, bool);
+extern bool shift_markers_for_replace (ptrdiff_t, ptrdiff_t, ptrdiff_t,
+				       ptrdiff_t, ptrdiff_t, ptrdiff_t);
+extern void set_marker_tree_absolute (struct Lisp_Marker *, bool);
 extern Lisp_Object set_marker_restricted (Lisp_Object, Lisp_Object, Lisp_Object);
 extern Lisp_Object set_marker_both (Lisp_Object, Lisp_Object, ptrdiff_t, ptrdiff_t);
 extern Lisp_Object set_marker_restricted_both (Lisp_Object, Lisp_Object,
@@ -4051,6 +4173,7 @@ extern Lisp_Object Qdelete_file;
 
 /* Defined in search.c.  */
 extern void shrink_regexp_cache (void);
+extern void mark_regexp_cache (void);
 extern void restore_search_regs (void);
 extern void record_unwind_save_match_data (void);
 struct re_registers;
@@ -4063,6 +4186,20 @@ extern ptrdiff_t fast_c_string_match_ignore_case (Lisp_Object, const char *,
 extern ptrdiff_t fast_string_match_ignore_case (Lisp_Object, Lisp_Object);
 extern ptrdiff_t fast_looking_at (Lisp_Object, ptrdiff_t, ptrdiff_t,
                                   ptrdiff_t, ptrdiff_t, Lisp_Object);
+extern ptrdiff_t memcount_newlines (unsigned char const *, ptrdiff_t);
+extern ptrdiff_t skip_lines_forward (unsigned char const *, ptrdiff_t,
+				     ptrdiff_t *);
+extern ptrdiff_t skip_lines_backward (unsigned char const *, ptrdiff_t,
+				      ptrdiff_t *);
+extern void clear_line_index (struct buffer *);
+extern void move_line_index_gap (struct buffer *);
+extern void trim_line_index (struct buffer *);
+extern void forget_line_checkpoints (struct buffer *, ptrdiff_t, ptrdiff_t);
+extern void adjust_line_index_for_insert (struct buffer *,
+					  ptrdiff_t, ptrdiff_t);
+extern void adjust_line_index_for_delete (struct buffer *,
+					  ptrdiff_t, ptrdiff_t);
+extern ptrdiff_t count_newlines_indexed (ptrdiff_t, ptrdiff_t, ptrdiff_t);
 extern ptrdiff_t find_newline (ptrdiff_t, ptrdiff_t, ptrdiff_t, ptrdiff_t,
 			       ptrdiff_t, ptrdiff_t *, ptrdiff_t *, bool);
 extern ptrdiff_t scan_newline (ptrdiff_t, ptrdiff_t, ptrdiff_t, ptrdiff_t,
@@ -4255,10 +4392,13 @@ extern void syms_of_macros (void);
 extern Lisp_Object Qapply;
 extern Lisp_Object Qinhibit_read_only;
 extern void truncate_undo_list (struct buffer *);
+extern void pack_undo_group (struct buffer *);
+extern Lisp_Object packed_undo_args (Lisp_Object);
 extern void record_insert (ptrdiff_t, ptrdiff_t);
 extern void record_delete (ptrdiff_t, Lisp_Object, bool);
 extern void record_first_change (void);
 extern void record_change (ptrdiff_t, ptrdiff_t);
+extern void record_undo_function (ptrdiff_t, Lisp_Object, Lisp_Object);
 extern void record_property_change (ptrdiff_t, ptrdiff_t,
 				    Lisp_Object, Lisp_Object,
                                     Lisp_Object);
@@ -4414,6 +4554,12 @@ extern void xml_cleanup_parser (void);
 
 #ifdef HAVE_ZLIB
 /* Defined in decompress.c.  */
+extern unsigned char *zlib_compress_text (unsigned char const *, ptrdiff_t,
+					  unsigned char const *, ptrdiff_t,
+					  ptrdiff_t, ptrdiff_t *);
+extern bool zlib_uncompress_text (unsigned char const *, ptrdiff_t,
+				  unsigned char *, ptrdiff_t,
+				  unsigned char *, ptrdiff_t);
 extern void syms_of_decompress (void);
 #endif
 
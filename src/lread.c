@@ -25,6 +25,7 @@ along with GNU Emacs.  If not, see <http://www.gnu.org/licenses/>.  */
 #include <sys/stat.h>
 #include <sys/file.h>
 #include <errno.h>
+#include <float.h>
 #include <limits.h>	/* For CHAR_BIT.  */
 #include <stat-time.h>
 #include "lisp.h"
@@ -56,6 +57,10 @@ along with GNU Emacs.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include <fcntl.h>
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
 #ifdef HAVE_FSEEKO
 #define file_offset off_t
 #define file_tell ftello
@@ -145,6 +150,35 @@ static int read_emacs_mule_char (int, int (*) (int, Lisp_Object),
 static void readevalloop (Lisp_Object, FILE *, Lisp_Object, bool,
                           Lisp_Object, Lisp_Object,
                           Lisp_Object, Lisp_Object);
+
+/* A binary compiled file opened for reading; see elb_open.  */
+
+struct elb_file
+{
+  /* The file name, as a Lisp string.  */
+  Lisp_Object file;
+
+  /* The contents of the file, and whether they are mmapped rather
+     than read into memory from the heap.  */
+  unsigned char *data;
+  ptrdiff_t size;
+  bool mapped;
+
+  /* The encoded forms, their number and total size.  */
+  unsigned char const *body;
+  ptrdiff_t body_len;
+  EMACS_INT nforms;
+
+  /* Vector of the symbols the forms refer to.  */
+  Lisp_Object symbols;
+
+  /* A number identifying the .elc file that this was written from.  */
+  EMACS_INT stamp;
+};
+
+static bool elb_open (struct elb_file *, Lisp_Object, struct stat const *);
+static void elb_close (void *);
+static void elb_evalloop (struct elb_file *, Lisp_Object);
 
 /* Functions that read one byte from the current source READCHARFUN
    or unreads one byte.  If the integer argument C is -1, it returns
@@ -201,6 +235,8 @@ readchar (Lisp_Object readcharfun, bool *multibyte)
       if (pt_byte >= BUF_ZV_BYTE (inbuffer))
 	return -1;
 
+      ensure_buffer_text (inbuffer);
+
       if (! NILP (BVAR (inbuffer, enable_multibyte_characters)))
 	{
 	  /* Fetch the character code from the buffer.  */
@@ -230,6 +266,8 @@ readchar (Lisp_Object readcharfun, bool *multibyte)
       if (bytepos >= BUF_ZV_BYTE (inbuffer))
 	return -1;
 
+      ensure_buffer_text (inbuffer);
+
       if (! NILP (BVAR (inbuffer, enable_multibyte_characters)))
 	{
 	  /* Fetch the character code from the buffer.  */
@@ -247,8 +285,8 @@ readchar (Lisp_Object readcharfun, bool *multibyte)
 	  bytepos++;
 	}
 
-      XMARKER (readcharfun)->bytepos = bytepos;
-      XMARKER (readcharfun)->charpos++;
+      attach_marker (XMARKER (readcharfun), inbuffer,
+		     marker_charpos (XMARKER (readcharfun)) + 1, bytepos);
 
       return c;
     }
@@ -412,15 +450,15 @@ unreadchar (Lisp_Object readcharfun, int c)
   else if (MARKERP (readcharfun))
     {
       struct buffer *b = XMARKER (readcharfun)->buffer;
-      ptrdiff_t bytepos = XMARKER (readcharfun)->bytepos;
+      ptrdiff_t bytepos = marker_bytepos (XMARKER (readcharfun));
 
-      XMARKER (readcharfun)->charpos--;
       if (! NILP (BVAR (b, enable_multibyte_characters)))
 	BUF_DEC_POS (b, bytepos);
       else
 	bytepos--;
 
-      XMARKER (readcharfun)->bytepos = bytepos;
+      attach_marker (XMARKER (readcharfun), b,
+		     marker_charpos (XMARKER (readcharfun)) - 1, bytepos);
     }
   else if (STRINGP (readcharfun))
     {
@@ -1053,6 +1091,9 @@ Return t if the file exists and loads successfully.  */)
   bool newer = 0;
   /* True means we are loading a compiled file.  */
   bool compiled = 0;
+  /* True means we are evaluating the forms of its binary counterpart.  */
+  bool binary = 0;
+  struct elb_file elb;
   Lisp_Object handler;
   bool safe_p = 1;
   const char *fmode = "r";
@@ -1356,7 +1397,29 @@ Return t if the file exists and loads successfully.  */)
   if (lisp_file_lexically_bound_p (Qget_file_char))
     Fset (Qlexical_binding, Qt);
 
-  if (! version || version >= 22)
+  /* If FOUND is a .elc file with an up-to-date binary counterpart,
+     evaluate the forms from that instead of reading them.  */
+  if (compiled && version >= 22 && load_binary_compiled_files
+      && NILP (Vpurify_flag) && NILP (Vload_read_function)
+      && !load_force_doc_strings
+      && !memcmp (SDATA (found) + SBYTES (found) - 4, ".elc", 4))
+    {
+      struct stat st;
+      Lisp_Object elb_file = Fcopy_sequence (found);
+
+      unshare_string_data (elb_file);
+      SSET (elb_file, SBYTES (elb_file) - 1, 'b');
+      if (fstat (fileno (stream), &st) == 0
+	  && elb_open (&elb, elb_file, &st))
+	{
+	  record_unwind_protect_ptr (elb_close, &elb);
+	  binary = 1;
+	}
+    }
+
+  if (binary)
+    elb_evalloop (&elb, hist_file_name);
+  else if (! version || version >= 22)
     readevalloop (Qget_file_char, stream, hist_file_name,
 		  0, Qnil, Qnil, Qnil, Qnil);
   else
@@ -1984,6 +2047,859 @@ readevalloop (Lisp_Object readcharfun,
   unbind_to (count, Qnil);
 }
 
+/* Reading the binary encoding of Lisp objects written by print.c.  */
+
+struct binary_input
+{
+  /* The data to read, the next byte to read, and the end.  */
+  unsigned char const *start, *p, *end;
+
+  /* Vector of the symbols that BIN_SYMBOL refers to.  */
+  Lisp_Object symbols;
+
+  /* Vector of the objects that BIN_REF refers to, the number of
+     labels used so far, and the label of the object being read, or -1
+     if there is none.  */
+  Lisp_Object labels;
+  ptrdiff_t nlabels, pending_label;
+
+  /* The object that BIN_LOAD_FILE_NAME stands for.  */
+  Lisp_Object load_file_name;
+
+  /* If non-nil, the name of the binary compiled file being read and
+     its stamp; BIN_LAZY is valid only in that case.  */
+  Lisp_Object lazy_file;
+  EMACS_INT lazy_stamp;
+};
+
+static void
+binary_input_init (struct binary_input *in, unsigned char const *start,
+		   ptrdiff_t nbytes, Lisp_Object symbols)
+{
+  in->start = in->p = start;
+  in->end = start + nbytes;
+  in->symbols = symbols;
+  in->labels = Qnil;
+  in->nlabels = 0;
+  in->pending_label = -1;
+  in->load_file_name = Qnil;
+  in->lazy_file = Qnil;
+  in->lazy_stamp = 0;
+}
+
+static _Noreturn void
+binary_invalid (void)
+{
+  error ("Invalid binary Lisp data");
+}
+
+static int
+binary_read_byte (struct binary_input *in)
+{
+  if (in->p == in->end)
+    binary_invalid ();
+  return *in->p++;
+}
+
+static EMACS_UINT
+binary_read_uint (struct binary_input *in)
+{
+  EMACS_UINT n = 0;
+  int shift = 0;
+  int c;
+
+  do
+    {
+      if (shift >= sizeof n * CHAR_BIT)
+	binary_invalid ();
+      c = binary_read_byte (in);
+      n |= (EMACS_UINT) (c & 0x7f) << shift;
+      shift += 7;
+    }
+  while (c & 0x80);
+  return n;
+}
+
+/* Read a count of things that are each encoded in at least one byte,
+   and check that they fit in the data that is left.  */
+
+static ptrdiff_t
+binary_read_count (struct binary_input *in)
+{
+  EMACS_UINT n = binary_read_uint (in);
+  if (n > in->end - in->p)
+    binary_invalid ();
+  return n;
+}
+
+/* Give OBJ the label that BIN_DEF announced, if any.  */
+
+static void
+binary_register (struct binary_input *in, Lisp_Object obj)
+{
+  if (in->pending_label >= 0)
+    {
+      ASET (in->labels, in->pending_label, obj);
+      in->pending_label = -1;
+    }
+}
+
+/* Read the text of a string whose TAG has just been read.  */
+
+static Lisp_Object
+binary_read_string (struct binary_input *in, int tag)
+{
+  ptrdiff_t nchars, nbytes;
+  char const *p;
+  Lisp_Object obj;
+
+  if (tag == BIN_MSTRING)
+    {
+      nchars = binary_read_count (in);
+      nbytes = binary_read_count (in);
+      p = (char const *) in->p;
+      if (nchars > nbytes
+	  || multibyte_chars_in_text (in->p, nbytes) != nchars)
+	binary_invalid ();
+      obj = make_multibyte_string (p, nchars, nbytes);
+    }
+  else if (tag == BIN_STRING)
+    {
+      nbytes = binary_read_count (in);
+      obj = make_unibyte_string ((char const *) in->p, nbytes);
+    }
+  else
+    binary_invalid ();
+  in->p += nbytes;
+  binary_register (in, obj);
+  return obj;
+}
+
+static Lisp_Object
+binary_read_object (struct binary_input *in)
+{
+  int tag = binary_read_byte (in);
+  ptrdiff_t i, n;
+  Lisp_Object obj;
+
+  switch (tag)
+    {
+    case BIN_NIL:
+      return Qnil;
+
+    case BIN_T:
+      return Qt;
+
+    case BIN_INT:
+      {
+	EMACS_UINT u = binary_read_uint (in);
+	EMACS_INT v = u & 1 ? ~ (EMACS_INT) (u >> 1) : (EMACS_INT) (u >> 1);
+	if (FIXNUM_OVERFLOW_P (v))
+	  binary_invalid ();
+	return make_number (v);
+      }
+
+    case BIN_FLOAT:
+      {
+	union { double d; uint64_t u; } u;
+	if (in->end - in->p < 8)
+	  binary_invalid ();
+	u.u = 0;
+	for (i = 0; i < 8; i++)
+	  u.u |= (uint64_t) in->p[i] << (8 * i);
+	in->p += 8;
+	return make_float (u.d);
+      }
+
+    case BIN_SYMBOL:
+      n = binary_read_uint (in);
+      if (! (0 <= n && n < ASIZE (in->symbols)))
+	binary_invalid ();
+      return AREF (in->symbols, n);
+
+    case BIN_UNINTERNED:
+      {
+	ptrdiff_t nchars = binary_read_count (in);
+	ptrdiff_t nbytes = binary_read_count (in);
+	if (nchars > nbytes)
+	  binary_invalid ();
+	obj = Fmake_symbol (make_specified_string ((char const *) in->p,
+						   nchars, nbytes,
+						   nchars < nbytes));
+	in->p += nbytes;
+	binary_register (in, obj);
+	return obj;
+      }
+
+    case BIN_STRING:
+    case BIN_MSTRING:
+      return binary_read_string (in, tag);
+
+    case BIN_PROPS:
+      obj = binary_read_string (in, binary_read_byte (in));
+      for (n = binary_read_count (in); n > 0; n--)
+	{
+	  EMACS_UINT beg = binary_read_uint (in);
+	  EMACS_UINT end = binary_read_uint (in);
+	  Lisp_Object plist;
+	  if (! (beg < end && end <= SCHARS (obj)))
+	    binary_invalid ();
+	  plist = binary_read_object (in);
+	  Fset_text_properties (make_number (beg), make_number (end),
+				plist, obj);
+	}
+      return obj;
+
+    case BIN_LIST:
+      {
+	Lisp_Object tail;
+	n = binary_read_count (in);
+	if (n == 0)
+	  binary_invalid ();
+	obj = tail = Fcons (Qnil, Qnil);
+	binary_register (in, obj);
+	for (i = 0; i < n; i++)
+	  {
+	    if (i > 0)
+	      {
+		Lisp_Object cell = Fcons (Qnil, Qnil);
+		XSETCDR (tail, cell);
+		tail = cell;
+	      }
+	    XSETCAR (tail, binary_read_object (in));
+	  }
+	XSETCDR (tail, binary_read_object (in));
+	return obj;
+      }
+
+    case BIN_VECTOR:
+    case BIN_BYTECODE:
+    case BIN_CHAR_TABLE:
+      n = binary_read_count (in);
+      if ((tag == BIN_BYTECODE && n == 0)
+	  || (tag == BIN_CHAR_TABLE && n < CHAR_TABLE_STANDARD_SLOTS))
+	binary_invalid ();
+      obj = Fmake_vector (make_number (n), Qnil);
+      if (tag == BIN_CHAR_TABLE)
+	XSETPVECTYPE (XVECTOR (obj), PVEC_CHAR_TABLE);
+      binary_register (in, obj);
+      for (i = 0; i < n; i++)
+	ASET (obj, i, binary_read_object (in));
+      if (tag == BIN_BYTECODE)
+	make_byte_code (XVECTOR (obj));
+      return obj;
+
+    case BIN_SUB_CHAR_TABLE:
+      {
+	EMACS_UINT depth = binary_read_uint (in);
+	EMACS_UINT min_char = binary_read_uint (in);
+	if (! (1 <= depth && depth <= 3 && min_char <= MAX_CHAR))
+	  binary_invalid ();
+	obj = make_uninit_sub_char_table (depth, min_char);
+	n = chartab_size[depth];
+	for (i = 0; i < n; i++)
+	  XSUB_CHAR_TABLE (obj)->contents[i] = Qnil;
+	binary_register (in, obj);
+	for (i = 0; i < n; i++)
+	  XSUB_CHAR_TABLE (obj)->contents[i] = binary_read_object (in);
+	return obj;
+      }
+
+    case BIN_BOOL_VECTOR:
+      {
+	EMACS_UINT nbits = binary_read_uint (in);
+	ptrdiff_t nbytes;
+	if (nbits > MOST_POSITIVE_FIXNUM)
+	  binary_invalid ();
+	nbytes = bool_vector_bytes (nbits);
+	if (nbytes > in->end - in->p)
+	  binary_invalid ();
+	obj = make_uninit_bool_vector (nbits);
+	memcpy (bool_vector_uchar_data (obj), in->p, nbytes);
+	if (nbits % BOOL_VECTOR_BITS_PER_CHAR)
+	  bool_vector_uchar_data (obj)[nbytes - 1]
+	    &= (1 << (nbits % BOOL_VECTOR_BITS_PER_CHAR)) - 1;
+	in->p += nbytes;
+	binary_register (in, obj);
+	return obj;
+      }
+
+    case BIN_HASH_TABLE:
+      {
+	Lisp_Object args[10], key;
+	EMACS_UINT size;
+	args[0] = QCtest;
+	args[1] = binary_read_object (in);
+	args[2] = QCweakness;
+	args[3] = binary_read_object (in);
+	args[4] = QCsize;
+	size = binary_read_uint (in);
+	if (size > MOST_POSITIVE_FIXNUM)
+	  binary_invalid ();
+	args[5] = make_number (size);
+	args[6] = QCrehash_size;
+	args[7] = binary_read_object (in);
+	args[8] = QCrehash_threshold;
+	args[9] = binary_read_object (in);
+	obj = Fmake_hash_table (10, args);
+	binary_register (in, obj);
+	for (n = binary_read_count (in); n > 0; n--)
+	  {
+	    key = binary_read_object (in);
+	    Fputhash (key, binary_read_object (in), obj);
+	  }
+	return obj;
+      }
+
+    case BIN_DEF:
+      if (in->pending_label >= 0)
+	binary_invalid ();
+      if (NILP (in->labels))
+	in->labels = Fmake_vector (make_number (16), Qunbound);
+      else if (in->nlabels == ASIZE (in->labels))
+	{
+	  ptrdiff_t old_size = ASIZE (in->labels);
+	  in->labels = larger_vector (in->labels, 1, -1);
+	  for (i = old_size; i < ASIZE (in->labels); i++)
+	    ASET (in->labels, i, Qunbound);
+	}
+      in->pending_label = in->nlabels++;
+      obj = binary_read_object (in);
+      if (in->pending_label >= 0)
+	binary_invalid ();
+      return obj;
+
+    case BIN_REF:
+      n = binary_read_uint (in);
+      if (! (0 <= n && n < in->nlabels)
+	  || EQ (AREF (in->labels, n), Qunbound))
+	binary_invalid ();
+      return AREF (in->labels, n);
+
+    case BIN_LOAD_FILE_NAME:
+      return in->load_file_name;
+
+    case BIN_LAZY:
+      if (NILP (in->lazy_file))
+	binary_invalid ();
+      n = binary_read_count (in);
+      obj = make_number (in->p - in->start);
+      in->p += n;
+      return Fcons (in->lazy_file,
+		    Fcons (obj, make_number (in->lazy_stamp)));
+
+    default:
+      binary_invalid ();
+    }
+}
+
+
+/* Binary compiled files.
+
+   For a compiled file FOO.elc, the file FOO.elb holds the same
+   top-level forms in the binary encoding, preceded by the table of
+   the symbols they use.  `load' evaluates the forms from FOO.elb when
+   it is up to date, which saves tokenizing the text, looking up each
+   symbol name and rebuilding every constant vector.  The bytecode of
+   large functions is not even decoded until the function is first
+   called; see read_lazy_bytecode.
+
+   The file starts with the magic bytes below and a format version.
+   Then come, as varints, the size and modification time (seconds and
+   nanoseconds) of FOO.elc when FOO.elb was written, the number of
+   forms and the size of the encoded forms, and then the symbol
+   table: the number of symbols, and the NCHARS, NBYTES and bytes of
+   each name.  The rest of the file is the forms.  */
+
+static char const elb_magic[4] = "\0ELB";
+enum { ELB_FORMAT_VERSION = 1 };
+
+/* Write the bytecode of functions at least this large so that it is
+   decoded only when needed.  */
+enum { ELB_LAZY_THRESHOLD = 256 };
+
+/* Read a varint from *P, which is before END, into *N, and advance
+   *P.  Return false if the data is truncated or the number too big.  */
+
+static bool
+elb_read_uint (unsigned char const **p, unsigned char const *end,
+	       EMACS_UINT *n)
+{
+  int shift;
+  *n = 0;
+  for (shift = 0; *p < end && shift < sizeof *n * CHAR_BIT; shift += 7)
+    {
+      int c = *(*p)++;
+      *n |= (EMACS_UINT) (c & 0x7f) << shift;
+      if (! (c & 0x80))
+	return 1;
+    }
+  return 0;
+}
+
+static EMACS_UINT
+elb_time_uint (time_t t)
+{
+  return t < 0 ? ((EMACS_UINT) ~t << 1) | 1 : (EMACS_UINT) t << 1;
+}
+
+static EMACS_INT
+elb_stamp (EMACS_UINT size, EMACS_UINT sec, EMACS_UINT nsec)
+{
+  return (size ^ sec ^ (nsec << 10)) & MOST_POSITIVE_FIXNUM;
+}
+
+/* Map the SIZE bytes of the file open on FD into memory, or read them
+   if that fails, and set *MAPPED accordingly.  Return the address of
+   the contents, or null if they cannot be read.  */
+
+static unsigned char *
+binary_map_file (int fd, ptrdiff_t size, bool *mapped)
+{
+  unsigned char *data;
+
+  *mapped = 0;
+#ifdef HAVE_MMAP
+  data = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data != MAP_FAILED)
+    {
+      *mapped = 1;
+      return data;
+    }
+#endif
+  data = xmalloc (size);
+  if (emacs_read (fd, data, size) != size)
+    {
+      xfree (data);
+      return NULL;
+    }
+  return data;
+}
+
+/* Read the symbol table that binary_output_symbols writes from *P,
+   which is before END, interning the symbols in `obarray', and advance
+   *P past it.  Return the vector of the symbols, or nil if the table
+   is invalid.  */
+
+static Lisp_Object
+binary_read_symbols (unsigned char const **p, unsigned char const *end)
+{
+  Lisp_Object obarray = check_obarray (Vobarray);
+  Lisp_Object symbols, tem;
+  EMACS_UINT nsymbols, nchars, nbytes, i;
+
+  if (! (elb_read_uint (p, end, &nsymbols) && nsymbols <= end - *p))
+    return Qnil;
+  symbols = Fmake_vector (make_number (nsymbols), Qnil);
+  for (i = 0; i < nsymbols; i++)
+    {
+      if (! (elb_read_uint (p, end, &nchars)
+	     && elb_read_uint (p, end, &nbytes)
+	     && nchars <= nbytes && nbytes <= end - *p))
+	return Qnil;
+      tem = oblookup (obarray, (char const *) *p, nchars, nbytes);
+      if (!SYMBOLP (tem))
+	tem = intern_driver (make_specified_string ((char const *) *p,
+						    nchars, nbytes,
+						    nchars < nbytes),
+			     obarray, XINT (tem));
+      ASET (symbols, i, tem);
+      *p += nbytes;
+    }
+  return symbols;
+}
+
+/* Unmap or free the contents of ELB, a struct elb_file *.  */
+
+static void
+elb_close (void *arg)
+{
+  struct elb_file *elb = arg;
+
+  if (!elb->data)
+    return;
+#ifdef HAVE_MMAP
+  if (elb->mapped)
+    munmap (elb->data, elb->size);
+  else
+#endif
+    xfree (elb->data);
+  elb->data = NULL;
+}
+
+/* Open the binary compiled file FILE into ELB and intern its symbols.
+   If ELC is not null, it is the status of the .elc file that FILE
+   should have been written from.  Return false, leaving ELB closed,
+   if FILE does not exist, is invalid or does not match ELC.  */
+
+static bool
+elb_open (struct elb_file *elb, Lisp_Object file, struct stat const *elc)
+{
+  Lisp_Object efile = ENCODE_FILE (file);
+  unsigned char const *p, *end;
+  EMACS_UINT size, sec, nsec, nforms, body_len;
+  struct stat st;
+  struct timespec mtime;
+  int fd;
+
+  elb->data = NULL;
+  fd = emacs_open (SSDATA (efile), O_RDONLY, 0);
+  if (fd < 0)
+    return 0;
+  if (fstat (fd, &st) != 0
+      || st.st_size < sizeof elb_magic + 1 || PTRDIFF_MAX < st.st_size)
+    {
+      emacs_close (fd);
+      return 0;
+    }
+
+  elb->size = st.st_size;
+  elb->data = binary_map_file (fd, elb->size, &elb->mapped);
+  emacs_close (fd);
+  if (!elb->data)
+    return 0;
+
+  p = elb->data;
+  end = p + elb->size;
+  if (memcmp (p, elb_magic, sizeof elb_magic) != 0
+      || p[sizeof elb_magic] != ELB_FORMAT_VERSION)
+    goto invalid;
+  p += sizeof elb_magic + 1;
+  if (! (elb_read_uint (&p, end, &size)
+	 && elb_read_uint (&p, end, &sec)
+	 && elb_read_uint (&p, end, &nsec)
+	 && elb_read_uint (&p, end, &nforms)
+	 && elb_read_uint (&p, end, &body_len)
+	 && nforms <= MOST_POSITIVE_FIXNUM))
+    goto invalid;
+
+  if (elc)
+    {
+      mtime = get_stat_mtime (elc);
+      if (size != elc->st_size
+	  || sec != elb_time_uint (mtime.tv_sec)
+	  || nsec != mtime.tv_nsec)
+	goto invalid;
+    }
+
+  elb->symbols = binary_read_symbols (&p, end);
+  if (NILP (elb->symbols) || body_len != end - p)
+    goto invalid;
+  elb->file = file;
+  elb->body = p;
+  elb->body_len = body_len;
+  elb->nforms = nforms;
+  elb->stamp = elb_stamp (size, sec, nsec);
+  return 1;
+
+ invalid:
+  elb_close (elb);
+  return 0;
+}
+
+/* Evaluate the forms of ELB, like readevalloop does for those of the
+   .elc file.  SOURCENAME is the name to record in `load-history'.  */
+
+static void
+elb_evalloop (struct elb_file *elb, Lisp_Object sourcename)
+{
+  ptrdiff_t count = SPECPDL_INDEX ();
+  struct gcpro gcpro1, gcpro2, gcpro3, gcpro4, gcpro5;
+  struct binary_input in;
+  Lisp_Object lex_bound, val;
+  EMACS_INT i;
+
+  binary_input_init (&in, elb->body, elb->body_len, elb->symbols);
+  in.load_file_name = Vload_file_name;
+  in.lazy_file = elb->file;
+  in.lazy_stamp = elb->stamp;
+  GCPRO5 (sourcename, in.symbols, in.labels, in.load_file_name, in.lazy_file);
+
+  specbind (Qstandard_input, Qget_file_char);
+  specbind (Qcurrent_load_list, Qnil);
+  record_unwind_protect_int (readevalloop_1, load_convert_to_unibyte);
+  load_convert_to_unibyte = 0;
+
+  lex_bound = find_symbol_value (Qlexical_binding);
+  specbind (Qinternal_interpreter_environment,
+	    (NILP (lex_bound) || EQ (lex_bound, Qunbound)
+	     ? Qnil : list1 (Qt)));
+
+  if (!NILP (sourcename) && !NILP (Ffile_name_absolute_p (sourcename))
+      && !NILP (Ffboundp (Qfile_truename)))
+    sourcename = call1 (Qfile_truename, sourcename);
+  LOADHIST_ATTACH (sourcename);
+
+  for (i = 0; i < elb->nforms; i++)
+    {
+      /* Labels are local to each form, as with `read'.  */
+      in.labels = Qnil;
+      in.nlabels = 0;
+      val = binary_read_object (&in);
+      eval_sub (val);
+    }
+  if (in.p != in.end)
+    binary_invalid ();
+
+  build_load_history (sourcename, 1);
+  UNGCPRO;
+  unbind_to (count, Qnil);
+}
+
+/* The binary compiled file used by the last call to
+   read_lazy_bytecode, kept open for the next one.  */
+static struct elb_file lazy_elb;
+
+/* Return the bytecode string and constants vector, as a cons, of a
+   lazily loaded byte-code object whose bytecode slot is FILEPOS.
+   FILEPOS is (FILE . POSITION) if the function came from a .elc file
+   compiled with `byte-compile-dynamic', or (FILE POSITION . STAMP) if
+   it came from a binary compiled file.  */
+
+Lisp_Object
+read_lazy_bytecode (Lisp_Object filepos)
+{
+  struct binary_input in;
+  Lisp_Object file, tem;
+  EMACS_INT pos, stamp;
+  struct gcpro gcpro1, gcpro2, gcpro3;
+
+  if (! (CONSP (filepos) && STRINGP (XCAR (filepos))
+	 && CONSP (XCDR (filepos))))
+    return read_doc_string (filepos);
+
+  file = XCAR (filepos);
+  tem = XCDR (filepos);
+  if (! (INTEGERP (XCAR (tem)) && INTEGERP (XCDR (tem))))
+    return Qnil;
+  pos = XINT (XCAR (tem));
+  stamp = XINT (XCDR (tem));
+
+  if (! (lazy_elb.data && !NILP (Fstring_equal (lazy_elb.file, file))
+	 && lazy_elb.stamp == stamp))
+    {
+      elb_close (&lazy_elb);
+      lazy_elb.file = lazy_elb.symbols = Qnil;
+      if (!elb_open (&lazy_elb, file, NULL))
+	return Qnil;
+      if (lazy_elb.stamp != stamp)
+	error ("Binary compiled file `%s' changed since it was loaded",
+	       SDATA (file));
+    }
+
+  if (! (0 <= pos && pos < lazy_elb.body_len))
+    return Qnil;
+  binary_input_init (&in, lazy_elb.body, lazy_elb.body_len,
+		     lazy_elb.symbols);
+  in.p += pos;
+  in.load_file_name = Fcopy_sequence (file);
+  unshare_string_data (in.load_file_name);
+  SSET (in.load_file_name, SBYTES (file) - 1, 'c');
+  GCPRO3 (in.symbols, in.labels, in.load_file_name);
+  tem = binary_read_object (&in);
+  tem = Fcons (tem, binary_read_object (&in));
+  UNGCPRO;
+  return tem;
+}
+
+DEFUN ("write-binary-compiled-file", Fwrite_binary_compiled_file,
+       Swrite_binary_compiled_file, 1, 1, 0,
+       doc: /* Write the binary counterpart of the compiled Lisp file FILE.
+FILE should be a file written by the byte compiler, whose name ends in
+`.elc'.  The binary file has the same name, but ending in `.elb', and
+holds the same top-level forms in a binary encoding.
+
+`load' evaluates the forms of the binary file instead of reading FILE,
+provided `load-binary-compiled-files' is non-nil and FILE has not
+changed since the binary file was written.  This is much faster,
+because `load' need not parse the text, intern each symbol or rebuild
+each constant vector, and because the bytecode of large functions is
+not decoded until they are first called.
+
+Signal an error if some form in FILE has no binary representation.
+Return the name of the binary file.  */)
+  (Lisp_Object file)
+{
+  ptrdiff_t count = SPECPDL_INDEX ();
+  Lisp_Object readcharfun = Qget_file_char;
+  Lisp_Object elb_file, efile, val;
+  struct binary_output out, header;
+  struct gcpro gcpro1, gcpro2, gcpro3, gcpro4, gcpro5;
+  struct stat st;
+  struct timespec mtime;
+  EMACS_INT nforms = 0;
+  FILE *stream;
+  int fd, c;
+
+  file = Fexpand_file_name (file, Qnil);
+  if (! (SBYTES (file) > 4
+	 && !memcmp (SDATA (file) + SBYTES (file) - 4, ".elc", 4)))
+    error ("`%s' is not a compiled Lisp file", SDATA (file));
+  elb_file = Fcopy_sequence (file);
+  unshare_string_data (elb_file);
+  SSET (elb_file, SBYTES (elb_file) - 1, 'b');
+  binary_output_init (&out, Fcopy_sequence (file), ELB_LAZY_THRESHOLD);
+  binary_output_init (&header, Qnil, 0);
+  GCPRO5 (file, elb_file, out.seen, out.symbols, out.symbol_list);
+
+  efile = ENCODE_FILE (file);
+  fd = emacs_open (SSDATA (efile), O_RDONLY, 0);
+  if (fd < 0)
+    report_file_error ("Opening input file", file);
+  record_unwind_protect_int (close_file_unwind, fd);
+  if (fstat (fd, &st) != 0)
+    report_file_error ("Input file status", file);
+  if (safe_to_load_version (fd) < 22)
+    error ("File `%s' was not compiled by this version of Emacs",
+	   SDATA (file));
+  stream = fdopen (fd, "rb");
+  if (!stream)
+    report_file_error ("Opening stdio stream", file);
+  set_unwind_protect_ptr (count, fclose_unwind, stream);
+
+  /* Read the forms as `load' would, except that `#$' yields a
+     placeholder to be written as BIN_LOAD_FILE_NAME.  */
+  specbind (Qload_file_name, out.load_file_name);
+  record_unwind_protect_ptr (binary_output_free, &out);
+  record_unwind_protect_ptr (binary_output_free, &header);
+
+  while (1)
+    {
+      instream = stream;
+      c = READCHAR;
+      if (c == ';')
+	{
+	  while ((c = READCHAR) != '\n' && c != -1)
+	    continue;
+	  continue;
+	}
+      if (c < 0)
+	break;
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\f' || c == '\r'
+	  || c == 0xa0)
+	continue;
+      UNREAD (c);
+      read_objects = Qnil;
+      val = read_internal_start (readcharfun, Qnil, Qnil);
+      binary_output_object (&out, val);
+      nforms++;
+    }
+
+  mtime = get_stat_mtime (&st);
+  binary_output_byte (&header, elb_magic[0]);
+  binary_output_byte (&header, elb_magic[1]);
+  binary_output_byte (&header, elb_magic[2]);
+  binary_output_byte (&header, elb_magic[3]);
+  binary_output_byte (&header, ELB_FORMAT_VERSION);
+  binary_output_uint (&header, st.st_size);
+  binary_output_uint (&header, elb_time_uint (mtime.tv_sec));
+  binary_output_uint (&header, mtime.tv_nsec);
+  binary_output_uint (&header, nforms);
+  binary_output_uint (&header, out.len);
+  binary_output_symbols (&out, &header);
+  binary_output_write_file (elb_file, &header, &out);
+
+  UNGCPRO;
+  unbind_to (count, Qnil);
+  return elb_file;
+}
+
+DEFUN ("deserialize-object", Fdeserialize_object, Sdeserialize_object,
+       1, 2, 0,
+       doc: /* Return the object that SOURCE holds, as encoded by `serialize-object'.
+SOURCE is normally a string returned by `serialize-object'.
+
+If SOURCE is a buffer, decode the encoding that starts at point in that
+buffer, and move point past it.  Successive calls thus return the
+objects that successive calls to `serialize-object' inserted.
+
+If FILE is non-nil, SOURCE is the name of a file that
+`serialize-object' wrote.
+
+Symbols are interned in `obarray'.  */)
+  (Lisp_Object source, Lisp_Object file)
+{
+  ptrdiff_t count = SPECPDL_INDEX ();
+  struct elb_file src;
+  struct binary_input in;
+  unsigned char const *p, *end;
+  Lisp_Object symbols, val;
+  struct gcpro gcpro1, gcpro2, gcpro3;
+  ptrdiff_t pt = -1;
+
+  src.data = NULL;
+  record_unwind_protect_ptr (elb_close, &src);
+
+  if (!NILP (file))
+    {
+      Lisp_Object efile;
+      struct stat st;
+      int fd;
+
+      CHECK_STRING (source);
+      source = Fexpand_file_name (source, Qnil);
+      efile = ENCODE_FILE (source);
+      fd = emacs_open (SSDATA (efile), O_RDONLY, 0);
+      if (fd < 0)
+	report_file_error ("Opening input file", source);
+      record_unwind_protect_int (close_file_unwind, fd);
+      if (fstat (fd, &st) != 0)
+	report_file_error ("Input file status", source);
+      if (PTRDIFF_MAX < st.st_size)
+	buffer_overflow ();
+      src.size = st.st_size;
+      src.data = binary_map_file (fd, src.size, &src.mapped);
+      if (!src.data)
+	report_file_error ("Read error", source);
+    }
+  else
+    {
+      /* Copy the data, as GC may relocate string and buffer text.  */
+      src.mapped = 0;
+      if (BUFFERP (source))
+	{
+	  struct buffer *b = XBUFFER (source);
+	  if (!BUFFER_LIVE_P (b))
+	    error ("Reading from killed buffer");
+	  record_unwind_current_buffer ();
+	  set_buffer_internal (b);
+	  if (PT < GPT && GPT < ZV)
+	    move_gap_both (PT, PT_BYTE);
+	  pt = PT;
+	  src.data = xmalloc (ZV - PT + 1);
+	  src.size = copy_text (BYTE_POS_ADDR (PT_BYTE), src.data,
+				ZV_BYTE - PT_BYTE,
+				!NILP (BVAR (b, enable_multibyte_characters)),
+				0);
+	}
+      else
+	{
+	  CHECK_STRING (source);
+	  src.data = xmalloc (SCHARS (source) + 1);
+	  src.size = copy_text (SDATA (source), src.data, SBYTES (source),
+				STRING_MULTIBYTE (source), 0);
+	}
+    }
+
+  p = src.data;
+  end = p + src.size;
+  if (! (end - p >= sizeof SERIALIZED_MAGIC - 1
+	 && !memcmp (p, SERIALIZED_MAGIC, sizeof SERIALIZED_MAGIC - 1)))
+    binary_invalid ();
+  p += sizeof SERIALIZED_MAGIC - 1;
+  symbols = binary_read_symbols (&p, end);
+  if (NILP (symbols))
+    binary_invalid ();
+
+  binary_input_init (&in, p, end - p, symbols);
+  GCPRO3 (source, in.symbols, in.labels);
+  val = binary_read_object (&in);
+  if (pt >= 0)
+    SET_PT (clip_to_bounds (BEGV, pt + (in.p - src.data), ZV));
+  UNGCPRO;
+  return unbind_to (count, val);
+}
+
 DEFUN ("eval-buffer", Feval_buffer, Seval_buffer, 0, 5, "",
        doc: /* Execute the current buffer as Lisp code.
 When called from a Lisp program (i.e., not interactively), this
@@ -3402,6 +4318,80 @@ substitute_in_interval (INTERVAL interval, Lisp_Object arg)
 #define E_EXP 16
 
 
+/* Return the double nearest to the decimal number at CP, which has
+   digits, an optional fraction and an optional exponent, but no sign.
+   When the digits fit exactly in a double and so does the power of
+   ten, one multiplication or division rounds correctly (Clinger, "How
+   to read floating point numbers accurately", PLDI 1990); that covers
+   most numbers in practice, and strtod handles the others.  */
+
+static double
+decimal_to_double (char const *cp)
+{
+#if (FLT_RADIX == 2 && DBL_MANT_DIG == 53 \
+     && defined FLT_EVAL_METHOD && FLT_EVAL_METHOD == 0)
+  static double const powers_of_ten[] =
+    { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+  enum { MAX_EXACT = ARRAYELTS (powers_of_ten) - 1 };
+  uint_fast64_t mantissa = 0;
+  int ndigits = 0, exponent = 0, exp_sign = 1, exp_value = 0;
+  char const *p = cp;
+
+  for (; '0' <= *p && *p <= '9'; p++)
+    if (mantissa || *p != '0')
+      {
+	mantissa = 10 * mantissa + (*p - '0');
+	ndigits++;
+      }
+  if (*p == '.')
+    for (p++; '0' <= *p && *p <= '9'; p++)
+      {
+	if (mantissa || *p != '0')
+	  {
+	    mantissa = 10 * mantissa + (*p - '0');
+	    ndigits++;
+	  }
+	exponent--;
+      }
+  if (*p == 'e' || *p == 'E')
+    {
+      char const *q = p + 1;
+      if (*q == '+' || *q == '-')
+	exp_sign = *q++ == '-' ? -1 : 1;
+      for (; '0' <= *q && *q <= '9' && exp_value < 10000; q++)
+	exp_value = 10 * exp_value + (*q - '0');
+      exponent += exp_sign * exp_value;
+    }
+
+  /* 19 decimal digits always fit in 64 bits.  */
+  if (ndigits <= 19 && mantissa <= (uint_fast64_t) 1 << DBL_MANT_DIG)
+    {
+      double value = mantissa;
+      if (mantissa == 0)
+	return 0;
+      if (-MAX_EXACT <= exponent && exponent <= 0)
+	return value / powers_of_ten[-exponent];
+      if (0 <= exponent && exponent <= MAX_EXACT)
+	return value * powers_of_ten[exponent];
+
+      /* A large exponent may still be exact if the digits are few,
+	 as in 1e30.  */
+      if (MAX_EXACT < exponent)
+	{
+	  for (; MAX_EXACT < exponent
+		 && mantissa * 10 <= (uint_fast64_t) 1 << DBL_MANT_DIG;
+	       exponent--)
+	    mantissa *= 10;
+	  if (exponent <= MAX_EXACT)
+	    return (double) mantissa * powers_of_ten[exponent];
+	}
+    }
+#endif
+
+  return strtod (cp, NULL);
+}
+
 /* Convert STRING to a number, assuming base BASE.  Return a fixnum if CP has
    integer syntax and fits in a fixnum, else return the nearest float if CP has
    either floating point or integer syntax and BASE is 10, else return nil.  If
@@ -3549,7 +4539,7 @@ string_to_number (char const *string, int base, bool ignore_trailing)
      known because it is an infinity, a NAN, or its absolute value fits in
      uintmax_t.  */
   if (! value)
-    value = atof (string + signedp);
+    value = decimal_to_double (string + signedp);
 
   return make_float (negative ? -value : value);
 }
@@ -4506,6 +5496,8 @@ syms_of_lread (void)
   defsubr (&Sget_file_char);
   defsubr (&Smapatoms);
   defsubr (&Slocate_file_internal);
+  defsubr (&Swrite_binary_compiled_file);
+  defsubr (&Sdeserialize_object);
 
   DEFVAR_LISP ("obarray", Vobarray,
 	       doc: /* Symbol table for use by `intern' and `read'.
@@ -4692,6 +5684,13 @@ incompatible byte codes can make Emacs crash when it tries to execute
 them.  */);
   load_dangerous_libraries = 0;
 
+  DEFVAR_BOOL ("load-binary-compiled-files", load_binary_compiled_files,
+	       doc: /* Non-nil means `load' uses binary compiled files when available.
+When `load' finds a compiled Lisp file FOO.elc, and there is a file
+FOO.elb written by `write-binary-compiled-file' since FOO.elc last
+changed, it evaluates the forms from FOO.elb, which is faster.  */);
+  load_binary_compiled_files = 1;
+
   DEFVAR_BOOL ("force-load-messages", force_load_messages,
 	       doc: /* Non-nil means force printing messages when loading Lisp files.
 This overrides the value of the NOMESSAGE argument to `load'.  */);
@@ -4770,6 +5769,10 @@ that are loaded before your customizations are read!  */);
   Vloads_in_progress = Qnil;
   staticpro (&Vloads_in_progress);
 
+  lazy_elb.file = lazy_elb.symbols = Qnil;
+  staticpro (&lazy_elb.file);
+  staticpro (&lazy_elb.symbols);
+
   DEFSYM (Qhash_table, "hash-table");
   DEFSYM (Qdata, "data");
   DEFSYM (Qtest, "test");
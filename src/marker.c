@@ -75,12 +75,274 @@ clear_charpos_cache (struct buffer *b)
   if (cached_buffer == b)
     cached_buffer = 0;
 }
+
+/* The position index.
+
+   Each buffer text keeps checkpoints of the correspondence between
+   character and byte positions, so that a conversion never needs to
+   scan much more than CHECKPOINT_INTERVAL bytes once the part of the
+   buffer it is in has been indexed.  Conversions that have to scan
+   further add checkpoints along the way.
+
+   The vector of checkpoints has a gap that follows the gap of the
+   text: checkpoints before it record positions at or before GPT, and
+   those after it record positions at or after GPT, relative to Z.
+   Inserting text at the gap therefore leaves every checkpoint valid,
+   deleting text at the gap only invalidates checkpoints next to the
+   gap, and moving the gap converts the checkpoints it passes.  */
+
+#define CHECKPOINT_INTERVAL 4096
+
+/* Number of conversions that needed no new checkpoint, and number of
+   those that added checkpoints.  */
+
+static EMACS_INT position_index_hits;
+static EMACS_INT position_index_misses;
+
+/* Return the number of checkpoints of T.  */
+
+static ptrdiff_t
+checkpoint_count (struct buffer_text *t)
+{
+  return (t->checkpoints_gap
+	  + t->checkpoints_size - t->checkpoints_gap_end);
+}
+
+/* Return the Nth checkpoint of T, as positions.  */
+
+static struct position_checkpoint
+checkpoint_at (struct buffer_text *t, ptrdiff_t n)
+{
+  struct position_checkpoint c;
+
+  if (n < t->checkpoints_gap)
+    return t->checkpoints[n];
+  c = t->checkpoints[n + t->checkpoints_gap_end - t->checkpoints_gap];
+  c.charpos += t->z;
+  c.bytepos += t->z_byte;
+  return c;
+}
+
+/* Return the number of checkpoints of T at or before POS, a byte
+   position if BYTE, a character position otherwise.  */
+
+static ptrdiff_t
+checkpoint_rank (struct buffer_text *t, ptrdiff_t pos, bool byte)
+{
+  ptrdiff_t lo = 0, hi = t->checkpoints_gap, offset;
+
+  while (lo < hi)
+    {
+      ptrdiff_t mid = lo + (hi - lo) / 2;
+      struct position_checkpoint *c = &t->checkpoints[mid];
+
+      if ((byte ? c->bytepos : c->charpos) <= pos)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo < t->checkpoints_gap)
+    return lo;
+
+  offset = byte ? t->z_byte : t->z;
+  lo = t->checkpoints_gap_end;
+  hi = t->checkpoints_size;
+  while (lo < hi)
+    {
+      ptrdiff_t mid = lo + (hi - lo) / 2;
+      struct position_checkpoint *c = &t->checkpoints[mid];
+
+      if ((byte ? c->bytepos : c->charpos) + offset <= pos)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo - (t->checkpoints_gap_end - t->checkpoints_gap);
+}
+
+/* Checkpoints collected by a conversion while it scans.  */
+
+struct checkpoint_run
+{
+  struct position_checkpoint *vec;
+  ptrdiff_t n, size;
+};
+
+static void
+record_checkpoint (struct checkpoint_run *run,
+		   ptrdiff_t charpos, ptrdiff_t bytepos)
+{
+  if (run->n == run->size)
+    run->vec = xpalloc (run->vec, &run->size, 1, -1, sizeof *run->vec);
+  run->vec[run->n].charpos = charpos;
+  run->vec[run->n].bytepos = bytepos;
+  run->n++;
+}
+
+/* Add the checkpoints of RUN to the index of B, and free RUN.  The
+   checkpoints are in decreasing order if DESCENDING, and increasing
+   order otherwise.  They must all lie between two consecutive
+   checkpoints of B, on the same side of the gap.  */
+
+static void
+add_checkpoints (struct buffer *b, struct checkpoint_run *run,
+		 bool descending)
+{
+  struct buffer_text *t = b->text;
+  struct position_checkpoint *vec = run->vec;
+  ptrdiff_t i, k, n = run->n;
+
+  if (n == 0)
+    {
+      position_index_hits++;
+      return;
+    }
+  position_index_misses++;
+
+  if (descending)
+    for (i = 0; i < n / 2; i++)
+      {
+	struct position_checkpoint c = vec[i];
+	vec[i] = vec[n - 1 - i];
+	vec[n - 1 - i] = c;
+      }
+
+  if (t->checkpoints_gap_end - t->checkpoints_gap < n)
+    {
+      ptrdiff_t tail = t->checkpoints_size - t->checkpoints_gap_end;
+      ptrdiff_t needed = n - (t->checkpoints_gap_end - t->checkpoints_gap);
+
+      t->checkpoints = xpalloc (t->checkpoints, &t->checkpoints_size,
+				needed, -1, sizeof *t->checkpoints);
+      memmove (t->checkpoints + t->checkpoints_size - tail,
+	       t->checkpoints + t->checkpoints_gap_end,
+	       tail * sizeof *t->checkpoints);
+      t->checkpoints_gap_end = t->checkpoints_size - tail;
+    }
+
+  k = checkpoint_rank (t, vec[0].charpos, 0);
+  if (vec[0].charpos <= t->gpt)
+    {
+      memmove (t->checkpoints + k + n, t->checkpoints + k,
+	       (t->checkpoints_gap - k) * sizeof *t->checkpoints);
+      memcpy (t->checkpoints + k, vec, n * sizeof *vec);
+      t->checkpoints_gap += n;
+    }
+  else
+    {
+      k += t->checkpoints_gap_end - t->checkpoints_gap;
+      memmove (t->checkpoints + t->checkpoints_gap_end - n,
+	       t->checkpoints + t->checkpoints_gap_end,
+	       (k - t->checkpoints_gap_end) * sizeof *t->checkpoints);
+      t->checkpoints_gap_end -= n;
+      for (i = 0; i < n; i++)
+	{
+	  t->checkpoints[k - n + i].charpos = vec[i].charpos - t->z;
+	  t->checkpoints[k - n + i].bytepos = vec[i].bytepos - t->z_byte;
+	}
+    }
+
+  xfree (vec);
+}
+
+/* Discard all the checkpoints of B.  */
+
+void
+clear_position_index (struct buffer *b)
+{
+  struct buffer_text *t = b->text;
+
+  xfree (t->checkpoints);
+  t->checkpoints = NULL;
+  t->checkpoints_size = t->checkpoints_gap = t->checkpoints_gap_end = 0;
+}
+
+/* Update the checkpoints of B after the gap of its text moved.  */
+
+void
+move_position_index_gap (struct buffer *b)
+{
+  struct buffer_text *t = b->text;
+  struct position_checkpoint *c = t->checkpoints;
+
+  while (t->checkpoints_gap > 0
+	 && c[t->checkpoints_gap - 1].charpos > t->gpt)
+    {
+      struct position_checkpoint *from = &c[--t->checkpoints_gap];
+      struct position_checkpoint *to = &c[--t->checkpoints_gap_end];
+
+      to->charpos = from->charpos - t->z;
+      to->bytepos = from->bytepos - t->z_byte;
+    }
+  while (t->checkpoints_gap_end < t->checkpoints_size
+	 && c[t->checkpoints_gap_end].charpos + t->z < t->gpt)
+    {
+      struct position_checkpoint *from = &c[t->checkpoints_gap_end++];
+      struct position_checkpoint *to = &c[t->checkpoints_gap++];
+
+      to->charpos = from->charpos + t->z;
+      to->bytepos = from->bytepos + t->z_byte;
+    }
+}
+
+/* Discard the checkpoints of B that were in text just deleted at the
+   gap.  Those are the ones that are now on the wrong side of GPT.  */
+
+void
+trim_position_index (struct buffer *b)
+{
+  struct buffer_text *t = b->text;
+  struct position_checkpoint *c = t->checkpoints;
+
+  while (t->checkpoints_gap > 0
+	 && c[t->checkpoints_gap - 1].charpos > t->gpt)
+    t->checkpoints_gap--;
+  while (t->checkpoints_gap_end < t->checkpoints_size
+	 && c[t->checkpoints_gap_end].charpos + t->z < t->gpt)
+    t->checkpoints_gap_end++;
+}
 
+/* Discard the checkpoints of B strictly between FROM and TO, after
+   the text there was rearranged in place.  */
+
+void
+forget_position_checkpoints (struct buffer *b, ptrdiff_t from, ptrdiff_t to)
+{
+  struct buffer_text *t = b->text;
+  ptrdiff_t lo = checkpoint_rank (t, from, 0);
+  ptrdiff_t hi = checkpoint_rank (t, to - 1, 0);
+  ptrdiff_t n;
+
+  /* Those before the gap of the index.  */
+  n = min (hi, t->checkpoints_gap) - lo;
+  if (n > 0)
+    {
+      memmove (t->checkpoints + lo, t->checkpoints + lo + n,
+	       (t->checkpoints_gap - lo - n) * sizeof *t->checkpoints);
+      t->checkpoints_gap -= n;
+      hi -= n;
+    }
+
+  /* Those after it.  */
+  lo = max (lo, t->checkpoints_gap);
+  n = hi - lo;
+  if (n > 0)
+    {
+      ptrdiff_t k = lo + t->checkpoints_gap_end - t->checkpoints_gap;
+
+      memmove (t->checkpoints + t->checkpoints_gap_end + n,
+	       t->checkpoints + t->checkpoints_gap_end,
+	       (k - t->checkpoints_gap_end) * sizeof *t->checkpoints);
+      t->checkpoints_gap_end += n;
+    }
+}
+
 /* Converting between character positions and byte positions.  */
 
 /* There are several places in the buffer where we know
    the correspondence: BEG, BEGV, PT, GPT, ZV and Z,
-   and everywhere there is a marker.  So we find the one of these places
+   everywhere there is a marker, and at the checkpoints of the
+   position index.  So we find the one of these places
    that is closest to the specified position, and scan from there.  */
 
 /* This macro is a subroutine of buf_charpos_to_bytepos.
@@ -141,8 +403,12 @@ buf_charpos_to_bytepos (struct buffer *b, ptrdiff_t charpos)
   struct Lisp_Marker *tail;
   ptrdiff_t best_above, best_above_byte;
   ptrdiff_t best_below, best_below_byte;
+  struct checkpoint_run run = { NULL, 0, 0 };
+  ptrdiff_t n, last_byte;
+  int type;
 
   eassert (BUF_BEG (b) <= charpos && charpos <= BUF_Z (b));
+  ensure_buffer_text (b);
 
   best_above = BUF_Z (b);
   best_above_byte = BUF_Z_BYTE (b);
@@ -173,36 +439,52 @@ buf_charpos_to_bytepos (struct buffer *b, ptrdiff_t charpos)
   if (b == cached_buffer && BUF_MODIFF (b) == cached_modiff)
     CONSIDER (cached_charpos, cached_bytepos);
 
-  for (tail = BUF_MARKERS (b); tail; tail = tail->next)
+  n = checkpoint_rank (b->text, charpos, 0);
+  if (n > 0)
+    {
+      struct position_checkpoint c = checkpoint_at (b->text, n - 1);
+      CONSIDER (c.charpos, c.bytepos);
+    }
+  if (n < checkpoint_count (b->text))
     {
-      CONSIDER (tail->charpos, tail->bytepos);
+      struct position_checkpoint c = checkpoint_at (b->text, n);
+      CONSIDER (c.charpos, c.bytepos);
+    }
 
-      /* If we are down to a range of 50 chars,
-	 don't bother checking any other markers;
-	 scan the intervening chars directly now.  */
-      if (best_above - best_below < 50)
-	break;
+  /* The closest markers on either side of CHARPOS are on the path
+     from the root of each marker tree to where CHARPOS would go.  */
+  for (type = 0; type < 2; type++)
+    {
+      ptrdiff_t base = 0, base_byte = 0;
+
+      for (tail = BUF_MARKERS (b, type); tail; )
+	{
+	  base += tail->char_offset;
+	  base_byte += tail->byte_offset;
+	  CONSIDER (base, base_byte);
+	  tail = base < charpos ? tail->right : tail->left;
+	}
     }
 
   /* We get here if we did not exactly hit one of the known places.
      We have one known above and one known below.
-     Scan, counting characters, from whichever one is closer.  */
+     Scan, counting characters, from whichever one is closer,
+     and add checkpoints to the index if that is far.  */
 
   if (charpos - best_below < best_above - charpos)
     {
-      bool record = charpos - best_below > 5000;
-
+      last_byte = best_below_byte;
       while (best_below != charpos)
 	{
 	  best_below++;
 	  BUF_INC_POS (b, best_below_byte);
+	  if (best_below_byte - last_byte >= CHECKPOINT_INTERVAL)
+	    {
+	      record_checkpoint (&run, best_below, best_below_byte);
+	      last_byte = best_below_byte;
+	    }
 	}
-
-      /* If this position is quite far from the nearest known position,
-	 cache the correspondence by creating a marker here.
-	 It will last until the next GC.  */
-      if (record)
-	build_marker (b, best_below, best_below_byte);
+      add_checkpoints (b, &run, 0);
 
       byte_char_debug_check (b, best_below, best_below_byte);
 
@@ -215,19 +497,18 @@ buf_charpos_to_bytepos (struct buffer *b, ptrdiff_t charpos)
     }
   else
     {
-      bool record = best_above - charpos > 5000;
-
+      last_byte = best_above_byte;
       while (best_above != charpos)
 	{
 	  best_above--;
 	  BUF_DEC_POS (b, best_above_byte);
+	  if (last_byte - best_above_byte >= CHECKPOINT_INTERVAL)
+	    {
+	      record_checkpoint (&run, best_above, best_above_byte);
+	      last_byte = best_above_byte;
+	    }
 	}
-
-      /* If this position is quite far from the nearest known position,
-	 cache the correspondence by creating a marker here.
-	 It will last until the next GC.  */
-      if (record)
-	build_marker (b, best_above, best_above_byte);
+      add_checkpoints (b, &run, 1);
 
       byte_char_debug_check (b, best_above, best_above_byte);
 
@@ -293,8 +574,12 @@ buf_bytepos_to_charpos (struct buffer *b, ptrdiff_t bytepos)
   struct Lisp_Marker *tail;
   ptrdiff_t best_above, best_above_byte;
   ptrdiff_t best_below, best_below_byte;
+  struct checkpoint_run run = { NULL, 0, 0 };
+  ptrdiff_t n, last_byte;
+  int type;
 
   eassert (BUF_BEG_BYTE (b) <= bytepos && bytepos <= BUF_Z_BYTE (b));
+  ensure_buffer_text (b);
 
   best_above = BUF_Z (b);
   best_above_byte = BUF_Z_BYTE (b);
@@ -316,38 +601,51 @@ buf_bytepos_to_charpos (struct buffer *b, ptrdiff_t bytepos)
   if (b == cached_buffer && BUF_MODIFF (b) == cached_modiff)
     CONSIDER (cached_bytepos, cached_charpos);
 
-  for (tail = BUF_MARKERS (b); tail; tail = tail->next)
+  n = checkpoint_rank (b->text, bytepos, 1);
+  if (n > 0)
     {
-      CONSIDER (tail->bytepos, tail->charpos);
+      struct position_checkpoint c = checkpoint_at (b->text, n - 1);
+      CONSIDER (c.bytepos, c.charpos);
+    }
+  if (n < checkpoint_count (b->text))
+    {
+      struct position_checkpoint c = checkpoint_at (b->text, n);
+      CONSIDER (c.bytepos, c.charpos);
+    }
 
-      /* If we are down to a range of 50 chars,
-	 don't bother checking any other markers;
-	 scan the intervening chars directly now.  */
-      if (best_above - best_below < 50)
-	break;
+  for (type = 0; type < 2; type++)
+    {
+      ptrdiff_t base = 0, base_byte = 0;
+
+      for (tail = BUF_MARKERS (b, type); tail; )
+	{
+	  base += tail->char_offset;
+	  base_byte += tail->byte_offset;
+	  CONSIDER (base_byte, base);
+	  tail = base_byte < bytepos ? tail->right : tail->left;
+	}
     }
 
   /* We get here if we did not exactly hit one of the known places.
      We have one known above and one known below.
-     Scan, counting characters, from whichever one is closer.  */
+     Scan, counting characters, from whichever one is closer,
+     and add checkpoints to the index if that is far.  */
 
   if (bytepos - best_below_byte < best_above_byte - bytepos)
     {
-      bool record = bytepos - best_below_byte > 5000;
-
+      last_byte = best_below_byte;
       while (best_below_byte < bytepos)
 	{
 	  best_below++;
 	  BUF_INC_POS (b, best_below_byte);
+	  if (best_below_byte - last_byte >= CHECKPOINT_INTERVAL
+	      && best_below_byte < bytepos)
+	    {
+	      record_checkpoint (&run, best_below, best_below_byte);
+	      last_byte = best_below_byte;
+	    }
 	}
-
-      /* If this position is quite far from the nearest known position,
-	 cache the correspondence by creating a marker here.
-	 It will last until the next GC.
-	 But don't do it if BUF_MARKERS is nil;
-	 that is a signal from Fset_buffer_multibyte.  */
-      if (record && BUF_MARKERS (b))
-	build_marker (b, best_below, best_below_byte);
+      add_checkpoints (b, &run, 0);
 
       byte_char_debug_check (b, best_below, best_below_byte);
 
@@ -360,21 +658,19 @@ buf_bytepos_to_charpos (struct buffer *b, ptrdiff_t bytepos)
     }
   else
     {
-      bool record = best_above_byte - bytepos > 5000;
-
+      last_byte = best_above_byte;
       while (best_above_byte > bytepos)
 	{
 	  best_above--;
 	  BUF_DEC_POS (b, best_above_byte);
+	  if (last_byte - best_above_byte >= CHECKPOINT_INTERVAL
+	      && best_above_byte > bytepos)
+	    {
+	      record_checkpoint (&run, best_above, best_above_byte);
+	      last_byte = best_above_byte;
+	    }
 	}
-
-      /* If this position is quite far from the nearest known position,
-	 cache the correspondence by creating a marker here.
-	 It will last until the next GC.
-	 But don't do it if BUF_MARKERS is nil;
-	 that is a signal from Fset_buffer_multibyte.  */
-      if (record && BUF_MARKERS (b))
-	build_marker (b, best_above, best_above_byte);
+      add_checkpoints (b, &run, 1);
 
       byte_char_debug_check (b, best_above, best_above_byte);
 
@@ -389,6 +685,456 @@ buf_bytepos_to_charpos (struct buffer *b, ptrdiff_t bytepos)
 
 #undef CONSIDER
 
+/* Marker trees.
+
+   The markers of a buffer's text are kept in two AVL trees ordered by
+   position, one for each insertion type, so that an insertion at a
+   position moves either all or none of the markers there in each
+   tree.  Markers at the same position are in no particular order.
+   Each marker stores its positions relative to its parent, so adding
+   to the offsets of one marker moves its whole subtree.  */
+
+static int
+marker_height (struct Lisp_Marker *m)
+{
+  return m ? m->height : 0;
+}
+
+static void
+marker_update_height (struct Lisp_Marker *m)
+{
+  m->height = 1 + max (marker_height (m->left), marker_height (m->right));
+}
+
+/* Add NCHARS and NBYTES to the offsets of M, if M is non-null.  */
+
+static void
+marker_add_offset (struct Lisp_Marker *m, ptrdiff_t nchars, ptrdiff_t nbytes)
+{
+  if (m)
+    {
+      m->char_offset += nchars;
+      m->byte_offset += nbytes;
+    }
+}
+
+/* Make NEW take the place of OLD, the child of PARENT in the marker
+   tree of B whose insertion type is TYPE.  */
+
+static void
+marker_replace_child (struct buffer *b, bool type, struct Lisp_Marker *parent,
+		      struct Lisp_Marker *old, struct Lisp_Marker *new)
+{
+  if (!parent)
+    BUF_MARKERS (b, type) = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+  if (new)
+    new->parent = parent;
+}
+
+static struct Lisp_Marker *
+marker_rotate_left (struct buffer *b, struct Lisp_Marker *m)
+{
+  struct Lisp_Marker *r = m->right;
+  ptrdiff_t nchars = r->char_offset, nbytes = r->byte_offset;
+
+  marker_replace_child (b, m->insertion_type, m->parent, m, r);
+  m->right = r->left;
+  if (m->right)
+    m->right->parent = m;
+  marker_add_offset (m->right, nchars, nbytes);
+  r->left = m;
+  m->parent = r;
+  r->char_offset = m->char_offset + nchars;
+  r->byte_offset = m->byte_offset + nbytes;
+  m->char_offset = -nchars;
+  m->byte_offset = -nbytes;
+  marker_update_height (m);
+  marker_update_height (r);
+  return r;
+}
+
+static struct Lisp_Marker *
+marker_rotate_right (struct buffer *b, struct Lisp_Marker *m)
+{
+  struct Lisp_Marker *l = m->left;
+  ptrdiff_t nchars = l->char_offset, nbytes = l->byte_offset;
+
+  marker_replace_child (b, m->insertion_type, m->parent, m, l);
+  m->left = l->right;
+  if (m->left)
+    m->left->parent = m;
+  marker_add_offset (m->left, nchars, nbytes);
+  l->right = m;
+  m->parent = l;
+  l->char_offset = m->char_offset + nchars;
+  l->byte_offset = m->byte_offset + nbytes;
+  m->char_offset = -nchars;
+  m->byte_offset = -nbytes;
+  marker_update_height (m);
+  marker_update_height (l);
+  return l;
+}
+
+/* Restore the balance of a marker tree on the path from M to its
+   root.  */
+
+static void
+marker_rebalance (struct buffer *b, struct Lisp_Marker *m)
+{
+  for (; m; m = m->parent)
+    {
+      int balance = marker_height (m->left) - marker_height (m->right);
+
+      if (balance > 1)
+	{
+	  if (marker_height (m->left->left) < marker_height (m->left->right))
+	    marker_rotate_left (b, m->left);
+	  m = marker_rotate_right (b, m);
+	}
+      else if (balance < -1)
+	{
+	  if (marker_height (m->right->right) < marker_height (m->right->left))
+	    marker_rotate_right (b, m->right);
+	  m = marker_rotate_left (b, m);
+	}
+      else
+	marker_update_height (m);
+    }
+}
+
+/* Insert M, which points nowhere, into the marker tree of B at
+   CHARPOS and BYTEPOS.  */
+
+static void
+marker_tree_insert (struct buffer *b, struct Lisp_Marker *m,
+		    ptrdiff_t charpos, ptrdiff_t bytepos)
+{
+  struct Lisp_Marker *parent = NULL;
+  struct Lisp_Marker **link = &BUF_MARKERS (b, m->insertion_type);
+  ptrdiff_t base = 0, base_byte = 0;
+
+  while (*link)
+    {
+      parent = *link;
+      base += parent->char_offset;
+      base_byte += parent->byte_offset;
+      link = charpos < base ? &parent->left : &parent->right;
+    }
+
+  m->parent = parent;
+  m->left = m->right = NULL;
+  m->height = 1;
+  m->char_offset = charpos - base;
+  m->byte_offset = bytepos - base_byte;
+  *link = m;
+  marker_rebalance (b, parent);
+}
+
+/* Remove M from the marker tree of B.  */
+
+static void
+marker_tree_remove (struct buffer *b, struct Lisp_Marker *m)
+{
+  bool type = m->insertion_type;
+  struct Lisp_Marker *start;
+
+  if (!m->left || !m->right)
+    {
+      struct Lisp_Marker *child = m->left ? m->left : m->right;
+
+      marker_add_offset (child, m->char_offset, m->byte_offset);
+      marker_replace_child (b, type, m->parent, m, child);
+      start = m->parent;
+    }
+  else
+    {
+      /* Replace M with its successor S, which has no left child.  */
+      struct Lisp_Marker *s = m->right;
+      ptrdiff_t nchars = s->char_offset, nbytes = s->byte_offset;
+
+      while (s->left)
+	{
+	  s = s->left;
+	  nchars += s->char_offset;
+	  nbytes += s->byte_offset;
+	}
+
+      start = s->parent == m ? s : s->parent;
+      marker_add_offset (s->right, s->char_offset, s->byte_offset);
+      marker_replace_child (b, type, s->parent, s, s->right);
+
+      s->left = m->left;
+      s->right = m->right;
+      s->left->parent = s;
+      if (s->right)
+	s->right->parent = s;
+      marker_add_offset (s->left, -nchars, -nbytes);
+      marker_add_offset (s->right, -nchars, -nbytes);
+      s->char_offset = m->char_offset + nchars;
+      s->byte_offset = m->byte_offset + nbytes;
+      s->height = m->height;
+      marker_replace_child (b, type, m->parent, m, s);
+    }
+
+  m->parent = m->left = m->right = NULL;
+  marker_rebalance (b, start);
+}
+
+/* Return the first marker at or after CHARPOS in the marker tree of B
+   whose insertion type is TYPE, or NULL if there is none.  */
+
+struct Lisp_Marker *
+marker_tree_first (struct buffer *b, bool type, ptrdiff_t charpos)
+{
+  struct Lisp_Marker *m = BUF_MARKERS (b, type), *found = NULL;
+  ptrdiff_t base = 0;
+
+  while (m)
+    {
+      base += m->char_offset;
+      if (base >= charpos)
+	{
+	  found = m;
+	  m = m->left;
+	}
+      else
+	m = m->right;
+    }
+  return found;
+}
+
+/* Return the marker after M in its marker tree, or NULL if M is the
+   last one.  */
+
+struct Lisp_Marker *
+marker_tree_next (struct Lisp_Marker *m)
+{
+  if (m->right)
+    {
+      for (m = m->right; m->left; m = m->left)
+	continue;
+      return m;
+    }
+  while (m->parent && m->parent->right == m)
+    m = m->parent;
+  return m->parent;
+}
+
+/* Return the first of all the markers of B, of either insertion
+   type, or NULL if B has none.  */
+
+struct Lisp_Marker *
+first_marker (struct buffer *b)
+{
+  struct Lisp_Marker *m = marker_tree_first (b, 0, PTRDIFF_MIN);
+  return m ? m : marker_tree_first (b, 1, PTRDIFF_MIN);
+}
+
+/* Return the marker that follows M when iterating over all the
+   markers of B, or NULL if M is the last one.  */
+
+struct Lisp_Marker *
+next_marker (struct buffer *b, struct Lisp_Marker *m)
+{
+  struct Lisp_Marker *next = marker_tree_next (m);
+  return (next || m->insertion_type
+	  ? next : marker_tree_first (b, 1, PTRDIFF_MIN));
+}
+
+/* Add NCHARS and NBYTES to the positions of the markers of B whose
+   insertion type is TYPE and that are after FROM, or at or after FROM
+   if INCLUSIVE.  */
+
+static void
+shift_marker_tree (struct buffer *b, bool type, ptrdiff_t from,
+		   bool inclusive, ptrdiff_t nchars, ptrdiff_t nbytes)
+{
+  struct Lisp_Marker *m = BUF_MARKERS (b, type);
+  ptrdiff_t base = 0;
+  bool shifted = 0;
+
+  /* Walk down to FROM.  Each marker passed on the way is shifted
+     along with its subtree by adjusting its offset, and the subtree
+     still containing markers on the other side of FROM is then
+     fixed up in turn.  BASE stays the unshifted position.  */
+  while (m)
+    {
+      bool shift;
+
+      base += m->char_offset;
+      shift = inclusive ? base >= from : base > from;
+      if (shift != shifted)
+	marker_add_offset (m, shift ? nchars : -nchars,
+			   shift ? nbytes : -nbytes);
+      shifted = shift;
+      m = shift ? m->left : m->right;
+    }
+}
+
+/* Move the markers of B whose insertion type is TYPE and that are
+   after FROM but not after TO to FROM and FROM_BYTE.  Return true if
+   any were moved.  */
+
+static bool
+collapse_marker_tree (struct buffer *b, bool type, ptrdiff_t from,
+		      ptrdiff_t from_byte, ptrdiff_t to)
+{
+  struct Lisp_Marker *m;
+  bool collapsed = 0;
+
+  /* This keeps the tree ordered, provided the markers after TO are
+     not moved back past FROM.  Moving a single marker without its
+     subtree means compensating in its children's offsets.  */
+  for (m = marker_tree_first (b, type, from + 1); m; m = marker_tree_next (m))
+    {
+      ptrdiff_t charpos = marker_charpos (m);
+      ptrdiff_t nchars, nbytes;
+
+      if (charpos > to)
+	break;
+      nchars = from - charpos;
+      nbytes = from_byte - marker_bytepos (m);
+      marker_add_offset (m, nchars, nbytes);
+      marker_add_offset (m->left, -nchars, -nbytes);
+      marker_add_offset (m->right, -nchars, -nbytes);
+      collapsed = 1;
+    }
+  return collapsed;
+}
+
+/* Return true if B has a marker whose insertion type is TYPE at
+   CHARPOS.  */
+
+static bool
+marker_tree_has (struct buffer *b, bool type, ptrdiff_t charpos)
+{
+  struct Lisp_Marker *m = marker_tree_first (b, type, charpos);
+  return m && marker_charpos (m) == charpos;
+}
+
+/* Relocate the markers of the current buffer for an insertion from
+   FROM / FROM_BYTE to TO / TO_BYTE.  Markers at FROM advance if their
+   insertion type is t, or if BEFORE_MARKERS.  Return true if a marker
+   at FROM advanced because of its insertion type.  */
+
+bool
+shift_markers_for_insert (ptrdiff_t from, ptrdiff_t from_byte,
+			  ptrdiff_t to, ptrdiff_t to_byte, bool before_markers)
+{
+  struct buffer *b = current_buffer;
+  bool advanced = !before_markers && marker_tree_has (b, 1, from);
+
+  shift_marker_tree (b, 0, from, before_markers, to - from,
+		     to_byte - from_byte);
+  shift_marker_tree (b, 1, from, 1, to - from, to_byte - from_byte);
+  return advanced;
+}
+
+/* Relocate the markers of the current buffer for replacing the text
+   from FROM / FROM_BYTE to TO / TO_BYTE with NEW_CHARS characters of
+   NEW_BYTES bytes; a deletion if NEW_CHARS is zero.  Markers inside
+   the text go to FROM, and markers at or after TO move with the text
+   after it.  Return true if that left markers at FROM that were not
+   there before.  */
+
+bool
+shift_markers_for_replace (ptrdiff_t from, ptrdiff_t from_byte,
+			   ptrdiff_t to, ptrdiff_t to_byte,
+			   ptrdiff_t new_chars, ptrdiff_t new_bytes)
+{
+  struct buffer *b = current_buffer;
+  ptrdiff_t nchars = new_chars - (to - from);
+  ptrdiff_t nbytes = new_bytes - (to_byte - from_byte);
+  bool collapsed = 0;
+  int type;
+
+  for (type = 0; type < 2; type++)
+    {
+      if (new_chars == 0 && marker_tree_has (b, type, to))
+	collapsed = 1;
+      if (collapse_marker_tree (b, type, from, from_byte, to - 1))
+	collapsed = 1;
+      shift_marker_tree (b, type, to, 1, nchars, nbytes);
+    }
+  return collapsed;
+}
+
+/* Set the insertion type of M to TYPE.  */
+
+void
+set_marker_insertion_type (struct Lisp_Marker *m, bool type)
+{
+  struct buffer *b = m->buffer;
+
+  if (m->insertion_type == type)
+    return;
+  if (b)
+    {
+      ptrdiff_t charpos = marker_charpos (m);
+      ptrdiff_t bytepos = marker_bytepos (m);
+
+      marker_tree_remove (b, m);
+      m->insertion_type = type;
+      marker_tree_insert (b, m, charpos, bytepos);
+    }
+  else
+    m->insertion_type = type;
+}
+
+/* Convert the offsets of the markers in the tree rooted at ROOT to
+   positions, if ABSOLUTE, or back.  While they are positions, the tree
+   must not be part of a buffer, and the positions can be changed in
+   any way that preserves their order.  */
+
+void
+set_marker_tree_absolute (struct Lisp_Marker *root, bool absolute)
+{
+  struct Lisp_Marker *m = root;
+
+  /* Visit parents before their children when converting to positions,
+     and after them when converting back, so that each marker's
+     parent still holds a position.  */
+  while (m)
+    {
+      if (absolute && m->parent)
+	{
+	  m->char_offset += m->parent->char_offset;
+	  m->byte_offset += m->parent->byte_offset;
+	}
+      if (m->left)
+	m = m->left;
+      else if (m->right)
+	m = m->right;
+      else
+	{
+	  /* Climb to the nearest ancestor with an unvisited right
+	     subtree.  */
+	  for (;;)
+	    {
+	      struct Lisp_Marker *child = m;
+
+	      if (!absolute && m->parent)
+		{
+		  m->char_offset -= m->parent->char_offset;
+		  m->byte_offset -= m->parent->byte_offset;
+		}
+	      m = m->parent;
+	      if (!m)
+		break;
+	      if (m->right && m->right != child)
+		{
+		  m = m->right;
+		  break;
+		}
+	    }
+	}
+    }
+}
+
 /* Operations on markers. */
 
 DEFUN ("marker-buffer", Fmarker_buffer, Smarker_buffer, 1, 1, 0,
@@ -418,14 +1164,14 @@ Returns nil if MARKER points nowhere.  */)
 {
   CHECK_MARKER (marker);
   if (XMARKER (marker)->buffer)
-    return make_number (XMARKER (marker)->charpos);
+    return make_number (marker_charpos (XMARKER (marker)));
 
   return Qnil;
 }
 
 /* Change M so it points to B at CHARPOS and BYTEPOS.  */
 
-static void
+void
 attach_marker (struct Lisp_Marker *m, struct buffer *b,
 	       ptrdiff_t charpos, ptrdiff_t bytepos)
 {
@@ -436,16 +1182,9 @@ attach_marker (struct Lisp_Marker *m, struct buffer *b,
   else
     eassert (charpos <= bytepos);
 
-  m->charpos = charpos;
-  m->bytepos = bytepos;
-
-  if (m->buffer != b)
-    {
-      unchain_marker (m);
-      m->buffer = b;
-      m->next = BUF_MARKERS (b);
-      BUF_MARKERS (b) = m;
-    }
+  unchain_marker (m);
+  m->buffer = b;
+  marker_tree_insert (b, m, charpos, bytepos);
 }
 
 /* If BUFFER is nil, return current buffer pointer.  Next, check
@@ -483,10 +1222,8 @@ set_marker_internal (Lisp_Object marker, Lisp_Object position,
      an existing marker, and MARKER is already in the same buffer.  */
   else if (MARKERP (position) && b == XMARKER (position)->buffer
 	   && b == m->buffer)
-    {
-      m->bytepos = XMARKER (position)->bytepos;
-      m->charpos = XMARKER (position)->charpos;
-    }
+    attach_marker (m, b, marker_charpos (XMARKER (position)),
+		   marker_bytepos (XMARKER (position)));
 
   else
     {
@@ -499,8 +1236,8 @@ set_marker_internal (Lisp_Object marker, Lisp_Object position,
 	charpos = XINT (position), bytepos = -1;
       else if (MARKERP (position))
 	{
-	  charpos = XMARKER (position)->charpos;
-	  bytepos = XMARKER (position)->bytepos;
+	  charpos = marker_charpos (XMARKER (position));
+	  bytepos = marker_bytepos (XMARKER (position));
 	}
       else
 	wrong_type_argument (Qinteger_or_marker_p, position);
@@ -583,10 +1320,10 @@ set_marker_restricted_both (Lisp_Object marker, Lisp_Object buffer,
   return marker;
 }
 
-/* Remove MARKER from the chain of whatever buffer it is in,
+/* Remove MARKER from the tree of whatever buffer it is in,
    leaving it points to nowhere.  This is called during garbage
    collection, so we must be careful to ignore and preserve
-   mark bits, including those in chain fields of markers.  */
+   mark bits, including those in tree fields of markers.  */
 
 void
 unchain_marker (register struct Lisp_Marker *marker)
@@ -595,34 +1332,50 @@ unchain_marker (register struct Lisp_Marker *marker)
 
   if (b)
     {
-      register struct Lisp_Marker *tail, **prev;
-
       /* No dead buffers here.  */
       eassert (BUFFER_LIVE_P (b));
 
+      marker_tree_remove (b, marker);
       marker->buffer = NULL;
-      prev = &BUF_MARKERS (b);
-
-      for (tail = BUF_MARKERS (b); tail; prev = &tail->next, tail = *prev)
-	if (marker == tail)
-	  {
-	    if (*prev == BUF_MARKERS (b))
-	      {
-		/* Deleting first marker from the buffer's chain.  Crash
-		   if new first marker in chain does not say it belongs
-		   to the same buffer, or at least that they have the same
-		   base buffer.  */
-		if (tail->next && b->text != tail->next->buffer->text)
-		  emacs_abort ();
-	      }
-	    *prev = tail->next;
-	    /* We have removed the marker from the chain;
-	       no need to scan the rest of the chain.  */
-	    break;
-	  }
-
-      /* Error if marker was not in it's chain.  */
-      eassert (tail != NULL);
+    }
+}
+
+/* Unchain all markers of B and its indirect buffers, leaving them
+   pointing nowhere.  Markers are detached leaves first, so that the
+   walk never follows a link that has already been cleared.  */
+
+void
+unchain_all_markers (struct buffer *b)
+{
+  int type;
+
+  for (type = 0; type < 2; type++)
+    {
+      struct Lisp_Marker *m = BUF_MARKERS (b, type);
+
+      while (m)
+	{
+	  if (m->left)
+	    m = m->left;
+	  else if (m->right)
+	    m = m->right;
+	  else
+	    {
+	      struct Lisp_Marker *parent = m->parent;
+
+	      if (parent)
+		{
+		  if (parent->left == m)
+		    parent->left = NULL;
+		  else
+		    parent->right = NULL;
+		}
+	      m->parent = NULL;
+	      m->buffer = NULL;
+	      m = parent;
+	    }
+	}
+      BUF_MARKERS (b, type) = NULL;
     }
 }
 
@@ -633,13 +1386,15 @@ marker_position (Lisp_Object marker)
 {
   register struct Lisp_Marker *m = XMARKER (marker);
   register struct buffer *buf = m->buffer;
+  ptrdiff_t charpos;
 
   if (!buf)
     error ("Marker does not point anywhere");
 
-  eassert (BUF_BEG (buf) <= m->charpos && m->charpos <= BUF_Z (buf));
+  charpos = marker_charpos (m);
+  eassert (BUF_BEG (buf) <= charpos && charpos <= BUF_Z (buf));
 
-  return m->charpos;
+  return charpos;
 }
 
 /* Return the byte position of marker MARKER, as a C integer.  */
@@ -649,13 +1404,15 @@ marker_byte_position (Lisp_Object marker)
 {
   register struct Lisp_Marker *m = XMARKER (marker);
   register struct buffer *buf = m->buffer;
+  ptrdiff_t bytepos;
 
   if (!buf)
     error ("Marker does not point anywhere");
 
-  eassert (BUF_BEG_BYTE (buf) <= m->bytepos && m->bytepos <= BUF_Z_BYTE (buf));
+  bytepos = marker_bytepos (m);
+  eassert (BUF_BEG_BYTE (buf) <= bytepos && bytepos <= BUF_Z_BYTE (buf));
 
-  return m->bytepos;
+  return bytepos;
 }
 
 DEFUN ("copy-marker", Fcopy_marker, Scopy_marker, 0, 2, 0,
@@ -675,7 +1432,7 @@ see `marker-insertion-type'.  */)
   new = Fmake_marker ();
   Fset_marker (new, marker,
 	       (MARKERP (marker) ? Fmarker_buffer (marker) : Qnil));
-  XMARKER (new)->insertion_type = !NILP (type);
+  set_marker_insertion_type (XMARKER (new), !NILP (type));
   return new;
 }
 
@@ -698,7 +1455,7 @@ If TYPE is nil, it means the marker stays behind when you insert text at it.  */
 {
   CHECK_MARKER (marker);
 
-  XMARKER (marker)->insertion_type = ! NILP (type);
+  set_marker_insertion_type (XMARKER (marker), !NILP (type));
   return type;
 }
 
@@ -707,18 +1464,33 @@ DEFUN ("buffer-has-markers-at", Fbuffer_has_markers_at, Sbuffer_has_markers_at,
        doc: /* Return t if there are markers pointing at POSITION in the current buffer.  */)
   (Lisp_Object position)
 {
-  register struct Lisp_Marker *tail;
   register ptrdiff_t charpos;
 
   charpos = clip_to_bounds (BEG, XINT (position), Z);
 
-  for (tail = BUF_MARKERS (current_buffer); tail; tail = tail->next)
-    if (tail->charpos == charpos)
-      return Qt;
+  if (marker_tree_has (current_buffer, 0, charpos)
+      || marker_tree_has (current_buffer, 1, charpos))
+    return Qt;
 
   return Qnil;
 }
 
+DEFUN ("position-index-counters", Fposition_index_counters,
+       Sposition_index_counters, 0, 0, 0,
+       doc: /* Return a list (HITS MISSES CHECKPOINTS) about the position index.
+Converting between character positions and byte positions in a
+multibyte buffer scans the text from the nearest known position,
+such as a checkpoint of the buffer's position index.  HITS counts the
+conversions that scanned less than a few kilobytes, and MISSES those
+that scanned further and added checkpoints to the index.
+CHECKPOINTS is the number of checkpoints of the current buffer.  */)
+  (void)
+{
+  return list3 (make_number (position_index_hits),
+		make_number (position_index_misses),
+		make_number (checkpoint_count (current_buffer->text)));
+}
+
 #ifdef MARKER_DEBUG
 
 /* For debugging -- count the markers in buffer BUF.  */
@@ -729,7 +1501,7 @@ count_markers (struct buffer *buf)
   int total = 0;
   struct Lisp_Marker *tail;
 
-  for (tail = BUF_MARKERS (buf); tail; tail = tail->next)
+  FOR_EACH_MARKER (buf, tail)
     total++;
 
   return total;
@@ -765,4 +1537,5 @@ syms_of_marker (void)
   defsubr (&Smarker_insertion_type);
   defsubr (&Sset_marker_insertion_type);
   defsubr (&Sbuffer_has_markers_at);
+  defsubr (&Sposition_index_counters);
 }
@@ -3426,6 +3426,7 @@ The argument object is never altered--the value is a copy.  */)
     return Qnil;
 
   tem = Fcopy_sequence (filename);
+  unshare_string_data (tem);
   msdos_downcase_filename (SDATA (tem));
   return tem;
 }
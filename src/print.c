@@ -20,12 +20,15 @@ along with GNU Emacs.  If not, see <http://www.gnu.org/licenses/>.  */
 
 
 #include <config.h>
+#include <errno.h>
+#include <fcntl.h>
 #include "sysstdio.h"
 
 #include "lisp.h"
 #include "character.h"
 #include "buffer.h"
 #include "charset.h"
+#include "coding.h"
 #include "keyboard.h"
 #include "frame.h"
 #include "window.h"
@@ -494,8 +497,7 @@ temp_output_buffer_setup (const char *bufname)
   bset_read_only (current_buffer, Qnil);
   bset_filename (current_buffer, Qnil);
   bset_undo_list (current_buffer, Qt);
-  eassert (current_buffer->overlays_before == NULL);
-  eassert (current_buffer->overlays_after == NULL);
+  eassert (current_buffer->overlays == NULL);
   bset_enable_multibyte_characters
     (current_buffer, BVAR (&buffer_defaults, enable_multibyte_characters));
   specbind (Qinhibit_read_only, Qt);
@@ -939,6 +941,401 @@ print_error_message (Lisp_Object data, Lisp_Object stream, const char *context,
 
 
 
+#if FLT_RADIX == 2 && DBL_MANT_DIG == 53 && DBL_MAX_EXP == 1024
+
+/* Printing IEEE doubles with the fewest digits that read back exactly.
+
+   This gives the same output as dtoastr, which tries "%.*g" with
+   increasing precisions until strtod reads the result back as the
+   original value.  Instead of formatting and reading the number
+   several times, float_digits finds the needed precision in one pass
+   over the exact decimal expansion of the value, using the method of
+   Steele & White, "How to print floating-point numbers accurately",
+   PLDI 1990; the digits are then formatted as "%.*g" would.  Unlike
+   the free-format output of that paper and of Grisu (Loitsch, PLDI
+   2010), the digits are always the correctly rounded ones, so the
+   output stays the same as what dtoastr prints.  */
+
+/* An unsigned integer big enough for a double scaled by a power of
+   ten, with room to spare: none gets as large as 2**850.  */
+
+enum { FBIG_LIMBS = 40 };
+
+struct fbig
+{
+  int len;
+  uint32_t d[FBIG_LIMBS];
+};
+
+static void
+fbig_set (struct fbig *b, uint64_t v)
+{
+  b->len = 0;
+  for (; v; v >>= 32)
+    b->d[b->len++] = v;
+}
+
+static void
+fbig_mul_small (struct fbig *b, uint32_t m)
+{
+  uint64_t carry = 0;
+  int i;
+  for (i = 0; i < b->len; i++)
+    {
+      carry += (uint64_t) b->d[i] * m;
+      b->d[i] = carry;
+      carry >>= 32;
+    }
+  if (carry)
+    b->d[b->len++] = carry;
+}
+
+/* Multiply B by BASE**N, where BASE is 5 or 10.  */
+
+static void
+fbig_mul_pow (struct fbig *b, int base, int n)
+{
+  /* The largest powers that fit in 32 bits.  */
+  int chunk = base == 5 ? 13 : 9;
+  uint32_t big = base == 5 ? 1220703125 : 1000000000;
+  uint32_t m = 1;
+  for (; chunk < n; n -= chunk)
+    fbig_mul_small (b, big);
+  for (; 0 < n; n--)
+    m *= base;
+  fbig_mul_small (b, m);
+}
+
+static void
+fbig_shift_left (struct fbig *b, int n)
+{
+  int words = n / 32, bits = n % 32, i;
+  if (b->len == 0)
+    return;
+  if (bits)
+    {
+      uint32_t high = b->d[b->len - 1] >> (32 - bits);
+      for (i = b->len - 1; 0 < i; i--)
+	b->d[i] = b->d[i] << bits | b->d[i - 1] >> (32 - bits);
+      b->d[0] <<= bits;
+      if (high)
+	b->d[b->len++] = high;
+    }
+  if (words)
+    {
+      memmove (b->d + words, b->d, b->len * sizeof *b->d);
+      memset (b->d, 0, words * sizeof *b->d);
+      b->len += words;
+    }
+}
+
+static int
+fbig_cmp (struct fbig const *a, struct fbig const *b)
+{
+  int i;
+  if (a->len != b->len)
+    return a->len < b->len ? -1 : 1;
+  for (i = a->len - 1; 0 <= i; i--)
+    if (a->d[i] != b->d[i])
+      return a->d[i] < b->d[i] ? -1 : 1;
+  return 0;
+}
+
+/* Compare A + B with C.  */
+
+static int
+fbig_cmp_sum (struct fbig const *a, struct fbig const *b,
+	      struct fbig const *c)
+{
+  struct fbig sum;
+  uint64_t carry = 0;
+  int i, len = max (a->len, b->len);
+  for (i = 0; i < len; i++)
+    {
+      carry += ((uint64_t) (i < a->len ? a->d[i] : 0)
+		+ (i < b->len ? b->d[i] : 0));
+      sum.d[i] = carry;
+      carry >>= 32;
+    }
+  if (carry)
+    sum.d[len++] = carry;
+  sum.len = len;
+  return fbig_cmp (&sum, c);
+}
+
+/* Subtract B from A, which must not be less than B.  */
+
+static void
+fbig_sub (struct fbig *a, struct fbig const *b)
+{
+  int64_t borrow = 0;
+  int i;
+  for (i = 0; i < a->len; i++)
+    {
+      borrow += (int64_t) a->d[i] - (i < b->len ? b->d[i] : 0);
+      a->d[i] = borrow;
+      borrow = borrow < 0 ? -1 : 0;
+    }
+  while (a->len && !a->d[a->len - 1])
+    a->len--;
+}
+
+/* Subtract from R the largest multiple of S that R contains, which
+   must be less than 10, and return the multiplier.  */
+
+static int
+fbig_divide (struct fbig *r, struct fbig const *s)
+{
+  int len = s->len, i, q;
+  double top_r, top_s;
+  int64_t borrow = 0;
+
+  if (r->len < len)
+    return 0;
+
+  /* Estimate the quotient from the leading limbs, erring low.  */
+  top_r = ((r->len > len ? r->d[len] * 4294967296.0 : 0) + r->d[len - 1]
+	   + (1 < len ? r->d[len - 2] / 4294967296.0 : 0));
+  top_s = s->d[len - 1] + (1 < len ? (s->d[len - 2] + 1) / 4294967296.0 : 0);
+  q = top_r / top_s;
+  if (q)
+    {
+      q--;
+      for (i = 0; i < r->len; i++)
+	{
+	  borrow += r->d[i] - (i < len ? (int64_t) s->d[i] * q : 0);
+	  r->d[i] = borrow;
+	  borrow = (borrow - (uint32_t) borrow) / 4294967296;
+	}
+      while (r->len && !r->d[r->len - 1])
+	r->len--;
+    }
+  for (; 0 <= fbig_cmp (r, s); q++)
+    fbig_sub (r, s);
+  return q;
+}
+
+/* Whether the digit just generated should be rounded up, given
+   HALF, the comparison of the remainder with half a unit in the last
+   place, and the parity of DIGIT.  printf rounds ties to even.  */
+
+static bool
+float_round_up (int half, int digit)
+{
+  return 0 < half || (half == 0 && (digit & 1));
+}
+
+/* Whether a number MARGIN (compared with the distance to the value
+   being printed) reads back as that value; EVEN says ties do.  */
+
+static bool
+float_reads_back (int margin, bool even)
+{
+  return 0 < margin || (margin == 0 && even);
+}
+
+/* Store in DIGITS the decimal digits of the finite positive double
+   F * 2**E that "%.*g" prints with the smallest precision, no less
+   than START, that reads back as the same value.  BOUNDARY says F is
+   a power of two whose lower neighbor is closer than its upper one.
+   Return the precision, and set *EXP10 to the decimal exponent of
+   the first digit.  */
+
+static int
+float_digits (char *digits, uint64_t f, int e, bool boundary, int start,
+	      int *exp10)
+{
+  struct fbig r, s, mplus, mminus, twice;
+  bool even = !(f & 1), up;
+  int scale = boundary ? 2 : 1;
+  int bits = 0, k, n, rshift, sshift, common, i;
+
+  /* The value is R / S, and any number less than MPLUS / S above it
+     or MMINUS / S below it reads back as the same value.  */
+  fbig_set (&r, f << scale);
+  fbig_set (&mplus, boundary ? 2 : 1);
+  fbig_set (&mminus, 1);
+  fbig_set (&s, 1);
+  rshift = max (e, 0);
+  sshift = scale - min (e, 0);
+
+  /* Scale so that 1 <= R / S < 10, starting from an estimate of the
+     decimal exponent that is off by at most one.  Multiply by powers
+     of five and leave the powers of two to the shifts, which can
+     then drop any power of two common to R and S.  */
+  for (; f >> bits; bits++)
+    continue;
+  k = e + bits - 1;
+  k = 0 <= k ? k * 78913 >> 18 : - ((-k * 78913 + (1 << 18) - 1) >> 18);
+  if (0 <= k)
+    fbig_mul_pow (&s, 5, k);
+  else
+    {
+      fbig_mul_pow (&r, 5, -k);
+      fbig_mul_pow (&mplus, 5, -k);
+      fbig_mul_pow (&mminus, 5, -k);
+    }
+  sshift += k;
+  common = min (rshift, sshift);
+  fbig_shift_left (&r, rshift - common);
+  fbig_shift_left (&mplus, rshift - common);
+  fbig_shift_left (&mminus, rshift - common);
+  fbig_shift_left (&s, sshift - common);
+  for (; fbig_cmp (&r, &s) < 0; k--)
+    {
+      fbig_mul_small (&r, 10);
+      fbig_mul_small (&mplus, 10);
+      fbig_mul_small (&mminus, 10);
+    }
+  twice = s;
+  fbig_mul_small (&twice, 10);
+  for (; 0 <= fbig_cmp (&r, &twice); k++)
+    {
+      fbig_mul_small (&s, 10);
+      fbig_mul_small (&twice, 10);
+    }
+
+  /* Generate digits until the correctly rounded number reads back.
+     Until then MPLUS and MMINUS are at most 2 * S, so if S < 2**59
+     nothing overflows 64 bits, which is the common case for numbers
+     of ordinary size.  */
+  if (s.len == 1 || (s.len == 2 && s.d[1] < 1 << 27))
+    {
+      uint64_t s64 = s.d[0] | (s.len == 2 ? (uint64_t) s.d[1] << 32 : 0);
+      uint64_t r64 = r.d[0] | (r.len == 2 ? (uint64_t) r.d[1] << 32 : 0);
+      uint64_t mplus64 = mplus.d[0] | (mplus.len == 2
+				       ? (uint64_t) mplus.d[1] << 32 : 0);
+      uint64_t mminus64 = mminus.d[0] | (mminus.len == 2
+					 ? (uint64_t) mminus.d[1] << 32 : 0);
+      for (n = 1; ; n++)
+	{
+	  int digit = r64 / s64;
+	  bool exact;
+	  r64 %= s64;
+	  digits[n - 1] = digit;
+	  up = float_round_up ((2 * r64 > s64) - (2 * r64 < s64), digit);
+	  exact = (up
+		   ? float_reads_back ((r64 + mplus64 > s64)
+				       - (r64 + mplus64 < s64), even)
+		   : float_reads_back ((mminus64 > r64) - (mminus64 < r64),
+				       even));
+	  if (exact || n == DBL_DIG + 2)
+	    break;
+	  r64 *= 10;
+	  mplus64 *= 10;
+	  mminus64 *= 10;
+	}
+    }
+  else
+    for (n = 1; ; n++)
+      {
+	int digit = fbig_divide (&r, &s);
+	bool exact;
+	digits[n - 1] = digit;
+	up = float_round_up (fbig_cmp_sum (&r, &r, &s), digit);
+	exact = (up
+		 ? float_reads_back (fbig_cmp_sum (&r, &mplus, &s), even)
+		 : float_reads_back (- fbig_cmp (&r, &mminus), even));
+	if (exact || n == DBL_DIG + 2)
+	  break;
+	fbig_mul_small (&r, 10);
+	fbig_mul_small (&mplus, 10);
+	fbig_mul_small (&mminus, 10);
+      }
+
+  if (up)
+    {
+      for (i = n - 1; 0 <= i && digits[i] == 9; i--)
+	digits[i] = 0;
+      if (i < 0)
+	{
+	  digits[0] = 1;
+	  k++;
+	}
+      else
+	digits[i]++;
+    }
+  *exp10 = k;
+
+  /* A number of at most DBL_DIG digits that reads back also results
+     from rounding to DBL_DIG digits, so dtoastr would have printed it
+     with trailing zeros.  */
+  for (; n < start; n++)
+    digits[n] = 0;
+  return n;
+}
+
+/* Print the finite double DATA into BUF the way dtoastr does, and
+   return the length of the output.  */
+
+static int
+float_to_shortest (char *buf, double data)
+{
+  char digits[DBL_DIG + 2];
+  char *p = buf;
+  uint64_t bits, f;
+  int biased, e, exp10, prec, ndigits, i;
+
+  memcpy (&bits, &data, sizeof bits);
+  if (bits >> 63)
+    *p++ = '-';
+  biased = bits >> 52 & 0x7ff;
+  f = bits & (((uint64_t) 1 << 52) - 1);
+  if (f == 0 && biased == 0)
+    {
+      *p++ = '0';
+      *p = 0;
+      return p - buf;
+    }
+  e = biased ? biased - 1075 : -1074;
+  if (biased)
+    f |= (uint64_t) 1 << 52;
+
+  /* dtoastr starts at precision DBL_DIG, or 1 for subnormals.  */
+  prec = float_digits (digits, f, e, f == (uint64_t) 1 << 52 && 1 < biased,
+		       biased ? DBL_DIG : 1, &exp10);
+
+  /* "%g" omits trailing zeros.  */
+  for (ndigits = prec; 1 < ndigits && digits[ndigits - 1] == 0; ndigits--)
+    continue;
+
+  if (exp10 < -4 || prec <= exp10)
+    {
+      *p++ = '0' + digits[0];
+      if (1 < ndigits)
+	{
+	  *p++ = '.';
+	  for (i = 1; i < ndigits; i++)
+	    *p++ = '0' + digits[i];
+	}
+      p += sprintf (p, "e%c%02d", exp10 < 0 ? '-' : '+', eabs (exp10));
+    }
+  else if (exp10 < 0)
+    {
+      *p++ = '0';
+      *p++ = '.';
+      for (i = -1; exp10 < i; i--)
+	*p++ = '0';
+      for (i = 0; i < ndigits; i++)
+	*p++ = '0' + digits[i];
+    }
+  else
+    {
+      for (i = 0; i <= exp10; i++)
+	*p++ = '0' + (i < ndigits ? digits[i] : 0);
+      if (exp10 + 1 < ndigits)
+	{
+	  *p++ = '.';
+	  for (; i < ndigits; i++)
+	    *p++ = '0' + digits[i];
+	}
+    }
+  *p = 0;
+  return p - buf;
+}
+
+#endif
+
 /*
  * The buffer should be at least as large as the max string size of the
  * largest float, printed in the biggest notation.  This is undoubtedly
@@ -1005,7 +1402,11 @@ float_to_string (char *buf, double data)
     {
       /* Generate the fewest number of digits that represent the
 	 floating point value without losing information.  */
+#if FLT_RADIX == 2 && DBL_MANT_DIG == 53 && DBL_MAX_EXP == 1024
+      len = float_to_shortest (buf, data);
+#else
       len = dtoastr (buf, FLOAT_TO_STRING_BUFSIZE - 2, 0, 0, data);
+#endif
       /* The decimal point must be printed, or the byte compiler can
 	 get confused (Bug#8033). */
       width = 1;
@@ -1101,7 +1502,6 @@ print (Lisp_Object obj, Lisp_Object printcharfun, bool escapeflag)
     {
       /* Construct Vprint_number_table.
 	 This increments print_number_index for the objects added.  */
-      print_depth = 0;
       print_preprocess (obj);
 
       if (HASH_TABLE_P (Vprint_number_table))
@@ -1131,125 +1531,128 @@ print (Lisp_Object obj, Lisp_Object printcharfun, bool escapeflag)
        && SYMBOLP (obj)							\
        && !SYMBOL_INTERNED_P (obj)))
 
+/* Objects that print_preprocess has yet to visit.  It does not call
+   Lisp, so there is only one walk at a time.  */
+static Lisp_Object *pp_stack;
+static ptrdiff_t pp_stack_size, pp_stack_len;
+
+static void
+pp_stack_push (Lisp_Object obj)
+{
+  if (pp_stack_len == pp_stack_size)
+    pp_stack = xpalloc (pp_stack, &pp_stack_size, 1, -1, sizeof *pp_stack);
+  pp_stack[pp_stack_len++] = obj;
+}
+
 /* Construct Vprint_number_table according to the structure of OBJ.
    OBJ itself and all its elements will be added to Vprint_number_table
-   recursively if it is a list, vector, compiled function, char-table,
-   string (its text properties will be traced), or a symbol that has
-   no obarray (this is for the print-gensym feature).
-   The status fields of Vprint_number_table mean whether each object appears
-   more than once in OBJ: Qnil at the first time, and Qt after that.  */
+   if it is a list, vector, compiled function, char-table, string (its
+   text properties will be traced), or a symbol that has no obarray
+   (this is for the print-gensym feature).  Each object is visited only
+   once, so this takes time proportional to the size of OBJ however
+   much it is shared, and since the walk keeps its own stack instead of
+   recursing, it does not overflow the C stack on deeply nested data.
+
+   The status fields of Vprint_number_table mean whether each object
+   appears more than once in OBJ: t at the first time, and a negative
+   number after that.  If `print-circle' is nil, only uninterned
+   symbols get numbers.  */
 static void
 print_preprocess (Lisp_Object obj)
 {
-  int i;
-  ptrdiff_t size;
-  int loop_count = 0;
-  Lisp_Object halftail;
+  struct Lisp_Hash_Table *h;
+  bool circle = !NILP (Vprint_circle);
+  ptrdiff_t i, size;
 
-  /* Avoid infinite recursion for circular nested structure
-     in the case where Vprint_circle is nil.  */
-  if (NILP (Vprint_circle))
+  if (!HASH_TABLE_P (Vprint_number_table))
     {
-      /* Give up if we go so deep that print_object will get an error.  */
-      /* See similar code in print_object.  */
-      if (print_depth >= PRINT_CIRCLE)
-	error ("Apparently circular structure being printed");
-
-      for (i = 0; i < print_depth; i++)
-	if (EQ (obj, being_printed[i]))
-	  return;
-      being_printed[print_depth] = obj;
+      Lisp_Object args[2];
+      args[0] = QCtest;
+      args[1] = Qeq;
+      Vprint_number_table = Fmake_hash_table (2, args);
     }
+  h = XHASH_TABLE (Vprint_number_table);
 
-  print_depth++;
-  halftail = obj;
-
- loop:
-  if (PRINT_CIRCLE_CANDIDATE_P (obj))
+  pp_stack_len = 0;
+  pp_stack_push (obj);
+  while (pp_stack_len > 0)
     {
-      if (!HASH_TABLE_P (Vprint_number_table))
-	{
-	  Lisp_Object args[2];
-	  args[0] = QCtest;
-	  args[1] = Qeq;
-	  Vprint_number_table = Fmake_hash_table (2, args);
+      EMACS_UINT hash;
+
+      obj = pp_stack[--pp_stack_len];
+      if (!PRINT_CIRCLE_CANDIDATE_P (obj))
+	continue;
+
+      i = hash_lookup (h, obj, &hash);
+      if (i >= 0)
+	{ /* OBJ appears more than once.  Let's remember that.  */
+	  if ((circle || SYMBOLP (obj)) && !INTEGERP (HASH_VALUE (h, i)))
+	    {
+	      print_number_index++;
+	      /* Negative number indicates it hasn't been printed yet.  */
+	      set_hash_value_slot (h, i, make_number (- print_number_index));
+	    }
+	  continue;
 	}
 
-      /* In case print-circle is nil and print-gensym is t,
-	 add OBJ to Vprint_number_table only when OBJ is a symbol.  */
-      if (! NILP (Vprint_circle) || SYMBOLP (obj))
+      /* If Vprint_continuous_numbering is non-nil and OBJ is a gensym,
+	 always print the gensym with a number.  This is a special for
+	 the lisp function byte-compile-output-docform.  */
+      if (!NILP (Vprint_continuous_numbering)
+	  && SYMBOLP (obj) && !SYMBOL_INTERNED_P (obj))
 	{
-	  Lisp_Object num = Fgethash (obj, Vprint_number_table, Qnil);
-	  if (!NILP (num)
-	      /* If Vprint_continuous_numbering is non-nil and OBJ is a gensym,
-		 always print the gensym with a number.  This is a special for
-		 the lisp function byte-compile-output-docform.  */
-	      || (!NILP (Vprint_continuous_numbering)
-		  && SYMBOLP (obj)
-		  && !SYMBOL_INTERNED_P (obj)))
-	    { /* OBJ appears more than once.	Let's remember that.  */
-	      if (!INTEGERP (num))
-		{
-		  print_number_index++;
-		  /* Negative number indicates it hasn't been printed yet.  */
-		  Fputhash (obj, make_number (- print_number_index),
-			    Vprint_number_table);
-		}
-	      print_depth--;
-	      return;
-	    }
-	  else
-	    /* OBJ is not yet recorded.  Let's add to the table.  */
-	    Fputhash (obj, Qt, Vprint_number_table);
+	  print_number_index++;
+	  hash_put (h, obj, make_number (- print_number_index), hash);
+	  continue;
 	}
+      hash_put (h, obj, Qt, hash);
 
+      /* Push the elements of OBJ in reverse, so that they are visited
+	 in order and the numbers follow the order of printing.  */
       switch (XTYPE (obj))
 	{
 	case Lisp_String:
 	  /* A string may have text properties, which can be circular.  */
+	  i = pp_stack_len;
 	  traverse_intervals_noorder (string_intervals (obj),
 				      print_preprocess_string, Qnil);
+	  for (size = pp_stack_len - 1; i < size; i++, size--)
+	    {
+	      Lisp_Object tem = pp_stack[i];
+	      pp_stack[i] = pp_stack[size];
+	      pp_stack[size] = tem;
+	    }
 	  break;
 
 	case Lisp_Cons:
-	  /* Use HALFTAIL and LOOP_COUNT to detect circular lists,
-	     just as in print_object.  */
-	  if (loop_count && EQ (obj, halftail))
-	    break;
-	  print_preprocess (XCAR (obj));
-	  obj = XCDR (obj);
-	  loop_count++;
-	  if (!(loop_count & 1))
-	    halftail = XCDR (halftail);
-	  goto loop;
+	  pp_stack_push (XCDR (obj));
+	  pp_stack_push (XCAR (obj));
+	  break;
 
 	case Lisp_Vectorlike:
+	  if (HASH_TABLE_P (obj))
+	    /* For hash tables, the key_and_value slot is past `size'
+	       because it needs to be marked specially in case the table
+	       is weak.  */
+	    pp_stack_push (XHASH_TABLE (obj)->key_and_value);
 	  size = ASIZE (obj);
 	  if (size & PSEUDOVECTOR_FLAG)
 	    size &= PSEUDOVECTOR_SIZE_MASK;
-	  for (i = (SUB_CHAR_TABLE_P (obj)
-		    ? SUB_CHAR_TABLE_OFFSET : 0); i < size; i++)
-	    print_preprocess (AREF (obj, i));
-	  if (HASH_TABLE_P (obj))
-	    { /* For hash tables, the key_and_value slot is past
-		 `size' because it needs to be marked specially in case
-		 the table is weak.  */
-	      struct Lisp_Hash_Table *h = XHASH_TABLE (obj);
-	      print_preprocess (h->key_and_value);
-	    }
+	  for (i = size - 1;
+	       i >= (SUB_CHAR_TABLE_P (obj) ? SUB_CHAR_TABLE_OFFSET : 0); i--)
+	    pp_stack_push (AREF (obj, i));
 	  break;
 
 	default:
 	  break;
 	}
     }
-  print_depth--;
 }
 
 static void
 print_preprocess_string (INTERVAL interval, Lisp_Object arg)
 {
-  print_preprocess (interval->plist);
+  pp_stack_push (interval->plist);
 }
 
 static void print_check_string_charset_prop (INTERVAL interval, Lisp_Object string);
@@ -1331,6 +1734,47 @@ print_prune_string_charset (Lisp_Object string)
   return string;
 }
 
+/* Return the number of bytes from byte I_BYTE of STRING on that
+   print_object would print unchanged, one character at a time, and
+   store the number of their characters in *NCHARS.  SYMBOL means
+   STRING is the name of a symbol rather than a string, and ESCAPEFLAG
+   is as in print_object.  When printing to print_buffer, such a run of
+   characters can be copied in one go.  */
+
+static ptrdiff_t
+print_plain_run (Lisp_Object string, ptrdiff_t i_byte, bool symbol,
+		 bool escapeflag, ptrdiff_t *nchars)
+{
+  unsigned char const *start = SDATA (string) + i_byte;
+  unsigned char const *end = SDATA (string) + SBYTES (string);
+  unsigned char const *p;
+  bool multibyte = STRING_MULTIBYTE (string);
+  ptrdiff_t n = 0;
+
+  for (p = start; p < end; n++)
+    {
+      int c = *p;
+      if (ASCII_CHAR_P (c))
+	{
+	  if (!escapeflag)
+	    ;
+	  else if (symbol
+		   ? (c <= 040 || strchr ("\"\\';#(),.`[]?", c))
+		   : (c == '\"' || c == '\\'
+		      || ((c == '\n' || c == '\f') && print_escape_newlines)))
+	    break;
+	  p++;
+	}
+      else if (multibyte && !CHAR_BYTE8_HEAD_P (c)
+	       && (symbol || !escapeflag || !print_escape_multibyte))
+	p += BYTES_BY_CHAR_HEAD (c);
+      else
+	break;
+    }
+  *nchars = n;
+  return p - start;
+}
+
 static void
 print_object (Lisp_Object obj, Lisp_Object printcharfun, bool escapeflag)
 {
@@ -1436,6 +1880,22 @@ print_object (Lisp_Object obj, Lisp_Object printcharfun, bool escapeflag)
 		 corresponding character code before handing it to PRINTCHAR.  */
 	      int c;
 
+	      if (NILP (printcharfun) && !need_nonhex)
+		{
+		  ptrdiff_t nchars;
+		  ptrdiff_t nbytes = print_plain_run (obj, i_byte, 0, 1,
+						      &nchars);
+		  if (nbytes > 0)
+		    {
+		      QUIT;
+		      strout (SSDATA (obj) + i_byte, nchars, nbytes,
+			      printcharfun);
+		      i += nchars;
+		      i_byte += nbytes;
+		      continue;
+		    }
+		}
+
 	      FETCH_STRING_CHAR_ADVANCE (c, obj, i, i_byte);
 
 	      QUIT;
@@ -1565,6 +2025,22 @@ print_object (Lisp_Object obj, Lisp_Object printcharfun, bool escapeflag)
 
 	for (i = 0, i_byte = 0; i_byte < size_byte;)
 	  {
+	    if (NILP (printcharfun) && !confusing)
+	      {
+		ptrdiff_t nchars;
+		ptrdiff_t nbytes = print_plain_run (name, i_byte, 1,
+						    escapeflag, &nchars);
+		if (nbytes > 0)
+		  {
+		    QUIT;
+		    strout (SSDATA (name) + i_byte, nchars, nbytes,
+			    printcharfun);
+		    i += nchars;
+		    i_byte += nbytes;
+		    continue;
+		  }
+	      }
+
 	    /* Here, we must convert each multi-byte form to the
 	       corresponding character code before handing it to PRINTCHAR.  */
 	    FETCH_STRING_CHAR_ADVANCE (c, name, i, i_byte);
@@ -2194,6 +2670,640 @@ print_interval (INTERVAL interval, Lisp_Object printcharfun)
   print_object (interval->plist, printcharfun, 1);
 }
 
+
+/* Binary output of Lisp objects.
+
+   This writes objects in the encoding described by enum binary_tag,
+   which lread.c can turn back into objects without tokenizing text or
+   looking up every symbol name.  Sharing and circularity are always
+   preserved, as if `print-circle' were non-nil: a first pass over the
+   object records everything that is reachable more than once, and the
+   second pass writes such objects once, prefixed by BIN_DEF, and refers
+   to them later with BIN_REF.  */
+
+/* Initialize OUT.  LOAD_FILE_NAME, if non-nil, is an object that
+   stands for the name of the file being read, as `#$' does in .elc
+   files.  LAZY_THRESHOLD is as in struct binary_output.  */
+
+void
+binary_output_init (struct binary_output *out, Lisp_Object load_file_name,
+		    ptrdiff_t lazy_threshold)
+{
+  Lisp_Object args[4];
+
+  out->size = 1024;
+  out->buf = xmalloc (out->size);
+  out->len = 0;
+  args[0] = QCtest;
+  args[1] = Qeq;
+  out->symbols = Fmake_hash_table (2, args);
+  /* OUT->seen gets an entry for nearly every object written, so let it
+     grow faster than usual.  */
+  args[2] = QCrehash_size;
+  args[3] = make_float (4.0);
+  out->seen = Fmake_hash_table (4, args);
+  out->nshared = out->nlabels = 0;
+  out->symbol_list = Qnil;
+  out->nsymbols = 0;
+  out->load_file_name = load_file_name;
+  out->lazy_threshold = lazy_threshold;
+  out->in_lazy = 0;
+}
+
+/* Free the buffer of OUT, which is a struct binary_output *.
+   This can be used with record_unwind_protect_ptr.  */
+
+void
+binary_output_free (void *out)
+{
+  xfree (((struct binary_output *) out)->buf);
+}
+
+static void
+binary_output_grow (struct binary_output *out, ptrdiff_t nbytes)
+{
+  if (out->size - out->len < nbytes)
+    out->buf = xpalloc (out->buf, &out->size, nbytes - (out->size - out->len),
+			-1, 1);
+}
+
+void
+binary_output_byte (struct binary_output *out, int c)
+{
+  binary_output_grow (out, 1);
+  out->buf[out->len++] = c;
+}
+
+void
+binary_output_uint (struct binary_output *out, EMACS_UINT n)
+{
+  binary_output_grow (out, (sizeof n * CHAR_BIT + 6) / 7);
+  while (n >= 0x80)
+    {
+      out->buf[out->len++] = (n & 0x7f) | 0x80;
+      n >>= 7;
+    }
+  out->buf[out->len++] = n;
+}
+
+static void
+binary_output_bytes (struct binary_output *out, const void *p,
+		     ptrdiff_t nbytes)
+{
+  binary_output_grow (out, nbytes);
+  memcpy (out->buf + out->len, p, nbytes);
+  out->len += nbytes;
+}
+
+/* Write the text of string STR, without its properties, using TAG for
+   unibyte strings.  */
+
+static void
+binary_output_string_data (struct binary_output *out, Lisp_Object str,
+			   int tag)
+{
+  if (STRING_MULTIBYTE (str))
+    {
+      binary_output_byte (out, BIN_MSTRING);
+      binary_output_uint (out, SCHARS (str));
+    }
+  else
+    binary_output_byte (out, tag);
+  binary_output_uint (out, SBYTES (str));
+  binary_output_bytes (out, SDATA (str), SBYTES (str));
+}
+
+/* Return the end of the run of text properties of STR at POS.  */
+
+static ptrdiff_t
+binary_next_property_change (Lisp_Object str, ptrdiff_t pos)
+{
+  Lisp_Object next = Fnext_property_change (make_number (pos), str, Qnil);
+  return NILP (next) ? SCHARS (str) : XFASTINT (next);
+}
+
+/* Return true if OBJ can be reached more than once, i.e. if the
+   hash table OUT->seen should record it.  */
+
+static bool
+binary_shareable_p (struct binary_output *out, Lisp_Object obj)
+{
+  return ((STRINGP (obj) || CONSP (obj) || VECTORLIKEP (obj)
+	   || (SYMBOLP (obj) && !SYMBOL_INTERNED_P (obj)))
+	  && (NILP (out->load_file_name) || !EQ (obj, out->load_file_name)));
+}
+
+/* First pass: record in OUT->seen which objects reachable from OBJ
+   are reachable more than once.  Signal an error for objects that
+   have no binary representation.  */
+
+static void
+binary_scan (struct binary_output *out, Lisp_Object obj)
+{
+  struct Lisp_Hash_Table *h = XHASH_TABLE (out->seen);
+  EMACS_UINT hash;
+  ptrdiff_t i, size;
+
+ loop:
+  if (SYMBOLP (obj) && SYMBOL_INTERNED_P (obj)
+      && !SYMBOL_INTERNED_IN_INITIAL_OBARRAY_P (obj))
+    signal_error ("Symbol not in `obarray' has no binary form", obj);
+  if (!binary_shareable_p (out, obj))
+    return;
+
+  i = hash_lookup (h, obj, &hash);
+  if (i >= 0)
+    {
+      if (NILP (HASH_VALUE (h, i)))
+	{
+	  set_hash_value_slot (h, i, Qt);
+	  out->nshared++;
+	}
+      return;
+    }
+  hash_put (h, obj, Qnil, hash);
+
+  switch (XTYPE (obj))
+    {
+    case Lisp_String:
+      if (string_intervals (obj))
+	{
+	  ptrdiff_t pos, next;
+	  for (pos = 0; pos < SCHARS (obj); pos = next)
+	    {
+	      next = binary_next_property_change (obj, pos);
+	      binary_scan (out, Ftext_properties_at (make_number (pos), obj));
+	    }
+	}
+      break;
+
+    case Lisp_Cons:
+      binary_scan (out, XCAR (obj));
+      obj = XCDR (obj);
+      goto loop;
+
+    case Lisp_Vectorlike:
+      if (BOOL_VECTOR_P (obj))
+	break;
+      if (HASH_TABLE_P (obj))
+	{
+	  struct Lisp_Hash_Table *table = XHASH_TABLE (obj);
+	  binary_scan (out, table->test.name);
+	  binary_scan (out, table->weak);
+	  binary_scan (out, table->rehash_size);
+	  binary_scan (out, table->rehash_threshold);
+	  for (i = 0; i < HASH_TABLE_SIZE (table); i++)
+	    if (!NILP (HASH_HASH (table, i)))
+	      {
+		binary_scan (out, HASH_KEY (table, i));
+		binary_scan (out, HASH_VALUE (table, i));
+	      }
+	  break;
+	}
+      if (!(VECTORP (obj) || COMPILEDP (obj)
+	    || CHAR_TABLE_P (obj) || SUB_CHAR_TABLE_P (obj)))
+	signal_error ("Object has no binary form", obj);
+      size = ASIZE (obj) & PSEUDOVECTOR_SIZE_MASK;
+      for (i = SUB_CHAR_TABLE_P (obj) ? SUB_CHAR_TABLE_OFFSET : 0;
+	   i < size; i++)
+	binary_scan (out, AREF (obj, i));
+      break;
+
+    default:
+      break;
+    }
+}
+
+/* Return true if no object reachable from OBJ is reachable from
+   anywhere else, so that OBJ can be written out of line.  */
+
+static bool
+binary_unshared_p (struct binary_output *out, Lisp_Object obj)
+{
+  struct Lisp_Hash_Table *h = XHASH_TABLE (out->seen);
+  ptrdiff_t i, size;
+
+  for (; binary_shareable_p (out, obj); obj = XCDR (obj))
+    {
+      i = hash_lookup (h, obj, NULL);
+      if (i >= 0 && !NILP (HASH_VALUE (h, i)))
+	return 0;
+      if (STRINGP (obj))
+	return !string_intervals (obj);
+      if (SYMBOLP (obj) || BOOL_VECTOR_P (obj))
+	return 1;
+      if (HASH_TABLE_P (obj))
+	return 0;
+      if (VECTORLIKEP (obj))
+	{
+	  size = ASIZE (obj) & PSEUDOVECTOR_SIZE_MASK;
+	  for (i = SUB_CHAR_TABLE_P (obj) ? SUB_CHAR_TABLE_OFFSET : 0;
+	       i < size; i++)
+	    if (!binary_unshared_p (out, AREF (obj, i)))
+	      return 0;
+	  return 1;
+	}
+      if (!binary_unshared_p (out, XCAR (obj)))
+	return 0;
+    }
+  return 1;
+}
+
+/* If OBJ is reachable more than once, write BIN_REF and return true
+   if it was already written, or write BIN_DEF and return false if this
+   is the first time.  Otherwise, write nothing and return false.  */
+
+static bool
+binary_output_label (struct binary_output *out, Lisp_Object obj)
+{
+  struct Lisp_Hash_Table *h;
+  ptrdiff_t i;
+  Lisp_Object label;
+
+  if (out->nshared == 0)
+    return 0;
+  h = XHASH_TABLE (out->seen);
+  i = hash_lookup (h, obj, NULL);
+  if (i < 0)
+    return 0;
+  label = HASH_VALUE (h, i);
+  if (INTEGERP (label))
+    {
+      binary_output_byte (out, BIN_REF);
+      binary_output_uint (out, XFASTINT (label));
+      return 1;
+    }
+  if (EQ (label, Qt))
+    {
+      binary_output_byte (out, BIN_DEF);
+      set_hash_value_slot (h, i, make_number (out->nlabels++));
+    }
+  return 0;
+}
+
+static void binary_emit (struct binary_output *, Lisp_Object);
+
+/* Write the bytecode string and constants vector of the byte-code
+   object OBJ as a BIN_LAZY segment, which lread.c skips when reading
+   OBJ and reads only when the function is first called.  */
+
+static void
+binary_emit_lazy (struct binary_output *out, Lisp_Object obj)
+{
+  unsigned char *buf = out->buf;
+  ptrdiff_t size = out->size, len = out->len;
+  unsigned char *segment;
+  ptrdiff_t nbytes;
+
+  out->size = SBYTES (AREF (obj, COMPILED_BYTECODE)) + 64;
+  out->buf = xmalloc (out->size);
+  out->len = 0;
+  out->in_lazy = 1;
+  binary_emit (out, AREF (obj, COMPILED_BYTECODE));
+  binary_emit (out, AREF (obj, COMPILED_CONSTANTS));
+  out->in_lazy = 0;
+  segment = out->buf;
+  nbytes = out->len;
+  out->buf = buf;
+  out->size = size;
+  out->len = len;
+
+  binary_output_byte (out, BIN_LAZY);
+  binary_output_uint (out, nbytes);
+  binary_output_bytes (out, segment, nbytes);
+  xfree (segment);
+}
+
+/* Second pass: write OBJ.  */
+
+static void
+binary_emit (struct binary_output *out, Lisp_Object obj)
+{
+  ptrdiff_t i, size;
+
+  if (!NILP (out->load_file_name) && EQ (obj, out->load_file_name))
+    {
+      binary_output_byte (out, BIN_LOAD_FILE_NAME);
+      return;
+    }
+
+  switch (XTYPE (obj))
+    {
+    case_Lisp_Int:
+      {
+	EMACS_INT n = XINT (obj);
+	binary_output_byte (out, BIN_INT);
+	binary_output_uint (out, (n < 0
+				  ? ((EMACS_UINT) ~n << 1) | 1
+				  : (EMACS_UINT) n << 1));
+      }
+      break;
+
+    case Lisp_Float:
+      {
+	union { double d; uint64_t u; } u;
+	unsigned char bytes[8];
+	u.d = XFLOAT_DATA (obj);
+	for (i = 0; i < 8; i++)
+	  bytes[i] = u.u >> (8 * i);
+	binary_output_byte (out, BIN_FLOAT);
+	binary_output_bytes (out, bytes, 8);
+      }
+      break;
+
+    case Lisp_Symbol:
+      if (NILP (obj))
+	binary_output_byte (out, BIN_NIL);
+      else if (EQ (obj, Qt))
+	binary_output_byte (out, BIN_T);
+      else if (SYMBOL_INTERNED_P (obj))
+	{
+	  struct Lisp_Hash_Table *h = XHASH_TABLE (out->symbols);
+	  EMACS_UINT hash;
+	  ptrdiff_t n;
+
+	  i = hash_lookup (h, obj, &hash);
+	  if (i >= 0)
+	    n = XFASTINT (HASH_VALUE (h, i));
+	  else
+	    {
+	      n = out->nsymbols++;
+	      hash_put (h, obj, make_number (n), hash);
+	      out->symbol_list = Fcons (obj, out->symbol_list);
+	    }
+	  binary_output_byte (out, BIN_SYMBOL);
+	  binary_output_uint (out, n);
+	}
+      else if (!binary_output_label (out, obj))
+	{
+	  Lisp_Object name = SYMBOL_NAME (obj);
+	  binary_output_byte (out, BIN_UNINTERNED);
+	  binary_output_uint (out, SCHARS (name));
+	  binary_output_uint (out, SBYTES (name));
+	  binary_output_bytes (out, SDATA (name), SBYTES (name));
+	}
+      break;
+
+    case Lisp_String:
+      if (binary_output_label (out, obj))
+	break;
+      if (!string_intervals (obj))
+	binary_output_string_data (out, obj, BIN_STRING);
+      else
+	{
+	  ptrdiff_t pos, next, n = 0;
+
+	  for (pos = 0; pos < SCHARS (obj); pos = next)
+	    {
+	      next = binary_next_property_change (obj, pos);
+	      if (!NILP (Ftext_properties_at (make_number (pos), obj)))
+		n++;
+	    }
+	  binary_output_byte (out, BIN_PROPS);
+	  binary_output_string_data (out, obj, BIN_STRING);
+	  binary_output_uint (out, n);
+	  for (pos = 0; pos < SCHARS (obj); pos = next)
+	    {
+	      Lisp_Object plist
+		= Ftext_properties_at (make_number (pos), obj);
+	      next = binary_next_property_change (obj, pos);
+	      if (!NILP (plist))
+		{
+		  binary_output_uint (out, pos);
+		  binary_output_uint (out, next);
+		  binary_emit (out, plist);
+		}
+	    }
+	}
+      break;
+
+    case Lisp_Cons:
+      {
+	struct Lisp_Hash_Table *h = XHASH_TABLE (out->seen);
+	Lisp_Object tail;
+
+	if (binary_output_label (out, obj))
+	  break;
+
+	/* Write the conses up to the first one that is shared, as that
+	   one needs a label of its own.  */
+	size = 1;
+	for (tail = XCDR (obj); CONSP (tail); tail = XCDR (tail), size++)
+	  if (out->nshared > 0)
+	    {
+	      i = hash_lookup (h, tail, NULL);
+	      if (!NILP (HASH_VALUE (h, i)))
+		break;
+	    }
+	binary_output_byte (out, BIN_LIST);
+	binary_output_uint (out, size);
+	for (tail = obj, i = 0; i < size; tail = XCDR (tail), i++)
+	  binary_emit (out, XCAR (tail));
+	binary_emit (out, tail);
+      }
+      break;
+
+    case Lisp_Vectorlike:
+      if (binary_output_label (out, obj))
+	break;
+      size = ASIZE (obj) & PSEUDOVECTOR_SIZE_MASK;
+      if (BOOL_VECTOR_P (obj))
+	{
+	  binary_output_byte (out, BIN_BOOL_VECTOR);
+	  binary_output_uint (out, bool_vector_size (obj));
+	  binary_output_bytes (out, bool_vector_uchar_data (obj),
+			       bool_vector_bytes (bool_vector_size (obj)));
+	  break;
+	}
+      if (HASH_TABLE_P (obj))
+	{
+	  struct Lisp_Hash_Table *table = XHASH_TABLE (obj);
+	  binary_output_byte (out, BIN_HASH_TABLE);
+	  binary_emit (out, table->test.name);
+	  binary_emit (out, table->weak);
+	  binary_output_uint (out, HASH_TABLE_SIZE (table));
+	  binary_emit (out, table->rehash_size);
+	  binary_emit (out, table->rehash_threshold);
+	  binary_output_uint (out, table->count);
+	  for (i = 0; i < HASH_TABLE_SIZE (table); i++)
+	    if (!NILP (HASH_HASH (table, i)))
+	      {
+		binary_emit (out, HASH_KEY (table, i));
+		binary_emit (out, HASH_VALUE (table, i));
+	      }
+	  break;
+	}
+      if (SUB_CHAR_TABLE_P (obj))
+	{
+	  binary_output_byte (out, BIN_SUB_CHAR_TABLE);
+	  binary_output_uint (out, XSUB_CHAR_TABLE (obj)->depth);
+	  binary_output_uint (out, XSUB_CHAR_TABLE (obj)->min_char);
+	  for (i = SUB_CHAR_TABLE_OFFSET; i < size; i++)
+	    binary_emit (out, AREF (obj, i));
+	  break;
+	}
+      binary_output_byte (out, (COMPILEDP (obj) ? BIN_BYTECODE
+				: CHAR_TABLE_P (obj) ? BIN_CHAR_TABLE
+				: BIN_VECTOR));
+      binary_output_uint (out, size);
+      if (COMPILEDP (obj) && out->lazy_threshold > 0 && !out->in_lazy
+	  && size > COMPILED_CONSTANTS
+	  && STRINGP (AREF (obj, COMPILED_BYTECODE))
+	  && SBYTES (AREF (obj, COMPILED_BYTECODE)) >= out->lazy_threshold
+	  && VECTORP (AREF (obj, COMPILED_CONSTANTS))
+	  && binary_unshared_p (out, AREF (obj, COMPILED_BYTECODE))
+	  && binary_unshared_p (out, AREF (obj, COMPILED_CONSTANTS)))
+	{
+	  binary_emit (out, AREF (obj, COMPILED_ARGLIST));
+	  binary_emit_lazy (out, obj);
+	  binary_output_byte (out, BIN_NIL);
+	  i = COMPILED_STACK_DEPTH;
+	}
+      else
+	i = 0;
+      for (; i < size; i++)
+	binary_emit (out, AREF (obj, i));
+      break;
+
+    default:
+      signal_error ("Object has no binary form", obj);
+    }
+}
+
+/* Append the binary encoding of OBJ to OUT.  Sharing is preserved
+   within OBJ, but not between objects written by different calls.  */
+
+void
+binary_output_object (struct binary_output *out, Lisp_Object obj)
+{
+  Fclrhash (out->seen);
+  out->nshared = out->nlabels = 0;
+  binary_scan (out, obj);
+  binary_emit (out, obj);
+}
+
+/* Append to DEST the table of the symbols written to OUT so far,
+   which BIN_SYMBOL indexes.  */
+
+void
+binary_output_symbols (struct binary_output *out, struct binary_output *dest)
+{
+  Lisp_Object tail, name;
+  ptrdiff_t n = out->nsymbols;
+  Lisp_Object *syms;
+  USE_SAFE_ALLOCA;
+
+  SAFE_NALLOCA (syms, 1, n);
+  for (tail = out->symbol_list; CONSP (tail); tail = XCDR (tail))
+    syms[--n] = XCAR (tail);
+
+  binary_output_uint (dest, out->nsymbols);
+  for (n = 0; n < out->nsymbols; n++)
+    {
+      name = SYMBOL_NAME (syms[n]);
+      binary_output_uint (dest, SCHARS (name));
+      binary_output_uint (dest, SBYTES (name));
+      binary_output_bytes (dest, SDATA (name), SBYTES (name));
+    }
+  SAFE_FREE ();
+}
+
+/* Write the bytes of HEAD and then those of BODY to FILE.  Write to a
+   temporary file and rename it, so that a concurrent reader never sees
+   a partial file, and so that a copy of FILE that is mapped into memory
+   stays intact.  */
+
+void
+binary_output_write_file (Lisp_Object file, struct binary_output *head,
+			  struct binary_output *body)
+{
+  Lisp_Object temp = Fmake_temp_name (file);
+  Lisp_Object etemp = ENCODE_FILE (temp);
+  int fd = emacs_open (SSDATA (etemp), O_WRONLY | O_CREAT | O_EXCL, 0666);
+
+  if (fd < 0)
+    report_file_error ("Opening output file", file);
+  if (emacs_write (fd, head->buf, head->len) != head->len
+      || emacs_write (fd, body->buf, body->len) != body->len
+      || emacs_close (fd) != 0)
+    {
+      int err = errno;
+      unlink (SSDATA (etemp));
+      errno = err;
+      report_file_error ("Write error", file);
+    }
+  if (rename (SSDATA (etemp), SSDATA (ENCODE_FILE (file))) != 0)
+    {
+      int err = errno;
+      unlink (SSDATA (etemp));
+      errno = err;
+      report_file_error ("Renaming", list2 (temp, file));
+    }
+}
+
+DEFUN ("serialize-object", Fserialize_object, Sserialize_object, 1, 2, 0,
+       doc: /* Return a unibyte string holding OBJECT in a binary encoding.
+`deserialize-object' turns the string back into an object `equal' to
+OBJECT, much faster than `read' can parse its printed representation.
+Objects reachable more than once from OBJECT, including through
+cycles, are shared in the copy too, as if `print-circle' were non-nil.
+Strings keep their multibyteness and text properties.
+
+OBJECT may contain numbers, symbols, strings, conses, vectors,
+bool-vectors, char-tables, hash tables and byte-code functions.  Signal
+an error if it contains anything else, or a symbol interned in an
+obarray other than `obarray'.
+
+Optional argument DESTINATION says where to put the encoding instead
+of returning it.  If it is a buffer, insert the encoding at point in
+that buffer.  If it is a string, it is the name of a file to write the
+encoding to, replacing its old contents.  In both cases, return nil.  */)
+  (Lisp_Object object, Lisp_Object destination)
+{
+  ptrdiff_t count = SPECPDL_INDEX ();
+  struct binary_output out, head;
+  struct gcpro gcpro1, gcpro2, gcpro3, gcpro4, gcpro5;
+  Lisp_Object val = Qnil;
+
+  if (BUFFERP (destination))
+    {
+      if (!BUFFER_LIVE_P (XBUFFER (destination)))
+	error ("Selecting deleted buffer");
+    }
+  else if (!NILP (destination))
+    CHECK_STRING (destination);
+
+  binary_output_init (&out, Qnil, 0);
+  binary_output_init (&head, Qnil, 0);
+  GCPRO5 (object, destination, out.seen, out.symbols, out.symbol_list);
+  record_unwind_protect_ptr (binary_output_free, &out);
+  record_unwind_protect_ptr (binary_output_free, &head);
+
+  binary_output_object (&out, object);
+  binary_output_bytes (&head, SERIALIZED_MAGIC, sizeof SERIALIZED_MAGIC - 1);
+  binary_output_symbols (&out, &head);
+
+  if (STRINGP (destination))
+    binary_output_write_file (Fexpand_file_name (destination, Qnil),
+			      &head, &out);
+  else
+    {
+      val = make_uninit_string (head.len + out.len);
+      memcpy (SDATA (val), head.buf, head.len);
+      memcpy (SDATA (val) + head.len, out.buf, out.len);
+      if (BUFFERP (destination))
+	{
+	  record_unwind_current_buffer ();
+	  set_buffer_internal (XBUFFER (destination));
+	  Finsert (1, &val);
+	  val = Qnil;
+	}
+    }
+
+  UNGCPRO;
+  return unbind_to (count, val);
+}
+
 /* Initialize debug_print stuff early to have it working from the very
    beginning.  */
 
@@ -2333,6 +3443,7 @@ priorities.  */);
   defsubr (&Serror_message_string);
   defsubr (&Sprinc);
   defsubr (&Sprint);
+  defsubr (&Sserialize_object);
   defsubr (&Sterpri);
   defsubr (&Swrite_char);
 #ifdef WITH_REDIRECT_DEBUGGING_OUTPUT
@@ -262,6 +262,7 @@ enum syntaxcode { Swhitespace = 0, Sword = 1, Ssymbol = 2 };
 # define RE_TARGET_MULTIBYTE_P(x) 0
 # define WORD_BOUNDARY_P(c1, c2) (0)
 # define BYTES_BY_CHAR_HEAD(p) (1)
+# define CHAR_HEAD_P(byte) (1)
 # define PREV_CHAR_BOUNDARY(p, limit) ((p)--)
 # define STRING_CHAR(p) (*(p))
 # define RE_STRING_CHAR(p, multibyte) STRING_CHAR (p)
@@ -1630,8 +1631,14 @@ static boolean at_begline_loc_p (re_char *pattern, re_char *p,
 static boolean at_endline_loc_p (re_char *p, re_char *pend,
 				 reg_syntax_t syntax);
 static re_char *skip_one_char (re_char *p);
+static boolean execute_charset (re_char *p, unsigned int c,
+				boolean unibyte_char);
+#ifdef emacs
+static void free_dfa (struct re_dfa *dfa);
+#endif
 static int analyse_first (re_char *p, re_char *pend,
 			  char *fastmap, const int multibyte);
+static void analyse_must (struct re_pattern_buffer *bufp);
 
 /* Fetch the next character in the uncompiled pattern, with no
    translation.  */
@@ -2494,6 +2501,11 @@ regex_compile (const_re_char *pattern, size_t size, reg_syntax_t syntax,
   bufp->fastmap_accurate = 0;
   bufp->not_bol = bufp->not_eol = 0;
   bufp->used_syntax = 0;
+  bufp->must_length = 0;
+#ifdef emacs
+  free_dfa (bufp->dfa);
+  bufp->dfa = NULL;
+#endif
 
   /* Set `used' to zero, so that if we return an error, the pattern
      printer (for debugging) will think there's no pattern.  We reset it
@@ -3670,6 +3682,8 @@ regex_compile (const_re_char *pattern, size_t size, reg_syntax_t syntax,
   /* We have succeeded; set the length of the buffer.  */
   bufp->used = b - bufp->buffer;
 
+  analyse_must (bufp);
+
 #ifdef DEBUG
   if (debug > 0)
     {
@@ -4151,8 +4165,8 @@ analyse_first (const_re_char *p, const_re_char *pend, char *fastmap,
    The caller must supply the address of a (1 << BYTEWIDTH)-byte data
    area as BUFP->fastmap.
 
-   We set the `fastmap', `fastmap_accurate', and `can_be_null' fields in
-   the pattern buffer.
+   We set the `fastmap', `fastmap_accurate', `can_be_null' and
+   `fastmap_selective' fields in the pattern buffer.
 
    Returns 0 if we succeed, -2 if an internal error.   */
 
@@ -4160,7 +4174,7 @@ int
 re_compile_fastmap (struct re_pattern_buffer *bufp)
 {
   char *fastmap = bufp->fastmap;
-  int analysis;
+  int analysis, i, n = 0;
 
   assert (fastmap && bufp->buffer);
 
@@ -4170,8 +4184,147 @@ re_compile_fastmap (struct re_pattern_buffer *bufp)
   analysis = analyse_first (bufp->buffer, bufp->buffer + bufp->used,
 			    fastmap, RE_MULTIBYTE_P (bufp));
   bufp->can_be_null = (analysis != 0);
+
+  for (i = 0; i < (1 << BYTEWIDTH); i++)
+    n += fastmap[i] != 0;
+  bufp->fastmap_selective = !bufp->can_be_null && n <= (1 << BYTEWIDTH) / 4;
   return 0;
 } /* re_compile_fastmap */
+
+/* analyse_must.
+   Find the longest string of ASCII characters in the compiled pattern
+   of BUFP that every match contains, and record it in the `must_*'
+   fields of BUFP.  A string in an `exactn' qualifies if no jump before
+   it can go past it; after the first jump we no longer know how many
+   characters a match can have before the string, so a string from
+   before it is kept unless a later one is more than twice as long.  */
+
+static void
+analyse_must (struct re_pattern_buffer *bufp)
+{
+  re_char *start = bufp->buffer, *pend = start + bufp->used, *p = start;
+  /* The farthest place that a jump before P can go to.  */
+  re_char *reach = start;
+  /* At most how many characters a match has before P, or -1.  */
+  ssize_t lead = 0;
+  ssize_t i, best;
+  int mcnt;
+  /* Characters that are common in text, from the most common one.  */
+  static char const common[] = " etaoinsrhldcu\n\t";
+
+  bufp->must_length = 0;
+  bufp->must_lead = -1;
+  while (p < pend)
+    {
+      re_char *p1 = p;
+
+      switch (*p++)
+	{
+	case no_op:
+	case begline: case endline: case begbuf: case endbuf:
+	case wordbeg: case wordend: case wordbound: case notwordbound:
+	case symbeg: case symend:
+#ifdef emacs
+	case before_dot: case at_dot: case after_dot:
+#endif
+	  break;
+
+	case start_memory:
+	case stop_memory:
+	  p++;
+	  break;
+
+	case exactn:
+	  {
+	    re_char *s = p + 1, *end = s + *p;
+
+	    while (s < end && reach <= p1)
+	      {
+		re_char *run = s;
+
+		while (s < end && IS_REAL_ASCII (*s))
+		  s++;
+		size_t length = s - run;
+
+		if (length > bufp->must_length
+		    && (bufp->must_lead < 0 || lead >= 0
+			|| length > 2 * bufp->must_length))
+		  {
+		    bufp->must_offset = run - start;
+		    bufp->must_length = length;
+		    bufp->must_lead = lead < 0 ? -1 : lead + (run - (p + 1));
+		  }
+		while (s < end && !IS_REAL_ASCII (*s))
+		  s++;
+	      }
+	    /* In a multibyte pattern, there are no more characters
+	       than bytes.  */
+	    if (lead >= 0)
+	      lead += *p;
+	    p = end;
+	  }
+	  break;
+
+	case anychar:
+	case charset: case charset_not:
+	case syntaxspec: case notsyntaxspec:
+#ifdef emacs
+	case categoryspec: case notcategoryspec:
+#endif
+	  if (lead >= 0)
+	    lead++;
+	  p = skip_one_char (p1);
+	  break;
+
+	case duplicate:
+	  lead = -1;
+	  p++;
+	  break;
+
+	case set_number_at:
+	  p += 4;
+	  break;
+
+	case jump:
+	case on_failure_jump:
+	case on_failure_keep_string_jump:
+	case on_failure_jump_loop:
+	case on_failure_jump_nastyloop:
+	case on_failure_jump_smart:
+	case succeed_n:
+	case jump_n:
+	  EXTRACT_NUMBER_AND_INCR (mcnt, p);
+	  if (p + mcnt > reach)
+	    reach = p + mcnt;
+	  if (*p1 == succeed_n || *p1 == jump_n)
+	    p += 2;
+	  lead = -1;
+	  break;
+
+	default:
+	  /* `succeed' ends the match wherever it is.  */
+	  p = pend;
+	  break;
+	}
+    }
+
+  /* Look for the character of the string that is least common in
+     text, so that re_search stops less often to compare the whole
+     string.  */
+  bufp->must_guide = 0;
+  for (i = 0, best = -1; i < bufp->must_length; i++)
+    {
+      int c = start[bufp->must_offset + i];
+      char const *q = c ? strchr (common, c) : NULL;
+      ssize_t rank = q ? q - common : sizeof common;
+
+      if (rank > best)
+	{
+	  bufp->must_guide = i;
+	  best = rank;
+	}
+    }
+}
 
 /* Set REGS to hold NUM_REGS registers, storing them in STARTS and
    ENDS.  Subsequent matches using PATTERN_BUFFER and REGS will use
@@ -4204,6 +4357,1062 @@ re_set_registers (struct re_pattern_buffer *bufp, struct re_registers *regs, uns
     }
 }
 WEAK_ALIAS (__re_set_registers, re_set_registers)
+
+/* Return true if C is in the charset or charset_not at P.  C has been
+   converted to a byte if UNIBYTE_CHAR, else it is a character.  */
+
+static boolean
+execute_charset (re_char *p, unsigned int c, boolean unibyte_char)
+{
+  boolean not = (re_opcode_t) *p == charset_not;
+
+  if (unibyte_char && c < (1 << BYTEWIDTH))
+    {			/* Lookup bitmap.  */
+      /* Cast to `unsigned' instead of `unsigned char' in
+	 case the bit list is a full 32 bytes long.  */
+      if (c < (unsigned) (CHARSET_BITMAP_SIZE (p) * BYTEWIDTH)
+	  && p[2 + c / BYTEWIDTH] & (1 << (c % BYTEWIDTH)))
+	not = !not;
+    }
+#ifdef emacs
+  else if (CHARSET_RANGE_TABLE_EXISTS_P (p))
+    {
+      int class_bits = CHARSET_RANGE_TABLE_BITS (p);
+
+      if (  (class_bits & BIT_LOWER && ISLOWER (c))
+	  | (class_bits & BIT_MULTIBYTE)
+	  | (class_bits & BIT_PUNCT && ISPUNCT (c))
+	  | (class_bits & BIT_SPACE && ISSPACE (c))
+	  | (class_bits & BIT_UPPER && ISUPPER (c))
+	  | (class_bits & BIT_WORD  && ISWORD (c)))
+	not = !not;
+      else
+	CHARSET_LOOKUP_RANGE_TABLE (not, c, p);
+    }
+#endif /* emacs */
+
+  return not;
+}
+
+#ifdef emacs
+
+/* The lazy DFA.
+
+   The backtracking matcher can take time exponential in the length of
+   the text on some patterns, and even on simple ones it pushes a
+   failure point for each character that a loop matches.  Yet most of
+   the places where a search tries to match are places where the
+   pattern cannot match at all.  So re_search_2 and re_match_2 first
+   ask a DFA whether the pattern matches, and only run the
+   backtracking matcher to find where its groups and its end are.  A
+   forward search runs the DFA once over the text, with a match
+   starting at each place where the search may start one, so it finds
+   out in linear time whether, and how early, some match ends.
+
+   The DFA is made lazily from an NFA that has an insn for each
+   operation of the compiled pattern, and for each character of its
+   `exactn's.  A DFA state is the set of NFA insns that a match can
+   have reached after the characters seen so far, together with what
+   the zero-width assertions need to know about the last of these
+   characters.  The transitions of a state on the first
+   DFA_CACHED_CHARS characters are computed the first time they are
+   taken, and kept.
+
+   Patterns with back references, counted repetitions, categories or
+   \=, and the like, have no DFA.  Neither has any pattern while
+   `parse-sexp-lookup-properties' is non-nil if it looks up syntax.  */
+
+/* Operations of the NFA.  Those before DFA_CHAR do not consume a
+   character.  */
+enum dfa_op
+{
+  DFA_JUMP,			/* Go on at X.  */
+  DFA_SPLIT,			/* Go on at both X and Y.  */
+  DFA_ASSERT,			/* Go on if the assertion ARG holds.  */
+  DFA_MATCH,			/* The pattern has matched.  */
+  DFA_CHAR,			/* Match the character X.  */
+  DFA_ANY,			/* Match what `anychar' matches.  */
+  DFA_SET,			/* Match the charset at offset X.  */
+  DFA_SYNTAX			/* Match syntax X, or any other if ARG.  */
+};
+
+struct dfa_insn
+{
+  unsigned char op;
+
+  /* The re_opcode_t of a DFA_ASSERT; whether a DFA_SYNTAX is negated.  */
+  unsigned char arg;
+
+  /* The target of a DFA_JUMP and DFA_SPLIT, the character of a
+     DFA_CHAR, the offset of the charset in the compiled pattern of a
+     DFA_SET, and the syntax code of a DFA_SYNTAX.  */
+  int x;
+
+  /* The other target of a DFA_SPLIT.  */
+  int y;
+};
+
+/* Bits that describe what is on one side of a position, for the
+   zero-width assertions.  A state keeps those of the character before
+   it, and a transition looks at those of the character after it.  */
+enum
+{
+  CTX_EDGE = 1,			/* Nothing: the text starts or ends.  */
+  CTX_LINE = 2,			/* A newline, or an edge that ^ or $ matches.  */
+  CTX_WORD = 4,			/* A word constituent.  */
+  CTX_SYMBOL = 8,		/* A word or symbol constituent.  */
+  CTX_MULTI = 16,		/* A character that is not single-byte.  */
+  CTX_PREV_BITS = 32,		/* The bits above can describe a state.  */
+  CTX_RAW_SYMBOL = 32,		/* Like CTX_SYMBOL, for the raw byte of
+				   a unibyte text.  */
+  CTX_STOP = 64			/* The match cannot go past here.  */
+};
+
+/* Characters below this have their transitions cached.  */
+enum { DFA_CACHED_CHARS = 1 << BYTEWIDTH };
+
+/* The most states a DFA keeps.  When it needs more, it discards them
+   all, and if it needs to do that too often, it gives up.  */
+enum { DFA_MAX_STATES = 128 };
+
+/* Patterns that need more NFA insns than this get no DFA.  */
+enum { DFA_MAX_INSNS = 20000 };
+
+/* A transition that has not been computed yet.  */
+#define DFA_UNCOMPUTED (-1)
+
+/* A transition that the DFA cannot compute, because an assertion
+   needs to know more about the characters around it than a state
+   records, or because it needs too many states.  Any other value of
+   a transition is twice the index of the next state, plus one if the
+   pattern has matched before the character.  */
+#define DFA_UNDECIDED (-2)
+
+struct dfa_state
+{
+  /* The NFA insns that the characters so far lead to, in order: the
+     successors of insns that match characters, and the start.  */
+  int *kernel;
+  int nkernel;
+
+  /* The CTX_* bits of the character before the state.  */
+  unsigned char ctx;
+
+  /* Whether a match may start after the next character as well.  */
+  boolean searching;
+
+  unsigned int hash;
+
+  /* The last transition on a character not cached in NEXT.  */
+  int last_char, last_next;
+
+  /* The transitions on the first DFA_CACHED_CHARS characters.  */
+  int next[DFA_CACHED_CHARS];
+};
+
+struct re_dfa
+{
+  /* The NFA, or NULL if the pattern has no DFA.  Insn 0 jumps to the
+     start of the pattern.  */
+  struct dfa_insn *insns;
+  int ninsns;
+
+  /* Whether the NFA was made for a multibyte text.  */
+  boolean target_multibyte;
+
+  /* Whether the assertions look up the syntax of characters.  */
+  boolean ctx_syntax;
+
+  /* The CTX_* bits that the assertions look at in a state.  */
+  unsigned char ctx_mask;
+
+  /* Whether the states depend on the syntax table or the case table,
+     and those that they were computed with.  */
+  boolean uses_tables;
+  Lisp_Object syntax_table, case_table;
+
+  /* The states.  State 0 is the dead state, where no match goes on.  */
+  struct dfa_state **states;
+  int nstates;
+
+  /* A hash table of the states: indices into STATES, or -1.  */
+  int slots[2 * DFA_MAX_STATES];
+
+  /* The start states, by context and whether searching, or -1.  */
+  int start[CTX_PREV_BITS][2];
+
+  /* Where in the text the current run last discarded the states, and
+     how many times they have been discarded.  */
+  ssize_t flush_pos;
+  unsigned int flushes;
+
+  /* Work areas for computing transitions, and the marks of the insns
+     that the current one has reached.  */
+  int *stack, *work;
+  unsigned int *marks, mark;
+};
+
+/* Discard the states of DFA but the dead one.  */
+
+static void
+dfa_flush (struct re_dfa *dfa)
+{
+  int i;
+
+  dfa->flushes++;
+  for (i = 1; i < dfa->nstates; i++)
+    {
+      free (dfa->states[i]->kernel);
+      free (dfa->states[i]);
+    }
+  dfa->nstates = 1;
+  for (i = 0; i < 2 * DFA_MAX_STATES; i++)
+    dfa->slots[i] = -1;
+  for (i = 0; i < CTX_PREV_BITS; i++)
+    dfa->start[i][0] = dfa->start[i][1] = -1;
+}
+
+static void
+free_dfa (struct re_dfa *dfa)
+{
+  if (dfa)
+    {
+      if (dfa->insns)
+	{
+	  dfa_flush (dfa);
+	  free (dfa->states[0]);
+	  free (dfa->states);
+	  free (dfa->insns);
+	  free (dfa->stack);
+	  free (dfa->work);
+	  free (dfa->marks);
+	}
+      free (dfa);
+    }
+}
+
+/* Discard the states that BUFP's DFA has computed.  They depend on the
+   syntax and case tables, and they take memory.  */
+
+void
+re_flush_dfa (struct re_pattern_buffer *bufp)
+{
+  if (bufp->dfa && bufp->dfa->insns)
+    dfa_flush (bufp->dfa);
+}
+
+/* Free the DFA of BUFP, as when BUFP itself is freed.  */
+
+void
+re_free_dfa (struct re_pattern_buffer *bufp)
+{
+  free_dfa (bufp->dfa);
+  bufp->dfa = NULL;
+}
+
+/* Return the number of characters of the `exactn' at P.  */
+
+static int
+exactn_chars (re_char *p, boolean multibyte)
+{
+  re_char *end = p + 2 + p[1];
+  int n = 0;
+
+  if (!multibyte)
+    return p[1];
+  for (p += 2; p < end; p += BYTES_BY_CHAR_HEAD (*p))
+    n++;
+  return n;
+}
+
+/* Return the target of the jump at P in BUFP's compiled pattern, as an
+   offset.  A loop that on_failure_jump_smart has turned into an
+   on_failure_keep_string_jump loop jumps back just past that, but the
+   loop only exits through the failure point that it pushes, so make
+   the jump go back to it instead, as it did before.  */
+
+static int
+dfa_jump_target (struct re_pattern_buffer *bufp, re_char *p)
+{
+  re_char *start = bufp->buffer;
+  int offset = p + 3 - start + extract_number (p + 1);
+
+  if ((re_opcode_t) *p == jump && offset >= 3
+      && (re_opcode_t) start[offset - 3] == on_failure_keep_string_jump
+      && offset + extract_number (start + offset - 2) == p + 3 - start)
+    offset -= 3;
+  return offset;
+}
+
+/* Make the NFA of the pattern in BUFP for a text that is multibyte or
+   not, as it says, and return a DFA for it with no states.  The DFA
+   has no NFA if the pattern has operations that it cannot do.  */
+
+static struct re_dfa *
+dfa_compile (struct re_pattern_buffer *bufp)
+{
+  re_char *start = bufp->buffer, *pend = start + bufp->used, *p;
+  const boolean multibyte = RE_MULTIBYTE_P (bufp);
+  const boolean target_multibyte = RE_TARGET_MULTIBYTE_P (bufp);
+  struct re_dfa *dfa = malloc (sizeof *dfa);
+  struct dfa_insn *insn;
+  int *map;
+  int n;
+
+  memset (dfa, 0, sizeof *dfa);
+  dfa->target_multibyte = target_multibyte;
+
+  /* Map each operation of the pattern to its first insn.  */
+  map = malloc ((bufp->used + 1) * sizeof *map);
+  n = 1;
+  for (p = start; p < pend; )
+    {
+      map[p - start] = n;
+      switch (*p)
+	{
+	case no_op: case succeed:
+	case anychar:
+	case begline: case endline: case begbuf: case endbuf:
+	case wordbeg: case wordend: case wordbound: case notwordbound:
+	case symbeg: case symend:
+	  n++;
+	  p++;
+	  break;
+
+	case exactn:
+	  n += exactn_chars (p, multibyte);
+	  p += 2 + p[1];
+	  break;
+
+	case charset: case charset_not:
+	case syntaxspec: case notsyntaxspec:
+	  n++;
+	  p = skip_one_char (p);
+	  break;
+
+	case start_memory: case stop_memory:
+	  n++;
+	  p += 2;
+	  break;
+
+	case jump:
+	case on_failure_jump: case on_failure_keep_string_jump:
+	case on_failure_jump_loop: case on_failure_jump_nastyloop:
+	case on_failure_jump_smart:
+	  n++;
+	  p += 3;
+	  break;
+
+	default:
+	  /* duplicate, succeed_n, jump_n, set_number_at, the operations
+	     on point, and the categories.  */
+	  free (map);
+	  return dfa;
+	}
+      if (n > DFA_MAX_INSNS)
+	{
+	  free (map);
+	  return dfa;
+	}
+    }
+  map[bufp->used] = n++;
+
+  dfa->ninsns = n;
+  dfa->insns = insn = malloc (n * sizeof *insn);
+  insn->op = DFA_JUMP;
+  insn->x = 1;
+  insn++;
+  for (p = start; p < pend; )
+    {
+      switch (*p)
+	{
+	case no_op:
+	case start_memory: case stop_memory:
+	  insn->op = DFA_JUMP;
+	  insn->x = insn - dfa->insns + 1;
+	  insn++;
+	  p += *p == no_op ? 1 : 2;
+	  break;
+
+	case succeed:
+	  insn++->op = DFA_MATCH;
+	  p++;
+	  break;
+
+	case exactn:
+	  {
+	    re_char *end = p + 2 + p[1];
+
+	    for (p += 2; p < end; insn++)
+	      {
+		int c, len = 1;
+
+		/* This is how re_match_2_internal sees the character.  */
+		if (multibyte)
+		  c = STRING_CHAR_AND_LENGTH (p, len);
+		else
+		  c = *p;
+		if (target_multibyte)
+		  c = multibyte ? c : RE_CHAR_TO_MULTIBYTE (c);
+		else if (multibyte)
+		  c = RE_CHAR_TO_UNIBYTE (c);
+		insn->op = DFA_CHAR;
+		insn->x = c;
+		p += len;
+	      }
+	  }
+	  break;
+
+	case anychar:
+	  insn++->op = DFA_ANY;
+	  p++;
+	  break;
+
+	case charset: case charset_not:
+	  if (CHARSET_RANGE_TABLE_EXISTS_P (p)
+	      && CHARSET_RANGE_TABLE_BITS (p) & ~BIT_MULTIBYTE)
+	    dfa->uses_tables = true;
+	  insn->op = DFA_SET;
+	  insn->x = p - start;
+	  insn++;
+	  p = skip_one_char (p);
+	  break;
+
+	case syntaxspec: case notsyntaxspec:
+	  dfa->uses_tables = true;
+	  insn->op = DFA_SYNTAX;
+	  insn->arg = *p == notsyntaxspec;
+	  insn->x = p[1];
+	  insn++;
+	  p += 2;
+	  break;
+
+	case begline: case endline:
+	  dfa->ctx_mask |= CTX_EDGE | CTX_LINE;
+	  goto assertion;
+	case begbuf: case endbuf:
+	  dfa->ctx_mask |= CTX_EDGE;
+	  goto assertion;
+	case wordbeg: case wordend: case wordbound: case notwordbound:
+	  dfa->ctx_mask |= CTX_EDGE | CTX_WORD | CTX_MULTI;
+	  dfa->ctx_syntax = dfa->uses_tables = true;
+	  goto assertion;
+	case symbeg: case symend:
+	  dfa->ctx_mask |= CTX_EDGE | CTX_SYMBOL;
+	  dfa->ctx_syntax = dfa->uses_tables = true;
+	assertion:
+	  insn->op = DFA_ASSERT;
+	  insn->arg = *p++;
+	  insn++;
+	  break;
+
+	case jump:
+	  insn->op = DFA_JUMP;
+	  insn->x = map[dfa_jump_target (bufp, p)];
+	  insn++;
+	  p += 3;
+	  break;
+
+	default:
+	  /* All the on_failure_jumps: backtracking only tries the
+	     alternatives in a certain order, and the NFA tries them
+	     all at once.  */
+	  insn->op = DFA_SPLIT;
+	  insn->x = insn - dfa->insns + 1;
+	  insn->y = map[dfa_jump_target (bufp, p)];
+	  insn++;
+	  p += 3;
+	  break;
+	}
+    }
+  insn->op = DFA_MATCH;
+  free (map);
+
+  dfa->states = malloc (DFA_MAX_STATES * sizeof *dfa->states);
+  dfa->states[0] = malloc (sizeof *dfa->states[0]);
+  memset (dfa->states[0], 0, sizeof *dfa->states[0]);
+  dfa->nstates = 1;
+  dfa_flush (dfa);
+  dfa->stack = malloc (n * sizeof *dfa->stack);
+  dfa->work = malloc ((n + 1) * sizeof *dfa->work);
+  dfa->marks = malloc (n * sizeof *dfa->marks);
+  memset (dfa->marks, 0, n * sizeof *dfa->marks);
+  dfa->mark = 0;
+  dfa->syntax_table = dfa->case_table = Qnil;
+  return dfa;
+}
+
+/* Return the DFA to use for BUFP, or NULL if there is none.  The
+   syntax table must have been set up for the text.  */
+
+static struct re_dfa *
+dfa_for_pattern (struct re_pattern_buffer *bufp)
+{
+  struct re_dfa *dfa = bufp->dfa;
+
+#ifdef REL_ALLOC
+  /* The caller holds pointers to the text being searched.  */
+  r_alloc_inhibit_buffer_relocation (1);
+#endif
+  if (!dfa || dfa->target_multibyte != RE_TARGET_MULTIBYTE_P (bufp))
+    {
+      free_dfa (dfa);
+      bufp->dfa = NULL;
+      bufp->dfa = dfa = dfa_compile (bufp);
+    }
+  if (!dfa->insns)
+    dfa = NULL;
+  else if (dfa->uses_tables)
+    {
+      if (parse_sexp_lookup_properties)
+	dfa = NULL;
+      else if (!EQ (dfa->syntax_table, gl_state.current_syntax_table)
+	       || !EQ (dfa->case_table, BVAR (current_buffer, downcase_table)))
+	{
+	  dfa_flush (dfa);
+	  dfa->syntax_table = gl_state.current_syntax_table;
+	  dfa->case_table = BVAR (current_buffer, downcase_table);
+	}
+    }
+#ifdef REL_ALLOC
+  r_alloc_inhibit_buffer_relocation (0);
+#endif
+  return dfa;
+}
+
+/* Return the CTX_* bits of the character C of the text of BUFP.  */
+
+static int
+dfa_char_ctx (struct re_pattern_buffer *bufp, struct re_dfa *dfa, int c)
+{
+  int ctx = c == '\n' ? CTX_LINE : 0;
+
+  if (dfa->ctx_syntax)
+    {
+      /* Most assertions look at C as a multibyte character, but
+	 `symbeg' and `symend' look at the byte after a position.  */
+      int mc = dfa->target_multibyte ? c : RE_CHAR_TO_MULTIBYTE (c);
+      int syntax = SYNTAX (mc);
+
+      if (syntax == Sword)
+	ctx |= CTX_WORD;
+      if (syntax == Sword || syntax == Ssymbol)
+	ctx |= CTX_SYMBOL;
+      if (mc != c)
+	syntax = SYNTAX (c);
+      if (syntax == Sword || syntax == Ssymbol)
+	ctx |= CTX_RAW_SYMBOL;
+      if (!SINGLE_BYTE_CHAR_P (mc))
+	ctx |= CTX_MULTI;
+    }
+  return ctx;
+}
+
+/* Return whether the assertion OP holds between a character with the
+   CTX_* bits PREV and one with NEXT, or -1 if that depends on which
+   characters they are.  */
+
+static int
+dfa_assertion (re_opcode_t op, int prev, int next)
+{
+  switch (op)
+    {
+    case begline:
+      return (prev & CTX_LINE) != 0;
+    case endline:
+      return (next & CTX_LINE) != 0;
+    case begbuf:
+      return (prev & CTX_EDGE) != 0;
+    case endbuf:
+      return (next & CTX_EDGE) != 0;
+
+    case wordbound:
+    case notwordbound:
+      {
+	int bound;
+
+	if ((prev | next) & CTX_EDGE || (prev ^ next) & CTX_WORD)
+	  bound = 1;
+	else if (!(prev & CTX_WORD))
+	  bound = 0;
+	else if ((prev | next) & CTX_MULTI)
+	  /* WORD_BOUNDARY_P decides.  */
+	  return -1;
+	else
+	  bound = 0;
+	return op == wordbound ? bound : !bound;
+      }
+
+    case wordbeg:
+      if (next & (CTX_EDGE | CTX_STOP) || !(next & CTX_WORD))
+	return 0;
+      if (prev & CTX_EDGE || !(prev & CTX_WORD))
+	return 1;
+      return (prev | next) & CTX_MULTI ? -1 : 0;
+    case wordend:
+      if (prev & CTX_EDGE || !(prev & CTX_WORD))
+	return 0;
+      if (next & CTX_EDGE || !(next & CTX_WORD))
+	return 1;
+      return (prev | next) & CTX_MULTI ? -1 : 0;
+
+    case symbeg:
+      if (next & (CTX_EDGE | CTX_STOP) || !(next & CTX_RAW_SYMBOL))
+	return 0;
+      return prev & CTX_EDGE || !(prev & CTX_SYMBOL);
+    case symend:
+      if (prev & CTX_EDGE || !(prev & CTX_SYMBOL))
+	return 0;
+      return next & CTX_EDGE || !(next & CTX_RAW_SYMBOL);
+
+    default:
+      abort ();
+    }
+}
+
+/* Return whether the insn INSN of the DFA for BUFP matches the
+   character C of the text, which is a byte if the text is unibyte.  */
+
+static boolean
+dfa_insn_matches (struct re_pattern_buffer *bufp, struct re_dfa *dfa,
+		  struct dfa_insn *insn, int c)
+{
+  RE_TRANSLATE_TYPE translate = bufp->translate;
+
+  /* This follows re_match_2_internal.  */
+  switch (insn->op)
+    {
+    case DFA_CHAR:
+      if (dfa->target_multibyte)
+	return TRANSLATE (c) == insn->x;
+      else
+	{
+	  int c1 = RE_CHAR_TO_MULTIBYTE (c);
+
+	  if (! CHAR_BYTE8_P (c1))
+	    {
+	      c1 = RE_CHAR_TO_UNIBYTE (TRANSLATE (c1));
+	      if (c1 >= 0)
+		c = c1;
+	    }
+	  return c == insn->x;
+	}
+
+    case DFA_ANY:
+      c = TRANSLATE (c);
+      return !((!(bufp->syntax & RE_DOT_NEWLINE) && c == '\n')
+	       || ((bufp->syntax & RE_DOT_NOT_NULL) && c == '\000'));
+
+    case DFA_SET:
+      {
+	boolean unibyte_char = false;
+	int c1;
+
+	if (dfa->target_multibyte)
+	  {
+	    c = TRANSLATE (c);
+	    c1 = RE_CHAR_TO_UNIBYTE (c);
+	    if (c1 >= 0)
+	      {
+		unibyte_char = true;
+		c = c1;
+	      }
+	  }
+	else
+	  {
+	    c1 = RE_CHAR_TO_MULTIBYTE (c);
+	    if (! CHAR_BYTE8_P (c1))
+	      {
+		c1 = RE_CHAR_TO_UNIBYTE (TRANSLATE (c1));
+		if (c1 >= 0)
+		  {
+		    unibyte_char = true;
+		    c = c1;
+		  }
+	      }
+	    else
+	      unibyte_char = true;
+	  }
+	return execute_charset (bufp->buffer + insn->x, c, unibyte_char);
+      }
+
+    case DFA_SYNTAX:
+      if (!dfa->target_multibyte)
+	c = RE_CHAR_TO_MULTIBYTE (c);
+      return (SYNTAX (c) == insn->x) != insn->arg;
+
+    default:
+      abort ();
+    }
+}
+
+static int
+compare_ints (const void *a, const void *b)
+{
+  return *(const int *) a - *(const int *) b;
+}
+
+/* Return the index of the state of DFA with the first N insns of
+   KERNEL, the context CTX and SEARCHING, making it if need be.  KERNEL
+   must be in order, and must not be the kernel of a state.  POS is
+   where in the text that happens.  Return DFA_UNDECIDED if the states
+   had to be discarded too recently.  */
+
+static int
+dfa_state (struct re_dfa *dfa, int *kernel, int n, int ctx,
+	   boolean searching, ssize_t pos)
+{
+  struct dfa_state *state;
+  unsigned int hash = ctx * 2 + searching;
+  int i, slot;
+
+  if (n == 0 && !searching)
+    return 0;
+
+  for (i = 0; i < n; i++)
+    hash = hash * 31 + kernel[i];
+  for (slot = hash % (2 * DFA_MAX_STATES); dfa->slots[slot] >= 0;
+       slot = (slot + 1) % (2 * DFA_MAX_STATES))
+    {
+      state = dfa->states[dfa->slots[slot]];
+      if (state->hash == hash && state->nkernel == n && state->ctx == ctx
+	  && state->searching == searching
+	  && !memcmp (state->kernel, kernel, n * sizeof *kernel))
+	return dfa->slots[slot];
+    }
+
+  if (dfa->nstates == DFA_MAX_STATES)
+    {
+      /* Rather than discard the states over and over, let the
+	 backtracking matcher do the job.  */
+      if (pos - dfa->flush_pos < 10 * DFA_MAX_STATES)
+	return DFA_UNDECIDED;
+      dfa->flush_pos = pos;
+      dfa_flush (dfa);
+      for (slot = hash % (2 * DFA_MAX_STATES); dfa->slots[slot] >= 0;
+	   slot = (slot + 1) % (2 * DFA_MAX_STATES))
+	;
+    }
+
+  state = malloc (sizeof *state);
+  state->kernel = malloc (n * sizeof *kernel + 1);
+  memcpy (state->kernel, kernel, n * sizeof *kernel);
+  state->nkernel = n;
+  state->ctx = ctx;
+  state->searching = searching;
+  state->hash = hash;
+  state->last_char = -1;
+  for (i = 0; i < DFA_CACHED_CHARS; i++)
+    state->next[i] = DFA_UNCOMPUTED;
+  dfa->states[dfa->nstates] = state;
+  dfa->slots[slot] = dfa->nstates;
+  return dfa->nstates++;
+}
+
+/* Compute the transition of state S of the DFA for BUFP on the
+   character C, whose CTX_* bits are NEXT, at POS in the text.  If C is
+   negative, there is no character to consume, and only whether the
+   pattern matches at POS counts.  */
+
+static int
+dfa_transition (struct re_pattern_buffer *bufp, struct re_dfa *dfa,
+		int s, int c, int next, ssize_t pos)
+{
+  struct dfa_state *state = dfa->states[s];
+  int *stack = dfa->stack, *work = dfa->work;
+  unsigned int *marks = dfa->marks, mark;
+  int sp = 0, n = 0, i, t;
+  boolean matched = false;
+  boolean searching = state->searching && c >= 0;
+  unsigned int flushes = dfa->flushes;
+
+  if (++dfa->mark == 0)
+    {
+      memset (marks, 0, dfa->ninsns * sizeof *marks);
+      dfa->mark = 1;
+    }
+  mark = dfa->mark;
+
+#define DFA_PUSH(pc)				\
+  do {						\
+    int pc_ = (pc);				\
+    if (marks[pc_] != mark)			\
+      {						\
+	marks[pc_] = mark;			\
+	stack[sp++] = pc_;			\
+      }						\
+  } while (0)
+
+  for (i = state->nkernel - 1; i >= 0; i--)
+    DFA_PUSH (state->kernel[i]);
+  while (sp > 0)
+    {
+      int pc = stack[--sp];
+      struct dfa_insn *insn = &dfa->insns[pc];
+
+      switch (insn->op)
+	{
+	case DFA_JUMP:
+	  DFA_PUSH (insn->x);
+	  break;
+
+	case DFA_SPLIT:
+	  DFA_PUSH (insn->y);
+	  DFA_PUSH (insn->x);
+	  break;
+
+	case DFA_ASSERT:
+	  t = dfa_assertion (insn->arg, state->ctx, next);
+	  if (t < 0)
+	    return DFA_UNDECIDED;
+	  if (t)
+	    DFA_PUSH (pc + 1);
+	  break;
+
+	case DFA_MATCH:
+	  matched = true;
+	  break;
+
+	default:
+	  if (c >= 0 && dfa_insn_matches (bufp, dfa, insn, c))
+	    work[n++] = pc + 1;
+	  break;
+	}
+    }
+#undef DFA_PUSH
+
+  if (c < 0)
+    return matched;
+
+  if (searching)
+    work[n++] = 0;
+  if (n > 1)
+    qsort (work, n, sizeof *work, compare_ints);
+  t = dfa_state (dfa, work, n, next & dfa->ctx_mask, searching, pos);
+  if (t < 0)
+    return t;
+  t = 2 * t + matched;
+
+  /* Cache the transition, unless the states were just discarded.  */
+  if (dfa->flushes == flushes)
+    {
+      if (c < DFA_CACHED_CHARS)
+	state->next[c] = t;
+      else
+	{
+	  state->last_char = c;
+	  state->last_next = t;
+	}
+    }
+  return t;
+}
+
+/* Return the state to start matching at POS in the text of BUFP, the
+   virtual concatenation of STRING1 and STRING2, with its DFA.  */
+
+static int
+dfa_start_state (struct re_pattern_buffer *bufp, struct re_dfa *dfa,
+		 re_char *string1, ssize_t size1,
+		 re_char *string2, ssize_t size2,
+		 ssize_t pos, boolean searching)
+{
+  int ctx, s;
+
+  if (pos == 0)
+    ctx = CTX_EDGE | (bufp->not_bol ? 0 : CTX_LINE);
+  else if (!(dfa->ctx_mask & ~CTX_EDGE))
+    ctx = 0;
+  else
+    {
+      re_char *d = (pos <= size1 ? string1 + pos : string2 + (pos - size1));
+      re_char *limit = (pos <= size1 ? string1 : string2);
+      int c;
+
+      if (!dfa->ctx_syntax)
+	/* Only whether it is a newline counts.  */
+	ctx = d[-1] == '\n' ? CTX_LINE : 0;
+      else
+	{
+	  if (dfa->target_multibyte)
+	    {
+	      while (--d > limit && !CHAR_HEAD_P (*d))
+		;
+	      c = STRING_CHAR (d);
+	    }
+	  else
+	    c = d[-1];
+	  ctx = dfa_char_ctx (bufp, dfa, c);
+	}
+    }
+  ctx &= dfa->ctx_mask;
+
+  s = dfa->start[ctx][!!searching];
+  if (s < 0)
+    {
+      int zero = 0;
+
+      s = dfa_state (dfa, &zero, 1, ctx, searching, pos);
+      if (s >= 0)
+	dfa->start[ctx][!!searching] = s;
+    }
+  return s;
+}
+
+/* Subroutine of dfa_execute, which see.  */
+
+static ssize_t
+dfa_execute_1 (struct re_pattern_buffer *bufp, struct re_dfa *dfa,
+	       re_char *string1, ssize_t size1,
+	       re_char *string2, ssize_t size2,
+	       ssize_t pos, ssize_t last_start, ssize_t stop)
+{
+  const boolean target_multibyte = dfa->target_multibyte;
+  int s, t, next;
+  int quit_count = 1 << 16;
+
+  dfa->flush_pos = pos - 10 * DFA_MAX_STATES;
+  s = dfa_start_state (bufp, dfa, string1, size1, string2, size2,
+		       pos, last_start > pos);
+  if (s < 0)
+    return -2;
+
+  while (pos < stop)
+    {
+      /* The part of the text in STRING1 or in STRING2 that is left,
+	 as pointers into BASE, where BASE + POS is where POS is.  */
+      re_char *base = pos < size1 ? string1 : string2 - size1;
+      re_char *d = base + pos;
+      re_char *dend = base + (pos < size1 ? min (size1, stop) : stop);
+
+      while (d < dend)
+	{
+	  struct dfa_state *state = dfa->states[s];
+	  int c, len = 1;
+
+	  if (target_multibyte && ! ASCII_CHAR_P (*d))
+	    c = STRING_CHAR_AND_LENGTH (d, len);
+	  else
+	    c = *d;
+
+	  if (state->searching && d + len - base > last_start)
+	    {
+	      /* No match starts after this character.  */
+	      memcpy (dfa->work, state->kernel,
+		      state->nkernel * sizeof *dfa->work);
+	      s = dfa_state (dfa, dfa->work, state->nkernel,
+			     state->ctx, false, d - base);
+	      if (s < 0)
+		return -2;
+	      state = dfa->states[s];
+	    }
+
+	  if (c < DFA_CACHED_CHARS)
+	    t = state->next[c];
+	  else
+	    t = state->last_char == c ? state->last_next : DFA_UNCOMPUTED;
+	  if (t == DFA_UNCOMPUTED)
+	    {
+	      next = dfa_char_ctx (bufp, dfa, c);
+	      t = dfa_transition (bufp, dfa, s, c, next, d - base);
+	      if (t < 0)
+		return -2;
+	    }
+	  if (t & 1)
+	    return d - base;
+	  s = t >> 1;
+	  if (s == 0)
+	    return -1;
+	  d += len;
+
+	  if (--quit_count == 0)
+	    {
+	      IMMEDIATE_QUIT_CHECK;
+	      quit_count = 1 << 16;
+	    }
+	}
+      pos = d - base;
+    }
+
+  /* Whether the pattern matches at STOP depends on what follows.  */
+  if (pos == size1 + size2)
+    next = CTX_EDGE | CTX_STOP | (bufp->not_eol ? 0 : CTX_LINE);
+  else
+    {
+      re_char *d = pos < size1 ? string1 + pos : string2 + (pos - size1);
+
+      next = CTX_STOP | dfa_char_ctx (bufp, dfa,
+				      RE_STRING_CHAR (d, target_multibyte));
+    }
+  t = dfa_transition (bufp, dfa, s, -1, next, pos);
+  return t < 0 ? -2 : t ? pos : -1;
+}
+
+/* Run the DFA for BUFP over the virtual concatenation of STRING1 and
+   STRING2 from POS, not matching past STOP.  If LAST_START is not
+   negative, a match may start at any position from POS to LAST_START,
+   else only at POS.  Return the position where the earliest match
+   ends, -1 if there is no match, or -2 if the DFA cannot tell.  */
+
+static ssize_t
+dfa_execute (struct re_pattern_buffer *bufp, struct re_dfa *dfa,
+	     re_char *string1, ssize_t size1,
+	     re_char *string2, ssize_t size2,
+	     ssize_t pos, ssize_t last_start, ssize_t stop)
+{
+  ssize_t result;
+
+#ifdef REL_ALLOC
+  /* Adding states to the DFA allocates memory, which must not move
+     the buffer text that STRING1 and STRING2 point into.  */
+  r_alloc_inhibit_buffer_relocation (1);
+#endif
+  result = dfa_execute_1 (bufp, dfa, string1, size1, string2, size2,
+			  pos, last_start, stop);
+#ifdef REL_ALLOC
+  r_alloc_inhibit_buffer_relocation (0);
+#endif
+  return result;
+}
+
+/* Return the first position from POS to LAST_START where a match of
+   the pattern of BUFP starts, given its DFA, -1 if there is none, or
+   -2 if the DFA cannot tell.  The arguments are as for dfa_execute.
+   This looks for the first match end, then narrows down the last
+   position where the match can start.  */
+
+static ssize_t
+dfa_first_start (struct re_pattern_buffer *bufp, struct re_dfa *dfa,
+		 re_char *string1, ssize_t size1,
+		 re_char *string2, ssize_t size2,
+		 ssize_t pos, ssize_t last_start, ssize_t stop)
+{
+  ssize_t lo = pos, hi, end;
+
+  end = dfa_execute (bufp, dfa, string1, size1, string2, size2,
+		     pos, last_start, stop);
+  if (end < 0)
+    return end;
+
+  /* A match starts at or before HI, and none before LO.  */
+  hi = min (end, last_start);
+  while (lo < hi)
+    {
+      ssize_t mid = lo + (hi - lo) / 2;
+
+      end = dfa_execute (bufp, dfa, string1, size1, string2, size2,
+			 pos, mid, stop);
+      if (end == -2)
+	return -2;
+      if (end < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return hi;
+}
+
+#endif /* emacs */
+
 
 /* Searching routines.  */
 
@@ -4227,6 +5436,72 @@ WEAK_ALIAS (__re_search, re_search)
 #define POS_ADDR_VSTRING(POS)					\
   (((POS) >= size1 ? string2 - size1 : string1) + (POS))
 
+/* Return the first position from FROM to LAST in STRING where the
+   LENGTH bytes at MUST are, or -1 if there is none.  Look for the
+   byte at index GUIDE of MUST with memchr, which is fast.  */
+
+static ssize_t
+memmem_guided (re_char *string, ssize_t from, ssize_t last,
+	       re_char *must, size_t length, int guide)
+{
+  re_char *p = string + from + guide, *lim = string + last + guide;
+
+  while (from <= last)
+    {
+      re_char *q = memchr (p, must[guide], lim - p + 1);
+
+      if (!q)
+	break;
+      if (memcmp (q - guide, must, length) == 0)
+	return q - guide - string;
+      p = q + 1;
+      from = p - guide - string;
+    }
+  return -1;
+}
+
+/* Return the first position from FROM in the virtual concatenation of
+   STRING1 and STRING2 where the string that every match of BUFP
+   contains begins and ends by STOP, or -1 if there is none.  */
+
+static ssize_t
+search_must (struct re_pattern_buffer *bufp,
+	     re_char *string1, ssize_t size1,
+	     re_char *string2, ssize_t size2,
+	     ssize_t from, ssize_t stop)
+{
+  re_char *must = bufp->buffer + bufp->must_offset;
+  ssize_t length = bufp->must_length, pos;
+
+  if (from < size1)
+    {
+      /* Where the string is all in STRING1.  */
+      pos = memmem_guided (string1, from,
+			   (stop < size1 ? stop : size1) - length,
+			   must, length, bufp->must_guide);
+      if (pos >= 0)
+	return pos;
+
+      /* Where it straddles the end of STRING1.  */
+      for (pos = from <= size1 - length ? size1 - length + 1 : from;
+	   pos < size1 && pos + length <= stop; pos++)
+	{
+	  ssize_t i;
+
+	  for (i = 0; i < length; i++)
+	    if (*POS_ADDR_VSTRING (pos + i) != must[i])
+	      break;
+	  if (i == length)
+	    return pos;
+	}
+      from = size1;
+    }
+
+  pos = memmem_guided (string2, from - size1, stop - length - size1,
+		       must, length, bufp->must_guide);
+  return pos < 0 ? -1 : pos + size1;
+}
+
 /* Using the compiled pattern in BUFP->buffer, first tries to match the
    virtual concatenation of STRING1 and STRING2, starting first at index
    STARTPOS, then at STARTPOS + 1, and so on.
@@ -4263,6 +5538,16 @@ re_search_2 (struct re_pattern_buffer *bufp, const char *str1, size_t size1,
   boolean anchored_start;
   /* Nonzero if we are searching multibyte string.  */
   const boolean multibyte = RE_TARGET_MULTIBYTE_P (bufp);
+  /* Whether to look for the string that every match contains, and
+     where it was found last.  */
+  boolean use_must;
+  ssize_t must_pos = -1;
+#ifdef emacs
+  struct re_dfa *dfa = NULL;
+  /* How many more places the DFA may reject before the search asks
+     it where the first match can end, or 0 if it should not ask.  */
+  int dfa_tries = 4;
+#endif
 
   /* Check for out-of-range STARTPOS.  */
   if (startpos < 0 || startpos > total_size)
@@ -4304,6 +5589,19 @@ re_search_2 (struct re_pattern_buffer *bufp, const char *str1, size_t size1,
   /* See whether the pattern is anchored.  */
   anchored_start = (bufp->buffer[0] == begline);
 
+  /* A match contains the string exactly only if there is no
+     translation.  Trying a single position is quicker without it.  */
+  use_must = (bufp->must_length > 0 && range != 0
+	      && !RE_TRANSLATE_P (translate)
+	      && stop >= 0 && stop <= total_size);
+  if (use_must && range < 0)
+    {
+      if (search_must (bufp, string1, size1, string2, size2,
+		       startpos + range, stop) < 0)
+	return -1;
+      use_must = false;
+    }
+
 #ifdef emacs
   gl_state.object = re_match_object; /* Used by SYNTAX_TABLE_BYTE_TO_CHAR. */
   {
@@ -4311,11 +5609,48 @@ re_search_2 (struct re_pattern_buffer *bufp, const char *str1, size_t size1,
 
     SETUP_SYNTAX_TABLE_FOR_OBJECT (re_match_object, charpos, 1);
   }
+
+  if (stop >= 0 && stop <= total_size)
+    dfa = dfa_for_pattern (bufp);
+
+  /* When few characters can start a match, the fastmap loop skips
+     over the places where none starts faster than the DFA can, so
+     the DFA only checks each place the fastmap leaves.  */
+  if (fastmap && bufp->fastmap_selective)
+    dfa_tries = 0;
 #endif
 
   /* Loop through the string, looking for a place to start matching.  */
   for (;;)
     {
+      /* A match that starts at STARTPOS contains the string at
+	 STARTPOS or after it.  When we know how far into the match it
+	 can be, skip to where that is just far enough.  */
+      if (use_must && must_pos < startpos)
+	{
+	  must_pos = search_must (bufp, string1, size1, string2, size2,
+				  startpos, stop);
+	  if (must_pos < 0)
+	    return -1;
+	  if (bufp->must_lead >= 0)
+	    {
+	      ssize_t pos = must_pos, lead = bufp->must_lead;
+
+	      if (!multibyte)
+		pos = pos - lead < startpos ? startpos : pos - lead;
+	      else
+		while (lead-- > 0 && pos > startpos)
+		  do
+		    pos--;
+		  while (pos > startpos
+			 && !CHAR_HEAD_P (*POS_ADDR_VSTRING (pos)));
+	      if (pos > startpos + range)
+		return -1;
+	      range -= pos - startpos;
+	      startpos = pos;
+	    }
+	}
+
       /* If the pattern is anchored,
 	 skip quickly past places we cannot match.
 	 We don't bother to treat startpos == 0 specially
@@ -4432,6 +5767,41 @@ re_search_2 (struct re_pattern_buffer *bufp, const char *str1, size_t size1,
 	  && !bufp->can_be_null)
 	return -1;
 
+#ifdef emacs
+      /* Only run the backtracking matcher where a match starts, and
+	 not at all if it does not need to find the groups.  */
+      if (dfa && startpos <= stop)
+	{
+	  ssize_t end = dfa_execute (bufp, dfa, string1, size1,
+				     string2, size2, startpos, -1, stop);
+
+	  if (end == -1)
+	    {
+	      /* When the search keeps finding places where no match
+		 starts, skip to the first place where one does.  */
+	      if (range > 0 && dfa_tries > 0 && --dfa_tries == 0
+		  && startpos + range <= stop)
+		{
+		  ssize_t first = dfa_first_start (bufp, dfa, string1, size1,
+						   string2, size2, startpos,
+						   startpos + range, stop);
+
+		  if (first == -1)
+		    return -1;
+		  if (first >= 0)
+		    {
+		      range -= first - startpos;
+		      startpos = first;
+		      continue;
+		    }
+		}
+	      goto advance;
+	    }
+	  if (end >= 0 && (!regs || bufp->no_sub))
+	    return startpos;
+	}
+#endif
+
       val = re_match_2_internal (bufp, string1, size1, string2, size2,
 				 startpos, regs, stop);
 
@@ -4714,22 +6084,10 @@ mutually_exclusive_p (struct re_pattern_buffer *bufp, const_re_char *p1,
 	else if ((re_opcode_t) *p1 == charset
 		 || (re_opcode_t) *p1 == charset_not)
 	  {
-	    int not = (re_opcode_t) *p1 == charset_not;
-
 	    /* Test if C is listed in charset (or charset_not)
-	       at `p1'.  */
-	    if (! multibyte || IS_REAL_ASCII (c))
-	      {
-		if (c < CHARSET_BITMAP_SIZE (p1) * BYTEWIDTH
-		    && p1[2 + c / BYTEWIDTH] & (1 << (c % BYTEWIDTH)))
-		  not = !not;
-	      }
-	    else if (CHARSET_RANGE_TABLE_EXISTS_P (p1))
-	      CHARSET_LOOKUP_RANGE_TABLE (not, c, p1);
-
-	    /* `not' is equal to 1 if c would match, which means
-	       that we can't change to pop_failure_jump.  */
-	    if (!not)
+	       at `p1'.  If it is, we can't change to
+	       pop_failure_jump.  */
+	    if (!execute_charset (p1, c, ! multibyte || IS_REAL_ASCII (c)))
 	      {
 		DEBUG_PRINT ("	 No match => fast loop.\n");
 		return 1;
@@ -4906,6 +6264,15 @@ re_match_2 (struct re_pattern_buffer *bufp, const char *string1,
   gl_state.object = re_match_object; /* Used by SYNTAX_TABLE_BYTE_TO_CHAR. */
   charpos = SYNTAX_TABLE_BYTE_TO_CHAR (POS_AS_IN_BUFFER (pos));
   SETUP_SYNTAX_TABLE_FOR_OBJECT (re_match_object, charpos, 1);
+
+  if (pos >= 0 && pos <= stop && stop <= size1 + size2)
+    {
+      struct re_dfa *dfa = dfa_for_pattern (bufp);
+
+      if (dfa && dfa_execute (bufp, dfa, (re_char *) string1, size1,
+			      (re_char *) string2, size2, pos, -1, stop) == -1)
+	return -1;
+    }
 #endif
 
   result = re_match_2_internal (bufp, (re_char*) string1, size1,
@@ -5434,32 +6801,13 @@ re_match_2_internal (struct re_pattern_buffer *bufp, const_re_char *string1,
 	case charset_not:
 	  {
 	    register unsigned int c;
-	    boolean not = (re_opcode_t) *(p - 1) == charset_not;
 	    int len;
 
-	    /* Start of actual range_table, or end of bitmap if there is no
-	       range table.  */
-	    re_char *range_table IF_LINT (= NULL);
-
-	    /* Nonzero if there is a range table.  */
-	    int range_table_exists;
-
-	    /* Number of ranges of range table.  This is not included
-	       in the initial byte-length of the command.  */
-	    int count = 0;
-
 	    /* Whether matching against a unibyte character.  */
 	    boolean unibyte_char = false;
 
-	    DEBUG_PRINT ("EXECUTING charset%s.\n", not ? "_not" : "");
-
-	    range_table_exists = CHARSET_RANGE_TABLE_EXISTS_P (&p[-1]);
-
-	    if (range_table_exists)
-	      {
-		range_table = CHARSET_RANGE_TABLE (&p[-1]); /* Past the bitmap.  */
-		EXTRACT_NUMBER_AND_INCR (count, range_table);
-	      }
+	    DEBUG_PRINT ("EXECUTING charset%s.\n",
+			 (re_opcode_t) *(p - 1) == charset_not ? "_not" : "");
 
 	    PREFETCH ();
 	    c = RE_STRING_CHAR_AND_LENGTH (d, len, target_multibyte);
@@ -5493,38 +6841,11 @@ re_match_2_internal (struct re_pattern_buffer *bufp, const_re_char *string1,
 		  unibyte_char = true;
 	      }
 
-	    if (unibyte_char && c < (1 << BYTEWIDTH))
-	      {			/* Lookup bitmap.  */
-		/* Cast to `unsigned' instead of `unsigned char' in
-		   case the bit list is a full 32 bytes long.  */
-		if (c < (unsigned) (CHARSET_BITMAP_SIZE (&p[-1]) * BYTEWIDTH)
-		    && p[1 + c / BYTEWIDTH] & (1 << (c % BYTEWIDTH)))
-		  not = !not;
-	      }
-#ifdef emacs
-	    else if (range_table_exists)
-	      {
-		int class_bits = CHARSET_RANGE_TABLE_BITS (&p[-1]);
-
-		if (  (class_bits & BIT_LOWER && ISLOWER (c))
-		    | (class_bits & BIT_MULTIBYTE)
-		    | (class_bits & BIT_PUNCT && ISPUNCT (c))
-		    | (class_bits & BIT_SPACE && ISSPACE (c))
-		    | (class_bits & BIT_UPPER && ISUPPER (c))
-		    | (class_bits & BIT_WORD  && ISWORD (c)))
-		  not = !not;
-		else
-		  CHARSET_LOOKUP_RANGE_TABLE_RAW (not, c, range_table, count);
-	      }
-#endif /* emacs */
-
-	    if (range_table_exists)
-	      p = CHARSET_RANGE_TABLE_END (range_table, count);
-	    else
-	      p += CHARSET_BITMAP_SIZE (&p[-1]) + 1;
-
-	    if (!not) goto fail;
+	    p -= 1;
+	    if (!execute_charset (p, c, unibyte_char))
+	      goto fail;
 
+	    p = skip_one_char (p);
 	    d += len;
 	  }
 	  break;
@@ -369,6 +369,10 @@ struct re_pattern_buffer
            this absolutely perfectly; see `re_compile_fastmap'.  */
   unsigned can_be_null : 1;
 
+        /* Set by `re_compile_fastmap' if few characters can start a
+           match, so that the fastmap skips most of the text.  */
+  unsigned fastmap_selective : 1;
+
         /* If REGS_UNALLOCATED, allocate space in the `regs' structure
              for `max (RE_NREGS, re_nsub + 1)' groups.
            If REGS_REALLOCATE, reallocate space if necessary.
@@ -397,6 +401,18 @@ struct re_pattern_buffer
      so the compiled pattern is only valid for the current syntax table.  */
   unsigned used_syntax : 1;
 
+	/* A string of ASCII characters that every match contains, as
+	   the offset and length of its bytes in `buffer', or a length
+	   of zero if the compiler found none.  `must_lead' is how many
+	   characters a match can have before it, or -1 if there is no
+	   limit, and `must_guide' is the index of its least common
+	   character.  re_search uses it to skip text where no match
+	   can be.  */
+  size_t must_offset;
+  size_t must_length;
+  ssize_t must_lead;
+  int must_guide;
+
 #ifdef emacs
   /* If true, multi-byte form in the regexp pattern should be
      recognized as a multibyte character.  */
@@ -408,6 +424,10 @@ struct re_pattern_buffer
 
   /* Charset of unibyte characters at compiling time. */
   int charset_unibyte;
+
+  /* The lazy DFA that tells whether the pattern matches, or NULL if
+     it has not been needed yet.  */
+  struct re_dfa *dfa;
 #endif
 
 /* [[[end pattern_buffer]]] */
@@ -522,6 +542,14 @@ extern void re_set_registers (struct re_pattern_buffer *__buffer,
 			      unsigned __num_regs,
 			      regoff_t *__starts, regoff_t *__ends);
 
+#ifdef emacs
+/* Discard the states that the DFA of BUFFER has computed.  */
+extern void re_flush_dfa (struct re_pattern_buffer *__buffer);
+
+/* Free the DFA of BUFFER.  */
+extern void re_free_dfa (struct re_pattern_buffer *__buffer);
+#endif
+
 #if defined _REGEX_RE_COMP || defined _LIBC
 # ifndef _CRAY
 /* 4.2 bsd compatibility.  */
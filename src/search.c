@@ -21,6 +21,11 @@ along with GNU Emacs.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include <config.h>
 
+#include <count-one-bits.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 #include "lisp.h"
 #include "category.h"
 #include "character.h"
@@ -35,13 +40,16 @@ along with GNU Emacs.  If not, see <http://www.gnu.org/licenses/>.  */
 #include <sys/types.h>
 #include "regex.h"
 
-#define REGEXP_CACHE_SIZE 20
-
 /* If the regexp is non-nil, then the buffer contains the compiled form
    of that regexp, suitable for searching.  */
 struct regexp_cache
 {
-  struct regexp_cache *next;
+  /* The next and previous entries in the order of use.  */
+  struct regexp_cache *next, *prev;
+  /* The next entry in the same hash bucket.  */
+  struct regexp_cache *hash_next;
+  /* The hash of the regexp and of what it was compiled for.  */
+  EMACS_UINT hash;
   Lisp_Object regexp, whitespace_regexp;
   /* Syntax table for which the regexp applies.  We need this because
      of character classes.  If this is t, then the compiled pattern is valid
@@ -53,11 +61,29 @@ struct regexp_cache
   bool posix;
 };
 
-/* The instances of that struct.  */
-static struct regexp_cache searchbufs[REGEXP_CACHE_SIZE];
+/* The cache holds at most `regexp-cache-size' entries, allocated as
+   they are needed.  A hash table finds the entry of a regexp, and a
+   list in the order of use finds the least recently used entry, which
+   is the one to reuse when the cache is full.  The syntax table is
+   not part of the hash, since a compiled pattern may be valid for
+   any syntax table.  */
+
+/* The head and the tail of the list; the head is the most recently
+   used entry.  */
+static struct regexp_cache *searchbuf_head, *searchbuf_tail;
 
-/* The head of the linked list; points to the most recently used buffer.  */
-static struct regexp_cache *searchbuf_head;
+/* The number of entries, and the value of `regexp-cache-size' that
+   the cache was last set up for.  */
+static EMACS_INT searchbuf_count, searchbuf_size;
+
+/* The hash buckets of the entries whose regexp is non-nil.  Their
+   number is a power of 2.  */
+static struct regexp_cache **searchbuf_buckets;
+static ptrdiff_t searchbuf_nbuckets;
+
+/* The number of times `compile_pattern' found the pattern in the
+   cache, and the number of times it had to compile it.  */
+static EMACS_INT regexp_cache_hits, regexp_cache_misses;
 
 
 /* Every call to re_match, etc., must pass &search_regs as the regs
@@ -90,6 +116,9 @@ static Lisp_Object Qinvalid_regexp;
 /* Error condition used for failing searches.  */
 static Lisp_Object Qsearch_failed;
 
+/* Values of the DELIMITED argument of `search-forward-strings'.  */
+static Lisp_Object Qwords, Qsymbols;
+
 static void set_search_regs (ptrdiff_t, ptrdiff_t);
 static void save_search_regs (void);
 static EMACS_INT simple_search (EMACS_INT, unsigned char *, ptrdiff_t,
@@ -177,9 +206,154 @@ shrink_regexp_cache (void)
     {
       cp->buf.allocated = cp->buf.used;
       cp->buf.buffer = xrealloc (cp->buf.buffer, cp->buf.used);
+      re_flush_dfa (&cp->buf);
+    }
+}
+
+/* Mark the Lisp objects of the regexp cache.
+   This is called from garbage collection.  */
+
+void
+mark_regexp_cache (void)
+{
+  struct regexp_cache *cp;
+
+  for (cp = searchbuf_head; cp != 0; cp = cp->next)
+    {
+      mark_object (cp->regexp);
+      mark_object (cp->whitespace_regexp);
+      mark_object (cp->syntax_table);
+      mark_object (cp->buf.translate);
+    }
+}
+
+/* Remove CP from its hash bucket, if it is in one.  */
+
+static void
+unhash_regexp_cache (struct regexp_cache *cp)
+{
+  struct regexp_cache **p;
+
+  for (p = &searchbuf_buckets[cp->hash & (searchbuf_nbuckets - 1)];
+       *p; p = &(*p)->hash_next)
+    if (*p == cp)
+      {
+	*p = cp->hash_next;
+	break;
+      }
+  cp->hash_next = 0;
+}
+
+/* Put CP, whose regexp is non-nil, in its hash bucket.  */
+
+static void
+hash_regexp_cache (struct regexp_cache *cp)
+{
+  struct regexp_cache **p
+    = &searchbuf_buckets[cp->hash & (searchbuf_nbuckets - 1)];
+
+  cp->hash_next = *p;
+  *p = cp;
+}
+
+/* Remove CP from the list of entries.  */
+
+static void
+unlink_regexp_cache (struct regexp_cache *cp)
+{
+  if (cp->prev)
+    cp->prev->next = cp->next;
+  else
+    searchbuf_head = cp->next;
+  if (cp->next)
+    cp->next->prev = cp->prev;
+  else
+    searchbuf_tail = cp->prev;
+}
+
+/* Put CP at the head of the list of entries, if AT_HEAD, else at its
+   tail.  */
+
+static void
+link_regexp_cache (struct regexp_cache *cp, bool at_head)
+{
+  if (at_head)
+    {
+      cp->prev = 0;
+      cp->next = searchbuf_head;
+      if (searchbuf_head)
+	searchbuf_head->prev = cp;
+      else
+	searchbuf_tail = cp;
+      searchbuf_head = cp;
+    }
+  else
+    {
+      cp->next = 0;
+      cp->prev = searchbuf_tail;
+      if (searchbuf_tail)
+	searchbuf_tail->next = cp;
+      else
+	searchbuf_head = cp;
+      searchbuf_tail = cp;
     }
 }
 
+/* Make the cache fit the current value of `regexp-cache-size',
+   dropping the least recently used entries that are too many.  */
+
+static void
+resize_regexp_cache (void)
+{
+  EMACS_INT size = max (regexp_cache_size, 1);
+  ptrdiff_t nbuckets = 16;
+  struct regexp_cache *cp;
+
+  while (nbuckets < min (size, 1 << 16))
+    nbuckets *= 2;
+
+  while (searchbuf_count > size)
+    {
+      cp = searchbuf_tail;
+      unhash_regexp_cache (cp);
+      unlink_regexp_cache (cp);
+      xfree (cp->buf.buffer);
+      re_free_dfa (&cp->buf);
+      xfree (cp);
+      searchbuf_count--;
+    }
+
+  if (nbuckets != searchbuf_nbuckets)
+    {
+      xfree (searchbuf_buckets);
+      searchbuf_buckets = xzalloc (nbuckets * sizeof *searchbuf_buckets);
+      searchbuf_nbuckets = nbuckets;
+      for (cp = searchbuf_head; cp != 0; cp = cp->next)
+	if (!NILP (cp->regexp))
+	  hash_regexp_cache (cp);
+    }
+
+  searchbuf_size = regexp_cache_size;
+}
+
+/* Return the hash of PATTERN compiled with TRANSLATE and POSIX, and
+   with the current value of Vsearch_spaces_regexp.  */
+
+static EMACS_UINT
+regexp_cache_hash (Lisp_Object pattern, Lisp_Object translate, bool posix)
+{
+  EMACS_UINT hash = hash_string (SSDATA (pattern), SBYTES (pattern));
+
+  hash = sxhash_combine (hash, STRING_MULTIBYTE (pattern));
+  hash = sxhash_combine (hash, XHASH (translate));
+  hash = sxhash_combine (hash, posix);
+  if (STRINGP (Vsearch_spaces_regexp))
+    hash = sxhash_combine (hash,
+			   hash_string (SSDATA (Vsearch_spaces_regexp),
+					SBYTES (Vsearch_spaces_regexp)));
+  return hash;
+}
+
 /* Clear the regexp cache w.r.t. a particular syntax table,
    because it was changed.
    There is no danger of memory leak here because re_compile_pattern
@@ -188,14 +362,21 @@ shrink_regexp_cache (void)
 void
 clear_regexp_cache (void)
 {
-  int i;
+  struct regexp_cache *cp;
 
-  for (i = 0; i < REGEXP_CACHE_SIZE; ++i)
-    /* It's tempting to compare with the syntax-table we've actually changed,
-       but it's not sufficient because char-table inheritance means that
-       modifying one syntax-table can change others at the same time.  */
-    if (!EQ (searchbufs[i].syntax_table, Qt))
-      searchbufs[i].regexp = Qnil;
+  for (cp = searchbuf_head; cp != 0; cp = cp->next)
+    {
+      /* The DFA states depend on the syntax of characters.  */
+      re_flush_dfa (&cp->buf);
+      /* It's tempting to compare with the syntax-table we've actually changed,
+	 but it's not sufficient because char-table inheritance means that
+	 modifying one syntax-table can change others at the same time.  */
+      if (!EQ (cp->syntax_table, Qt))
+	{
+	  unhash_regexp_cache (cp);
+	  cp->regexp = Qnil;
+	}
+    }
 }
 
 /* Compile a regexp if necessary, but first check to see if there's one in
@@ -213,46 +394,62 @@ struct re_pattern_buffer *
 compile_pattern (Lisp_Object pattern, struct re_registers *regp,
 		 Lisp_Object translate, bool posix, bool multibyte)
 {
-  struct regexp_cache *cp, **cpp;
-
-  for (cpp = &searchbuf_head; ; cpp = &cp->next)
-    {
-      cp = *cpp;
-      /* Entries are initialized to nil, and may be set to nil by
-	 compile_pattern_1 if the pattern isn't valid.  Don't apply
-	 string accessors in those cases.  However, compile_pattern_1
-	 is only applied to the cache entry we pick here to reuse.  So
-	 nil should never appear before a non-nil entry.  */
-      if (NILP (cp->regexp))
-	goto compile_it;
-      if (SCHARS (cp->regexp) == SCHARS (pattern)
-	  && STRING_MULTIBYTE (cp->regexp) == STRING_MULTIBYTE (pattern)
-	  && !NILP (Fstring_equal (cp->regexp, pattern))
-	  && EQ (cp->buf.translate, (! NILP (translate) ? translate : make_number (0)))
-	  && cp->posix == posix
-	  && (EQ (cp->syntax_table, Qt)
-	      || EQ (cp->syntax_table, BVAR (current_buffer, syntax_table)))
-	  && !NILP (Fequal (cp->whitespace_regexp, Vsearch_spaces_regexp))
-	  && cp->buf.charset_unibyte == charset_unibyte)
-	break;
+  struct regexp_cache *cp;
+  EMACS_UINT hash;
+
+  if (NILP (translate))
+    translate = make_number (0);
+  if (searchbuf_size != regexp_cache_size)
+    resize_regexp_cache ();
+
+  hash = regexp_cache_hash (pattern, translate, posix);
+  for (cp = searchbuf_buckets[hash & (searchbuf_nbuckets - 1)];
+       cp != 0; cp = cp->hash_next)
+    if (cp->hash == hash
+	&& SCHARS (cp->regexp) == SCHARS (pattern)
+	&& STRING_MULTIBYTE (cp->regexp) == STRING_MULTIBYTE (pattern)
+	&& !NILP (Fstring_equal (cp->regexp, pattern))
+	&& EQ (cp->buf.translate, translate)
+	&& cp->posix == posix
+	&& (EQ (cp->syntax_table, Qt)
+	    || EQ (cp->syntax_table, BVAR (current_buffer, syntax_table)))
+	&& !NILP (Fequal (cp->whitespace_regexp, Vsearch_spaces_regexp))
+	&& cp->buf.charset_unibyte == charset_unibyte)
+      break;
+
+  if (cp)
+    regexp_cache_hits++;
+  else
+    {
+      regexp_cache_misses++;
 
-      /* If we're at the end of the cache, compile into the nil cell
-	 we found, or the last (least recently used) cell with a
-	 string value.  */
-      if (cp->next == 0)
+      /* Compile into a new entry if there is room for one, else into
+	 the least recently used entry.  If the pattern is invalid,
+	 the entry is left with a nil regexp at the tail of the list,
+	 to be reused first.  */
+      if (searchbuf_count < max (searchbuf_size, 1))
 	{
-	compile_it:
-	  compile_pattern_1 (cp, pattern, translate, posix);
-	  break;
+	  cp = xzalloc (sizeof *cp);
+	  cp->regexp = cp->whitespace_regexp = cp->syntax_table = Qnil;
+	  cp->buf.allocated = 100;
+	  cp->buf.buffer = xmalloc (100);
+	  cp->buf.fastmap = cp->fastmap;
+	  cp->buf.translate = Qnil;
+	  link_regexp_cache (cp, false);
+	  searchbuf_count++;
 	}
+      cp = searchbuf_tail;
+      unhash_regexp_cache (cp);
+      compile_pattern_1 (cp, pattern, translate, posix);
+      cp->hash = hash;
+      hash_regexp_cache (cp);
     }
 
-  /* When we get here, cp (aka *cpp) contains the compiled pattern,
+  /* When we get here, cp contains the compiled pattern,
      either because we found it in the cache or because we just compiled it.
      Move it to the front of the queue to mark it as most recently used.  */
-  *cpp = cp->next;
-  cp->next = searchbuf_head;
-  searchbuf_head = cp;
+  unlink_regexp_cache (cp);
+  link_regexp_cache (cp, true);
 
   /* Advise the searching functions about the space we have allocated
      for register data.  */
@@ -266,7 +463,23 @@ compile_pattern (Lisp_Object pattern, struct re_registers *regp,
   return &cp->buf;
 }
 
-
+DEFUN ("regexp-cache-counts", Fregexp_cache_counts, Sregexp_cache_counts,
+       0, 0, 0,
+       doc: /* Return a list of counters that describe the regexp cache.
+The elements of the value are as follows:
+  (HITS MISSES ENTRIES)
+HITS is the number of times a search or match found its regexp already
+compiled in the cache, and MISSES the number of times it had to compile
+the regexp.  ENTRIES is the number of regexps the cache holds now.
+See `regexp-cache-size'.  */)
+  (void)
+{
+  return list3 (make_fixnum_or_float (regexp_cache_hits),
+		make_fixnum_or_float (regexp_cache_misses),
+		make_number (searchbuf_count));
+}
+
+
 static Lisp_Object
 looking_at_1 (Lisp_Object string, bool posix)
 {
@@ -647,6 +860,572 @@ newline_cache_on_off (struct buffer *buf)
 }
 
 
+/* Counting newlines in bulk.
+
+   Hopping from one newline to the next with memchr costs a call per
+   line, which is most of the work when lines are short.  These
+   functions count the newlines of a whole chunk of text at once
+   instead: 16 bytes at a time with SSE2 where the compiler has it,
+   and a word at a time otherwise.  */
+
+/* The size of the chunks that skip_lines_forward and
+   skip_lines_backward skip.  */
+
+#define NEWLINE_CHUNK 256
+
+/* Return the number of newlines in the LEN bytes at P.  */
+
+ptrdiff_t
+memcount_newlines (unsigned char const *p, ptrdiff_t len)
+{
+  ptrdiff_t n = 0;
+
+#ifdef __SSE2__
+  __m128i newline = _mm_set1_epi8 ('\n'), zero = _mm_setzero_si128 ();
+
+  while (len >= 16)
+    {
+      /* Each byte of ACC counts the newlines in its lane, so it can
+	 take at most 255 rounds.  */
+      ptrdiff_t rounds = min (len / 16, 255);
+      __m128i acc = zero, sums;
+
+      len -= rounds * 16;
+      do
+	{
+	  __m128i v = _mm_loadu_si128 ((__m128i const *) p);
+	  acc = _mm_sub_epi8 (acc, _mm_cmpeq_epi8 (v, newline));
+	  p += 16;
+	}
+      while (--rounds != 0);
+      sums = _mm_sad_epu8 (acc, zero);
+      n += (_mm_cvtsi128_si32 (sums)
+	    + _mm_cvtsi128_si32 (_mm_srli_si128 (sums, 8)));
+    }
+#else
+  unsigned long ones = ULONG_MAX / UCHAR_MAX;
+  unsigned long highs = ones << (CHAR_BIT - 1);
+
+  for (; len >= (ptrdiff_t) sizeof ones; p += sizeof ones, len -= sizeof ones)
+    {
+      unsigned long w;
+
+      memcpy (&w, p, sizeof w);
+      w ^= ones * '\n';
+      /* Set the high bit of just those bytes of W that are zero.  */
+      w = ~(((w & ~highs) + ~highs) | w) & highs;
+      n += count_one_bits_l (w);
+    }
+#endif
+
+  for (; len > 0; len--)
+    n += *p++ == '\n';
+  return n;
+}
+
+/* Return the number of bytes at the start of the LEN bytes at P that
+   hold fewer than *COUNT newlines and can be skipped in whole chunks,
+   and decrease *COUNT by the number of newlines in them.  Only chunks
+   of short lines are skipped, as a caller hopping from one newline to
+   the next may want to cache the long stretches without any.  */
+
+ptrdiff_t
+skip_lines_forward (unsigned char const *p, ptrdiff_t len,
+		    ptrdiff_t *count)
+{
+  ptrdiff_t skipped = 0;
+
+  while (*count > 2 && len - skipped >= NEWLINE_CHUNK)
+    {
+      ptrdiff_t n = memcount_newlines (p + skipped, NEWLINE_CHUNK);
+
+      if (n < 2 || n >= *count)
+	break;
+      *count -= n;
+      skipped += NEWLINE_CHUNK;
+    }
+  return skipped;
+}
+
+/* Likewise, for the end of the LEN bytes that end at END, and a
+   negative *COUNT that is increased instead.  */
+
+ptrdiff_t
+skip_lines_backward (unsigned char const *end, ptrdiff_t len,
+		     ptrdiff_t *count)
+{
+  ptrdiff_t skipped = 0;
+
+  while (*count < -2 && len - skipped >= NEWLINE_CHUNK)
+    {
+      ptrdiff_t n = memcount_newlines (end - skipped - NEWLINE_CHUNK,
+				       NEWLINE_CHUNK);
+
+      if (n < 2 || n >= - *count)
+	break;
+      *count += n;
+      skipped += NEWLINE_CHUNK;
+    }
+  return skipped;
+}
+
+
+/* The line index.
+
+   Once the newlines of a buffer text have been counted, insdel.c
+   keeps their number up to date, and the text keeps checkpoints of
+   the number of newlines before some byte positions, about
+   LINE_CHECKPOINT_INTERVAL bytes apart.  The line number of a
+   position, or the position of a line, can then be found by scanning
+   no further than the nearest checkpoint.  Scans that go further add
+   checkpoints along the way.
+
+   The vector of checkpoints has a gap that follows the gap of the
+   text, like the position index in marker.c: checkpoints before it
+   are at or before GPT_BYTE, and those after it are at or after
+   GPT_BYTE and relative to Z_BYTE and to the number of newlines.  */
+
+#define LINE_CHECKPOINT_INTERVAL 8192
+
+/* Return the number of line checkpoints of T.  */
+
+static ptrdiff_t
+line_checkpoint_count (struct buffer_text *t)
+{
+  return (t->line_checkpoints_gap
+	  + t->line_checkpoints_size - t->line_checkpoints_gap_end);
+}
+
+/* Return the Nth line checkpoint of T, with absolute values.  */
+
+static struct line_checkpoint
+line_checkpoint_at (struct buffer_text *t, ptrdiff_t n)
+{
+  struct line_checkpoint c;
+
+  if (n < t->line_checkpoints_gap)
+    return t->line_checkpoints[n];
+  c = t->line_checkpoints[n + t->line_checkpoints_gap_end
+			  - t->line_checkpoints_gap];
+  c.bytepos += t->z_byte;
+  c.lines += t->newlines;
+  return c;
+}
+
+/* Return the number of line checkpoints of T that have at most VALUE
+   newlines before them if BY_LINE, or that are at or before byte
+   position VALUE otherwise.  */
+
+static ptrdiff_t
+line_checkpoint_rank (struct buffer_text *t, ptrdiff_t value, bool by_line)
+{
+  ptrdiff_t lo = 0, hi = t->line_checkpoints_gap, offset;
+
+  while (lo < hi)
+    {
+      ptrdiff_t mid = lo + (hi - lo) / 2;
+      struct line_checkpoint *c = &t->line_checkpoints[mid];
+
+      if ((by_line ? c->lines : c->bytepos) <= value)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo < t->line_checkpoints_gap)
+    return lo;
+
+  offset = by_line ? t->newlines : t->z_byte;
+  lo = t->line_checkpoints_gap_end;
+  hi = t->line_checkpoints_size;
+  while (lo < hi)
+    {
+      ptrdiff_t mid = lo + (hi - lo) / 2;
+      struct line_checkpoint *c = &t->line_checkpoints[mid];
+
+      if ((by_line ? c->lines : c->bytepos) + offset <= value)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo - (t->line_checkpoints_gap_end - t->line_checkpoints_gap);
+}
+
+/* Return the number of newlines in B between FROM_BYTE and TO_BYTE,
+   which may straddle the gap.  */
+
+static ptrdiff_t
+count_newlines_1 (struct buffer *b, ptrdiff_t from_byte, ptrdiff_t to_byte)
+{
+  ptrdiff_t n = 0;
+
+  while (from_byte < to_byte)
+    {
+      ptrdiff_t ceiling = (from_byte < BUF_GPT_BYTE (b)
+			   ? min (to_byte, BUF_GPT_BYTE (b)) : to_byte);
+      n += memcount_newlines (BUF_BYTE_ADDRESS (b, from_byte),
+			      ceiling - from_byte);
+      from_byte = ceiling;
+    }
+  return n;
+}
+
+/* Return the byte position in B just after the Nth newline from
+   FROM_BYTE.  There must be that many newlines after FROM_BYTE.  */
+
+static ptrdiff_t
+find_nth_newline (struct buffer *b, ptrdiff_t from_byte, ptrdiff_t n)
+{
+  while (true)
+    {
+      ptrdiff_t ceiling = (from_byte < BUF_GPT_BYTE (b)
+			   ? BUF_GPT_BYTE (b) : BUF_Z_BYTE (b));
+      unsigned char *base = BUF_BYTE_ADDRESS (b, from_byte);
+      unsigned char *p = base, *lim = base + (ceiling - from_byte);
+
+      while (true)
+	{
+	  p += skip_lines_forward (p, lim - p, &n);
+	  p = memchr (p, '\n', lim - p);
+	  if (! p)
+	    break;
+	  p++;
+	  if (--n == 0)
+	    return from_byte + (p - base);
+	}
+      from_byte = ceiling;
+    }
+}
+
+/* Line checkpoints collected by a scan.  */
+
+struct line_run
+{
+  struct line_checkpoint *vec;
+  ptrdiff_t n, size;
+};
+
+/* Return the number of newlines in B between FROM_BYTE and TO_BYTE,
+   recording in RUN a checkpoint every LINE_CHECKPOINT_INTERVAL bytes
+   of the way, with the number of newlines from FROM_BYTE.  */
+
+static ptrdiff_t
+scan_lines (struct buffer *b, ptrdiff_t from_byte, ptrdiff_t to_byte,
+	    struct line_run *run)
+{
+  ptrdiff_t n = 0;
+
+  while (to_byte - from_byte > LINE_CHECKPOINT_INTERVAL)
+    {
+      from_byte += LINE_CHECKPOINT_INTERVAL;
+      n += count_newlines_1 (b, from_byte - LINE_CHECKPOINT_INTERVAL,
+			     from_byte);
+      if (run->n == run->size)
+	run->vec = xpalloc (run->vec, &run->size, 1, -1, sizeof *run->vec);
+      run->vec[run->n].bytepos = from_byte;
+      run->vec[run->n].lines = n;
+      run->n++;
+    }
+  return n + count_newlines_1 (b, from_byte, to_byte);
+}
+
+/* Add the checkpoints of RUN to the line index of B, counting LINES
+   more newlines before each, and free RUN.  The checkpoints must all
+   lie strictly between two consecutive checkpoints of B.  */
+
+static void
+add_line_checkpoints (struct buffer *b, struct line_run *run,
+		      ptrdiff_t lines)
+{
+  struct buffer_text *t = b->text;
+  struct line_checkpoint *vec = run->vec;
+  ptrdiff_t i, k, m, n = run->n;
+
+  if (n == 0)
+    return;
+
+  if (t->line_checkpoints_gap_end - t->line_checkpoints_gap < n)
+    {
+      ptrdiff_t tail = t->line_checkpoints_size - t->line_checkpoints_gap_end;
+      ptrdiff_t needed
+	= n - (t->line_checkpoints_gap_end - t->line_checkpoints_gap);
+
+      t->line_checkpoints = xpalloc (t->line_checkpoints,
+				     &t->line_checkpoints_size,
+				     needed, -1, sizeof *t->line_checkpoints);
+      memmove (t->line_checkpoints + t->line_checkpoints_size - tail,
+	       t->line_checkpoints + t->line_checkpoints_gap_end,
+	       tail * sizeof *t->line_checkpoints);
+      t->line_checkpoints_gap_end = t->line_checkpoints_size - tail;
+    }
+
+  for (i = 0; i < n; i++)
+    vec[i].lines += lines;
+
+  /* The run may straddle the gap of the text, so put the checkpoints
+     at or before it before the gap of the index.  */
+  for (m = 0; m < n && vec[m].bytepos <= t->gpt_byte; m++)
+    continue;
+  if (m > 0)
+    {
+      k = line_checkpoint_rank (t, vec[0].bytepos, 0);
+      memmove (t->line_checkpoints + k + m, t->line_checkpoints + k,
+	       (t->line_checkpoints_gap - k) * sizeof *t->line_checkpoints);
+      memcpy (t->line_checkpoints + k, vec, m * sizeof *vec);
+      t->line_checkpoints_gap += m;
+    }
+  if (m < n)
+    {
+      k = (line_checkpoint_rank (t, vec[m].bytepos, 0)
+	   + t->line_checkpoints_gap_end - t->line_checkpoints_gap);
+      memmove (t->line_checkpoints + t->line_checkpoints_gap_end - (n - m),
+	       t->line_checkpoints + t->line_checkpoints_gap_end,
+	       (k - t->line_checkpoints_gap_end)
+	       * sizeof *t->line_checkpoints);
+      t->line_checkpoints_gap_end -= n - m;
+      for (i = m; i < n; i++)
+	{
+	  struct line_checkpoint *c = &t->line_checkpoints[k - n + i];
+
+	  c->bytepos = vec[i].bytepos - t->z_byte;
+	  c->lines = vec[i].lines - t->newlines;
+	}
+    }
+
+  xfree (vec);
+}
+
+/* Count the newlines of B, if that has not been done yet.  */
+
+static void
+make_line_index (struct buffer *b)
+{
+  struct buffer_text *t = b->text;
+  struct line_run run = { NULL, 0, 0 };
+
+  if (t->newlines >= 0)
+    return;
+  t->newlines = scan_lines (b, BUF_BEG_BYTE (b), BUF_Z_BYTE (b), &run);
+  add_line_checkpoints (b, &run, 0);
+}
+
+/* Return the number of newlines in B before byte position BYTEPOS.  */
+
+static ptrdiff_t
+lines_before (struct buffer *b, ptrdiff_t bytepos)
+{
+  struct buffer_text *t = b->text;
+  struct line_checkpoint below = { BUF_BEG_BYTE (b), 0 };
+  struct line_checkpoint above = { BUF_Z_BYTE (b), t->newlines };
+  struct line_run run = { NULL, 0, 0 };
+  ptrdiff_t n = line_checkpoint_rank (t, bytepos, 0), lines;
+
+  if (n > 0)
+    below = line_checkpoint_at (t, n - 1);
+  if (n < line_checkpoint_count (t))
+    above = line_checkpoint_at (t, n);
+
+  if (bytepos - below.bytepos <= above.bytepos - bytepos)
+    {
+      lines = below.lines + scan_lines (b, below.bytepos, bytepos, &run);
+      add_line_checkpoints (b, &run, below.lines);
+    }
+  else
+    {
+      lines = above.lines - scan_lines (b, bytepos, above.bytepos, &run);
+      add_line_checkpoints (b, &run, lines);
+    }
+  return lines;
+}
+
+/* Return the byte position in B just after its Nth newline, counting
+   from 1.  B must have that many newlines.  */
+
+static ptrdiff_t
+line_start_byte (struct buffer *b, ptrdiff_t n)
+{
+  struct buffer_text *t = b->text;
+  struct line_checkpoint below = { BUF_BEG_BYTE (b), 0 };
+  ptrdiff_t k = line_checkpoint_rank (t, n - 1, 1), above_byte;
+
+  if (k > 0)
+    below = line_checkpoint_at (t, k - 1);
+
+  /* If that line is in text not indexed yet, index it first.  */
+  above_byte = (k < line_checkpoint_count (t)
+		? line_checkpoint_at (t, k).bytepos : BUF_Z_BYTE (b));
+  if (above_byte - below.bytepos > 2 * LINE_CHECKPOINT_INTERVAL)
+    {
+      struct line_run run = { NULL, 0, 0 };
+
+      scan_lines (b, below.bytepos, above_byte, &run);
+      add_line_checkpoints (b, &run, below.lines);
+      k = line_checkpoint_rank (t, n - 1, 1);
+      if (k > 0)
+	below = line_checkpoint_at (t, k - 1);
+    }
+
+  return find_nth_newline (b, below.bytepos, n - below.lines);
+}
+
+/* Discard the line index of B.  */
+
+void
+clear_line_index (struct buffer *b)
+{
+  struct buffer_text *t = b->text;
+
+  xfree (t->line_checkpoints);
+  t->line_checkpoints = NULL;
+  t->line_checkpoints_size = 0;
+  t->line_checkpoints_gap = t->line_checkpoints_gap_end = 0;
+  t->newlines = -1;
+}
+
+/* Update the line checkpoints of B after the gap of its text
+   moved.  */
+
+void
+move_line_index_gap (struct buffer *b)
+{
+  struct buffer_text *t = b->text;
+  struct line_checkpoint *c = t->line_checkpoints;
+
+  while (t->line_checkpoints_gap > 0
+	 && c[t->line_checkpoints_gap - 1].bytepos > t->gpt_byte)
+    {
+      struct line_checkpoint *from = &c[--t->line_checkpoints_gap];
+      struct line_checkpoint *to = &c[--t->line_checkpoints_gap_end];
+
+      to->bytepos = from->bytepos - t->z_byte;
+      to->lines = from->lines - t->newlines;
+    }
+  while (t->line_checkpoints_gap_end < t->line_checkpoints_size
+	 && c[t->line_checkpoints_gap_end].bytepos + t->z_byte < t->gpt_byte)
+    {
+      struct line_checkpoint *from = &c[t->line_checkpoints_gap_end++];
+      struct line_checkpoint *to = &c[t->line_checkpoints_gap++];
+
+      to->bytepos = from->bytepos + t->z_byte;
+      to->lines = from->lines + t->newlines;
+    }
+}
+
+/* Discard the line checkpoints of B that were in text just deleted
+   at the gap.  */
+
+void
+trim_line_index (struct buffer *b)
+{
+  struct buffer_text *t = b->text;
+  struct line_checkpoint *c = t->line_checkpoints;
+
+  while (t->line_checkpoints_gap > 0
+	 && c[t->line_checkpoints_gap - 1].bytepos > t->gpt_byte)
+    t->line_checkpoints_gap--;
+  while (t->line_checkpoints_gap_end < t->line_checkpoints_size
+	 && c[t->line_checkpoints_gap_end].bytepos + t->z_byte < t->gpt_byte)
+    t->line_checkpoints_gap_end++;
+}
+
+/* Discard the line checkpoints of B strictly between FROM_BYTE and
+   TO_BYTE, after the text there was rearranged in place.  */
+
+void
+forget_line_checkpoints (struct buffer *b, ptrdiff_t from_byte,
+			 ptrdiff_t to_byte)
+{
+  struct buffer_text *t = b->text;
+  ptrdiff_t lo = line_checkpoint_rank (t, from_byte, 0);
+  ptrdiff_t hi = line_checkpoint_rank (t, to_byte - 1, 0);
+  ptrdiff_t n;
+
+  n = min (hi, t->line_checkpoints_gap) - lo;
+  if (n > 0)
+    {
+      memmove (t->line_checkpoints + lo, t->line_checkpoints + lo + n,
+	       (t->line_checkpoints_gap - lo - n)
+	       * sizeof *t->line_checkpoints);
+      t->line_checkpoints_gap -= n;
+      hi -= n;
+    }
+
+  lo = max (lo, t->line_checkpoints_gap);
+  n = hi - lo;
+  if (n > 0)
+    {
+      ptrdiff_t k = lo + t->line_checkpoints_gap_end - t->line_checkpoints_gap;
+
+      memmove (t->line_checkpoints + t->line_checkpoints_gap_end + n,
+	       t->line_checkpoints + t->line_checkpoints_gap_end,
+	       (k - t->line_checkpoints_gap_end)
+	       * sizeof *t->line_checkpoints);
+      t->line_checkpoints_gap_end += n;
+    }
+}
+
+/* Count the newlines of the text just inserted in B between FROM_BYTE
+   and TO_BYTE.  */
+
+void
+adjust_line_index_for_insert (struct buffer *b, ptrdiff_t from_byte,
+			      ptrdiff_t to_byte)
+{
+  if (b->text->newlines >= 0)
+    b->text->newlines += count_newlines_1 (b, from_byte, to_byte);
+}
+
+/* Uncount the newlines of the text in B between FROM_BYTE and TO_BYTE,
+   which is about to be deleted.  The gap must be in or next to it.  */
+
+void
+adjust_line_index_for_delete (struct buffer *b, ptrdiff_t from_byte,
+			      ptrdiff_t to_byte)
+{
+  if (b->text->newlines < 0)
+    return;
+  if (to_byte - from_byte <= 2 * LINE_CHECKPOINT_INTERVAL)
+    b->text->newlines -= count_newlines_1 (b, from_byte, to_byte);
+  else
+    b->text->newlines -= lines_before (b, to_byte) - lines_before (b, from_byte);
+}
+
+/* Return true if a search for COUNT newlines between START_BYTE and
+   END_BYTE in the current buffer had better use the line index.
+   Building the index means counting all the newlines of the buffer,
+   so only do that for a search that is likely to scan a good part of
+   it anyway.  */
+
+static bool
+use_line_index (ptrdiff_t start_byte, ptrdiff_t end_byte, ptrdiff_t count)
+{
+  ptrdiff_t distance = eabs (end_byte - start_byte);
+  ptrdiff_t guess = min (distance, eabs (count) < PTRDIFF_MAX / 64
+			 ? eabs (count) * 64 : PTRDIFF_MAX);
+
+  if (guess <= 4 * LINE_CHECKPOINT_INTERVAL)
+    return false;
+  if (current_buffer->text->newlines < 0
+      && guess < (Z_BYTE - BEG_BYTE) / 8)
+    return false;
+  make_line_index (current_buffer);
+  return true;
+}
+
+/* Return the number of newlines between START_BYTE and END_BYTE in
+   the current buffer, if a search for COUNT of them had better use
+   the line index.  Otherwise, return -1.  */
+
+ptrdiff_t
+count_newlines_indexed (ptrdiff_t start_byte, ptrdiff_t end_byte,
+			ptrdiff_t count)
+{
+  if (!use_line_index (start_byte, end_byte, count))
+    return -1;
+  return (lines_before (current_buffer, end_byte)
+	  - lines_before (current_buffer, start_byte));
+}
+
+
 /* Search for COUNT newlines between START/START_BYTE and END/END_BYTE.
 
    If COUNT is positive, search forwards; END must be >= START.
@@ -703,6 +1482,29 @@ find_newline (ptrdiff_t start, ptrdiff_t start_byte, ptrdiff_t end,
   if (shortage != 0)
     *shortage = 0;
 
+  if (start_byte == -1)
+    start_byte = CHAR_TO_BYTE (start);
+  if (use_line_index (start_byte, end_byte, count))
+    {
+      ptrdiff_t start_lines = lines_before (current_buffer, start_byte);
+      ptrdiff_t end_lines = lines_before (current_buffer, end_byte);
+      ptrdiff_t found = eabs (end_lines - start_lines), pos_byte;
+
+      if (found < eabs (count))
+	{
+	  if (shortage != 0)
+	    *shortage = eabs (count) - found;
+	  if (bytepos)
+	    *bytepos = end_byte;
+	  return end;
+	}
+      pos_byte = line_start_byte (current_buffer,
+				  start_lines + count + (count < 0));
+      if (bytepos)
+	*bytepos = pos_byte;
+      return BYTE_TO_CHAR (pos_byte);
+    }
+
   immediate_quit = allow_quit;
 
   if (count > 0)
@@ -801,8 +1603,15 @@ find_newline (ptrdiff_t start, ptrdiff_t start_byte, ptrdiff_t end,
 
 	  for (cursor = base; cursor < 0; cursor = next)
 	    {
+	      unsigned char *nl;
+
+	      /* Count short lines in bulk; caching the stretches
+		 between them would not pay.  */
+	      cursor += skip_lines_forward (lim_addr + cursor, - cursor,
+					    &count);
+
               /* The dumb loop.  */
-	      unsigned char *nl = memchr (lim_addr + cursor, '\n', - cursor);
+	      nl = memchr (lim_addr + cursor, '\n', - cursor);
 	      next = nl ? nl - lim_addr : 0;
 
               /* If we're using the newline cache, cache the fact that
@@ -911,7 +1720,11 @@ find_newline (ptrdiff_t start, ptrdiff_t start_byte, ptrdiff_t end,
 
 	  for (cursor = base; 0 < cursor; cursor = prev)
             {
-	      unsigned char *nl = memrchr (ceiling_addr, '\n', cursor);
+	      unsigned char *nl;
+
+	      cursor -= skip_lines_backward (ceiling_addr + cursor, cursor,
+					     &count);
+	      nl = memrchr (ceiling_addr, '\n', cursor);
 	      prev = nl ? nl - ceiling_addr : -1;
 
               /* If we're looking for newlines, cache the fact that
@@ -2290,6 +3103,511 @@ and `replace-match'.  */)
   return search_command (regexp, bound, noerror, count, 1, 1, 1);
 }
 
+/* Searching for any of a set of strings.
+
+   An Aho-Corasick automaton finds the occurrences of all the strings
+   in one pass over the text.  Its states are the prefixes of the
+   strings, and its transitions are complete, so each character of
+   the text costs one table lookup.  The characters that occur in no
+   string share one class, which keeps the table small.  The
+   automata of the last few lists of strings are kept, like compiled
+   regexps.  */
+
+struct string_matcher
+{
+  /* Number of states and of character classes.  State 0 is the empty
+     prefix, and class 0 holds the characters that are in no string.  */
+  int nstates, nclasses;
+
+  /* The class of each ASCII character of the text, after translation.  */
+  int ascii_class[128];
+
+  /* The non-ASCII characters of the strings, in increasing order, and
+     their classes.  */
+  int nchars;
+  int *chars, *char_class;
+
+  /* NEXT[S * NCLASSES + C] is the state after state S and a character
+     of class C.  */
+  int *next;
+
+  /* The number of characters of the prefix of each state.  */
+  int *depth;
+
+  /* For each state, the longest of its suffixes that is a whole
+     string, that state itself included, or -1 if there is none.  */
+  int *output;
+
+  /* For each state, the next shorter suffix of its output that is a
+     whole string, or -1.  */
+  int *output_link;
+
+  /* The number of characters of the longest string.  */
+  int max_depth;
+};
+
+#define STRING_MATCHER_CACHE_SIZE 8
+
+/* The automata that were used last, with the list of strings and the
+   translation table each was made from.  COPY holds copies of the
+   strings, to notice when they change.  */
+static struct
+{
+  Lisp_Object strings, copy, trt;
+  struct string_matcher *matcher;
+} string_matchers[STRING_MATCHER_CACHE_SIZE];
+
+/* Return the class of the non-ASCII character C in matcher M.  */
+
+static int
+string_matcher_char_class (struct string_matcher *m, int c)
+{
+  int lo = 0, hi = m->nchars;
+
+  while (lo < hi)
+    {
+      int mid = lo + (hi - lo) / 2;
+
+      if (m->chars[mid] < c)
+	lo = mid + 1;
+      else if (m->chars[mid] > c)
+	hi = mid;
+      else
+	return m->char_class[mid];
+    }
+  return 0;
+}
+
+static int
+compare_chars (const void *a, const void *b)
+{
+  int x = *(const int *) a, y = *(const int *) b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+free_string_matcher (struct string_matcher *m)
+{
+  if (m)
+    {
+      xfree (m->chars);
+      xfree (m->char_class);
+      xfree (m->next);
+      xfree (m->depth);
+      xfree (m->output);
+      xfree (m->output_link);
+      xfree (m);
+    }
+}
+
+/* Make the automaton for the list of STRINGS, whose characters are
+   translated by TRT.  Empty strings are ignored.  */
+
+static struct string_matcher *
+make_string_matcher (Lisp_Object strings, Lisp_Object trt)
+{
+  struct string_matcher *m = xzalloc (sizeof *m);
+  ptrdiff_t total = 0, n, i;
+  int *text, *queue, *fail;
+  int string_class[128];
+  Lisp_Object tail;
+  int s, c;
+
+  for (tail = strings; CONSP (tail); tail = XCDR (tail))
+    total += SCHARS (XCAR (tail));
+  if (total >= INT_MAX)
+    memory_full (SIZE_MAX);
+
+  /* The translated characters of all the strings, one after the
+     other, and the sorted non-ASCII ones.  */
+  text = xnmalloc (total + 1, sizeof *text);
+  m->chars = xnmalloc (total + 1, sizeof *m->chars);
+  n = 0;
+  for (tail = strings; CONSP (tail); tail = XCDR (tail))
+    {
+      Lisp_Object string = XCAR (tail);
+      ptrdiff_t charpos = 0, bytepos = 0;
+
+      while (charpos < SCHARS (string))
+	{
+	  if (STRING_MULTIBYTE (string))
+	    FETCH_STRING_CHAR_ADVANCE_NO_CHECK (c, string, charpos, bytepos);
+	  else
+	    {
+	      c = UNIBYTE_TO_CHAR (SREF (string, charpos));
+	      charpos++;
+	    }
+	  text[n++] = c = translate_char (trt, c);
+	  if (!ASCII_CHAR_P (c))
+	    m->chars[m->nchars++] = c;
+	}
+    }
+  qsort (m->chars, m->nchars, sizeof *m->chars, compare_chars);
+  for (i = n = 0; i < m->nchars; i++)
+    if (n == 0 || m->chars[n - 1] != m->chars[i])
+      m->chars[n++] = m->chars[i];
+  m->nchars = n;
+
+  /* Number the classes: the ASCII characters of the strings first.  */
+  m->nclasses = 1;
+  for (i = 0; i < total; i++)
+    if (ASCII_CHAR_P (text[i]) && !m->ascii_class[text[i]])
+      m->ascii_class[text[i]] = m->nclasses++;
+  m->char_class = xnmalloc (m->nchars + 1, sizeof *m->char_class);
+  for (i = 0; i < m->nchars; i++)
+    m->char_class[i] = m->nclasses++;
+  /* Classify the ASCII characters of the text by their translation.  */
+  memcpy (string_class, m->ascii_class, sizeof string_class);
+  for (c = 0; c < 128; c++)
+    {
+      int t = translate_char (trt, c);
+
+      m->ascii_class[c] = (ASCII_CHAR_P (t) ? string_class[t]
+			   : string_matcher_char_class (m, t));
+    }
+
+  /* Make the trie of the strings, with -1 for missing transitions.  */
+  if (m->nclasses > INT_MAX / (total + 1))
+    memory_full (SIZE_MAX);
+  m->next = xnmalloc ((total + 1) * m->nclasses, sizeof *m->next);
+  for (i = 0; i < (total + 1) * m->nclasses; i++)
+    m->next[i] = -1;
+  m->depth = xnmalloc (total + 1, sizeof *m->depth);
+  m->output = xnmalloc (total + 1, sizeof *m->output);
+  m->output_link = xnmalloc (total + 1, sizeof *m->output_link);
+  m->nstates = 1;
+  m->depth[0] = 0;
+  m->output[0] = -1;
+  n = 0;
+  for (tail = strings; CONSP (tail); tail = XCDR (tail))
+    {
+      ptrdiff_t end = n + SCHARS (XCAR (tail));
+
+      if (n == end)
+	continue;
+      for (s = 0; n < end; n++)
+	{
+	  int *t = &m->next[s * m->nclasses
+			    + (ASCII_CHAR_P (text[n]) ? string_class[text[n]]
+			       : string_matcher_char_class (m, text[n]))];
+
+	  if (*t < 0)
+	    {
+	      *t = m->nstates++;
+	      m->depth[*t] = m->depth[s] + 1;
+	      m->output[*t] = -1;
+	    }
+	  s = *t;
+	}
+      m->output[s] = s;
+      m->max_depth = max (m->max_depth, m->depth[s]);
+    }
+  xfree (text);
+
+  /* Complete the transitions breadth first, with the failure of each
+     state: the state of its longest proper suffix.  */
+  queue = xnmalloc (m->nstates, sizeof *queue);
+  fail = xnmalloc (m->nstates, sizeof *fail);
+  fail[0] = 0;
+  m->output_link[0] = -1;
+  queue[0] = 0;
+  for (i = 0, n = 1; i < n; i++)
+    {
+      int *next;
+
+      s = queue[i];
+      next = &m->next[s * m->nclasses];
+      for (c = 0; c < m->nclasses; c++)
+	{
+	  int f = s == 0 ? 0 : m->next[fail[s] * m->nclasses + c];
+
+	  if (next[c] < 0)
+	    next[c] = f;
+	  else
+	    {
+	      int t = next[c];
+
+	      fail[t] = f;
+	      if (m->output[t] < 0)
+		m->output[t] = m->output[f];
+	      m->output_link[t] = (m->output[t] == t ? m->output[f]
+				   : m->output_link[f]);
+	      queue[n++] = t;
+	    }
+	}
+    }
+  xfree (queue);
+  xfree (fail);
+  m->next = xrealloc (m->next,
+		      m->nstates * m->nclasses * sizeof *m->next);
+  return m;
+}
+
+/* Return the automaton for the list of STRINGS, whose characters are
+   translated by TRT.  */
+
+static struct string_matcher *
+get_string_matcher (Lisp_Object strings, Lisp_Object trt)
+{
+  int i;
+  Lisp_Object tail, copy;
+  struct string_matcher *m;
+
+  for (i = 0; i < STRING_MATCHER_CACHE_SIZE; i++)
+    if (EQ (string_matchers[i].strings, strings)
+	&& EQ (string_matchers[i].trt, trt)
+	&& string_matchers[i].matcher
+	&& !NILP (Fequal (string_matchers[i].copy, strings)))
+      break;
+  if (i == STRING_MATCHER_CACHE_SIZE)
+    {
+      copy = Qnil;
+      for (tail = strings; CONSP (tail); tail = XCDR (tail))
+	{
+	  CHECK_STRING (XCAR (tail));
+	  copy = Fcons (Fcopy_sequence (XCAR (tail)), copy);
+	}
+      CHECK_TYPE (NILP (tail), Qlistp, strings);
+      i = STRING_MATCHER_CACHE_SIZE - 1;
+      free_string_matcher (string_matchers[i].matcher);
+      string_matchers[i].matcher = NULL;
+      string_matchers[i].strings = string_matchers[i].copy = Qnil;
+      string_matchers[i].matcher = make_string_matcher (strings, trt);
+      string_matchers[i].strings = strings;
+      string_matchers[i].copy = Fnreverse (copy);
+      string_matchers[i].trt = trt;
+    }
+
+  /* Move the entry to the front, so the least recently used one is
+     last.  */
+  m = string_matchers[i].matcher;
+  copy = string_matchers[i].copy;
+  for (; i > 0; i--)
+    string_matchers[i] = string_matchers[i - 1];
+  string_matchers[0].strings = strings;
+  string_matchers[0].copy = copy;
+  string_matchers[0].trt = trt;
+  string_matchers[0].matcher = m;
+  return m;
+}
+
+/* Store in *C the character at POS, POS_BYTE, and return true if it
+   is a word constituent, or if SYMBOLS, a word or symbol constituent.  */
+
+static bool
+constituent_at (ptrdiff_t pos, ptrdiff_t pos_byte, bool symbols, int *c)
+{
+  enum syntaxcode code;
+
+  UPDATE_SYNTAX_TABLE (pos - gl_state.offset);
+  *c = FETCH_CHAR_AS_MULTIBYTE (pos_byte);
+  code = SYNTAX (*c);
+  return code == Sword || (symbols && code == Ssymbol);
+}
+
+/* Return true if the text from BEG to END is a whole word, or if
+   SYMBOLS, a whole symbol, as `\<' and `\>', or `\_<' and `\_>',
+   would find it.  */
+
+static bool
+whole_word_p (ptrdiff_t beg, ptrdiff_t beg_byte,
+	      ptrdiff_t end, ptrdiff_t end_byte, bool symbols)
+{
+  int c1, c2;
+
+  if (!constituent_at (beg, beg_byte, symbols, &c2))
+    return false;
+  if (beg > BEGV)
+    {
+      DEC_BOTH (beg, beg_byte);
+      if (constituent_at (beg, beg_byte, symbols, &c1)
+	  && (symbols || !WORD_BOUNDARY_P (c1, c2)))
+	return false;
+    }
+  DEC_BOTH (end, end_byte);
+  if (!constituent_at (end, end_byte, symbols, &c1))
+    return false;
+  if (end + 1 < ZV)
+    {
+      INC_BOTH (end, end_byte);
+      if (constituent_at (end, end_byte, symbols, &c2)
+	  && (symbols || !WORD_BOUNDARY_P (c1, c2)))
+	return false;
+    }
+  return true;
+}
+
+/* Look for the first occurrence of a string of matcher M from POS,
+   POS_BYTE to LIM_BYTE in the current buffer; if several start there, take the
+   longest.  If DELIMITED is `words' or `symbols', consider only
+   occurrences that are whole words or symbols.  TRT is the
+   translation table of M.  Store the bounds of the occurrence in
+   *BEG and *END, as character and byte positions, and return true if
+   there is one.  */
+
+static bool
+search_strings (struct string_matcher *m, Lisp_Object trt,
+		Lisp_Object delimited,
+		ptrdiff_t pos, ptrdiff_t pos_byte, ptrdiff_t lim_byte,
+		ptrdiff_t beg[2], ptrdiff_t end[2])
+{
+  bool multibyte = !NILP (BVAR (current_buffer, enable_multibyte_characters));
+  bool words = EQ (delimited, Qwords), symbols = EQ (delimited, Qsymbols);
+  /* The byte positions of the last MAX_DEPTH + 1 characters, so that
+     an occurrence that ends here can tell where it starts.  */
+  USE_SAFE_ALLOCA;
+  ptrdiff_t *bytes;
+  ptrdiff_t nbytes = m->max_depth + 1;
+  int s = 0;
+  bool found = false;
+
+  SAFE_NALLOCA (bytes, 1, nbytes);
+  if (words || symbols)
+    /* The syntax table functions count positions from BEGV.  */
+    SETUP_SYNTAX_TABLE_FOR_OBJECT (Qnil, pos - BEGV + 1, 1);
+  immediate_quit = 1;
+  while (pos_byte < lim_byte)
+    {
+      /* Scan the text up to LIM or the gap, whichever comes first.  */
+      ptrdiff_t seg_end = (pos_byte < GPT_BYTE && GPT_BYTE < lim_byte
+			   ? GPT_BYTE : lim_byte);
+      unsigned char *p = BYTE_POS_ADDR (pos_byte);
+
+      while (pos_byte < seg_end)
+	{
+	  int c = *p, len = 1, o;
+
+	  bytes[pos % nbytes] = pos_byte;
+	  if (ASCII_CHAR_P (c))
+	    c = m->ascii_class[c];
+	  else
+	    {
+	      if (multibyte)
+		c = STRING_CHAR_AND_LENGTH (p, len);
+	      else
+		c = BYTE8_TO_CHAR (c);
+	      c = string_matcher_char_class (m, translate_char (trt, c));
+	    }
+	  s = m->next[s * m->nclasses + c];
+	  p += len;
+	  pos++;
+	  pos_byte += len;
+
+	  for (o = m->output[s]; o >= 0; o = m->output_link[o])
+	    {
+	      ptrdiff_t start = pos - m->depth[o];
+
+	      if (found && (start > beg[0]
+			    || (start == beg[0] && pos <= end[0])))
+		continue;
+	      if (words || symbols)
+		{
+		  if (!whole_word_p (start, bytes[start % nbytes],
+				     pos, pos_byte, symbols))
+		    continue;
+		  /* That can have relocated the text.  */
+		  p = BYTE_POS_ADDR (pos_byte);
+		}
+	      beg[0] = start;
+	      beg[1] = bytes[start % nbytes];
+	      end[0] = pos;
+	      end[1] = pos_byte;
+	      found = true;
+	    }
+
+	  /* Stop when no occurrence can start at the one found.  */
+	  if (found && pos - m->depth[s] > beg[0])
+	    goto done;
+	}
+    }
+ done:
+  immediate_quit = 0;
+  SAFE_FREE ();
+  return found;
+}
+
+DEFUN ("search-forward-strings", Fsearch_forward_strings,
+       Ssearch_forward_strings, 1, 4, 0,
+       doc: /* Search forward from point for any of the strings in STRINGS.
+STRINGS is a list of strings; empty strings in it are ignored.
+Among the occurrences of the strings, find the one that starts first,
+and if several start there, the longest one.  Set point to its end,
+and return point.  The match data describes the whole occurrence.
+
+An optional second argument bounds the search; it is a buffer position.
+The occurrence found must not extend after that position.
+Optional third argument, if t, means if fail just return nil (no error).
+  If not nil and not t, move to limit of search and return nil.
+Optional fourth argument DELIMITED, if `words', means consider only
+occurrences that are whole words, like the regexp that `regexp-opt'
+makes with `words'; if `symbols', only whole symbols.
+
+This is faster than searching for the regexp that matches any of
+STRINGS, especially when there are many of them.  The search is
+case-insensitive if `case-fold-search' is non-nil.  */)
+  (Lisp_Object strings, Lisp_Object bound, Lisp_Object noerror,
+   Lisp_Object delimited)
+{
+  ptrdiff_t lim, lim_byte, beg[2], end[2];
+  Lisp_Object trt = (!NILP (BVAR (current_buffer, case_fold_search))
+		     ? BVAR (current_buffer, case_canon_table) : Qnil);
+  struct string_matcher *m = get_string_matcher (strings, trt);
+
+  if (NILP (bound))
+    lim = ZV, lim_byte = ZV_BYTE;
+  else
+    {
+      CHECK_NUMBER_COERCE_MARKER (bound);
+      lim = XINT (bound);
+      if (lim < PT)
+	error ("Invalid search bound (wrong side of point)");
+      if (lim > ZV)
+	lim = ZV, lim_byte = ZV_BYTE;
+      else
+	lim_byte = CHAR_TO_BYTE (lim);
+    }
+
+  if (!search_strings (m, trt, delimited, PT, PT_BYTE, lim_byte, beg, end))
+    {
+      if (NILP (noerror))
+	xsignal1 (Qsearch_failed, strings);
+      if (!EQ (noerror, Qt))
+	SET_PT_BOTH (lim, lim_byte);
+      return Qnil;
+    }
+
+  set_search_regs (beg[1], end[1] - beg[1]);
+  SET_PT_BOTH (end[0], end[1]);
+  return make_number (end[0]);
+}
+
+DEFUN ("search-strings-in-region", Fsearch_strings_in_region,
+       Ssearch_strings_in_region, 3, 4, 0,
+       doc: /* Return the occurrences of STRINGS between START and END.
+The value is a list of conses (BEG . END), in the order of the text,
+of the occurrences that `search-forward-strings' would find one after
+the other; STRINGS and DELIMITED are as for that function.  This
+neither moves point nor changes the match data.  */)
+  (Lisp_Object strings, Lisp_Object start, Lisp_Object end,
+   Lisp_Object delimited)
+{
+  ptrdiff_t pos, pos_byte, lim_byte, b[2], e[2];
+  Lisp_Object trt = (!NILP (BVAR (current_buffer, case_fold_search))
+		     ? BVAR (current_buffer, case_canon_table) : Qnil);
+  struct string_matcher *m = get_string_matcher (strings, trt);
+  Lisp_Object result = Qnil;
+
+  validate_region (&start, &end);
+  pos = XINT (start), pos_byte = CHAR_TO_BYTE (pos);
+  lim_byte = CHAR_TO_BYTE (XINT (end));
+  while (search_strings (m, trt, delimited, pos, pos_byte, lim_byte, b, e))
+    {
+      result = Fcons (Fcons (make_number (b[0]), make_number (e[0])), result);
+      pos = e[0], pos_byte = e[1];
+    }
+  return Fnreverse (result);
+}
+
 DEFUN ("replace-match", Freplace_match, Sreplace_match, 1, 5, 0,
        doc: /* Replace text matched by last search with NEWTEXT.
 Leave point at the end of the replacement text.
@@ -3296,23 +4614,21 @@ syms_of_search (void)
 {
   register int i;
 
-  for (i = 0; i < REGEXP_CACHE_SIZE; ++i)
+
+  for (i = 0; i < STRING_MATCHER_CACHE_SIZE; i++)
     {
-      searchbufs[i].buf.allocated = 100;
-      searchbufs[i].buf.buffer = xmalloc (100);
-      searchbufs[i].buf.fastmap = searchbufs[i].fastmap;
-      searchbufs[i].regexp = Qnil;
-      searchbufs[i].whitespace_regexp = Qnil;
-      searchbufs[i].syntax_table = Qnil;
-      staticpro (&searchbufs[i].regexp);
-      staticpro (&searchbufs[i].whitespace_regexp);
-      staticpro (&searchbufs[i].syntax_table);
-      searchbufs[i].next = (i == REGEXP_CACHE_SIZE-1 ? 0 : &searchbufs[i+1]);
+      string_matchers[i].strings = Qnil;
+      string_matchers[i].copy = Qnil;
+      string_matchers[i].trt = Qnil;
+      staticpro (&string_matchers[i].strings);
+      staticpro (&string_matchers[i].copy);
+      staticpro (&string_matchers[i].trt);
     }
-  searchbuf_head = &searchbufs[0];
 
   DEFSYM (Qsearch_failed, "search-failed");
   DEFSYM (Qinvalid_regexp, "invalid-regexp");
+  DEFSYM (Qwords, "words");
+  DEFSYM (Qsymbols, "symbols");
 
   Fput (Qsearch_failed, Qerror_conditions,
 	listn (CONSTYPE_PURE, 2, Qsearch_failed, Qerror));
@@ -3338,6 +4654,15 @@ or other such regexp constructs are not replaced with this.
 A value of nil (which is the normal value) means treat spaces literally.  */);
   Vsearch_spaces_regexp = Qnil;
 
+  DEFVAR_INT ("regexp-cache-size", regexp_cache_size,
+      doc: /* Maximum number of compiled regexps to keep for reuse.
+Searching and matching functions compile each regexp they are given,
+unless it is among the ones they compiled last.  A larger value saves
+compiling again the regexps that a program cycles through, at the
+cost of memory.  See also `regexp-cache-counts'.  */);
+  regexp_cache_size = 100;
+  resize_regexp_cache ();
+
   DEFVAR_LISP ("inhibit-changing-match-data", Vinhibit_changing_match_data,
       doc: /* Internal use only.
 If non-nil, the primitive searching and matching functions
@@ -3356,11 +4681,14 @@ is to bind it with `let' around a small expression.  */);
   defsubr (&Sre_search_backward);
   defsubr (&Sposix_search_forward);
   defsubr (&Sposix_search_backward);
+  defsubr (&Ssearch_forward_strings);
+  defsubr (&Ssearch_strings_in_region);
   defsubr (&Sreplace_match);
   defsubr (&Smatch_beginning);
   defsubr (&Smatch_end);
   defsubr (&Smatch_data);
   defsubr (&Sset_match_data);
   defsubr (&Sregexp_quote);
+  defsubr (&Sregexp_cache_counts);
   defsubr (&Snewline_cache_check);
 }
@@ -60,6 +60,8 @@ Lisp_Object Qinvisible, Qintangible, Qmouse_face;
 static Lisp_Object Qread_only;
 Lisp_Object Qminibuffer_prompt;
 
+static Lisp_Object Qput_text_properties_bulk;
+
 enum property_set_type
 {
   TEXT_PROPERTY_REPLACE,
@@ -844,7 +846,13 @@ past position LIMIT; return LIMIT if nothing is found before LIMIT.  */)
       else
 	while (1)
 	  {
-	    position = Fnext_char_property_change (position, limit);
+	    /* Only overlays and PROP's text property can change the
+	       value.  */
+	    Lisp_Object temp = Fnext_overlay_change (position);
+	    if (XINT (limit) < XINT (temp))
+	      temp = limit;
+	    position = Fnext_single_property_change (position, prop,
+						     object, temp);
 	    if (XFASTINT (position) >= XFASTINT (limit))
 	      {
 		position = limit;
@@ -930,7 +938,11 @@ position LIMIT; return LIMIT if nothing is found before reaching LIMIT.  */)
 
 	  while (1)
 	    {
-	      position = Fprevious_char_property_change (position, limit);
+	      Lisp_Object temp = Fprevious_overlay_change (position);
+	      if (XINT (limit) > XINT (temp))
+		temp = limit;
+	      position = Fprevious_single_property_change (position, prop,
+							   object, temp);
 
 	      if (XFASTINT (position) <= XFASTINT (limit))
 		{
@@ -1037,6 +1049,7 @@ past position LIMIT; return LIMIT if nothing is found before LIMIT.  */)
 {
   register INTERVAL i, next;
   register Lisp_Object here_val;
+  unsigned int bits;
 
   if (NILP (object))
     XSETBUFFER (object, current_buffer);
@@ -1049,11 +1062,15 @@ past position LIMIT; return LIMIT if nothing is found before LIMIT.  */)
     return limit;
 
   here_val = textget (i->plist, prop);
-  next = next_interval (i);
+  /* Text without any of these bits has PROP's default value, so if
+     that's what we have here, it can't contain the change.  */
+  bits = (EQ (here_val, textget (Qnil, prop))
+	  ? property_search_bits (prop) : 0);
+  next = next_interval_with_bits (i, bits);
   while (next
 	 && EQ (here_val, textget (next->plist, prop))
 	 && (NILP (limit) || next->position < XFASTINT (limit)))
-    next = next_interval (next);
+    next = next_interval_with_bits (next, bits);
 
   if (!next
       || (next->position
@@ -1132,6 +1149,7 @@ back past position LIMIT; return LIMIT if nothing is found until LIMIT.  */)
 {
   register INTERVAL i, previous;
   register Lisp_Object here_val;
+  unsigned int bits;
 
   if (NILP (object))
     XSETBUFFER (object, current_buffer);
@@ -1149,12 +1167,14 @@ back past position LIMIT; return LIMIT if nothing is found until LIMIT.  */)
     return limit;
 
   here_val = textget (i->plist, prop);
-  previous = previous_interval (i);
+  bits = (EQ (here_val, textget (Qnil, prop))
+	  ? property_search_bits (prop) : 0);
+  previous = previous_interval_with_bits (i, bits);
   while (previous
 	 && EQ (here_val, textget (previous->plist, prop))
 	 && (NILP (limit)
 	     || (previous->position + LENGTH (previous) > XFASTINT (limit))))
-    previous = previous_interval (previous);
+    previous = previous_interval_with_bits (previous, bits);
 
   if (!previous
       || (previous->position + LENGTH (previous)
@@ -1324,6 +1344,235 @@ markers).  If OBJECT is a string, START and END are 0-based indices into it.  */
   return Qnil;
 }
 
+/* Check the N runs of the vector RUNS for `put-text-properties-bulk',
+   storing the start and end of each run, in order, in POS.  Return
+   the extent of all the runs in *STARTP and *ENDP.  */
+
+static void
+validate_property_runs (Lisp_Object runs, Lisp_Object object, ptrdiff_t *pos,
+			ptrdiff_t *startp, ptrdiff_t *endp)
+{
+  ptrdiff_t i, n = ASIZE (runs);
+  ptrdiff_t lo = (BUFFERP (object) ? BUF_BEGV (XBUFFER (object)) : 0);
+  ptrdiff_t hi = (BUFFERP (object) ? BUF_ZV (XBUFFER (object))
+		  : SCHARS (object));
+
+  *startp = hi;
+  *endp = lo;
+  for (i = 0; i < n; i++)
+    {
+      Lisp_Object run = AREF (runs, i);
+      Lisp_Object beg, end;
+
+      CHECK_LIST (run);
+      if (XINT (Flength (run)) != 4)
+	wrong_type_argument (Qlistp, run);
+      beg = XCAR (run);
+      end = XCAR (XCDR (run));
+      if (BUFFERP (object))
+	{
+	  CHECK_NUMBER_COERCE_MARKER (beg);
+	  CHECK_NUMBER_COERCE_MARKER (end);
+	}
+      else
+	{
+	  CHECK_NUMBER (beg);
+	  CHECK_NUMBER (end);
+	}
+      if (XINT (beg) > XINT (end))
+	{
+	  Lisp_Object tem = beg;
+	  beg = end;
+	  end = tem;
+	}
+      if (XINT (beg) < lo || XINT (end) > hi)
+	args_out_of_range (beg, end);
+      pos[2 * i] = XINT (beg);
+      pos[2 * i + 1] = XINT (end);
+      if (pos[2 * i] < pos[2 * i + 1])
+	{
+	  *startp = min (*startp, pos[2 * i]);
+	  *endp = max (*endp, pos[2 * i + 1]);
+	}
+    }
+}
+
+/* Return true if all the text of OBJECT from S to E already has the
+   properties of PLIST.  */
+
+static bool
+run_has_all_properties (Lisp_Object object, ptrdiff_t s, ptrdiff_t e,
+			Lisp_Object plist)
+{
+  INTERVAL i = (BUFFERP (object) ? buffer_intervals (XBUFFER (object))
+		: string_intervals (object));
+
+  if (s == e)
+    return 1;
+  if (!i)
+    return 0;
+  for (i = find_interval (i, s); i && i->position < e; i = next_interval (i))
+    if (! interval_has_all_properties (plist, i))
+      return 0;
+  return 1;
+}
+
+/* Give the text of OBJECT from S to E the value VAL for PROP, without
+   running any hooks.  Unless UNDO is null, push a (BEG END PROP VAL)
+   run onto *UNDO for each piece of text whose old value changed.
+   Return true if anything changed.  */
+
+static bool
+put_property_run (Lisp_Object object, ptrdiff_t s, ptrdiff_t e,
+		  Lisp_Object prop, Lisp_Object val, Lisp_Object *undo)
+{
+  INTERVAL i = (BUFFERP (object) ? buffer_intervals (XBUFFER (object))
+		: string_intervals (object));
+  Lisp_Object plist = list2 (prop, val);
+  bool changed = 0;
+  struct gcpro gcpro1;
+
+  if (s == e)
+    return 0;
+  if (!i)
+    i = create_root_interval (object);
+  GCPRO1 (plist);
+
+  for (i = find_interval (i, s); s < e; i = next_interval (i))
+    {
+      INTERVAL unchanged;
+      Lisp_Object tail;
+
+      eassert (i);
+      if (interval_has_all_properties (plist, i))
+	{
+	  s = i->position + LENGTH (i);
+	  continue;
+	}
+      if (i->position < s)
+	{
+	  unchanged = i;
+	  i = split_interval_right (unchanged, s - unchanged->position);
+	  copy_properties (unchanged, i);
+	}
+      if (i->position + LENGTH (i) > e)
+	{
+	  unchanged = i;
+	  i = split_interval_left (unchanged, e - s);
+	  copy_properties (unchanged, i);
+	}
+
+      for (tail = i->plist; CONSP (tail); tail = Fcdr (XCDR (tail)))
+	if (EQ (XCAR (tail), prop))
+	  break;
+      if (undo)
+	*undo = Fcons (list4 (make_number (i->position),
+			      make_number (i->position + LENGTH (i)),
+			      prop, CONSP (tail) ? Fcar (XCDR (tail)) : Qnil),
+		       *undo);
+      if (CONSP (tail))
+	Fsetcar (XCDR (tail), val);
+      else
+	set_interval_plist (i, Fcons (prop, Fcons (val, i->plist)));
+      changed = 1;
+      s = i->position + LENGTH (i);
+    }
+
+  UNGCPRO;
+  return changed;
+}
+
+/* Callers note, this can GC when OBJECT is a buffer (or nil).  */
+
+DEFUN ("put-text-properties-bulk", Fput_text_properties_bulk,
+       Sput_text_properties_bulk, 1, 2, 0,
+       doc: /* Set properties of many runs of text at once.
+RUNS is a vector of lists (START END PROPERTY VALUE), each saying to
+give the text from START to END the value VALUE for PROPERTY, as
+`put-text-property' would.  The runs are applied in order, so a later
+run overrides an earlier one where they overlap.
+If the optional second argument OBJECT is a buffer (or nil, which means
+the current buffer), START and END are buffer positions (integers or
+markers).  If OBJECT is a string, START and END are 0-based indices into it.
+
+In a buffer, this runs the change hooks just once, over the text from
+the first to the last run, and records the old values of all the runs
+as a single undo entry.  Return t if any property value actually
+changed, nil otherwise.  */)
+  (Lisp_Object runs, Lisp_Object object)
+{
+  ptrdiff_t i, n, start, end, *pos;
+  Lisp_Object undo = Qnil, *undop = NULL;
+  bool changed = 0;
+  ptrdiff_t count = SPECPDL_INDEX ();
+  struct gcpro gcpro1, gcpro2, gcpro3;
+  USE_SAFE_ALLOCA;
+
+  CHECK_VECTOR (runs);
+  if (NILP (object))
+    XSETBUFFER (object, current_buffer);
+  CHECK_STRING_OR_BUFFER (object);
+  if (BUFFERP (object) && !BUFFER_LIVE_P (XBUFFER (object)))
+    return Qnil;
+
+  n = ASIZE (runs);
+  SAFE_NALLOCA (pos, 2, n);
+  validate_property_runs (runs, object, pos, &start, &end);
+
+  /* Do nothing, and run no hooks, if the text already has all the
+     properties.  */
+  for (i = 0; i < n; i++)
+    {
+      Lisp_Object run = AREF (runs, i);
+
+      if (! run_has_all_properties (object, pos[2 * i], pos[2 * i + 1],
+				    Fcdr (XCDR (run))))
+	break;
+    }
+  if (i == n)
+    {
+      SAFE_FREE ();
+      return Qnil;
+    }
+
+  GCPRO3 (runs, object, undo);
+
+  if (BUFFERP (object))
+    {
+      record_unwind_current_buffer ();
+      set_buffer_internal (XBUFFER (object));
+      modify_text_properties (object, make_number (start), make_number (end));
+      /* The change hooks might have changed the text.  */
+      validate_property_runs (runs, object, pos, &start, &end);
+      if (! EQ (BVAR (current_buffer, undo_list), Qt))
+	undop = &undo;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      Lisp_Object run = AREF (runs, i);
+
+      changed |= put_property_run (object, pos[2 * i], pos[2 * i + 1],
+				   XCAR (XCDR (XCDR (run))),
+				   XCAR (XCDR (XCDR (XCDR (run)))), undop);
+    }
+
+  if (BUFFERP (object))
+    {
+      /* Undoing the change restores the old values, last run first.  */
+      if (!NILP (undo))
+	record_undo_function (start, Qput_text_properties_bulk,
+			      list1 (Fvconcat (1, &undo)));
+      if (start < end)
+	signal_after_change (start, end - start, end - start);
+    }
+
+  UNGCPRO;
+  SAFE_FREE ();
+  unbind_to (count, Qnil);
+  return changed ? Qt : Qnil;
+}
+
 DEFUN ("set-text-properties", Fset_text_properties,
        Sset_text_properties, 3, 4, 0,
        doc: /* Completely replace properties of text from START to END.
@@ -1773,6 +2022,7 @@ markers).  If OBJECT is a string, START and END are 0-based indices into it.  */
 {
   register INTERVAL i;
   register ptrdiff_t e, pos;
+  unsigned int bits;
 
   if (NILP (object))
     XSETBUFFER (object, current_buffer);
@@ -1780,6 +2030,10 @@ markers).  If OBJECT is a string, START and END are 0-based indices into it.  */
   if (!i)
     return (!NILP (value) || EQ (start, end) ? Qnil : start);
   e = XINT (end);
+  /* Text without any of these bits can't have VALUE, unless that is
+     the default value.  */
+  bits = (EQ (textget (Qnil, property), value)
+	  ? 0 : property_search_bits (property));
 
   while (i)
     {
@@ -1792,7 +2046,7 @@ markers).  If OBJECT is a string, START and END are 0-based indices into it.  */
 	    pos = XINT (start);
 	  return make_number (pos);
 	}
-      i = next_interval (i);
+      i = next_interval_with_bits (i, bits);
     }
   return Qnil;
 }
@@ -1809,6 +2063,7 @@ markers).  If OBJECT is a string, START and END are 0-based indices into it.  */
 {
   register INTERVAL i;
   register ptrdiff_t s, e;
+  unsigned int bits;
 
   if (NILP (object))
     XSETBUFFER (object, current_buffer);
@@ -1817,6 +2072,8 @@ markers).  If OBJECT is a string, START and END are 0-based indices into it.  */
     return (NILP (value) || EQ (start, end)) ? Qnil : start;
   s = XINT (start);
   e = XINT (end);
+  bits = (EQ (textget (Qnil, property), value)
+	  ? property_search_bits (property) : 0);
 
   while (i)
     {
@@ -1828,7 +2085,7 @@ markers).  If OBJECT is a string, START and END are 0-based indices into it.  */
 	    s = i->position;
 	  return make_number (s);
 	}
-      i = next_interval (i);
+      i = next_interval_with_bits (i, bits);
     }
   return Qnil;
 }
@@ -2400,6 +2657,7 @@ inherits it if NONSTICKINESS is nil.  The `front-sticky' and
   DEFSYM (Qmouse_entered, "mouse-entered");
   DEFSYM (Qpoint_left, "point-left");
   DEFSYM (Qpoint_entered, "point-entered");
+  DEFSYM (Qput_text_properties_bulk, "put-text-properties-bulk");
 
   defsubr (&Stext_properties_at);
   defsubr (&Sget_text_property);
@@ -2415,6 +2673,7 @@ inherits it if NONSTICKINESS is nil.  The `front-sticky' and
   defsubr (&Sprevious_single_property_change);
   defsubr (&Sadd_text_properties);
   defsubr (&Sput_text_property);
+  defsubr (&Sput_text_properties_bulk);
   defsubr (&Sset_text_properties);
   defsubr (&Sadd_face_text_property);
   defsubr (&Sremove_text_properties);
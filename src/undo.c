@@ -40,6 +40,10 @@ Lisp_Object Qinhibit_read_only;
 
 Lisp_Object Qapply;
 
+/* The function that undoes a packed undo group.  */
+
+static Lisp_Object Qundo_packed_changes;
+
 /* The first time a command records something for undo.
    it also allocates the undo-boundary object
    which will be added to the list at the end of the command.
@@ -140,6 +144,7 @@ record_marker_adjustments (ptrdiff_t from, ptrdiff_t to)
   Lisp_Object marker;
   register struct Lisp_Marker *m;
   register ptrdiff_t charpos, adjustment;
+  int type;
 
   /* Allocate a cons cell to be the undo boundary after this command.  */
   if (NILP (pending_boundary))
@@ -149,12 +154,10 @@ record_marker_adjustments (ptrdiff_t from, ptrdiff_t to)
     Fundo_boundary ();
   last_undo_buffer = current_buffer;
 
-  for (m = BUF_MARKERS (current_buffer); m; m = m->next)
-    {
-      charpos = m->charpos;
-      eassert (charpos <= Z);
-
-      if (from <= charpos && charpos <= to)
+  for (type = 0; type < 2; type++)
+    for (m = marker_tree_first (current_buffer, type, from);
+	 m && (charpos = marker_charpos (m)) <= to;
+	 m = marker_tree_next (m))
         {
           /* insertion_type nil markers will end up at the beginning of
              the re-inserted text after undoing a deletion, and must be
@@ -174,7 +177,6 @@ record_marker_adjustments (ptrdiff_t from, ptrdiff_t to)
                         BVAR (current_buffer, undo_list)));
             }
         }
-    }
 }
 
 /* Record that a deletion is about to take place, of the characters in
@@ -222,6 +224,22 @@ record_change (ptrdiff_t beg, ptrdiff_t length)
   record_insert (beg, length);
 }
 
+/* Record that a change starting at BEG is about to take place, which
+   calling FUNCTION with ARGS undoes.  */
+
+void
+record_undo_function (ptrdiff_t beg, Lisp_Object function, Lisp_Object args)
+{
+  if (EQ (BVAR (current_buffer, undo_list), Qt))
+    return;
+
+  record_point (beg);
+
+  bset_undo_list (current_buffer,
+		  Fcons (Fcons (Qapply, Fcons (function, args)),
+			 BVAR (current_buffer, undo_list)));
+}
+
 /* Record that an unmodified buffer is about to be changed.
    Record the file modification date so that when undoing this entry
    we can tell whether it is obsolete because the file was saved again.  */
@@ -317,6 +335,343 @@ but another undo command will undo to the previous boundary.  */)
   return Qnil;
 }
 
+/* Packed undo groups.
+
+   After a command, a change group with many entries is replaced by a
+   single entry (apply undo-packed-changes DATA OBJECTS).  DATA is a
+   unibyte string holding one record per entry, newest first: a tag
+   byte followed by variable-length integers, with positions stored as
+   differences from the previous one.  The text of deletions without
+   text properties is stored inline.  OBJECTS is a vector (or nil) of
+   the Lisp objects the records refer to: markers of marker
+   adjustments, and any entry that has no compact form.  */
+
+enum undo_pack_tag
+  {
+    UNDO_PACK_POINT,		/* POSITION */
+    UNDO_PACK_INSERT,		/* (BEG . END) */
+    UNDO_PACK_DELETE,		/* (TEXT . POSITION) */
+    UNDO_PACK_MARKER,		/* (MARKER . ADJUSTMENT) */
+    UNDO_PACK_OBJECT,		/* Any other entry, as is.  */
+    UNDO_PACK_KIND = 0x0f,
+
+    /* Flags for UNDO_PACK_DELETE.  */
+    UNDO_PACK_MULTIBYTE = 0x10,
+    UNDO_PACK_AT_END = 0x20	/* POSITION is negative.  */
+  };
+
+struct undo_packer
+{
+  /* Where to store the records, or NULL to just count their size.  */
+  unsigned char *data;
+  ptrdiff_t nbytes;
+
+  /* Where to store the objects, or nil.  */
+  Lisp_Object objects;
+  ptrdiff_t nobjects;
+};
+
+static void
+pack_byte (struct undo_packer *pk, int c)
+{
+  if (pk->data)
+    pk->data[pk->nbytes] = c;
+  pk->nbytes++;
+}
+
+static void
+pack_uint (struct undo_packer *pk, EMACS_UINT u)
+{
+  for (; u >= 0x80; u >>= 7)
+    pack_byte (pk, (u & 0x7f) | 0x80);
+  pack_byte (pk, u);
+}
+
+static void
+pack_int (struct undo_packer *pk, EMACS_INT i)
+{
+  pack_uint (pk, (i < 0
+		  ? ((EMACS_UINT) -(i + 1) << 1) | 1
+		  : (EMACS_UINT) i << 1));
+}
+
+static void
+pack_object (struct undo_packer *pk, Lisp_Object obj)
+{
+  if (!NILP (pk->objects))
+    ASET (pk->objects, pk->nobjects, obj);
+  pk->nobjects++;
+}
+
+/* Pack the entries of LIST up to the first undo boundary.  */
+
+static void
+pack_undo_records (struct undo_packer *pk, Lisp_Object list)
+{
+  EMACS_INT last = 0;
+
+  for (; CONSP (list) && !NILP (XCAR (list)); list = XCDR (list))
+    {
+      Lisp_Object elt = XCAR (list);
+
+      if (INTEGERP (elt))
+	{
+	  pack_byte (pk, UNDO_PACK_POINT);
+	  pack_int (pk, XINT (elt) - last);
+	  last = XINT (elt);
+	  continue;
+	}
+
+      if (CONSP (elt) && INTEGERP (XCDR (elt)))
+	{
+	  Lisp_Object car = XCAR (elt);
+	  EMACS_INT pos = XINT (XCDR (elt));
+
+	  if (INTEGERP (car) && XINT (car) <= pos)
+	    {
+	      pack_byte (pk, UNDO_PACK_INSERT);
+	      pack_int (pk, XINT (car) - last);
+	      pack_uint (pk, pos - XINT (car));
+	      last = XINT (car);
+	      continue;
+	    }
+
+	  if (STRINGP (car) && !string_intervals (car))
+	    {
+	      int tag = UNDO_PACK_DELETE;
+
+	      if (STRING_MULTIBYTE (car))
+		tag |= UNDO_PACK_MULTIBYTE;
+	      if (pos < 0)
+		{
+		  tag |= UNDO_PACK_AT_END;
+		  pos = -pos;
+		}
+	      pack_byte (pk, tag);
+	      pack_int (pk, pos - last);
+	      pack_uint (pk, SBYTES (car));
+	      if (STRING_MULTIBYTE (car))
+		pack_uint (pk, SCHARS (car));
+	      if (pk->data)
+		memcpy (pk->data + pk->nbytes, SDATA (car), SBYTES (car));
+	      pk->nbytes += SBYTES (car);
+	      last = pos;
+	      continue;
+	    }
+
+	  if (MARKERP (car))
+	    {
+	      pack_byte (pk, UNDO_PACK_MARKER);
+	      pack_int (pk, pos);
+	      pack_object (pk, car);
+	      continue;
+	    }
+	}
+
+      pack_byte (pk, UNDO_PACK_OBJECT);
+      pack_object (pk, elt);
+    }
+}
+
+/* If the most recent change group in buffer B's undo list, the one
+   just below the undo boundary at its front, has at least
+   undo-pack-threshold entries, replace them by one packed entry.
+   The first cons cell of the group is reused for the packed entry,
+   so references to the start of the group stay valid.  */
+
+void
+pack_undo_group (struct buffer *b)
+{
+  Lisp_Object list = BVAR (b, undo_list);
+  Lisp_Object group, tail, data, objects;
+  struct undo_packer pk;
+  EMACS_INT n = 0;
+
+  if (! CONSP (list) || ! NILP (XCAR (list)))
+    return;
+  group = XCDR (list);
+  for (tail = group; CONSP (tail) && ! NILP (XCAR (tail)); tail = XCDR (tail))
+    n++;
+  if (n < 2 || n < undo_pack_threshold)
+    return;
+
+  pk.data = NULL;
+  pk.nbytes = pk.nobjects = 0;
+  pk.objects = Qnil;
+  pack_undo_records (&pk, group);
+  if (STRING_BYTES_BOUND < pk.nbytes)
+    return;
+
+  data = make_uninit_string (pk.nbytes);
+  objects = (pk.nobjects
+	     ? Fmake_vector (make_number (pk.nobjects), Qnil)
+	     : Qnil);
+  pk.data = SDATA (data);
+  pk.nbytes = pk.nobjects = 0;
+  pk.objects = objects;
+  pack_undo_records (&pk, group);
+
+  XSETCAR (group, list4 (Qapply, Qundo_packed_changes, data, objects));
+  XSETCDR (group, tail);
+}
+
+/* If ELT is a packed undo entry, return the list (DATA OBJECTS) of
+   its arguments; otherwise return Qnil.  */
+
+Lisp_Object
+packed_undo_args (Lisp_Object elt)
+{
+  if (CONSP (elt) && EQ (XCAR (elt), Qapply))
+    {
+      elt = XCDR (elt);
+      if (CONSP (elt) && EQ (XCAR (elt), Qundo_packed_changes)
+	  && CONSP (XCDR (elt)) && STRINGP (XCAR (XCDR (elt)))
+	  && CONSP (XCDR (XCDR (elt))))
+	return XCDR (elt);
+    }
+  return Qnil;
+}
+
+static EMACS_UINT
+unpack_uint (const unsigned char **p, const unsigned char *end)
+{
+  EMACS_UINT u = 0;
+  int shift;
+
+  for (shift = 0; ; shift += 7)
+    {
+      if (*p == end || shift >= BITS_PER_EMACS_INT)
+	error ("Invalid packed undo data");
+      u |= (EMACS_UINT) (**p & 0x7f) << shift;
+      if (! (*(*p)++ & 0x80))
+	return u;
+    }
+}
+
+static EMACS_INT
+unpack_int (const unsigned char **p, const unsigned char *end)
+{
+  EMACS_UINT u = unpack_uint (p, end);
+  return u & 1 ? -(EMACS_INT) (u >> 1) - 1 : (EMACS_INT) (u >> 1);
+}
+
+DEFUN ("undo-unpack", Fundo_unpack, Sundo_unpack, 2, 2, 0,
+       doc: /* Return the list of undo entries packed into DATA and OBJECTS.
+DATA and OBJECTS are the arguments of an element
+\(apply undo-packed-changes DATA OBJECTS) of `buffer-undo-list'.
+The entries come out in the order they had in the list, newest first.
+See `undo-pack-threshold'.  */)
+  (Lisp_Object data, Lisp_Object objects)
+{
+  const unsigned char *p, *end;
+  ptrdiff_t nobjects, iobject = 0;
+  EMACS_INT last = 0;
+  Lisp_Object result = Qnil, tail = Qnil;
+
+  CHECK_STRING (data);
+  if (!NILP (objects))
+    CHECK_VECTOR (objects);
+  nobjects = NILP (objects) ? 0 : ASIZE (objects);
+  p = SDATA (data);
+  end = p + SBYTES (data);
+
+  while (p < end)
+    {
+      int tag = *p++;
+      Lisp_Object elt, obj;
+
+      switch (tag & UNDO_PACK_KIND)
+	{
+	case UNDO_PACK_POINT:
+	  last += unpack_int (&p, end);
+	  elt = make_number (last);
+	  break;
+
+	case UNDO_PACK_INSERT:
+	  last += unpack_int (&p, end);
+	  elt = Fcons (make_number (last),
+		       make_number (last + unpack_uint (&p, end)));
+	  break;
+
+	case UNDO_PACK_DELETE:
+	  {
+	    bool multibyte = (tag & UNDO_PACK_MULTIBYTE) != 0;
+	    ptrdiff_t nbytes, nchars;
+
+	    last += unpack_int (&p, end);
+	    nbytes = unpack_uint (&p, end);
+	    nchars = multibyte ? unpack_uint (&p, end) : nbytes;
+	    if (nchars < 0 || nbytes < nchars || end - p < nbytes)
+	      error ("Invalid packed undo data");
+	    elt = Fcons (make_specified_string ((const char *) p, nchars,
+						nbytes, multibyte),
+			 make_number (tag & UNDO_PACK_AT_END ? -last : last));
+	    p += nbytes;
+	  }
+	  break;
+
+	case UNDO_PACK_MARKER:
+	case UNDO_PACK_OBJECT:
+	  {
+	    EMACS_INT adjustment = 0;
+
+	    if ((tag & UNDO_PACK_KIND) == UNDO_PACK_MARKER)
+	      adjustment = unpack_int (&p, end);
+	    if (iobject == nobjects)
+	      error ("Invalid packed undo data");
+	    obj = AREF (objects, iobject++);
+	    /* Garbage collection replaces markers that are no longer
+	       used by nil; drop their adjustments.  */
+	    if (NILP (obj))
+	      continue;
+	    elt = ((tag & UNDO_PACK_KIND) == UNDO_PACK_MARKER
+		   ? Fcons (obj, make_number (adjustment))
+		   : obj);
+	  }
+	  break;
+
+	default:
+	  error ("Invalid packed undo data");
+	}
+
+      elt = Fcons (elt, Qnil);
+      if (NILP (tail))
+	result = elt;
+      else
+	XSETCDR (tail, elt);
+      tail = elt;
+    }
+
+  return result;
+}
+
+/* Return the number of bytes the undo list element ELT occupies,
+   counting its chain link.  */
+
+static EMACS_INT
+undo_elt_size (Lisp_Object elt)
+{
+  EMACS_INT size = sizeof (struct Lisp_Cons);
+  Lisp_Object args;
+
+  if (CONSP (elt))
+    {
+      size += sizeof (struct Lisp_Cons);
+      if (STRINGP (XCAR (elt)))
+	size += sizeof (struct Lisp_String) - 1 + SCHARS (XCAR (elt));
+      else if (!NILP (args = packed_undo_args (elt)))
+	{
+	  Lisp_Object objects = XCAR (XCDR (args));
+
+	  size += (3 * sizeof (struct Lisp_Cons)
+		   + sizeof (struct Lisp_String) + SBYTES (XCAR (args)));
+	  if (VECTORP (objects))
+	    size += header_size + ASIZE (objects) * word_size;
+	}
+    }
+  return size;
+}
+
 /* At garbage collection time, make an undo list shorter at the end,
    returning the truncated list.  How this is done depends on the
    variables undo-limit, undo-strong-limit and undo-outer-limit.
@@ -368,14 +723,7 @@ truncate_undo_list (struct buffer *b)
       elt = XCAR (next);
 
       /* Add in the space occupied by this element and its chain link.  */
-      size_so_far += sizeof (struct Lisp_Cons);
-      if (CONSP (elt))
-	{
-	  size_so_far += sizeof (struct Lisp_Cons);
-	  if (STRINGP (XCAR (elt)))
-	    size_so_far += (sizeof (struct Lisp_String) - 1
-			    + SCHARS (XCAR (elt)));
-	}
+      size_so_far += undo_elt_size (elt);
 
       /* Advance to next element.  */
       prev = next;
@@ -429,14 +777,7 @@ truncate_undo_list (struct buffer *b)
 	}
 
       /* Add in the space occupied by this element and its chain link.  */
-      size_so_far += sizeof (struct Lisp_Cons);
-      if (CONSP (elt))
-	{
-	  size_so_far += sizeof (struct Lisp_Cons);
-	  if (STRINGP (XCAR (elt)))
-	    size_so_far += (sizeof (struct Lisp_String) - 1
-			    + SCHARS (XCAR (elt)));
-	}
+      size_so_far += undo_elt_size (elt);
 
       /* Advance to next element.  */
       prev = next;
@@ -469,7 +810,10 @@ syms_of_undo (void)
   last_undo_buffer = NULL;
   last_boundary_buffer = NULL;
 
+  DEFSYM (Qundo_packed_changes, "undo-packed-changes");
+
   defsubr (&Sundo_boundary);
+  defsubr (&Sundo_unpack);
 
   DEFVAR_INT ("undo-limit", undo_limit,
 	      doc: /* Keep no more undo information once it exceeds this size.
@@ -524,4 +868,14 @@ so it must make sure not to do a lot of consing.  */);
   DEFVAR_BOOL ("undo-inhibit-record-point", undo_inhibit_record_point,
 	       doc: /* Non-nil means do not record `point' in `buffer-undo-list'.  */);
   undo_inhibit_record_point = 0;
+
+  DEFVAR_INT ("undo-pack-threshold", undo_pack_threshold,
+	      doc: /* Pack the undo entries of commands that make at least this many.
+When a command has recorded this many entries in `buffer-undo-list',
+they are replaced by a single entry (apply undo-packed-changes DATA
+OBJECTS) that stores the same information in far less memory, and
+that garbage collection scans quickly.  Undoing the entry undoes all
+the packed changes; `undo-unpack' turns DATA and OBJECTS back into
+the list of entries.  */);
+  undo_pack_threshold = 100;
 }
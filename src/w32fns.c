@@ -6505,8 +6505,10 @@ value of DIR as in previous invocations; this is standard Windows behavior.  */)
 
     /* We modify these in-place, so make copies for safety.  */
     dir = Fcopy_sequence (dir);
+    unshare_string_data (dir);
     unixtodos_filename (SDATA (dir));
     filename = Fcopy_sequence (filename);
+    unshare_string_data (filename);
     unixtodos_filename (SDATA (filename));
     if (SBYTES (filename) >= MAX_UTF8_PATH)
       report_file_error ("filename too long", default_filename);
@@ -296,6 +296,8 @@ adjust_window_count (struct window *w, int arg)
 
       if (b->base_buffer)
 	b = b->base_buffer;
+      if (arg > 0)
+	ensure_buffer_text (b);
       b->window_count += arg;
       eassert (b->window_count >= 0);
       /* These should be recalculated by redisplay code.  */
@@ -3463,8 +3465,10 @@ set_window_buffer (Lisp_Object window, Lisp_Object buffer,
   record_unwind_current_buffer ();
   Fset_buffer (buffer);
 
-  XMARKER (w->pointm)->insertion_type = !NILP (Vwindow_point_insertion_type);
-  XMARKER (w->old_pointm)->insertion_type = !NILP (Vwindow_point_insertion_type);
+  set_marker_insertion_type (XMARKER (w->pointm),
+			     !NILP (Vwindow_point_insertion_type));
+  set_marker_insertion_type (XMARKER (w->old_pointm),
+			     !NILP (Vwindow_point_insertion_type));
 
   if (!keep_margins_p)
     {
@@ -6673,12 +6677,14 @@ save_window_save (Lisp_Object window, struct Lisp_Vector *vector, int i)
 	  else
 	    p->pointm = Fcopy_marker (w->pointm, Qnil);
 	  p->old_pointm = Fcopy_marker (w->old_pointm, Qnil);
-	  XMARKER (p->pointm)->insertion_type
-	    = !NILP (buffer_local_value /* Don't signal error if void.  */
-		     (Qwindow_point_insertion_type, w->contents));
-	  XMARKER (p->old_pointm)->insertion_type
-	    = !NILP (buffer_local_value /* Don't signal error if void.  */
-		     (Qwindow_point_insertion_type, w->contents));
+	  set_marker_insertion_type
+	    (XMARKER (p->pointm),
+	     !NILP (buffer_local_value /* Don't signal error if void.  */
+		    (Qwindow_point_insertion_type, w->contents)));
+	  set_marker_insertion_type
+	    (XMARKER (p->old_pointm),
+	     !NILP (buffer_local_value /* Don't signal error if void.  */
+		    (Qwindow_point_insertion_type, w->contents)));
 
 	  p->start = Fcopy_marker (w->start, Qnil);
 	  p->start_at_line_beg = w->start_at_line_beg ? Qt : Qnil;
@@ -5746,7 +5746,7 @@ static void
 load_overlay_strings (struct it *it, ptrdiff_t charpos)
 {
   Lisp_Object overlay, window, str, invisible;
-  struct Lisp_Overlay *ov;
+  struct overlay_node *node;
   ptrdiff_t start, end;
   ptrdiff_t n = 0, i, j;
   int invis_p;
@@ -5784,17 +5784,14 @@ load_overlay_strings (struct it *it, ptrdiff_t charpos)
     }									\
   while (0)
 
-  /* Process overlay before the overlay center.  */
-  for (ov = current_buffer->overlays_before; ov; ov = ov->next)
+  for (node = overlay_tree_first (current_buffer, charpos, charpos); node;
+       node = overlay_tree_next (node, charpos, charpos))
     {
-      XSETMISC (overlay, ov);
+      XSETMISC (overlay, node->overlay);
       eassert (OVERLAYP (overlay));
       start = OVERLAY_POSITION (OVERLAY_START (overlay));
       end = OVERLAY_POSITION (OVERLAY_END (overlay));
 
-      if (end < charpos)
-	break;
-
       /* Skip this overlay if it doesn't start or end at IT's current
 	 position.  */
       if (end != charpos && start != charpos)
@@ -5824,45 +5821,6 @@ load_overlay_strings (struct it *it, ptrdiff_t charpos)
 	RECORD_OVERLAY_STRING (overlay, str, 1);
     }
 
-  /* Process overlays after the overlay center.  */
-  for (ov = current_buffer->overlays_after; ov; ov = ov->next)
-    {
-      XSETMISC (overlay, ov);
-      eassert (OVERLAYP (overlay));
-      start = OVERLAY_POSITION (OVERLAY_START (overlay));
-      end = OVERLAY_POSITION (OVERLAY_END (overlay));
-
-      if (start > charpos)
-	break;
-
-      /* Skip this overlay if it doesn't start or end at IT's current
-	 position.  */
-      if (end != charpos && start != charpos)
-	continue;
-
-      /* Skip this overlay if it doesn't apply to IT->w.  */
-      window = Foverlay_get (overlay, Qwindow);
-      if (WINDOWP (window) && XWINDOW (window) != it->w)
-	continue;
-
-      /* If the text ``under'' the overlay is invisible, it has a zero
-	 dimension, and both before- and after-strings apply.  */
-      invisible = Foverlay_get (overlay, Qinvisible);
-      invis_p = TEXT_PROP_MEANS_INVISIBLE (invisible);
-
-      /* If overlay has a non-empty before-string, record it.  */
-      if ((start == charpos || (end == charpos && invis_p))
-	  && (str = Foverlay_get (overlay, Qbefore_string), STRINGP (str))
-	  && SCHARS (str))
-	RECORD_OVERLAY_STRING (overlay, str, 0);
-
-      /* If overlay has a non-empty after-string, record it.  */
-      if ((end == charpos || (start == charpos && invis_p))
-	  && (str = Foverlay_get (overlay, Qafter_string), STRINGP (str))
-	  && SCHARS (str))
-	RECORD_OVERLAY_STRING (overlay, str, 1);
-    }
-
 #undef RECORD_OVERLAY_STRING
 
   /* Sort entries.  */
@@ -9357,7 +9315,6 @@ move_it_to (struct it *it, ptrdiff_t to_charpos, int to_x, int to_y, int to_vpos
 	}
 
       /* Reset/increment for the next run.  */
-      recenter_overlay_lists (current_buffer, IT_CHARPOS (*it));
       it->current_x = line_start_x;
       line_start_x = 0;
       it->hpos = 0;
@@ -20094,13 +20051,6 @@ display_line (struct it *it)
   row->starts_in_middle_of_char_p = it->starts_in_middle_of_char_p;
   it->starts_in_middle_of_char_p = 0;
 
-  /* Arrange the overlays nicely for our purposes.  Usually, we call
-     display_line on only one line at a time, in which case this
-     can't really hurt too much, or we call it on lines which appear
-     one after another in the buffer, in which case all calls to
-     recenter_overlay_lists but the first will be pretty cheap.  */
-  recenter_overlay_lists (current_buffer, IT_CHARPOS (*it));
-
   /* Move over display elements that are not visible because we are
      hscrolled.  This may stop at an x-position < IT->first_visible_x
      if the first glyph is partially visible or if we hit a line end.  */
@@ -23206,6 +23156,18 @@ display_count_lines (ptrdiff_t start_byte,
   int selective_display = (!NILP (BVAR (current_buffer, selective_display))
 			   && !INTEGERP (BVAR (current_buffer, selective_display)));
 
+  /* Counting many lines is faster with the line index.  */
+  if (count > 0 && !selective_display)
+    {
+      ptrdiff_t nlines = count_newlines_indexed (start_byte, limit_byte, count);
+
+      if (0 <= nlines && nlines < count)
+	{
+	  *byte_pos_ptr = limit_byte;
+	  return nlines;
+	}
+    }
+
   if (count > 0)
     {
       while (start_byte < limit_byte)
@@ -23227,6 +23189,8 @@ display_count_lines (ptrdiff_t start_byte,
 		}
 	      else
 		{
+		  cursor += skip_lines_forward (cursor, ceiling_addr - cursor,
+						&count);
 		  cursor = memchr (cursor, '\n', ceiling_addr - cursor);
 		  if (! cursor)
 		    break;
@@ -23266,6 +23230,8 @@ display_count_lines (ptrdiff_t start_byte,
 		}
 	      else
 		{
+		  cursor -= skip_lines_backward (cursor, cursor - ceiling_addr,
+						 &count);
 		  cursor = memrchr (ceiling_addr, '\n', cursor - ceiling_addr);
 		  if (! cursor)
 		    break;
@@ -0,0 +1,237 @@
+;;; buffer-tests.el --- Tests for buffer.c
+
+;; Copyright (C) 2014 Free Software Foundation, Inc.
+
+;; This program is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation, either version 3 of the License, or
+;; (at your option) any later version.
+
+;; This program is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Code:
+
+(require 'ert)
+
+(defun buffer-tests-overlay-ids (overlays)
+  (sort (mapcar (lambda (ov) (overlay-get ov 'id)) overlays) #'<))
+
+(defun buffer-tests-make-overlay (id beg end &optional front rear)
+  (let ((ov (make-overlay beg end nil front rear)))
+    (overlay-put ov 'id id)
+    ov))
+
+(ert-deftest buffer-tests-overlay-lookup ()
+  (with-temp-buffer
+    (insert (make-string 20 ?x))
+    (buffer-tests-make-overlay 1 2 6)
+    (buffer-tests-make-overlay 2 4 10)
+    (buffer-tests-make-overlay 3 8 8)
+    (buffer-tests-make-overlay 4 12 15)
+    (should (equal (buffer-tests-overlay-ids (overlays-at 5)) '(1 2)))
+    (should (equal (buffer-tests-overlay-ids (overlays-at 6)) '(2)))
+    (should (equal (buffer-tests-overlay-ids (overlays-at 8)) '(2)))
+    (should (equal (buffer-tests-overlay-ids (overlays-in 6 8)) '(2)))
+    (should (equal (buffer-tests-overlay-ids (overlays-in 8 10)) '(2 3)))
+    (should (equal (buffer-tests-overlay-ids (overlays-in 10 12)) nil))
+    (should (equal (buffer-tests-overlay-ids (overlays-in 1 21)) '(1 2 3 4)))
+    (should (= (next-overlay-change 1) 2))
+    (should (= (next-overlay-change 6) 8))
+    (should (= (next-overlay-change 10) 12))
+    (should (= (next-overlay-change 15) (point-max)))
+    (should (= (previous-overlay-change 12) 10))
+    (should (= (previous-overlay-change 4) 2))
+    (should (= (previous-overlay-change 2) (point-min)))
+    (should (equal (buffer-tests-overlay-ids (car (overlay-lists)))
+                   '(1 2 3 4)))))
+
+(ert-deftest buffer-tests-overlay-insertion ()
+  (with-temp-buffer
+    (insert (make-string 10 ?x))
+    (let ((plain (buffer-tests-make-overlay 1 4 4))
+          (front (buffer-tests-make-overlay 2 4 6 t nil))
+          (rear (buffer-tests-make-overlay 3 2 4 nil t))
+          (empty (buffer-tests-make-overlay 4 4 4 t nil)))
+      (goto-char 4)
+      (insert "ab")
+      (should (equal (list (overlay-start plain) (overlay-end plain)) '(4 4)))
+      (should (equal (list (overlay-start front) (overlay-end front)) '(6 8)))
+      (should (equal (list (overlay-start rear) (overlay-end rear)) '(2 6)))
+      ;; An empty overlay whose start advances would become backwards.
+      (should (equal (list (overlay-start empty) (overlay-end empty)) '(4 4)))
+      (should (equal (buffer-tests-overlay-ids (overlays-at 5)) '(3)))
+      (should (equal (buffer-tests-overlay-ids (overlays-in 4 4)) '(1 3 4)))
+      (goto-char 6)
+      (insert-before-markers "c")
+      (should (equal (list (overlay-start front) (overlay-end front)) '(7 9)))
+      (should (equal (list (overlay-start rear) (overlay-end rear)) '(2 7)))
+      (should (equal (buffer-tests-overlay-ids (overlays-at 6)) '(3)))
+      (should (equal (buffer-tests-overlay-ids (overlays-at 7)) '(2))))))
+
+(ert-deftest buffer-tests-overlay-deletion ()
+  (with-temp-buffer
+    (insert (make-string 20 ?x))
+    (let ((inside (buffer-tests-make-overlay 1 6 8 t nil))
+          (across (buffer-tests-make-overlay 2 3 12))
+          (after (buffer-tests-make-overlay 3 10 14))
+          (evaporating (buffer-tests-make-overlay 4 7 9)))
+      (overlay-put evaporating 'evaporate t)
+      (delete-region 5 10)
+      (should (equal (list (overlay-start inside) (overlay-end inside)) '(5 5)))
+      (should (equal (list (overlay-start across) (overlay-end across)) '(3 7)))
+      (should (equal (list (overlay-start after) (overlay-end after)) '(5 9)))
+      (should-not (overlay-buffer evaporating))
+      (should (equal (buffer-tests-overlay-ids (overlays-at 5)) '(2 3)))
+      (goto-char 5)
+      (insert "y")
+      (should (equal (list (overlay-start inside) (overlay-end inside)) '(5 5)))
+      (should (equal (list (overlay-start after) (overlay-end after)) '(5 10)))
+      (should (= (next-overlay-change 5) 8))
+      (delete-region 2 15)
+      (should (equal (buffer-tests-overlay-ids (overlays-in 2 2)) '(1 2 3))))))
+
+(ert-deftest buffer-tests-overlay-transpose ()
+  (with-temp-buffer
+    (insert "aabbbbccc")
+    (let ((a (buffer-tests-make-overlay 1 1 3))
+          (b (buffer-tests-make-overlay 2 3 7))
+          (c (buffer-tests-make-overlay 3 7 10)))
+      ;; Overlay endpoints move like other markers, which can leave
+      ;; overlays backwards; those are made empty.
+      (transpose-regions 1 3 7 10)
+      (should (equal (buffer-string) "cccbbbbaa"))
+      (should (equal (list (overlay-start a) (overlay-end a)) '(4 4)))
+      (should (equal (list (overlay-start b) (overlay-end b)) '(1 1)))
+      (should (equal (list (overlay-start c) (overlay-end c)) '(1 10)))
+      (should (equal (buffer-tests-overlay-ids (overlays-at 2)) '(3)))
+      (should (equal (buffer-tests-overlay-ids (overlays-in 1 1)) '(2)))
+      (should (= (next-overlay-change 1) 4)))))
+
+(ert-deftest buffer-tests-overlay-indirect ()
+  (let ((base (generate-new-buffer " *buffer-tests*")))
+    (unwind-protect
+        (with-current-buffer base
+          (insert (make-string 10 ?x))
+          (let* ((indirect (make-indirect-buffer base " *buffer-tests-i*"))
+                 (ov (with-current-buffer indirect
+                       (buffer-tests-make-overlay 1 3 3 t nil))))
+            (goto-char 3)
+            (insert "ab")
+            (should (equal (list (overlay-start ov) (overlay-end ov)) '(3 3)))
+            (with-current-buffer indirect
+              (should (equal (buffer-tests-overlay-ids (overlays-in 3 3))
+                             '(1))))
+            (kill-buffer indirect)
+            (should-not (overlay-buffer ov))))
+      (kill-buffer base))))
+
+(ert-deftest buffer-tests-overlay-many ()
+  (with-temp-buffer
+    (insert (make-string 3000 ?x))
+    (let (overlays)
+      (dotimes (i 1000)
+        (push (buffer-tests-make-overlay i (1+ (* 3 i)) (+ 5 (* 3 i)))
+              overlays))
+      (should (equal (buffer-tests-overlay-ids (overlays-at 301)) '(99 100)))
+      (should (= (next-overlay-change 301) 302))
+      (should (= (previous-overlay-change 301) 299))
+      (dolist (ov overlays)
+        (when (cl-oddp (overlay-get ov 'id))
+          (delete-overlay ov)))
+      (should (equal (buffer-tests-overlay-ids (overlays-at 301)) '(100)))
+      (should (equal (buffer-tests-overlay-ids (overlays-in 1 20))
+                     '(0 2 4 6)))
+      (delete-region 1 1501)
+      (should (= (length (overlays-in 1 1)) 250))
+      (should (= (length (overlays-at 1)) 1))
+      (delete-all-overlays)
+      (should-not (overlays-in (point-min) (point-max))))))
+
+(ert-deftest buffer-tests-gap-growth ()
+  (with-temp-buffer
+    (insert (make-string 1000000 ?x))
+    (goto-char 1)
+    (insert (make-string 5000 ?y))
+    ;; A large buffer gets and keeps a gap in proportion to its size.
+    (should (>= (gap-size) (/ 1000000 64)))
+    (garbage-collect)
+    (should (>= (gap-size) (/ 1000000 64)))
+    (should (= (buffer-size) 1005000))))
+
+;; Idle buffers give up their text until something uses it again.
+;; Other buffers may be compressed too, so look only at BUF.
+(ert-deftest buffer-tests-compress-idle-buffers ()
+  (skip-unless (zlib-available-p))
+  (let ((buf (generate-new-buffer " *buffer-tests*"))
+        text)
+    (unwind-protect
+        (progn
+          (with-current-buffer buf
+            (dotimes (i 10000)
+              (insert (format "line %d \u00e9\n" i)))
+            (goto-char 5000)
+            (insert "gap")
+            (setq text (buffer-string)))
+          ;; The first call only notes that BUF has been used.
+          (compress-idle-buffers 0)
+          (should-not (buffer-text-compressed-p buf))
+          (should (>= (compress-idle-buffers 0) 1))
+          (should (buffer-text-compressed-p buf))
+          (let ((counts (buffer-compression-counts)))
+            (should (> (car counts) 0))
+            (should (< (nth 2 counts) (nth 1 counts))))
+          (with-temp-buffer
+            (insert-buffer-substring buf 4990 5010)
+            (should (equal (buffer-string) (substring text 4989 5009))))
+          (should-not (buffer-text-compressed-p buf))
+          (compress-idle-buffers 0)
+          (should (>= (compress-idle-buffers 0) 1))
+          (should (buffer-text-compressed-p buf))
+          (should (equal (with-current-buffer buf (buffer-string)) text))
+          (should-not (buffer-text-compressed-p buf)))
+      (kill-buffer buf))
+    ;; BUF is dead, but it is still around until the next collection.
+    (compress-idle-buffers 0)
+    (should (natnump (compress-idle-buffers 0)))))
+
+;; Swapping text with a compressed buffer gets its text back first.
+(ert-deftest buffer-tests-swap-compressed-text ()
+  (skip-unless (zlib-available-p))
+  (let ((buf (generate-new-buffer " *buffer-tests*"))
+        text)
+    (unwind-protect
+        (progn
+          (with-current-buffer buf
+            (dotimes (i 2000)
+              (insert (format "line %d\n" i)))
+            (setq text (buffer-string)))
+          (compress-idle-buffers 0)
+          (compress-idle-buffers 0)
+          (should (buffer-text-compressed-p buf))
+          (with-temp-buffer
+            (insert "x")
+            (buffer-swap-text buf)
+            (should (equal (buffer-string) text))
+            (should (equal (with-current-buffer buf (buffer-string)) "x"))))
+      (kill-buffer buf))))
+
+(ert-deftest buffer-tests-memory-report ()
+  (let ((report (memory-report)))
+    (dolist (kind '(buffer-text buffer-gaps compressed-buffer-text
+                    lisp-objects intervals lisp-free glyph-matrices))
+      (should (natnump (cdr (assq kind report)))))
+    (with-temp-buffer
+      (insert (make-string 300000 ?x))
+      (let ((new-report (memory-report)))
+        (should (>= (- (cdr (assq 'buffer-text new-report))
+                       (cdr (assq 'buffer-text report)))
+                    300000))))))
+
+(provide 'buffer-tests)
+;;; buffer-tests.el ends here
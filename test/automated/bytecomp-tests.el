@@ -394,6 +394,46 @@ Subtests signal errors if something goes wrong."
       (defun def () (m))))
   (should (equal (funcall 'def) 4)))
 
+(ert-deftest test-byte-comp-binary-file ()
+  (let* ((elfile (make-temp-file "test-bytecomp" nil ".el"))
+         (elcfile (concat elfile "c"))
+         (elbfile (concat (file-name-sans-extension elfile) ".elb")))
+    (unwind-protect
+        (progn
+          (with-temp-buffer
+            (dolist (form `((defvar test-byte-comp-bin-v
+                              (list ,(propertize "\u00e9t\u00e9" 'face 'bold)
+                                    1.5 -7 [a "b" (c . d)]))
+                            (defun test-byte-comp-bin-small (x) (* 2 x))
+                            (defun test-byte-comp-bin-big (x)
+                              (list ,@(make-list 300 '(car x))))))
+              (print form (current-buffer)))
+            (write-region (point-min) (point-max) elfile))
+          (let ((byte-compile-dest-file-function (lambda (_e) elcfile)))
+            (byte-compile-file elfile))
+          (should (equal (write-binary-compiled-file elcfile) elbfile))
+          (fmakunbound 'test-byte-comp-bin-big)
+          (let ((load-binary-compiled-files t))
+            (load elcfile nil t t))
+          ;; Only the binary file leaves the bytecode of a large
+          ;; function to be read from it when first called.
+          (let ((code (aref (symbol-function 'test-byte-comp-bin-big) 1)))
+            (should (consp code))
+            (should (file-equal-p (car code) elbfile))
+            (should (integerp (cadr code)))
+            (should (integerp (cddr code))))
+          (should (equal test-byte-comp-bin-v
+                         '("\u00e9t\u00e9" 1.5 -7 [a "b" (c . d)])))
+          (should (multibyte-string-p (car test-byte-comp-bin-v)))
+          (should (eq (get-text-property 0 'face (car test-byte-comp-bin-v))
+                      'bold))
+          (should (= (test-byte-comp-bin-small 21) 42))
+          (should (equal (test-byte-comp-bin-big '(x)) (make-list 300 'x)))
+          (should (stringp (aref (symbol-function 'test-byte-comp-bin-big) 1))))
+      (delete-file elfile)
+      (when (file-exists-p elcfile) (delete-file elcfile))
+      (when (file-exists-p elbfile) (delete-file elbfile)))))
+
 
 ;; Local Variables:
 ;; no-byte-compile: t
@@ -206,6 +206,25 @@
 				   'raw-text-mac 'decoder-tests-lf-to-lflf)))
     (decoder-tests-remove-files)))
 
+;; The decoder skips runs of plain ASCII in bulk, so check that it
+;; still notices EOLs and other bytes at every offset within a run.
+(ert-deftest ert-test-decoder-long-runs ()
+  (let ((run (make-string 70 ?a)))
+    (dotimes (i 70)
+      (dolist (c '("\r\n" "\r" "\n" "\t" "\0" "\u00e9"))
+	(let* ((eol (if (string-match "[\r\n]" c) c "\n"))
+	       (str (concat (substring run 0 i) c (substring run i) eol))
+	       (encoded (encode-coding-string str 'utf-8-unix))
+	       (decoded (replace-regexp-in-string "\r\n?" "\n" str)))
+	  (should (eq (coding-system-eol-type
+		       (car (detect-coding-string encoded)))
+		      (cond ((equal c "\r\n") 1)
+			    ((equal c "\r") 2)
+			    (t 0))))
+	  (should (equal (decode-coding-string encoded 'utf-8-unix) str))
+	  (should (equal (decode-coding-string encoded 'undecided)
+			 decoded)))))))
+
 
 ;;; Check the coding system `prefer-utf-8'.
 
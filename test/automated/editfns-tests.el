@@ -0,0 +1,176 @@
+;;; editfns-tests.el --- Tests for editfns.c
+
+;; Copyright (C) 2014 Free Software Foundation, Inc.
+
+;; This program is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation, either version 3 of the License, or
+;; (at your option) any later version.
+
+;; This program is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Code:
+
+(require 'ert)
+
+(ert-deftest format-simple-directives ()
+  (should (equal (format "") ""))
+  (should (equal (format "a%%b%s" "c") "a%bc"))
+  (should (equal (format "%s-%d" 'sym -42) "sym--42"))
+  (should (equal (format "%d" most-negative-fixnum)
+                 (number-to-string most-negative-fixnum)))
+  ;; Arguments that are not plain strings or integers.
+  (should (equal (format "%s %d" 1.5 2.7) "1.5 2"))
+  (should (equal (format "%s" '(1 "a")) "(1 a)"))
+  (should (equal-including-properties
+               (format "%s!" (propertize "x" 'face 'bold))
+               #("x!" 0 1 (face bold))))
+  (should-error (format "%s %s" "a"))
+  ;; Multibyte and unibyte pieces.
+  (let ((s (format "\u00e9%s" (string-to-unibyte "\377"))))
+    (should (multibyte-string-p s))
+    (should (= (length s) 2))
+    (should (eq (aref s 1) (unibyte-char-to-multibyte ?\377))))
+  ;; A format string modified after use.
+  (let ((f (copy-sequence "v%s")))
+    (should (equal (format f 1) "v1"))
+    (aset f 2 ?d)
+    (should (equal (format f 1) "v1"))
+    (aset f 0 ?w)
+    (should (equal (format f 2) "w2"))))
+
+;; Replace the regions of EDITS one by one, the way `replace-regions'
+;; should behave.
+(defun editfns-tests-replace-one-by-one (edits)
+  (dolist (edit (reverse edits))
+    (save-excursion
+      (set-match-data (list (nth 0 edit) (nth 1 edit)))
+      (replace-match (nth 2 edit) t t))))
+
+(ert-deftest replace-regions-basic ()
+  (let ((edits '((2 4 "XY") (4 4 "+") (6 6 "\u00e9\u00e9") (8 11 ""))))
+    (dolist (one-by-one '(nil t))
+      (with-temp-buffer
+        (insert "abcdefghij")
+        (let ((markers (list (copy-marker 3) (copy-marker 3 t)
+                             (copy-marker 4) (copy-marker 6 t)
+                             (copy-marker 9) (copy-marker 11))))
+          (goto-char 7)
+          (if one-by-one
+              (editfns-tests-replace-one-by-one edits)
+            (replace-regions edits))
+          (should (equal (buffer-string) "aXY+de\u00e9\u00e9fg"))
+          (should (= (point) 10))
+          (should (equal (mapcar #'marker-position markers)
+                         '(2 2 5 9 11 11))))))
+    (with-temp-buffer
+      (insert "abc")
+      (should-error (replace-regions '((2 3 "x") (1 2 "y"))))
+      (should-error (replace-regions '((1 3 "x") (2 3 "y"))))
+      (should-error (replace-regions '((1 5 "x"))))
+      (should (equal (buffer-string) "abc")))))
+
+(ert-deftest replace-regions-hooks-and-undo ()
+  (with-temp-buffer
+    (insert "one two three four")
+    (buffer-enable-undo)
+    (let* ((calls nil)
+           (before-change-functions
+            (list (lambda (beg end) (push (list 'before beg end) calls))))
+           (after-change-functions
+            (list (lambda (beg end len) (push (list 'after beg end len) calls)))))
+      (replace-regions '((5 8 "2") (9 14 "3")))
+      (should (equal (buffer-string) "one 2 3 four"))
+      (should (equal (nreverse calls) '((before 5 14) (after 5 8 9)))))
+    ;; Undo the change, and then undo the undo.
+    (dolist (text '("one two three four" "one 2 3 four"))
+      (let ((list buffer-undo-list))
+        (setq buffer-undo-list nil)
+        (primitive-undo 1 list))
+      (should (equal (buffer-string) text)))))
+
+;; `replace-buffer-contents' leaves alone markers in text that stays.
+(ert-deftest replace-buffer-contents-basic ()
+  (dolist (source-buffer '(nil t))
+    (with-temp-buffer
+      (insert "one two three\nfour five\nsix \u00e9\n")
+      (buffer-enable-undo)
+      (let* ((new "one 2 three\nfour five\nsix \u00e9!\nseven\n")
+             (markers (mapcar #'copy-marker '(1 6 11 15 20 25 29)))
+             (source (if source-buffer (generate-new-buffer "source") new)))
+        (when source-buffer
+          (with-current-buffer source
+            (insert "junk" new "junk")
+            (narrow-to-region 5 (- (point-max) 4))))
+        (should (eq (replace-buffer-contents source) t))
+        (when source-buffer
+          (kill-buffer source))
+        (should (equal (buffer-string) new))
+        (should (equal (mapcar #'marker-position markers)
+                       '(1 5 9 13 18 23 27)))
+        (let ((list buffer-undo-list))
+          (setq buffer-undo-list nil)
+          (primitive-undo 1 list))
+        (should (equal (buffer-string)
+                       "one two three\nfour five\nsix \u00e9\n")))))
+  ;; Giving up replaces all of the text between the common ends.
+  (with-temp-buffer
+    (insert "abcdef")
+    (let ((marker (copy-marker 4)))
+      (should (eq (replace-buffer-contents "abXdYf" 0) nil))
+      (should (equal (buffer-string) "abXdYf"))
+      (should (= marker 3)))))
+
+(ert-deftest insert-file-contents-replace-minimally ()
+  (let ((file (make-temp-file "editfns-tests")))
+    (unwind-protect
+        (dolist (text '("x" "\u00e9"))
+          (with-temp-file file
+            (dotimes (i 100)
+              (insert (format "line %d %s\n" i text))))
+          (with-temp-buffer
+            (insert-file-contents file)
+            (let ((old (buffer-string))
+                  (marker (progn (goto-char (point-min))
+                                 (search-forward "line 50 ")
+                                 (point-marker))))
+              (goto-char (point-min))
+              (while (re-search-forward "^line \\(45\\|55\\) " nil t)
+                (replace-match "LINE \\1 "))
+              (insert-file-contents file nil nil nil t)
+              (should (equal (buffer-string) old))
+              (should (equal (buffer-substring marker (1+ marker)) text)))))
+      (delete-file file))))
+
+;; When most of the file differs, reverting replaces all of it.
+(ert-deftest insert-file-contents-replace-most ()
+  (let ((file (make-temp-file "editfns-tests")))
+    (unwind-protect
+        (dolist (text '("x" "\u00e9"))
+          (with-temp-file file
+            (dotimes (i 100)
+              (insert (format "line %d %s\n" i text))))
+          (with-temp-buffer
+            (insert-file-contents file)
+            (let ((old (buffer-string)))
+              (goto-char (point-min))
+              (while (re-search-forward "^line \\(1\\|99\\) " nil t)
+                (replace-match "LINE \\1 "))
+              (buffer-enable-undo)
+              (insert-file-contents file nil nil nil t)
+              (should (equal (buffer-string) old))
+              (goto-char (point-min))
+              (undo-boundary)
+              (primitive-undo 1 buffer-undo-list)
+              (should (search-forward "LINE 1 " nil t))
+              (should (search-forward "LINE 99 " nil t)))))
+      (delete-file file))))
+
+(provide 'editfns-tests)
+;;; editfns-tests.el ends here
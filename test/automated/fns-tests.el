@@ -189,3 +189,53 @@
 	      (string-collate-lessp
 	       a b (if (eq system-type 'windows-nt) "enu_USA" "en_US.UTF-8")))))
     '("Adrian" "Ævar" "Agustín" "Eli"))))
+
+;; Copies and tails of large strings share their data until changed.
+(ert-deftest fns-tests-shared-substring ()
+  (let* ((string (apply #'concat (mapcar (lambda (i) (format "%05dé" i))
+                                         (number-sequence 0 999))))
+         (chars (string-to-list string))
+         (copy (copy-sequence string))
+         (tail (substring string 600))
+         (bare (substring-no-properties string 1200)))
+    (garbage-collect)
+    (should (equal copy string))
+    (should (equal (string-to-list tail) (nthcdr 600 chars)))
+    (should (equal (string-to-list bare) (nthcdr 1200 chars)))
+    (aset string 600 ?x)
+    (aset copy 0 ?é)
+    (aset tail 1 ?y)
+    (should (equal (string-to-list string)
+                   (append (butlast chars (- (length chars) 600))
+                           '(?x) (nthcdr 601 chars))))
+    (should (equal (string-to-list copy) (cons ?é (cdr chars))))
+    (should (equal (string-to-list tail)
+                   (append (list (nth 600 chars) ?y) (nthcdr 602 chars))))
+    (should (equal (upcase bare) (upcase (apply #'string (nthcdr 1200 chars)))))
+    (should (equal (string-to-list bare) (nthcdr 1200 chars)))
+    (setq string nil copy nil)
+    (garbage-collect)
+    (clear-string tail)
+    (should (equal (string-to-list bare) (nthcdr 1200 chars)))))
+
+;; Indexing alternately into long multibyte strings.
+(ert-deftest fns-tests-string-index ()
+  (let* ((strings (list (apply #'string
+                               (mapcar (lambda (i) (if (cl-evenp (/ i 7))
+                                                       ?λ ?x))
+                                       (number-sequence 0 19999)))
+                        (concat (make-string 10000 ?é) "abc"
+                                (make-string 10000 ?\U0001F600))))
+         (vectors (mapcar #'vconcat strings)))
+    (dotimes (k 2000)
+      (let* ((n (% k 2))
+             (string (nth n strings))
+             (i (% (* k 7919) (length string))))
+        (should (eq (aref string i) (aref (nth n vectors) i)))
+        (when (zerop (% k 100))
+          (should (= (string-match "." string i) i))
+          ;; Changing the string discards its index.
+          (aset string i ?é)
+          (aset (nth n vectors) i ?é)
+          (garbage-collect))))
+    (should (equal (append (car strings) nil) (append (car vectors) nil)))))
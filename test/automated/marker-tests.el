@@ -0,0 +1,129 @@
+;;; marker-tests.el --- Tests for marker.c
+
+;; Copyright (C) 2014 Free Software Foundation, Inc.
+
+;; This program is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation, either version 3 of the License, or
+;; (at your option) any later version.
+
+;; This program is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Code:
+
+(require 'ert)
+
+(ert-deftest marker-tests-insertion ()
+  (with-temp-buffer
+    (insert "abcdef")
+    (let ((before (copy-marker 3))
+          (after (copy-marker 3 t))
+          (later (copy-marker 5)))
+      (goto-char 3)
+      (insert "xy")
+      (should (= before 3))
+      (should (= after 5))
+      (should (= later 7))
+      (set-marker-insertion-type before t)
+      (goto-char 3)
+      (insert "z")
+      (should (= before 4))
+      (should (= after 6))
+      (goto-char 6)
+      (insert-before-markers "w")
+      (should (= after 7))
+      (should (= later 9))
+      (should (buffer-has-markers-at 4))
+      (should-not (buffer-has-markers-at 5)))))
+
+(ert-deftest marker-tests-deletion ()
+  (with-temp-buffer
+    (insert (make-string 100 ?x))
+    (let ((markers (let (l)
+                     (dotimes (i 101)
+                       (push (copy-marker (1+ i) (cl-oddp i)) l))
+                     (nreverse l))))
+      (delete-region 20 40)
+      (dotimes (i 101)
+        (should (= (nth i markers)
+                   (cond ((< i 19) (1+ i)) ((< i 40) 20) (t (- i 19))))))
+      (goto-char 20)
+      (insert "ab")
+      (dotimes (i 101)
+        (let ((m (nth i markers)))
+          (should (= m (cond ((< i 19) (1+ i))
+                             ((< i 40) (if (marker-insertion-type m) 22 20))
+                             (t (- i 17)))))))
+      (set-marker (nth 50 markers) nil)
+      (erase-buffer)
+      (should-not (marker-buffer (nth 50 markers)))
+      (dolist (m (delq (nth 50 markers) markers))
+        (should (= m 1))))))
+
+(ert-deftest marker-tests-byte-positions ()
+  (with-temp-buffer
+    (dotimes (_ 2000)
+      (insert "aé中"))
+    (let ((markers (let (l)
+                     (dotimes (i 600)
+                       (push (copy-marker (1+ (* 10 i))) l))
+                     l)))
+      (transpose-regions 1 100 200 1000)
+      (goto-char 3000)
+      (insert "é")
+      (delete-region 10 20)
+      (set-buffer-multibyte nil)
+      (set-buffer-multibyte t)
+      (dolist (m markers)
+        (should (<= (point-min) m (point-max))))
+      (dotimes (i 100)
+        (let ((pos (1+ (* 59 i))))
+          (should (= (byte-to-position (position-bytes pos)) pos))
+          (should (= (position-bytes pos)
+                     (1+ (string-bytes (buffer-substring 1 pos))))))))))
+
+(ert-deftest marker-tests-position-index ()
+  (with-temp-buffer
+    (dotimes (_ 20000)
+      (insert "a\u00e9\u4e2d\n"))
+    (let ((misses (nth 1 (position-index-counters)))
+          (check (lambda (pos)
+                   (let ((byte (1+ (string-bytes
+                                     (substring (buffer-string) 0 (1- pos))))))
+                     (should (= (position-bytes pos) byte))
+                     (should (= (byte-to-position byte) pos))))))
+      (funcall check 40001)
+      (should (> (nth 1 (position-index-counters)) misses))
+      (should (> (nth 2 (position-index-counters)) 5))
+      ;; Edits before, inside and after indexed text, with the gap
+      ;; moving across the checkpoints.
+      (goto-char 30000)
+      (insert (make-string 10000 ?\u00e9))
+      (funcall check 65001)
+      (delete-region 20000 50000)
+      (funcall check 40001)
+      (goto-char 10)
+      (insert "\u4e2d")
+      (funcall check 60000)
+      (funcall check 15000)
+      (delete-region 5 25000)
+      (dotimes (i 35)
+        (funcall check (1+ (* i 1000))))
+      ;; Swapping regions of different byte lengths moves text
+      ;; without going through the gap.
+      (funcall check 20001)
+      (transpose-regions 10 15001 25000 26003)
+      (dotimes (i 35)
+        (funcall check (1+ (* i 1000))))
+      (set-buffer-multibyte nil)
+      (set-buffer-multibyte t)
+      (funcall check 30001))))
+
+(provide 'marker-tests)
+;;; marker-tests.el ends here
@@ -0,0 +1,86 @@
+;;; print-tests.el --- Tests for print.c
+
+;; Copyright (C) 2014 Free Software Foundation, Inc.
+
+;; This program is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation, either version 3 of the License, or
+;; (at your option) any later version.
+
+;; This program is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Code:
+
+(require 'ert)
+
+(ert-deftest print-tests-circle ()
+  (let* ((print-circle t)
+         (shared (list 1 2))
+         (cycle (list 'a 'b))
+         (vec (vector shared shared)))
+    (setcdr (cdr cycle) cycle)
+    (aset vec 1 vec)
+    (should (equal (prin1-to-string (list shared shared))
+                   "(#1=(1 2) #1#)"))
+    (should (equal (prin1-to-string cycle) "#1=(a b . #1#)"))
+    (should (equal (prin1-to-string (list vec shared))
+                   "(#1=[#2=(1 2) #1#] #2#)"))
+    ;; Numbers follow the order of printing, even in deep structures.
+    (let ((deep (list shared)))
+      (dotimes (_ 10000)
+        (setq deep (list deep)))
+      (let ((printed (prin1-to-string (list deep shared))))
+        (should (string-match "\\`(+#1=(1 2))+ #1#)\\'" printed))
+        (should (equal (prin1-to-string (read printed)) printed))))))
+
+(ert-deftest print-tests-gensym ()
+  (let ((g (make-symbol "g"))
+        (print-gensym t))
+    (let ((print-circle t))
+      (should (equal (prin1-to-string (list g g)) "(#1=#:g #1#)")))
+    (let ((print-circle nil))
+      (should (equal (prin1-to-string (list g g)) "(#:g #:g)")))
+    (let ((print-continuous-numbering t)
+          (print-number-table nil)
+          (print-circle t))
+      (should (equal (prin1-to-string (list g)) "(#1=#:g)"))
+      (should (equal (prin1-to-string (list g)) "(#1#)")))))
+
+(ert-deftest print-tests-escapes ()
+  (should (equal (prin1-to-string "a\"b\\c") "\"a\\\"b\\\\c\""))
+  (should (equal (prin1-to-string (intern "a b;c(d)")) "a\\ b\\;c\\(d\\)"))
+  (should (equal (prin1-to-string (intern "12")) "\\12"))
+  (let ((print-escape-newlines t))
+    (should (equal (prin1-to-string "x\ny\fz") "\"x\\ny\\fz\"")))
+  (let ((print-escape-multibyte t))
+    (should (equal (prin1-to-string "a\u00e9b") "\"a\\x00e9\\ b\"")))
+  (should (equal (prin1-to-string (string-to-multibyte "\377"))
+                 "\"\\377\""))
+  (let ((s (make-string 1000 ?\u00e9)))
+    (should (equal (read (prin1-to-string s)) s))))
+
+(ert-deftest print-tests-floats ()
+  (dolist (pair '((0.1 . "0.1") (100.0 . "100.0") (1e15 . "1e+15")
+                  (1e23 . "1e+23") (5e-324 . "5e-324") (-0.0 . "-0.0")
+                  (1e-05 . "1e-05") (0.3333333333333333 . "0.3333333333333333")
+                  (1.2345678901234568e+17 . "1.2345678901234568e+17")
+                  (1.7976931348623157e+308 . "1.7976931348623157e+308")))
+    (should (equal (prin1-to-string (car pair)) (cdr pair))))
+  (dolist (pair '(("1e30" . 1e30) ("0.1e-3" . 0.0001) ("1.5e" . 1.5)
+                  ("12345678901234567890e-5" . 123456789012345.67)
+                  ("4.9e-324" . 5e-324) ("1e400" . 1.0e+INF)))
+    (should (eql (string-to-number (car pair)) (cdr pair))))
+  (let ((x 1.0))
+    (dotimes (_ 200)
+      (setq x (* x -1.37))
+      (should (eql (read (prin1-to-string x)) x))
+      (should (eql (read (prin1-to-string (/ 1 x))) (/ 1 x))))))
+
+(provide 'print-tests)
+;;; print-tests.el ends here
@@ -28,4 +28,66 @@
 The test data is in `compile-tests--test-regexps-data'."
   (should (string-match (regexp-opt-charset '(?^)) "a^b")))
 
+;; Patterns that make the backtracking matcher try exponentially many
+;; ways to match, which the DFA rules out at once.
+(ert-deftest regexp-test-exponential ()
+  (let ((s (make-string 40 ?a)))
+    (should-not (string-match-p "\\(a*\\)*b" s))
+    (should-not (string-match "\\(a\\|aa\\)*c" s))
+    (with-temp-buffer
+      (insert s "\n" s)
+      (goto-char (point-min))
+      (should-not (re-search-forward "\\(?:a*\\)*b" nil t))
+      (should (= (re-search-forward "\\(a*\\)*$" nil t) 41))
+      (should (= (match-beginning 1) 41)))))
+
+(ert-deftest regexp-test-dfa ()
+  "Test that matching with and without the groups agree."
+  (let ((text "foo-bar baz_qux été\nquux a-b\n")
+        (case-fold-search nil))
+    (dolist (re '("\\<ba" "ba\\>" "\\bq" "u\\B" "\\_<baz_" "\\_>" "^q"
+                  "x$" "\\`f" "\\'" "\\w+\\W" "[[:word:]]+t" "\\s-+\\S-"
+                  "\\(?:ab\\)*$" "é.*?\\>" "[^a-z\n]+" "a.b"))
+      (dotimes (start (length text))
+        (should (equal (string-match-p re text start)
+                       (string-match re text start)))
+        (with-temp-buffer
+          (insert text)
+          (goto-char (1+ start))
+          (let ((end (re-search-forward re nil t)))
+            (goto-char (1+ start))
+            (should (equal (let ((inhibit-changing-match-data t))
+                             (re-search-forward re nil t))
+                           end))
+            (goto-char (1+ start))
+            (should (equal (looking-at-p re) (looking-at re)))))))
+    ;; A loop stops before what follows it can match.
+    (should (= (string-match "[[:word:]]+é" "1é") 0))
+    (should-not (string-match "x\\(?:ab\\)*$" "xa"))))
+
+;; The searches look for a string that every match contains first,
+;; also where it straddles the gap.
+(ert-deftest regexp-test-required-string ()
+  (with-temp-buffer
+    (insert "ERROR: no\n" "ERROR: x timeout\n" "é.defun  foo\n")
+    (dolist (gap (number-sequence 1 (point-max)))
+      (goto-char gap)
+      (insert "Q")
+      (delete-char -1)
+      (goto-char (point-min))
+      (should (= (re-search-forward "^ERROR: .*timeout" nil t) 27))
+      (should (= (match-beginning 0) 11))
+      (goto-char (point-min))
+      (should (= (re-search-forward "\\(.\\)defun\\s-+" nil t) 37))
+      (should (equal (match-string 1) "."))
+      (should-not (re-search-forward "defun" nil t))
+      (should (= (re-search-backward "x ti" nil t) 18))
+      (should-not (re-search-backward "timeouts" nil t))
+      (goto-char 12)
+      (should-not (re-search-forward "ERROR" 17 t))))
+  (should (= (string-match "[0-9]+ms" "1 23 456ms") 5))
+  (should (= (string-match "é+ab" "éxééab") 2))
+  (let ((case-fold-search t))
+    (should (= (string-match "timeout" "TIMEOUT") 0))))
+
 ;;; regexp-tests.el ends here.
@@ -0,0 +1,196 @@
+;;; search-tests.el --- Tests for search.c
+
+;; Copyright (C) 2014 Free Software Foundation, Inc.
+
+;; This program is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation, either version 3 of the License, or
+;; (at your option) any later version.
+
+;; This program is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Code:
+
+(require 'ert)
+
+(defun search-tests-count-newlines (beg end)
+  (let ((n 0) (s (buffer-substring-no-properties beg end)))
+    (dotimes (i (length s))
+      (when (eq (aref s i) ?\n)
+        (setq n (1+ n))))
+    n))
+
+(defun search-tests-check-lines ()
+  (dolist (pos (list (point-min) (+ (point-min) 5000) (+ (point-min) 77777)
+                     (/ (+ (point-min) (point-max)) 2) (- (point-max) 3)
+                     (point-max)))
+    (should (= (line-number-at-pos pos)
+               (1+ (search-tests-count-newlines (point-min) pos)))))
+  (let ((beg (+ (point-min) 100)) (end (- (point-max) 100)))
+    (should (= (count-lines beg end)
+               (+ (search-tests-count-newlines beg end)
+                  (if (eq (char-before end) ?\n) 0 1)))))
+  (let ((lines (search-tests-count-newlines (point-min) (point-max))))
+    (goto-char (point-min))
+    (should (= (forward-line (+ lines 10)) (if (bolp) 10 9)))
+    (should (eobp))
+    (should (= (forward-line (- (+ lines 10))) -10))
+    (should (bobp))
+    (goto-char (point-min))
+    (should (= (forward-line (/ lines 2)) 0))
+    (should (bolp))
+    (should (= (search-tests-count-newlines (point-min) (point)) (/ lines 2)))
+    (goto-char (point-max))
+    (should (= (forward-line (- (/ lines 3))) 0))
+    (should (bolp))
+    (should (= (search-tests-count-newlines (point) (point-max))
+               (/ lines 3)))))
+
+(ert-deftest search-tests-line-index ()
+  (with-temp-buffer
+    (dotimes (i 20000)
+      (insert (make-string (% i 37) ?\u00e9) "x\n"))
+    (search-tests-check-lines)
+    ;; Edits before, inside and after the indexed text.
+    (goto-char 50000)
+    (dotimes (_ 5000)
+      (insert "a\nb"))
+    (search-tests-check-lines)
+    (delete-region 30000 200000)
+    (search-tests-check-lines)
+    (goto-char (point-min))
+    (insert "\n\n\n")
+    (search-tests-check-lines)
+    ;; Changes made in place, without going through the gap.
+    (transpose-regions 10 20000 40000 90000)
+    (search-tests-check-lines)
+    (subst-char-in-region 1000 100000 ?x ?\n)
+    (search-tests-check-lines)
+    (translate-region 50000 150000 (make-translation-table '((?\n . ?y))))
+    (search-tests-check-lines)
+    (set-buffer-multibyte nil)
+    (search-tests-check-lines)
+    (set-buffer-multibyte t)
+    (search-tests-check-lines)
+    (save-restriction
+      (narrow-to-region 20000 (- (point-max) 20000))
+      (search-tests-check-lines))))
+
+;; A buffer this small has no line index, so this scans the text.
+(ert-deftest search-tests-short-lines ()
+  (with-temp-buffer
+    (dotimes (i 2000)
+      (insert (make-string (% (* i 7) 13) (if (cl-evenp i) ?x ?\u00e9))
+              "\n"))
+    (dolist (cache '(nil t))
+      (setq cache-long-scans cache)
+      (dolist (n '(1 2 3 10 100 1000 1999 2000 2001))
+        (goto-char (point-min))
+        (should (= (forward-line n) (max 0 (- n 2000))))
+        (should (= (search-tests-count-newlines (point-min) (point))
+                   (min n 2000)))
+        (goto-char (point-max))
+        (should (= (forward-line (- n)) (min 0 (- 2000 n))))
+        (should (= (search-tests-count-newlines (point) (point-max))
+                   (min n 2000)))
+        (should (= (count-lines (point-min) (point-max)) 2000))))))
+
+;; Compare with the regexp that `regexp-opt' makes.  POSIX matching
+;; takes the longest alternative, as the search for strings does.
+(defun search-tests-check-strings (strings delimited)
+  (let ((regexp (regexp-opt strings delimited))
+        expected)
+    (goto-char (point-min))
+    (while (posix-search-forward regexp nil t)
+      (push (cons (match-beginning 0) (match-end 0)) expected))
+    (setq expected (nreverse expected))
+    (should (equal (search-strings-in-region strings (point-min) (point-max)
+                                             delimited)
+                   expected))
+    (goto-char (point-min))
+    (dolist (occurrence expected)
+      (should (= (search-forward-strings strings nil nil delimited)
+                 (cdr occurrence)))
+      (should (= (match-beginning 0) (car occurrence))))
+    (should-not (search-forward-strings strings nil t delimited))))
+
+(ert-deftest search-tests-strings ()
+  (with-temp-buffer
+    (insert "if iff elsewhere \u00c9T\u00c9 _x f-if else_x\nelse")
+    ;; Move the gap across the text.
+    (dolist (gap (number-sequence 1 (point-max) 7))
+      (goto-char gap)
+      (insert "Q")
+      (delete-char -1)
+      (dolist (delimited '(nil words symbols))
+        (let ((strings '("if" "iff" "else" "\u00e9t\u00e9" "el" "_x" "f-")))
+          (let ((case-fold-search nil))
+            (search-tests-check-strings strings delimited))
+          (let ((case-fold-search t))
+            (search-tests-check-strings strings delimited)))))
+    (goto-char (point-min))
+    (should (= (search-forward-strings '("else") 12 1) 12))
+    (should-error (search-forward-strings '("zz")) :type 'search-failed)
+    (should-error (search-forward-strings '("a" 1)))))
+
+(ert-deftest search-tests-font-lock-strings ()
+  (with-temp-buffer
+    (insert "if x then iff y else z fi")
+    (setq font-lock-defaults
+          '(((("if" "iff" "fi") . font-lock-keyword-face)
+             ((words "x" "y") . font-lock-variable-name-face))))
+    (font-lock-mode 1)
+    (font-lock-fontify-buffer)
+    (should (eq (get-text-property 1 'face) 'font-lock-keyword-face))
+    (should (eq (get-text-property 4 'face) 'font-lock-variable-name-face))
+    (should (eq (get-text-property 13 'face) 'font-lock-keyword-face))
+    (should-not (get-text-property 8 'face))
+    (should (eq (get-text-property 24 'face) 'font-lock-keyword-face))))
+
+;; Searches that cycle through more regexps than the cache holds
+;; compile them each time.
+(ert-deftest search-tests-regexp-cache ()
+  (let ((regexps (mapcar (lambda (i) (format "search-tests-[%d]" i))
+                         (number-sequence 1 5)))
+        (regexp-cache-size 3)
+        before after)
+    (with-temp-buffer
+      (insert "search-tests-3 search-tests-4")
+      (setq before (regexp-cache-counts))
+      (dotimes (_ 2)
+        (dolist (regexp regexps)
+          (goto-char (point-min))
+          (re-search-forward regexp nil t)))
+      (setq after (regexp-cache-counts))
+      (should (= (- (nth 1 after) (nth 1 before)) 10))
+      (should (= (nth 2 after) 3))
+      (setq regexp-cache-size 10)
+      (dolist (regexp regexps)
+        (string-match regexp "search-tests-5"))
+      (setq before (regexp-cache-counts))
+      (dolist (regexp regexps)
+        (goto-char (point-min))
+        (re-search-forward regexp nil t))
+      (setq after (regexp-cache-counts))
+      (should (= (- (car after) (car before)) 5))
+      (should (= (nth 1 after) (nth 1 before)))
+      (goto-char (point-min))
+      (should (= (re-search-forward "search-tests-4" nil t) 30))))
+  ;; A change in a syntax table discards the regexps that depend on it.
+  (with-temp-buffer
+    (set-syntax-table (make-syntax-table))
+    (insert "a-b")
+    (goto-char (point-min))
+    (should (= (re-search-forward "[[:word:]]+" nil t) 2))
+    (modify-syntax-entry ?- "w")
+    (goto-char (point-min))
+    (should (= (re-search-forward "[[:word:]]+" nil t) 4))))
+
+(provide 'search-tests)
+;;; search-tests.el ends here
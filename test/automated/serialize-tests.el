@@ -0,0 +1,87 @@
+;;; serialize-tests.el --- Tests for serialize-object and deserialize-object
+
+;; Copyright (C) 2014 Free Software Foundation, Inc.
+
+;; This program is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation, either version 3 of the License, or
+;; (at your option) any later version.
+
+;; This program is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Code:
+
+(require 'ert)
+
+(defun serialize-tests-round-trip (object)
+  (deserialize-object (serialize-object object)))
+
+(ert-deftest serialize-tests-atoms ()
+  (dolist (object (list nil t 0 -1 most-positive-fixnum most-negative-fixnum
+                        1.5 -0.0 1.0e+INF 'foo :key "abc" ""
+                        [1 (2 . 3) "four"] (make-bool-vector 11 t)
+                        (list 1 (list 2 3) 4 5)))
+    (should (equal (serialize-tests-round-trip object) object)))
+  (should-not (multibyte-string-p (serialize-object '(a "b")))))
+
+(ert-deftest serialize-tests-strings ()
+  (let* ((multi (propertize "h\u00e9llo" 'face 'bold))
+         (uni (string-to-unibyte "a\377"))
+         (copy (serialize-tests-round-trip (list multi uni))))
+    (should (equal copy (list multi uni)))
+    (should (multibyte-string-p (car copy)))
+    (should-not (multibyte-string-p (cadr copy)))
+    (should (equal (text-properties-at 1 (car copy)) '(face bold)))))
+
+(ert-deftest serialize-tests-sharing ()
+  (let* ((s "shared")
+         (g (make-symbol "g"))
+         (cycle (list 1 2 3))
+         copy)
+    (setcdr (last cycle) cycle)
+    (setq copy (serialize-tests-round-trip (list s s g g cycle)))
+    (should (eq (nth 0 copy) (nth 1 copy)))
+    (should (eq (nth 2 copy) (nth 3 copy)))
+    (should-not (intern-soft (nth 2 copy)))
+    (should (eq (nthcdr 3 (nth 4 copy)) (nth 4 copy)))))
+
+(ert-deftest serialize-tests-hash-table ()
+  (let ((table (make-hash-table :test 'equal :size 10)))
+    (puthash "a" 1 table)
+    (puthash '(b) table table)
+    (let ((copy (serialize-tests-round-trip table)))
+      (should (eq (hash-table-test copy) 'equal))
+      (should (= (hash-table-count copy) 2))
+      (should (= (gethash "a" copy) 1))
+      (should (eq (gethash '(b) copy) copy)))))
+
+(ert-deftest serialize-tests-buffer-and-file ()
+  (with-temp-buffer
+    (serialize-object '(1 "two") (current-buffer))
+    (serialize-object 'three (current-buffer))
+    (goto-char (point-min))
+    (should (equal (deserialize-object (current-buffer)) '(1 "two")))
+    (should (eq (deserialize-object (current-buffer)) 'three))
+    (should (eobp)))
+  (let ((file (make-temp-file "serialize-tests")))
+    (unwind-protect
+        (progn
+          (should-not (serialize-object [a "b" 3.0] file))
+          (should (equal (deserialize-object file t) [a "b" 3.0])))
+      (delete-file file))))
+
+(ert-deftest serialize-tests-errors ()
+  (should-error (serialize-object (list (current-buffer))))
+  (should-error (serialize-object (intern "x" (make-vector 3 0))))
+  (should-error (deserialize-object "not serialized"))
+  (should-error (deserialize-object
+                 (substring (serialize-object '(1 2 3)) 0 -1))))
+
+(provide 'serialize-tests)
+;;; serialize-tests.el ends here
@@ -0,0 +1,123 @@
+;;; textprop-tests.el --- Tests for textprop.c
+
+;; Copyright (C) 2014 Free Software Foundation, Inc.
+
+;; This program is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation, either version 3 of the License, or
+;; (at your option) any later version.
+
+;; This program is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Code:
+
+(require 'ert)
+
+(defun textprop-tests-next-change (pos prop)
+  "Return the next change of PROP after POS, one character at a time."
+  (let ((val (get-text-property pos prop)))
+    (setq pos (1+ pos))
+    (while (and (< pos (point-max))
+                (eq (get-text-property pos prop) val))
+      (setq pos (1+ pos)))
+    (and (< pos (point-max)) pos)))
+
+(defun textprop-tests-previous-change (pos prop)
+  "Return the previous change of PROP before POS, one character at a time."
+  (let ((val (get-text-property (1- pos) prop)))
+    (setq pos (1- pos))
+    (while (and (> pos (point-min))
+                (eq (get-text-property (1- pos) prop) val))
+      (setq pos (1- pos)))
+    (and (> pos (point-min)) pos)))
+
+(defun textprop-tests-check-changes (prop)
+  (dolist (pos (list 1 2 4000 9000 9001 9005 12345 (1- (point-max))))
+    (should (equal (next-single-property-change pos prop)
+                   (textprop-tests-next-change pos prop)))
+    (should (equal (previous-single-property-change (1+ pos) prop)
+                   (textprop-tests-previous-change (1+ pos) prop))))
+  (should (equal (text-property-any 1 (point-max) prop 'here)
+                 (let ((pos 1))
+                   (while (and pos (not (eq (get-text-property pos prop)
+                                            'here)))
+                     (setq pos (next-single-property-change pos prop)))
+                   pos))))
+
+;; Searches for a rare property skip the text that lacks it.
+(ert-deftest textprop-tests-sparse-property ()
+  (with-temp-buffer
+    (dotimes (i 4000)
+      (insert (propertize "abc" 'face (if (cl-evenp i) 'bold 'italic))
+              (propertize "de\n" 'fontified t)))
+    (put-text-property 9001 9005 'rare 'here)
+    (textprop-tests-check-changes 'rare)
+    (textprop-tests-check-changes 'face)
+    ;; Changes to the text and the properties after the first search.
+    (put-text-property 4000 4002 'rare 'here)
+    (remove-text-properties 9001 9003 '(rare nil))
+    (goto-char 3000)
+    (insert (propertize "xyz" 'rare 'other))
+    (delete-region 100 200)
+    (textprop-tests-check-changes 'rare)
+    ;; Properties that provide the value of other properties.
+    (let ((char-property-alias-alist '((rare alias))))
+      (put-text-property 12000 12010 'alias 'here)
+      (textprop-tests-check-changes 'rare))
+    (put 'textprop-tests-category 'rare 'here)
+    (put-text-property 15000 15010 'category 'textprop-tests-category)
+    (textprop-tests-check-changes 'rare)
+    (let ((default-text-properties '(rare here)))
+      (textprop-tests-check-changes 'rare))
+    (should (= (next-single-char-property-change 1 'rare) 2900))
+    (should (= (previous-single-char-property-change (point-max) 'rare)
+               15010))))
+
+;; Applying many runs at once matches applying them one at a time.
+(ert-deftest textprop-tests-put-bulk ()
+  (let ((runs (vector '(5 20 face bold) '(15 30 face italic)
+                      '(40 35 mouse-face highlight) '(50 50 face bold)
+                      '(1 10 fontified t)))
+        (calls 0)
+        expected)
+    (with-temp-buffer
+      (insert (propertize (make-string 60 ?x) 'face 'underline))
+      (dotimes (i (length runs))
+        (apply #'put-text-property (aref runs i)))
+      (setq expected (buffer-string))
+      (erase-buffer)
+      (insert (propertize (make-string 60 ?x) 'face 'underline))
+      (buffer-enable-undo)
+      (undo-boundary)
+      (add-hook 'after-change-functions
+                (lambda (&rest _) (setq calls (1+ calls))) nil t)
+      (should (eq (put-text-properties-bulk runs) t))
+      (should (= calls 1))
+      (should (equal-including-properties (buffer-string) expected))
+      ;; Nothing changes, and no hooks run, the second time.
+      (should-not (put-text-properties-bulk
+                   [(1 10 fontified t) (35 40 mouse-face highlight)]))
+      (should (= calls 1))
+      ;; Undo gives the properties that were missing a nil value.
+      (should (eq (caar buffer-undo-list) 'apply))
+      (primitive-undo 1 buffer-undo-list)
+      (dotimes (i 60)
+        (should (eq (get-text-property (1+ i) 'face) 'underline))
+        (should-not (get-text-property (1+ i) 'fontified))
+        (should-not (get-text-property (1+ i) 'mouse-face))))
+    (let ((string (make-string 60 ?x)))
+      (should (eq (put-text-properties-bulk runs string) t))
+      (should (eq (get-text-property 5 'face string) 'bold))
+      (should (eq (get-text-property 15 'face string) 'italic))
+      (should (eq (get-text-property 1 'fontified string) t))
+      (should-error (put-text-properties-bulk [(0 61 face bold)] string)
+                    :type 'args-out-of-range))))
+
+(provide 'textprop-tests)
+;;; textprop-tests.el ends here
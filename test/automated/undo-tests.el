@@ -437,6 +437,65 @@ Demonstrates bug 16818."
 
     (should (string= (buffer-string) "aaaFirst line\nSecond line\nbbb"))))
 
+(defun undo-test-replace-foo ()
+  "Replace every \"foo\" in the buffer by \"bar\"."
+  (interactive)
+  (goto-char (point-min))
+  (while (search-forward "foo" nil t)
+    (replace-match "bar")))
+
+(defun undo-test-packed-buffer ()
+  "Make the current buffer contain text with many \"foo\"s.
+Then replace them all with a command, and return the old text.
+The command's undo entries get packed."
+  (switch-to-buffer (current-buffer))
+  (buffer-enable-undo)
+  (dotimes (i 100)
+    (insert (format "%d foo\u00e9 foo\n" i)))
+  (undo-boundary)
+  (let ((text (buffer-string))
+        (map (make-sparse-keymap))
+        (undo-pack-threshold 50))
+    (define-key map "a" #'undo-test-replace-foo)
+    (define-key map "b" #'ignore)
+    (use-local-map map)
+    (execute-kbd-macro "ab")
+    (should (eq (car-safe (cdr-safe (cadr buffer-undo-list)))
+                'undo-packed-changes))
+    (should (> (length (apply #'undo-unpack
+                              (cddr (cadr buffer-undo-list))))
+               400))
+    (should-not (string-match "foo" (buffer-string)))
+    text))
+
+(ert-deftest undo-test-packed ()
+  "Test undo of a command whose changes were packed."
+  (with-temp-buffer
+    (let ((text (undo-test-packed-buffer)))
+      (setq last-command nil)
+      (undo)
+      (undo-boundary)
+      (should (string= (buffer-string) text))
+      (setq last-command nil)
+      (undo)
+      (should-not (string-match "foo" (buffer-string))))))
+
+(ert-deftest undo-test-region-packed ()
+  "Test undo in region of a command whose changes were packed."
+  (with-temp-buffer
+    (transient-mark-mode 1)
+    (undo-test-packed-buffer)
+    (goto-char (point-min))
+    (forward-line 2)
+    (push-mark (point) t t)
+    (setq mark-active t)
+    (forward-line 1)
+    (setq last-command nil)
+    (undo)
+    (goto-char (point-min))
+    (forward-line 1)
+    (should (looking-at "1 bar\u00e9 bar\n2 foo\u00e9 foo\n3 bar"))))
+
 (defun undo-test-all (&optional interactive)
   "Run all tests for \\[undo]."
   (interactive "p")
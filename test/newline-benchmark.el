@@ -0,0 +1,90 @@
+;;; newline-benchmark.el --- Time scanning for newlines  -*- lexical-binding: t -*-
+
+;; Copyright (C) 2014 Free Software Foundation, Inc.
+
+;; Keywords:       internal
+;; Human-Keywords: internal
+
+;; This file is part of GNU Emacs.
+
+;; GNU Emacs is free software: you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation, either version 3 of the License, or
+;; (at your option) any later version.
+
+;; GNU Emacs is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with GNU Emacs.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Commentary:
+
+;; Times `count-lines', `forward-line' and `vertical-motion' over
+;; buffers of short, medium and long lines, with and without
+;; `cache-long-scans'.  Run it with
+;;
+;;   emacs -Q -batch -l test/newline-benchmark.el -f newline-benchmark
+;;
+;; or type M-x newline-benchmark RET after loading this file.  The
+;; scans stay within a tenth of each buffer, which is too little to
+;; build its line index, so they measure the scanning itself.
+
+;;; Code:
+
+(require 'benchmark)
+
+(defvar newline-benchmark-size 4000000
+  "Number of characters in each buffer `newline-benchmark' uses.")
+
+(defvar newline-benchmark-repetitions 100
+  "Number of times `newline-benchmark' repeats each scan.")
+
+(defun newline-benchmark-fill (line-length)
+  "Fill the current buffer with lines of about LINE-LENGTH characters."
+  (let ((line (concat (make-string (1- line-length) ?x) "\n")))
+    (while (< (buffer-size) newline-benchmark-size)
+      (insert line))))
+
+(defun newline-benchmark-time (form-function)
+  "Return the seconds it takes to call FORM-FUNCTION repeatedly."
+  (car (benchmark-run
+         (dotimes (_ newline-benchmark-repetitions)
+           (funcall form-function)))))
+
+(defun newline-benchmark ()
+  "Time scanning for newlines in buffers of various line lengths."
+  (interactive)
+  (dolist (line-length '(20 80 1000))
+    (dolist (cache '(nil t))
+      (with-temp-buffer
+        (setq cache-long-scans cache)
+        (newline-benchmark-fill line-length)
+        (let ((start (/ (point-max) 2)))
+          (narrow-to-region start (+ start (/ newline-benchmark-size 10))))
+        (let ((lines (count-lines (point-min) (point-max))))
+          (message "lines of %d characters, cache-long-scans %s:"
+                   line-length cache)
+          (message "  count-lines     %.3fs"
+                   (newline-benchmark-time
+                    (lambda () (count-lines (point-min) (point-max)))))
+          (message "  forward-line    %.3fs"
+                   (newline-benchmark-time
+                    (lambda ()
+                      (goto-char (point-min))
+                      (forward-line lines))))
+          (message "  backward        %.3fs"
+                   (newline-benchmark-time
+                    (lambda ()
+                      (goto-char (point-max))
+                      (forward-line (- lines)))))
+          (message "  vertical-motion %.3fs"
+                   (newline-benchmark-time
+                    (lambda ()
+                      (goto-char (point-min))
+                      (vertical-motion (min lines 1000))))))))))
+
+(provide 'newline-benchmark)
+;;; newline-benchmark.el ends here
@@ -0,0 +1,101 @@
+;;; regex-benchmark.el --- Time regexp searches in a large log  -*- lexical-binding: t -*-
+
+;; Copyright (C) 2014 Free Software Foundation, Inc.
+
+;; Keywords:       internal
+;; Human-Keywords: internal
+
+;; This file is part of GNU Emacs.
+
+;; GNU Emacs is free software: you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation, either version 3 of the License, or
+;; (at your option) any later version.
+
+;; GNU Emacs is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with GNU Emacs.  If not, see <http://www.gnu.org/licenses/>.
+
+;;; Commentary:
+
+;; Times `re-search-forward' and `re-search-backward' over a large
+;; made-up log, for regexps that contain a string every match must
+;; have, and for some that do not.  Run it with
+;;
+;;   emacs -Q -batch -l test/regex-benchmark.el -f regex-benchmark
+;;
+;; or type M-x regex-benchmark RET after loading this file.  The gap
+;; is left in the middle of the log, so the searches cross it.  Each
+;; regexp is timed with `case-fold-search' nil and t, since folding
+;; case changes which shortcuts the searches can take.
+
+;;; Code:
+
+(require 'benchmark)
+
+(defvar regex-benchmark-size 8000000
+  "Number of characters in the log `regex-benchmark' searches.")
+
+(defvar regex-benchmark-regexps
+  '("^ERROR: .*timeout"
+    "defun\\s-+"
+    "connection \\([0-9]+\\) closed"
+    "\\(?:WARN\\|INFO\\): disk [a-z]+ full"
+    "[0-9]+ms"
+    "^[A-Z]+: request [0-9]+ from [0-9.]+"
+    "not in the log"
+    "[[:upper:]]+: .*"
+    "\\_<closed\\_>"
+    "\\([a-z]+\\)-\\1")
+  "Regexps that `regex-benchmark' looks for.")
+
+(defun regex-benchmark-fill ()
+  "Fill the current buffer with a log of `regex-benchmark-size' characters."
+  (let ((levels ["INFO" "INFO" "INFO" "DEBUG" "WARN" "ERROR"])
+        (events ["request %d from 10.0.%d.%d took %dms"
+                 "connection %d closed after %d requests, %d retries, %dms"
+                 "cache hit for key-%d in shard %d (%d entries, %dms)"
+                 "upstream %d did not answer: timeout after %d.%d s, %dms"])
+        (i 0))
+    (while (< (buffer-size) regex-benchmark-size)
+      (insert (aref levels (% (* i 7) (length levels))) ": "
+              (format (aref events (% (* i 13) (length events)))
+                      i (% i 256) (% (* i 3) 256) (% (* i 11) 1000))
+              "\n")
+      (setq i (1+ i)))
+    (goto-char (/ (point-max) 2))
+    (insert "x")
+    (delete-char -1)))
+
+(defun regex-benchmark-count (regexp)
+  "Return the number of matches for REGEXP and the seconds they take."
+  (let (count)
+    (list (car (benchmark-run
+                 (goto-char (point-min))
+                 (setq count 0)
+                 (while (re-search-forward regexp nil t)
+                   (setq count (1+ count)))))
+          count)))
+
+(defun regex-benchmark ()
+  "Time searching a large log for various regexps."
+  (interactive)
+  (with-temp-buffer
+    (regex-benchmark-fill)
+    (dolist (case-fold-search '(nil t))
+      (message "case-fold-search %s:" case-fold-search)
+      (dolist (regexp regex-benchmark-regexps)
+        (let ((all (regex-benchmark-count regexp)))
+          (message "%-40s %8d matches  %.3fs  backward %.3fs"
+                   regexp (nth 1 all) (car all)
+                   (car (benchmark-run 20
+                          (goto-char (point-max))
+                          (re-search-backward regexp
+                                              (- (point-max) 100000) t)))))))))
+
+(provide 'regex-benchmark)
+;;; regex-benchmark.el ends here